@@ -0,0 +1,223 @@
+/*
+ * Adaptation field functions
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsfuncs.h"
+
+static uint64_t ts_adapt_pcr_decode(uint8_t *d) {
+	uint64_t pcr_base;
+	uint16_t pcr_ext;
+	pcr_base  = (uint64_t)d[0] << 25;
+	pcr_base |= (uint64_t)d[1] << 17;
+	pcr_base |= (uint64_t)d[2] << 9;
+	pcr_base |= (uint64_t)d[3] << 1;
+	pcr_base |= (uint64_t)d[4] >> 7;
+	pcr_ext   = ((d[4] & 0x01) << 8) | d[5];
+	return pcr_base * 300 + pcr_ext;
+}
+
+static void ts_adapt_pcr_encode(uint8_t *d, uint64_t pcr) {
+	uint64_t pcr_base = (pcr / 300) & (TS_TIMESTAMP_WRAP - 1);
+	uint16_t pcr_ext  = pcr % 300;
+	d[0] = pcr_base >> 25;
+	d[1] = pcr_base >> 17;
+	d[2] = pcr_base >> 9;
+	d[3] = pcr_base >> 1;
+	d[4] = ((pcr_base & 0x01) << 7) | 0x7e | (pcr_ext >> 8);	// 0x7e == 6 reserved bits
+	d[5] = pcr_ext &~ 0xff00;
+}
+
+// Parse adaptation field of TS packet. Returns 1 if the packet has valid adaptation field.
+int ts_adapt_field_parse(uint8_t *ts_packet, struct ts_adapt_field *af) {
+	memset(af, 0, sizeof(struct ts_adapt_field));
+	if (ts_packet[0] != 0x47 || !(ts_packet[3] & 0x20))
+		return 0;
+
+	af->len = ts_packet[4];
+	if (af->len > (ts_packet_has_payload(ts_packet) ? 182 : 183))
+		return 0;
+	if (!af->len)
+		return 1;
+
+	uint8_t *d   = ts_packet + 5;
+	uint8_t *end = d + af->len;
+	uint8_t flags = *d++;
+	af->discontinuity		= bit_on(flags, bit_8);
+	af->random_access		= bit_on(flags, bit_7);
+	af->es_priority			= bit_on(flags, bit_6);
+	af->pcr_flag			= bit_on(flags, bit_5);
+	af->opcr_flag			= bit_on(flags, bit_4);
+	af->splicing_point_flag	= bit_on(flags, bit_3);
+	af->private_data_flag	= bit_on(flags, bit_2);
+	af->extension_flag		= bit_on(flags, bit_1);
+
+	if (af->pcr_flag) {
+		if (end - d < 6)
+			return 0;
+		af->pcr = ts_adapt_pcr_decode(d);
+		d += 6;
+	}
+	if (af->opcr_flag) {
+		if (end - d < 6)
+			return 0;
+		af->opcr = ts_adapt_pcr_decode(d);
+		d += 6;
+	}
+	if (af->splicing_point_flag) {
+		if (end - d < 1)
+			return 0;
+		af->splice_countdown = (int8_t)*d++;
+	}
+	if (af->private_data_flag) {
+		if (end - d < 1 || end - d - 1 < d[0])
+			return 0;
+		af->private_data_len = d[0];
+		af->private_data     = d + 1;
+		d += 1 + af->private_data_len;
+	}
+	if (af->extension_flag) {
+		if (end - d < 2 || end - d - 1 < d[0])
+			return 0;
+		uint8_t *ext_end = d + 1 + d[0];
+		d++;
+		af->ltw_flag				= bit_on(d[0], bit_8);
+		af->piecewise_rate_flag		= bit_on(d[0], bit_7);
+		af->seamless_splice_flag	= bit_on(d[0], bit_6);
+		d++;
+		if (af->ltw_flag) {
+			if (ext_end - d < 2)
+				return 0;
+			af->ltw_valid  = bit_on(d[0], bit_8);
+			af->ltw_offset = ((d[0] &~ 0x80) << 8) | d[1];			// x1111111 11111111
+			d += 2;
+		}
+		if (af->piecewise_rate_flag) {
+			if (ext_end - d < 3)
+				return 0;
+			af->piecewise_rate = ((d[0] &~ 0xc0) << 16) | (d[1] << 8) | d[2];	// xx111111
+			d += 3;
+		}
+		if (af->seamless_splice_flag) {
+			if (ext_end - d < 5)
+				return 0;
+			af->splice_type = d[0] >> 4;
+			ts_decode_pts_dts(d, &af->dts_next_au);
+			d += 5;
+		}
+	}
+	return 1;
+}
+
+// Returns the minimal adaptation field size including adaptation_field_length byte
+int ts_adapt_field_size(struct ts_adapt_field *af) {
+	int size = 2; // adaptation_field_length and flags
+	if (af->pcr_flag)				size += 6;
+	if (af->opcr_flag)				size += 6;
+	if (af->splicing_point_flag)	size += 1;
+	if (af->private_data_flag)		size += 1 + af->private_data_len;
+	if (af->extension_flag) {
+		size += 2;
+		if (af->ltw_flag)				size += 2;
+		if (af->piecewise_rate_flag)	size += 3;
+		if (af->seamless_splice_flag)	size += 5;
+	}
+	// Single 0x00 byte is enough when nothing is signalled (one byte stuffing)
+	if (size == 2 && !af->discontinuity && !af->random_access && !af->es_priority)
+		size = 1;
+	return size;
+}
+
+// Write adaptation field taking size bytes (including adaptation_field_length)
+// after the TS header and set adaptation_field_control. The space after the
+// fields is filled with stuffing bytes. Returns size or -1 if the fields do not fit.
+int ts_adapt_field_generate(uint8_t *ts_packet, struct ts_adapt_field *af, int size) {
+	if (size < ts_adapt_field_size(af) || size > TS_MAX_PAYLOAD_SIZE)
+		return -1;
+
+	ts_packet[3] |= 0x20;
+	af->len = size - 1;
+	ts_packet[4] = af->len;
+	if (!af->len)
+		return size;
+
+	uint8_t *d = ts_packet + 5;
+	memset(d, 0xff, af->len);
+	*d++ = (af->discontinuity		<< 7) |
+		   (af->random_access		<< 6) |
+		   (af->es_priority			<< 5) |
+		   (af->pcr_flag			<< 4) |
+		   (af->opcr_flag			<< 3) |
+		   (af->splicing_point_flag	<< 2) |
+		   (af->private_data_flag	<< 1) |
+		   (af->extension_flag);
+	if (af->pcr_flag) {
+		ts_adapt_pcr_encode(d, af->pcr);
+		d += 6;
+	}
+	if (af->opcr_flag) {
+		ts_adapt_pcr_encode(d, af->opcr);
+		d += 6;
+	}
+	if (af->splicing_point_flag)
+		*d++ = (uint8_t)af->splice_countdown;
+	if (af->private_data_flag) {
+		*d++ = af->private_data_len;
+		memcpy(d, af->private_data, af->private_data_len);
+		d += af->private_data_len;
+	}
+	if (af->extension_flag) {
+		uint8_t *ext_len = d++;
+		*d++ = (af->ltw_flag << 7) | (af->piecewise_rate_flag << 6) | (af->seamless_splice_flag << 5) | 0x1f; // 5 reserved bits
+		if (af->ltw_flag) {
+			*d++ = (af->ltw_valid << 7) | ((af->ltw_offset >> 8) &~ 0x80);
+			*d++ = af->ltw_offset &~ 0xff00;
+		}
+		if (af->piecewise_rate_flag) {
+			*d++ = 0xc0 | ((af->piecewise_rate >> 16) &~ 0xc0);	// 2 reserved bits
+			*d++ = af->piecewise_rate >> 8;
+			*d++ = af->piecewise_rate &~ 0xffff00;
+		}
+		if (af->seamless_splice_flag) {
+			ts_encode_pts_dts(d, af->splice_type, af->dts_next_au & (TS_TIMESTAMP_WRAP - 1));
+			d += 5;
+		}
+		*ext_len = d - ext_len - 1;
+	}
+	return size;
+}
+
+void ts_adapt_field_dump(struct ts_adapt_field *af) {
+	char pcr[64] = "", opcr[64] = "", splice[32] = "", ext[128] = "";
+	if (af->pcr_flag)
+		snprintf(pcr, sizeof(pcr), " pcr:%"PRIu64, af->pcr);
+	if (af->opcr_flag)
+		snprintf(opcr, sizeof(opcr), " opcr:%"PRIu64, af->opcr);
+	if (af->splicing_point_flag)
+		snprintf(splice, sizeof(splice), " splice_countdown:%d", af->splice_countdown);
+	if (af->extension_flag) {
+		int pos = 0;
+		if (af->ltw_flag)
+			pos += snprintf(ext + pos, sizeof(ext) - pos, " ltw_valid:%d ltw_offset:%d", af->ltw_valid, af->ltw_offset);
+		if (af->piecewise_rate_flag)
+			pos += snprintf(ext + pos, sizeof(ext) - pos, " piecewise_rate:%u", af->piecewise_rate);
+		if (af->seamless_splice_flag)
+			snprintf(ext + pos, sizeof(ext) - pos, " splice_type:%d dts_next_au:%"PRIu64, af->splice_type, af->dts_next_au);
+	}
+	ts_LOGf("*** adapt_len:%d%s%s%s%s%s%s%s private_data_len:%d%s\n",
+		af->len,
+		af->discontinuity	? " discontinuity"	: "",
+		af->random_access	? " random_access"	: "",
+		af->es_priority		? " es_priority"	: "",
+		pcr, opcr, splice,
+		af->extension_flag	? " extension"		: "",
+		af->private_data_len,
+		ext
+	);
+}
@@ -0,0 +1,247 @@
+/*
+ * PSI/SI tables carousel
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsfuncs.h"
+
+#define CAROUSEL_START_ENTRIES 16
+
+struct ts_carousel *ts_carousel_alloc(uint32_t bitrate) {
+	struct ts_carousel *c = calloc(1, sizeof(struct ts_carousel));
+	if (!c)
+		return NULL;
+	c->bitrate      = bitrate;
+	c->entries_max  = CAROUSEL_START_ENTRIES;
+	c->entries      = calloc(c->entries_max, sizeof(struct ts_carousel_entry *));
+	c->pids_max     = CAROUSEL_START_ENTRIES;
+	c->pids         = calloc(c->pids_max, sizeof(struct ts_carousel_pid *));
+	return c;
+}
+
+void ts_carousel_free(struct ts_carousel **pc) {
+	struct ts_carousel *c = *pc;
+	int i;
+	if (c) {
+		for (i=0;i<c->entries_num;i++) {
+			FREE(c->entries[i]->packets);
+			FREE(c->entries[i]);
+		}
+		for (i=0;i<c->pids_num;i++) {
+			FREE(c->pids[i]);
+		}
+		FREE(c->entries);
+		FREE(c->pids);
+		FREE(*pc);
+	}
+}
+
+// Convert milliseconds to output packet slots
+static uint64_t ts_carousel_ms_to_slots(struct ts_carousel *c, uint32_t ms) {
+	uint64_t slots = ((uint64_t)ms * c->bitrate) / (1000 * TS_PACKET_SIZE * 8);
+	return slots ? slots : 1;
+}
+
+static struct ts_carousel_pid *ts_carousel_get_pid(struct ts_carousel *c, uint16_t pid) {
+	int i;
+	for (i=0;i<c->pids_num;i++) {
+		if (c->pids[i]->pid == pid)
+			return c->pids[i];
+	}
+	if (c->pids_num == c->pids_max) {
+		c->pids_max *= 2;
+		c->pids = realloc(c->pids, c->pids_max * sizeof(struct ts_carousel_pid *));
+	}
+	struct ts_carousel_pid *cpid = calloc(1, sizeof(struct ts_carousel_pid));
+	cpid->pid     = pid;
+	cpid->min_gap = 1;
+	c->pids[c->pids_num++] = cpid;
+	return cpid;
+}
+
+int ts_carousel_set_pid_max_bitrate(struct ts_carousel *c, uint16_t pid, uint32_t max_bitrate) {
+	if (!max_bitrate)
+		return 0;
+	struct ts_carousel_pid *cpid = ts_carousel_get_pid(c, pid);
+	// Minimum distance between two packets of the PID in output slots
+	cpid->min_gap = (c->bitrate + max_bitrate - 1) / max_bitrate;
+	if (!cpid->min_gap)
+		cpid->min_gap = 1;
+	return 1;
+}
+
+int ts_carousel_add_section(struct ts_carousel *c, struct ts_header *ts_header, struct ts_section_header *section_header, uint32_t interval_ms) {
+	int i;
+	if (!section_header || !interval_ms)
+		return 0;
+
+	for (i=0;i<c->entries_num;i++) {
+		if (c->entries[i]->section_header == section_header) {
+			ts_LOGf("!!! Section with table_id 0x%02x on PID %03x is already in the carousel!\n",
+				section_header->table_id, ts_header->pid);
+			return 0;
+		}
+	}
+
+	if (c->entries_num == c->entries_max) {
+		c->entries_max *= 2;
+		c->entries = realloc(c->entries, c->entries_max * sizeof(struct ts_carousel_entry *));
+	}
+
+	struct ts_carousel_entry *e = calloc(1, sizeof(struct ts_carousel_entry));
+	e->section_header = section_header;
+	e->pid            = ts_carousel_get_pid(c, ts_header->pid);
+	e->interval_ms    = interval_ms;
+	e->interval       = ts_carousel_ms_to_slots(c, interval_ms);
+	e->deadline       = 0; // Send as soon as possible
+	e->packets        = ts_section_data_alloc_packet();
+
+	c->entries[c->entries_num++] = e;
+	c->next_deadline = 0; // The new entry is due now
+	return 1;
+}
+
+int ts_carousel_del_section(struct ts_carousel *c, struct ts_section_header *section_header) {
+	int i;
+	for (i=0;i<c->entries_num;i++) {
+		struct ts_carousel_entry *e = c->entries[i];
+		if (e->section_header != section_header)
+			continue;
+		if (e->pid->active == e) {
+			e->pid->active = NULL;
+			c->active_num--;
+		}
+		FREE(e->packets);
+		FREE(e);
+		for (;i+1<c->entries_num;i++) {
+			c->entries[i] = c->entries[i+1];
+		}
+		c->entries_num--;
+		return 1;
+	}
+	return 0;
+}
+
+int ts_carousel_add_pat(struct ts_carousel *c, struct ts_pat *pat, uint32_t interval_ms) {
+	return ts_carousel_add_section(c, &pat->ts_header, pat->section_header, interval_ms);
+}
+
+int ts_carousel_add_cat(struct ts_carousel *c, struct ts_cat *cat, uint32_t interval_ms) {
+	return ts_carousel_add_section(c, &cat->ts_header, cat->section_header, interval_ms);
+}
+
+int ts_carousel_add_pmt(struct ts_carousel *c, struct ts_pmt *pmt, uint32_t interval_ms) {
+	return ts_carousel_add_section(c, &pmt->ts_header, pmt->section_header, interval_ms);
+}
+
+int ts_carousel_add_nit(struct ts_carousel *c, struct ts_nit *nit, uint32_t interval_ms) {
+	return ts_carousel_add_section(c, &nit->ts_header, nit->section_header, interval_ms);
+}
+
+int ts_carousel_add_sdt(struct ts_carousel *c, struct ts_sdt *sdt, uint32_t interval_ms) {
+	return ts_carousel_add_section(c, &sdt->ts_header, sdt->section_header, interval_ms);
+}
+
+int ts_carousel_add_eit(struct ts_carousel *c, struct ts_eit *eit, uint32_t interval_ms) {
+	return ts_carousel_add_section(c, &eit->ts_header, eit->section_header, interval_ms);
+}
+
+int ts_carousel_add_tdt(struct ts_carousel *c, struct ts_tdt *tdt, uint32_t interval_ms) {
+	return ts_carousel_add_section(c, &tdt->ts_header, tdt->section_header, interval_ms);
+}
+
+// Snapshot the table packets, so the table can be regenerated while
+// its packets are being sent without mixing old and new section data.
+static void ts_carousel_entry_start(struct ts_carousel_entry *e) {
+	struct ts_section_header *sec = e->section_header;
+	e->num_packets = sec->num_packets;
+	e->packet_pos  = 0;
+	if (e->num_packets > 0)
+		memcpy(e->packets, sec->packet_data, e->num_packets * TS_PACKET_SIZE);
+	e->pid->active = e;
+}
+
+int ts_carousel_next_packet(struct ts_carousel *c, uint64_t slot, uint8_t *ts_packet) {
+	struct ts_carousel_entry *best = NULL;
+	int i;
+
+	// Fast path, nothing is due and no table is being sent
+	if (slot < c->next_deadline && !c->active_num)
+		return 0;
+
+	uint64_t next_deadline = (uint64_t)-1;
+	for (i=0;i<c->entries_num;i++) {
+		struct ts_carousel_entry *e = c->entries[i];
+		struct ts_carousel_pid *cpid = e->pid;
+		if (e->deadline < next_deadline)
+			next_deadline = e->deadline;
+		if (cpid->active && cpid->active != e) // Other table is sent on this PID
+			continue;
+		if (!cpid->active && e->deadline > slot) // Not yet due
+			continue;
+		if (cpid->next_slot > slot) // PID bitrate limit
+			continue;
+		if (!cpid->active && !e->section_header->num_packets) // Nothing to send
+			continue;
+		if (!best || e->deadline < best->deadline)
+			best = e;
+	}
+	c->next_deadline = next_deadline;
+
+	if (!best)
+		return 0;
+
+	struct ts_carousel_pid *cpid = best->pid;
+	if (!cpid->active) {
+		ts_carousel_entry_start(best);
+		c->active_num++;
+	}
+
+	memcpy(ts_packet, best->packets + (best->packet_pos * TS_PACKET_SIZE), TS_PACKET_SIZE);
+	ts_packet_set_pid(ts_packet, cpid->pid);
+	ts_packet_set_cont(ts_packet, cpid->cc);
+	cpid->cc = (cpid->cc + 1) & 0x0f;
+	cpid->next_slot = slot + cpid->min_gap;
+	best->packet_pos++;
+	c->packets_sent++;
+
+	if (best->packet_pos >= best->num_packets) {
+		// The whole table is sent, schedule the next repetition
+		cpid->active = NULL;
+		c->active_num--;
+		best->deadline += best->interval;
+		if (best->deadline <= slot) // We are late for more than one interval, do not try to catch up
+			best->deadline = slot + best->interval;
+		best->sent++;
+		if (best->deadline < c->next_deadline)
+			c->next_deadline = best->deadline;
+	}
+
+	return 1;
+}
+
+void ts_carousel_dump(struct ts_carousel *c) {
+	int i;
+	ts_LOGf("Carousel\n");
+	ts_LOGf("  * Bitrate      : %u\n", c->bitrate);
+	ts_LOGf("  * Packets sent : %llu\n", (unsigned long long)c->packets_sent);
+	for (i=0;i<c->entries_num;i++) {
+		struct ts_carousel_entry *e = c->entries[i];
+		ts_LOGf("    * [%02d/%02d] PID %04x (%d) table_id 0x%02x interval %u ms (%llu slots) sent %u times cc %d\n",
+			i+1, c->entries_num,
+			e->pid->pid, e->pid->pid,
+			e->section_header->table_id,
+			e->interval_ms,
+			(unsigned long long)e->interval,
+			e->sent,
+			e->pid->cc);
+	}
+}
@@ -110,20 +110,26 @@ int ts_cat_parse(struct ts_cat *cat) {
 	return 1;
 }
 
-void ts_cat_generate(struct ts_cat *cat, uint8_t **ts_packets, int *num_packets) {
-	uint8_t *secdata = ts_section_data_alloc_section();
+// Generate CAT packets into ts_packets buffer (must be at least 5120 bytes)
+void ts_cat_generate_buf(struct ts_cat *cat, uint8_t *ts_packets, int *num_packets) {
+	uint8_t secdata[4096];
 	ts_section_header_generate(secdata, cat->section_header, 0);
 	int curpos = 8; // Compensate for the section header, frist data byte is at offset 8
 
-	memcpy(secdata + curpos, cat->program_info, cat->program_info_size);
-	curpos += cat->program_info_size;
+	if (cat->program_info_size) {
+		memcpy(secdata + curpos, cat->program_info, cat->program_info_size);
+		curpos += cat->program_info_size;
+	}
 
 	cat->section_header->CRC = ts_section_data_calculate_crc(secdata, curpos);
     curpos += 4; // CRC
 
-    ts_section_data_gen_ts_packets(&cat->ts_header, secdata, curpos, cat->section_header->pointer_field, ts_packets, num_packets);
+    ts_section_data_gen_ts_packets_buf(&cat->ts_header, secdata, curpos, cat->section_header->pointer_field, ts_packets, num_packets);
+}
 
-    FREE(secdata);
+void ts_cat_generate(struct ts_cat *cat, uint8_t **ts_packets, int *num_packets) {
+	*ts_packets = ts_section_data_alloc_packet();
+	ts_cat_generate_buf(cat, *ts_packets, num_packets);
 }
 
 void ts_cat_regenerate_packets(struct ts_cat *cat) {
@@ -0,0 +1,128 @@
+/*
+ * CAT descriptor generator
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsfuncs.h"
+
+#define CAT_MAX_SECTION_LENGTH 1021
+
+static void ts_cat_regenerate_packet_data(struct ts_cat *cat) {
+	if (cat->update_deferred) // Packets are generated by ts_cat_commit()
+		return;
+	ts_cat_generate_buf(cat, cat->section_header->packet_data, &cat->section_header->num_packets);
+}
+
+// Increment the version once per update and regenerate the packets
+static void ts_cat_changed(struct ts_cat *cat) {
+	if (!cat->version_changed)
+		cat->section_header->version_number++;
+	if (cat->update_deferred) {
+		cat->version_changed = 1;
+		return;
+	}
+	ts_cat_regenerate_packet_data(cat);
+}
+
+// Batch several changes and generate the packets only once in ts_cat_commit()
+void ts_cat_begin_update(struct ts_cat *cat) {
+	cat->update_deferred = 1;
+	cat->version_changed = 0;
+}
+
+void ts_cat_commit(struct ts_cat *cat) {
+	cat->update_deferred = 0;
+	cat->version_changed = 0;
+	ts_cat_regenerate_packet_data(cat);
+}
+
+struct ts_cat *ts_cat_init(struct ts_cat *cat) {
+	cat->ts_header.pid            = 0x01;
+	cat->ts_header.pusi           = 1;
+	cat->ts_header.payload_field  = 1;
+	cat->ts_header.payload_offset = 4;
+
+	cat->section_header->table_id                 = 0x01;
+	cat->section_header->version_number           = 1;
+	cat->section_header->current_next_indicator   = 1;
+	cat->section_header->section_syntax_indicator = 1;
+	cat->section_header->private_indicator        = 0;
+	cat->section_header->section_length           = 9; // Empty section (9)
+	cat->section_header->ts_id_number             = 0xffff; // 18 bits are reserved in CAT
+	cat->section_header->reserved1                = 3;
+	cat->section_header->reserved2                = 3;
+
+	cat->program_info_size = 0;
+	cat->program_info      = NULL;
+
+	cat->initialized = 1;
+
+	ts_cat_regenerate_packet_data(cat);
+
+	return cat;
+}
+
+struct ts_cat *ts_cat_alloc_init(void) {
+	struct ts_cat *cat = ts_cat_alloc();
+	if (!cat)
+		return NULL;
+	return ts_cat_init(cat);
+}
+
+// desc must contain whole descriptor(s) including tag and length bytes
+int ts_cat_add_descriptor(struct ts_cat *cat, uint8_t *desc, int desc_size) {
+	if (!desc || desc_size <= 0)
+		return 0;
+	if (cat->section_header->section_length + desc_size > CAT_MAX_SECTION_LENGTH) {
+		ts_LOGf("CAT no space left, max %d, current %d will become %d!\n",
+			CAT_MAX_SECTION_LENGTH,
+			cat->section_header->section_length,
+			cat->section_header->section_length + desc_size);
+		return 0;
+	}
+
+	cat->program_info = realloc(cat->program_info, cat->program_info_size + desc_size);
+	memcpy(cat->program_info + cat->program_info_size, desc, desc_size);
+	cat->program_info_size += desc_size;
+	cat->section_header->section_length += desc_size;
+
+	ts_cat_changed(cat);
+	return 1;
+}
+
+int ts_cat_add_ca_descriptor(struct ts_cat *cat, uint16_t CA_id, uint16_t CA_pid) {
+	uint8_t desc[6];
+	ts_descriptor_gen_ca(desc, CA_id, CA_pid);
+	return ts_cat_add_descriptor(cat, desc, sizeof(desc));
+}
+
+// Remove all CA descriptors with CA_id
+int ts_cat_del_ca_descriptor(struct ts_cat *cat, uint16_t CA_id) {
+	int pos = 0, deleted = 0;
+	while (pos + 2 <= cat->program_info_size) {
+		uint8_t *desc = cat->program_info + pos;
+		int desc_size = desc[1] + 2;
+		if (pos + desc_size > cat->program_info_size)
+			break;
+		if (desc[0] == 0x09 && desc_size >= 4 && ((desc[2] << 8) | desc[3]) == CA_id) {
+			memmove(desc, desc + desc_size, cat->program_info_size - pos - desc_size);
+			cat->program_info_size -= desc_size;
+			cat->section_header->section_length -= desc_size;
+			deleted++;
+			continue;
+		}
+		pos += desc_size;
+	}
+	if (!deleted)
+		return 0;
+	ts_cat_changed(cat);
+	return 1;
+}
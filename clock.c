@@ -0,0 +1,161 @@
+/*
+ * PCR clock recovery and bitrate estimation
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsfuncs.h"
+
+#define TS_BITS_PER_SECOND_PER_TICK ((double)TS_PACKET_SIZE * 8 * 27000000)
+
+// Bits per second from 27MHz ticks per packet, clamped to the uint32_t range
+static uint32_t ts_clock_bitrate(double ticks_per_packet) {
+	double bitrate = TS_BITS_PER_SECOND_PER_TICK / ticks_per_packet;
+	return bitrate < UINT32_MAX ? (uint32_t)bitrate : UINT32_MAX;
+}
+
+struct ts_clock *ts_clock_alloc(uint16_t pcr_pid) {
+	struct ts_clock *c = calloc(1, sizeof(struct ts_clock));
+	if (!c)
+		return NULL;
+	c->pcr_pid = pcr_pid;
+	return c;
+}
+
+void ts_clock_free(struct ts_clock **pc) {
+	FREE(*pc);
+}
+
+// Forget the PCR values, the next PCR starts a new model
+void ts_clock_reset(struct ts_clock *c) {
+	c->samples_num      = 0;
+	c->samples_pos      = 0;
+	c->initialized      = 0;
+	c->have_drift       = 0;
+	c->bitrate_instant  = 0;
+}
+
+static void ts_clock_update_model(struct ts_clock *c) {
+	struct ts_clock_sample *base = &c->samples[(c->samples_pos - c->samples_num + TS_CLOCK_WINDOW) % TS_CLOCK_WINDOW];
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	double tx = 0, ty = 0, txx = 0, txy = 0;
+	int i, n = c->samples_num, tn = 0;
+
+	// Values relative to the oldest sample keep the precision of doubles
+	for (i=0;i<n;i++) {
+		struct ts_clock_sample *s = &c->samples[i];
+		double x = (double)(int64_t)(s->pos - base->pos);
+		double y = (double)(int64_t)(s->pcr - base->pcr);
+		sx  += x;
+		sy  += y;
+		sxx += x * x;
+		sxy += x * y;
+		if (s->time != TS_CLOCK_NO_TIME && base->time != TS_CLOCK_NO_TIME) {
+			double t = (double)(int64_t)(s->time - base->time);
+			tx  += t;
+			ty  += y;
+			txx += t * t;
+			txy += t * y;
+			tn++;
+		}
+	}
+
+	c->initialized = 0;
+	c->have_drift  = 0;
+	if (n < 2)
+		return;
+
+	double d = n * sxx - sx * sx;
+	if (d > 0) {
+		c->ticks_per_packet = (n * sxy - sx * sy) / d;
+		c->ref_pos          = base->pos + sx / n;
+		c->ref_pcr          = base->pcr + sy / n;
+		if (c->ticks_per_packet > 0) {
+			c->bitrate     = ts_clock_bitrate(c->ticks_per_packet);
+			c->initialized = 1;
+		}
+	}
+
+	d = tn * txx - tx * tx;
+	if (tn >= 2 && d > 0) {
+		double ticks_per_us = (tn * txy - tx * ty) / d;
+		c->drift_ppm  = (ticks_per_us / 27 - 1) * 1000000;
+		c->have_drift = 1;
+	}
+}
+
+// Add PCR value of packet with index pos (counted from any start, all packets
+// of the stream must be counted). arrival_us is the packet arrival time in
+// microseconds or TS_CLOCK_NO_TIME. Returns 1 if a new model was started.
+int ts_clock_push_pcr(struct ts_clock *c, uint64_t pos, uint64_t pcr, uint64_t arrival_us) {
+	int restart = 0;
+	uint64_t delta = (pcr - c->last_raw_pcr + TS_CLOCK_PCR_WRAP) % TS_CLOCK_PCR_WRAP;
+	uint64_t unwrapped = c->last_pcr + delta;
+
+	if (c->samples_num) {
+		struct ts_clock_sample *last = &c->samples[(c->samples_pos + TS_CLOCK_WINDOW - 1) % TS_CLOCK_WINDOW];
+		// PCR stepped back (delta wraps to big value), jumped forward or the packet index did not increase
+		if (delta > TS_CLOCK_MAX_GAP || pos <= last->pos) {
+			ts_clock_reset(c);
+			c->discontinuities++;
+			restart = 1;
+		} else if (delta) {
+			c->bitrate_instant = ts_clock_bitrate((double)delta / (pos - last->pos));
+		}
+	}
+	if (!c->samples_num)
+		unwrapped = pcr;
+
+	struct ts_clock_sample *s = &c->samples[c->samples_pos];
+	s->pos  = pos;
+	s->pcr  = unwrapped;
+	s->time = arrival_us;
+	c->samples_pos = (c->samples_pos + 1) % TS_CLOCK_WINDOW;
+	if (c->samples_num < TS_CLOCK_WINDOW)
+		c->samples_num++;
+
+	c->last_raw_pcr = pcr;
+	c->last_pcr     = unwrapped;
+	c->pcrs++;
+	ts_clock_update_model(c);
+	return restart;
+}
+
+// Count TS packet and add its PCR if it is on the PCR PID. Returns 1 if the packet had PCR.
+int ts_clock_push_packet(struct ts_clock *c, uint8_t *ts_packet, uint64_t arrival_us) {
+	uint64_t pos = c->packets++;
+	if (ts_packet_get_pid(ts_packet) != c->pcr_pid)
+		return 0;
+	if (ts_packet_has_discontinuity(ts_packet) && c->samples_num) {
+		ts_clock_reset(c);
+		c->discontinuities++;
+	}
+	if (!ts_packet_has_pcr(ts_packet))
+		return 0;
+	ts_clock_push_pcr(c, pos, ts_packet_get_pcr(ts_packet), arrival_us);
+	return 1;
+}
+
+// Returns the PCR of packet with index pos according to the model or NO_PCR
+uint64_t ts_clock_predict_pcr(struct ts_clock *c, uint64_t pos) {
+	if (!c->initialized)
+		return NO_PCR;
+	double pcr = c->ref_pcr + c->ticks_per_packet * ((double)pos - c->ref_pos);
+	if (pcr < 0)
+		pcr += (double)TS_CLOCK_PCR_WRAP;
+	return (uint64_t)(pcr + 0.5) % TS_CLOCK_PCR_WRAP;
+}
+
+void ts_clock_dump(struct ts_clock *c) {
+	char drift[32] = "";
+	if (c->have_drift)
+		snprintf(drift, sizeof(drift), " drift:%.1f ppm", c->drift_ppm);
+	ts_LOGf("*** Clock PID %04x pcrs:%u discontinuities:%u bitrate:%u instant:%u%s\n",
+		c->pcr_pid, c->pcrs, c->discontinuities, c->bitrate, c->bitrate_instant, drift);
+}
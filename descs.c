@@ -511,3 +511,15 @@ void ts_descriptor_dump(uint8_t *desc_data, int desc_data_len) {
 		data += this_length;
 	}
 }
+
+// Generate CA_descriptor (0x09) without private data, desc must have room for 6 bytes
+int ts_descriptor_gen_ca(uint8_t *desc, uint16_t CA_id, uint16_t CA_pid) {
+	desc[0]  = 0x09;				// CA_descriptor
+	desc[1]  = 4;					// -2 Because of two byte header
+	desc[2]  = CA_id >> 8;			// xxxxxxxx xxxxxxxx
+	desc[3]  = CA_id &~ 0xff00;
+	desc[4]  = 0xe0;				// 111xxxxx (reserved)
+	desc[4] |= CA_pid >> 8;			// xxx11111 xxxxxxxx
+	desc[5]  = CA_pid &~ 0xff00;
+	return 6;
+}
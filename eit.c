@@ -168,8 +168,9 @@ int ts_eit_parse(struct ts_eit *eit) {
 	return 1;
 }
 
-void ts_eit_generate(struct ts_eit *eit, uint8_t **ts_packets, int *num_packets) {
-	uint8_t *secdata = ts_section_data_alloc_section();
+// Generate EIT packets into ts_packets buffer (must be at least 5120 bytes)
+void ts_eit_generate_buf(struct ts_eit *eit, uint8_t *ts_packets, int *num_packets) {
+	uint8_t secdata[4096];
 	ts_section_header_generate(secdata, eit->section_header, 0);
 	int curpos = 8; // Compensate for the section header, frist data byte is at offset 8
 
@@ -215,9 +216,12 @@ void ts_eit_generate(struct ts_eit *eit, uint8_t **ts_packets, int *num_packets)
 	eit->section_header->CRC = ts_section_data_calculate_crc(secdata, curpos);
 	curpos += 4; // CRC
 
-	ts_section_data_gen_ts_packets(&eit->ts_header, secdata, curpos, eit->section_header->pointer_field, ts_packets, num_packets);
+	ts_section_data_gen_ts_packets_buf(&eit->ts_header, secdata, curpos, eit->section_header->pointer_field, ts_packets, num_packets);
+}
 
-	FREE(secdata);
+void ts_eit_generate(struct ts_eit *eit, uint8_t **ts_packets, int *num_packets) {
+	*ts_packets = ts_section_data_alloc_packet();
+	ts_eit_generate_buf(eit, *ts_packets, num_packets);
 }
 
 void ts_eit_check_generator(struct ts_eit *eit) {
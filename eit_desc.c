@@ -14,12 +14,19 @@
 #include "tsfuncs.h"
 
 static void ts_eit_regenerate_packet_data(struct ts_eit *eit) {
-	uint8_t *ts_packets;
-	int num_packets;
-	ts_eit_generate(eit, &ts_packets, &num_packets);
-	memcpy(eit->section_header->packet_data, ts_packets, num_packets * TS_PACKET_SIZE);
-	eit->section_header->num_packets = num_packets;
-	free(ts_packets);
+	if (eit->update_deferred) // Packets are generated by ts_eit_commit()
+		return;
+	ts_eit_generate_buf(eit, eit->section_header->packet_data, &eit->section_header->num_packets);
+}
+
+// Batch several changes and generate the packets only once in ts_eit_commit()
+void ts_eit_begin_update(struct ts_eit *eit) {
+	eit->update_deferred = 1;
+}
+
+void ts_eit_commit(struct ts_eit *eit) {
+	eit->update_deferred = 0;
+	ts_eit_regenerate_packet_data(eit);
 }
 
 struct ts_eit *ts_eit_init(struct ts_eit *eit, uint16_t service_id, uint16_t transport_stream_id, uint16_t org_network_id, uint8_t table_id, uint8_t sec_number, uint8_t last_sec_number) {
@@ -0,0 +1,259 @@
+/*
+ * EIT present/following generator
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsfuncs.h"
+
+#define PF_START_SERVICES 16
+
+struct ts_eit_pf *ts_eit_pf_alloc_init(uint16_t transport_stream_id, uint16_t org_network_id) {
+	struct ts_eit_pf *pf = calloc(1, sizeof(struct ts_eit_pf));
+	if (!pf)
+		return NULL;
+	pf->transport_stream_id = transport_stream_id;
+	pf->original_network_id = org_network_id;
+	pf->services_max        = PF_START_SERVICES;
+	pf->services            = calloc(pf->services_max, sizeof(struct ts_eit_pf_service *));
+	pf->heap                = calloc(pf->services_max, sizeof(struct ts_eit_pf_service *));
+	pf->changed             = calloc(pf->services_max, sizeof(struct ts_eit_pf_service *));
+	return pf;
+}
+
+static void ts_eit_pf_events_free(struct ts_eit_pf_service *svc) {
+	int i;
+	for (i=0;i<svc->events_num;i++) {
+		FREE(svc->events[i].event_name);
+		FREE(svc->events[i].event_short_descr);
+	}
+	FREE(svc->events);
+	svc->events_num = 0;
+}
+
+void ts_eit_pf_free(struct ts_eit_pf **ppf) {
+	struct ts_eit_pf *pf = *ppf;
+	int i;
+	if (pf) {
+		for (i=0;i<pf->services_num;i++) {
+			struct ts_eit_pf_service *svc = pf->services[i];
+			ts_eit_pf_events_free(svc);
+			ts_eit_free(&svc->eit_present);
+			ts_eit_free(&svc->eit_following);
+			FREE(svc);
+		}
+		FREE(pf->services);
+		FREE(pf->heap);
+		FREE(pf->changed);
+		FREE(*ppf);
+	}
+}
+
+struct ts_eit_pf_service *ts_eit_pf_get_service(struct ts_eit_pf *pf, uint16_t service_id) {
+	int i;
+	for (i=0;i<pf->services_num;i++) {
+		if (pf->services[i]->service_id == service_id)
+			return pf->services[i];
+	}
+	return NULL;
+}
+
+static struct ts_eit_pf_service *ts_eit_pf_add_service(struct ts_eit_pf *pf, uint16_t service_id) {
+	if (pf->services_num == pf->services_max) {
+		pf->services_max *= 2;
+		pf->services = realloc(pf->services, pf->services_max * sizeof(struct ts_eit_pf_service *));
+		pf->heap     = realloc(pf->heap    , pf->services_max * sizeof(struct ts_eit_pf_service *));
+		pf->changed  = realloc(pf->changed , pf->services_max * sizeof(struct ts_eit_pf_service *));
+	}
+	struct ts_eit_pf_service *svc = calloc(1, sizeof(struct ts_eit_pf_service));
+	svc->service_id    = service_id;
+	svc->present       = -1;
+	svc->following     = -1;
+	svc->heap_pos      = -1;
+	svc->eit_present   = ts_eit_alloc();
+	svc->eit_following = ts_eit_alloc();
+	pf->services[pf->services_num++] = svc;
+	return svc;
+}
+
+// Min heap of services keyed by next_change
+static void ts_eit_pf_heap_swap(struct ts_eit_pf *pf, int a, int b) {
+	struct ts_eit_pf_service *tmp = pf->heap[a];
+	pf->heap[a] = pf->heap[b];
+	pf->heap[b] = tmp;
+	pf->heap[a]->heap_pos = a;
+	pf->heap[b]->heap_pos = b;
+}
+
+static void ts_eit_pf_heap_up(struct ts_eit_pf *pf, int pos) {
+	while (pos > 0) {
+		int parent = (pos - 1) / 2;
+		if (pf->heap[parent]->next_change <= pf->heap[pos]->next_change)
+			break;
+		ts_eit_pf_heap_swap(pf, parent, pos);
+		pos = parent;
+	}
+}
+
+static void ts_eit_pf_heap_down(struct ts_eit_pf *pf, int pos) {
+	while (1) {
+		int smallest = pos;
+		int l = pos * 2 + 1;
+		int r = pos * 2 + 2;
+		if (l < pf->heap_num && pf->heap[l]->next_change < pf->heap[smallest]->next_change)
+			smallest = l;
+		if (r < pf->heap_num && pf->heap[r]->next_change < pf->heap[smallest]->next_change)
+			smallest = r;
+		if (smallest == pos)
+			break;
+		ts_eit_pf_heap_swap(pf, smallest, pos);
+		pos = smallest;
+	}
+}
+
+static void ts_eit_pf_heap_remove(struct ts_eit_pf *pf, struct ts_eit_pf_service *svc) {
+	int pos = svc->heap_pos;
+	if (pos < 0)
+		return;
+	svc->heap_pos = -1;
+	pf->heap_num--;
+	if (pos == pf->heap_num)
+		return;
+	pf->heap[pos] = pf->heap[pf->heap_num];
+	pf->heap[pos]->heap_pos = pos;
+	ts_eit_pf_heap_up(pf, pos);
+	ts_eit_pf_heap_down(pf, pf->heap[pos]->heap_pos);
+}
+
+static void ts_eit_pf_heap_insert(struct ts_eit_pf *pf, struct ts_eit_pf_service *svc) {
+	if (!svc->next_change) // Nothing will change
+		return;
+	svc->heap_pos = pf->heap_num;
+	pf->heap[pf->heap_num++] = svc;
+	ts_eit_pf_heap_up(pf, svc->heap_pos);
+}
+
+// Find present and following events at time now, returns 1 if they are changed
+static int ts_eit_pf_update_state(struct ts_eit_pf_service *svc, time_t now) {
+	int present = -1, following = -1;
+	// Skip finished events
+	while (svc->pos < svc->events_num && svc->events[svc->pos].start_time + svc->events[svc->pos].duration_sec <= now)
+		svc->pos++;
+	if (svc->pos < svc->events_num) {
+		if (svc->events[svc->pos].start_time <= now) {
+			present = svc->pos;
+			// Overlapping events that already started can not be following
+			following = svc->pos + 1;
+			while (following < svc->events_num && svc->events[following].start_time <= now)
+				following++;
+			if (following == svc->events_num)
+				following = -1;
+		} else {
+			following = svc->pos;
+		}
+	}
+	// Both the present end and the following start are after now
+	svc->next_change = 0;
+	if (present >= 0)
+		svc->next_change = svc->events[present].start_time + svc->events[present].duration_sec;
+	if (following >= 0 && (!svc->next_change || svc->events[following].start_time < svc->next_change))
+		svc->next_change = svc->events[following].start_time;
+	if (present == svc->present && following == svc->following)
+		return 0;
+	svc->present   = present;
+	svc->following = following;
+	return 1;
+}
+
+static void ts_eit_pf_generate_section(struct ts_eit_pf *pf, struct ts_eit_pf_service *svc, struct ts_eit *eit, uint8_t sec_number, int event, uint8_t running) {
+	ts_eit_clear(eit);
+	ts_eit_begin_update(eit);
+	ts_eit_init(eit, svc->service_id, pf->transport_stream_id, pf->original_network_id, 0x4e, sec_number, 1);
+	eit->section_header->version_number = svc->version;
+	eit->segment_last_section_number    = 1;
+	if (event >= 0) {
+		struct ts_eit_event *ev = &svc->events[event];
+		ts_eit_add_short_event_descriptor(eit, ev->event_id, running, ev->start_time, ev->duration_sec,
+			ev->event_name, ev->event_short_descr);
+	}
+	ts_eit_commit(eit);
+}
+
+static void ts_eit_pf_generate(struct ts_eit_pf *pf, struct ts_eit_pf_service *svc) {
+	svc->version = (svc->version + 1) & 0x1f;
+	ts_eit_pf_generate_section(pf, svc, svc->eit_present  , 0, svc->present  , 1);
+	ts_eit_pf_generate_section(pf, svc, svc->eit_following, 1, svc->following, 0);
+}
+
+// Set the events of a service. Events must be sorted by start_time.
+// The events are copied, present/following sections are regenerated with new version.
+int ts_eit_pf_set_events(struct ts_eit_pf *pf, uint16_t service_id, struct ts_eit_event *events, int num_events, time_t now) {
+	int i;
+	for (i=1;i<num_events;i++) {
+		if (events[i].start_time < events[i-1].start_time) {
+			ts_LOGf("EIT p/f: service %d events are not sorted by start_time!\n", service_id);
+			return 0;
+		}
+	}
+
+	struct ts_eit_pf_service *svc = ts_eit_pf_get_service(pf, service_id);
+	if (!svc)
+		svc = ts_eit_pf_add_service(pf, service_id);
+
+	ts_eit_pf_heap_remove(pf, svc);
+	ts_eit_pf_events_free(svc);
+	if (num_events) {
+		svc->events = malloc(num_events * sizeof(struct ts_eit_event));
+		for (i=0;i<num_events;i++) {
+			svc->events[i] = events[i];
+			svc->events[i].event_name        = events[i].event_name        ? strdup(events[i].event_name)        : NULL;
+			svc->events[i].event_short_descr = events[i].event_short_descr ? strdup(events[i].event_short_descr) : NULL;
+		}
+	}
+	svc->events_num = num_events;
+	svc->pos        = 0;
+
+	ts_eit_pf_update_state(svc, now);
+	ts_eit_pf_generate(pf, svc);
+	ts_eit_pf_heap_insert(pf, svc);
+	return 1;
+}
+
+// Regenerate present/following of the services which events have changed
+// since the last call. Returns the number of changed services, they
+// are available in pf->changed.
+int ts_eit_pf_tick(struct ts_eit_pf *pf, time_t now) {
+	pf->changed_num = 0;
+	while (pf->heap_num && pf->heap[0]->next_change <= now) {
+		struct ts_eit_pf_service *svc = pf->heap[0];
+		ts_eit_pf_heap_remove(pf, svc);
+		if (ts_eit_pf_update_state(svc, now)) {
+			ts_eit_pf_generate(pf, svc);
+			pf->changed[pf->changed_num++] = svc;
+		}
+		ts_eit_pf_heap_insert(pf, svc);
+	}
+	return pf->changed_num;
+}
+
+void ts_eit_pf_dump(struct ts_eit_pf *pf) {
+	int i;
+	ts_LOGf("EIT present/following\n");
+	ts_LOGf("  * TS id     : 0x%04x (%d)\n", pf->transport_stream_id, pf->transport_stream_id);
+	ts_LOGf("  * Org net id: 0x%04x (%d)\n", pf->original_network_id, pf->original_network_id);
+	for (i=0;i<pf->services_num;i++) {
+		struct ts_eit_pf_service *svc = pf->services[i];
+		ts_LOGf("    * Service 0x%04x (%d) version %d events %d present %d following %d next_change %ld\n",
+			svc->service_id, svc->service_id, svc->version, svc->events_num,
+			svc->present   >= 0 ? svc->events[svc->present].event_id   : -1,
+			svc->following >= 0 ? svc->events[svc->following].event_id : -1,
+			(long)svc->next_change);
+	}
+}
@@ -0,0 +1,382 @@
+/*
+ * EIT schedule generator
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsfuncs.h"
+
+#define SCHED_START_SERVICES 16
+#define SCHED_MAX_EVENTS_IN_SECTION 127 // ts_eit_alloc() allocates 128 streams
+
+struct ts_eit_sched *ts_eit_sched_alloc_init(uint16_t transport_stream_id, uint16_t org_network_id, time_t now, int days) {
+	struct ts_eit_sched *sched = calloc(1, sizeof(struct ts_eit_sched));
+	if (!sched)
+		return NULL;
+	if (days < 1)
+		days = 1;
+	if (days > EIT_SCHED_MAX_TABLES * EIT_SCHED_TABLE_SEGMENTS / 8)
+		days = EIT_SCHED_MAX_TABLES * EIT_SCHED_TABLE_SEGMENTS / 8;
+	sched->transport_stream_id = transport_stream_id;
+	sched->original_network_id = org_network_id;
+	sched->start_time          = now - (now % 86400); // Schedule starts at midnight UTC
+	sched->days                = days;
+	sched->segments_num        = days * 8;
+	sched->services_max        = SCHED_START_SERVICES;
+	sched->services            = calloc(sched->services_max, sizeof(struct ts_eit_sched_service *));
+	sched->eit                 = ts_eit_alloc();
+	return sched;
+}
+
+static void ts_eit_sched_service_free(struct ts_eit_sched *sched, struct ts_eit_sched_service *svc) {
+	int i;
+	for (i=0;i<sched->segments_num;i++) {
+		FREE(svc->segments[i].packets);
+	}
+	FREE(svc->segments);
+	FREE(svc);
+}
+
+void ts_eit_sched_free(struct ts_eit_sched **psched) {
+	struct ts_eit_sched *sched = *psched;
+	int i;
+	if (sched) {
+		for (i=0;i<sched->services_num;i++) {
+			ts_eit_sched_service_free(sched, sched->services[i]);
+		}
+		FREE(sched->services);
+		ts_eit_free(&sched->eit);
+		FREE(*psched);
+	}
+}
+
+struct ts_eit_sched_service *ts_eit_sched_get_service(struct ts_eit_sched *sched, uint16_t service_id) {
+	int i;
+	for (i=0;i<sched->services_num;i++) {
+		if (sched->services[i]->service_id == service_id)
+			return sched->services[i];
+	}
+	return NULL;
+}
+
+static struct ts_eit_sched_service *ts_eit_sched_add_service(struct ts_eit_sched *sched, uint16_t service_id) {
+	if (sched->services_num == sched->services_max) {
+		sched->services_max *= 2;
+		sched->services = realloc(sched->services, sched->services_max * sizeof(struct ts_eit_sched_service *));
+	}
+	struct ts_eit_sched_service *svc = calloc(1, sizeof(struct ts_eit_sched_service));
+	svc->service_id = service_id;
+	svc->segments   = calloc(sched->segments_num, sizeof(struct ts_eit_sched_segment));
+	sched->services[sched->services_num++] = svc;
+	return svc;
+}
+
+// Returns the size of the event in EIT section (the same as ts_eit_add_short_event_descriptor() would add)
+// Returns 0 if the event can not be put in EIT
+static int ts_eit_sched_event_size(struct ts_eit_event *ev) {
+	int name_len  = ev->event_name ? strlen(ev->event_name) : 0;
+	int descr_len = ev->event_short_descr ? strlen(ev->event_short_descr) : 0;
+	int desc_size = 2 + 3 + 1 + name_len + 1 + descr_len;
+	if (!name_len || desc_size > 255)
+		return 0;
+	return 12 + desc_size;
+}
+
+static uint32_t ts_eit_sched_hash(uint32_t hash, void *data, int size) {
+	uint8_t *p = data;
+	int i;
+	for (i=0;i<size;i++) { // FNV-1a
+		hash ^= p[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static uint32_t ts_eit_sched_hash_event(uint32_t hash, struct ts_eit_event *ev) {
+	int64_t start_time = ev->start_time;
+	hash = ts_eit_sched_hash(hash, &ev->event_id, sizeof(ev->event_id));
+	hash = ts_eit_sched_hash(hash, &start_time, sizeof(start_time));
+	hash = ts_eit_sched_hash(hash, &ev->duration_sec, sizeof(ev->duration_sec));
+	hash = ts_eit_sched_hash(hash, &ev->running, sizeof(ev->running));
+	if (ev->event_name)
+		hash = ts_eit_sched_hash(hash, ev->event_name, strlen(ev->event_name) + 1);
+	if (ev->event_short_descr)
+		hash = ts_eit_sched_hash(hash, ev->event_short_descr, strlen(ev->event_short_descr) + 1);
+	return hash;
+}
+
+// Layout of one segment, calculated on every ts_eit_sched_set_events()
+struct ts_eit_sched_layout {
+	int			first_event;	// First event in the segment
+	int			last_event;		// One after the last event in the segment
+	int			num_events;		// Events that fit in the segment sections
+	uint8_t		num_sections;
+	uint32_t	hash;
+};
+
+static void ts_eit_sched_generate_segment(struct ts_eit_sched *sched, struct ts_eit_sched_service *svc, int seg_idx,
+	struct ts_eit_sched_layout *layout, struct ts_eit_event *events, uint8_t *ev_section)
+{
+	struct ts_eit_sched_segment *seg = &svc->segments[seg_idx];
+	struct ts_eit *eit = sched->eit;
+	int table_idx = seg_idx / EIT_SCHED_TABLE_SEGMENTS;
+	uint8_t first_section = (seg_idx % EIT_SCHED_TABLE_SEGMENTS) * EIT_SCHED_SEGMENT_SECTIONS;
+	uint8_t buf[5120];
+	int i, j, num_packets;
+
+	seg->num_packets = 0;
+	seg->packets = realloc(seg->packets, layout->num_sections * 5120);
+	for (i=0;i<layout->num_sections;i++) {
+		ts_eit_clear(eit);
+		ts_eit_begin_update(eit);
+		ts_eit_init(eit, svc->service_id, sched->transport_stream_id, sched->original_network_id,
+			0x50 + table_idx, first_section + i, svc->last_section_number[table_idx]);
+		eit->section_header->version_number = svc->version[table_idx];
+		eit->segment_last_section_number    = first_section + layout->num_sections - 1;
+		eit->last_table_id                  = svc->last_table_id;
+		for (j=layout->first_event;j<layout->last_event;j++) {
+			if (ev_section[j] != i)
+				continue;
+			struct ts_eit_event *ev = &events[j];
+			ts_eit_add_short_event_descriptor(eit, ev->event_id, ev->running, ev->start_time, ev->duration_sec,
+				ev->event_name, ev->event_short_descr);
+		}
+		ts_eit_generate_buf(eit, buf, &num_packets);
+		memcpy(seg->packets + seg->num_packets * TS_PACKET_SIZE, buf, num_packets * TS_PACKET_SIZE);
+		seg->section_packets[i] = num_packets;
+		seg->num_packets += num_packets;
+	}
+	ts_eit_clear(eit);
+	seg->num_sections = layout->num_sections;
+	seg->hash         = layout->hash;
+	sched->segments_regenerated++;
+}
+
+// Position of section byte in segment packets. Sections are generated without
+// adaptation field, so the first packet carries 183 section bytes (after the
+// pointer field) and the following packets 184 bytes.
+static uint8_t *ts_eit_sched_section_byte(uint8_t *packets, int pos) {
+	if (pos < TS_PACKET_SIZE - 5)
+		return packets + 5 + pos;
+	pos -= TS_PACKET_SIZE - 5;
+	return packets + TS_PACKET_SIZE * (1 + pos / (TS_PACKET_SIZE - 4)) + 4 + pos % (TS_PACKET_SIZE - 4);
+}
+
+// Unchanged segment in table with new version, patch only the
+// version_number, last_section_number, last_table_id and CRC.
+static void ts_eit_sched_patch_segment(struct ts_eit_sched *sched, struct ts_eit_sched_service *svc, int seg_idx) {
+	struct ts_eit_sched_segment *seg = &svc->segments[seg_idx];
+	int table_idx = seg_idx / EIT_SCHED_TABLE_SEGMENTS;
+	uint8_t secdata[4096];
+	int i, j, pkt = 0;
+	for (i=0;i<seg->num_sections;i++) {
+		uint8_t *packets = seg->packets + pkt * TS_PACKET_SIZE;
+		uint8_t *sec = packets + 5; // The header is in the first packet
+		int section_len = (((sec[1] &~ 0xf0) << 8) | sec[2]) + 3;
+		sec[5]  = (sec[5] &~ 0x3e) | (svc->version[table_idx] << 1);	// xx11111x
+		sec[7]  = svc->last_section_number[table_idx];
+		sec[13] = svc->last_table_id;
+		for (j=0;j<section_len-4;j++) {
+			secdata[j] = *ts_eit_sched_section_byte(packets, j);
+		}
+		uint32_t CRC = ts_crc32(secdata, section_len - 4);
+		*ts_eit_sched_section_byte(packets, section_len - 4) = (CRC &~ 0x00ffffff) >> 24;
+		*ts_eit_sched_section_byte(packets, section_len - 3) = (CRC &~ 0xff00ffff) >> 16;
+		*ts_eit_sched_section_byte(packets, section_len - 2) = (CRC &~ 0xffff00ff) >> 8;
+		*ts_eit_sched_section_byte(packets, section_len - 1) = (CRC &~ 0xffffff00);
+		pkt += seg->section_packets[i];
+	}
+	sched->segments_patched++;
+}
+
+// Set the events of a service. Events must be sorted by start_time.
+// Only the segments which events have changed are regenerated.
+int ts_eit_sched_set_events(struct ts_eit_sched *sched, uint16_t service_id, struct ts_eit_event *events, int num_events) {
+	int i, t, s;
+	time_t end_time = sched->start_time + (time_t)sched->segments_num * EIT_SCHED_SEGMENT_SEC;
+
+	for (i=1;i<num_events;i++) {
+		if (events[i].start_time < events[i-1].start_time) {
+			ts_LOGf("EIT schedule: service %d events are not sorted by start_time!\n", service_id);
+			return 0;
+		}
+	}
+
+	struct ts_eit_sched_service *svc = ts_eit_sched_get_service(sched, service_id);
+	if (!svc)
+		svc = ts_eit_sched_add_service(sched, service_id);
+
+	struct ts_eit_sched_layout *layout = calloc(sched->segments_num, sizeof(struct ts_eit_sched_layout));
+	uint8_t *ev_section = malloc(num_events ? num_events : 1);
+
+	// Put events in segments and segment sections
+	int seg_idx = 0, sec_len = 0, sec_events = 0;
+	for (s=0;s<sched->segments_num;s++) {
+		layout[s].first_event = num_events;
+		layout[s].last_event  = num_events;
+		layout[s].hash        = 2166136261u;
+	}
+	for (i=0;i<num_events;i++) {
+		struct ts_eit_event *ev = &events[i];
+		ev_section[i] = 0xff;
+		if (ev->start_time >= end_time)
+			break;
+		if (ev->start_time < sched->start_time) {
+			if (ev->start_time + ev->duration_sec <= sched->start_time) // Already finished
+				continue;
+			s = 0;
+		} else {
+			s = (ev->start_time - sched->start_time) / EIT_SCHED_SEGMENT_SEC;
+		}
+		struct ts_eit_sched_layout *l = &layout[s];
+		if (l->first_event == num_events) {
+			l->first_event = i;
+			seg_idx = s;
+			sec_len = 9 + 6;
+			sec_events = 0;
+		}
+		l->last_event = i + 1;
+		int ev_size = ts_eit_sched_event_size(ev);
+		if (!ev_size) {
+			ts_LOGf("EIT schedule: service %d event_id %d can not be added!\n", service_id, ev->event_id);
+			continue;
+		}
+		if (!l->num_sections) {
+			l->num_sections = 1;
+		} else if (sec_len + ev_size > 4093 || sec_events == SCHED_MAX_EVENTS_IN_SECTION) { // Next section
+			if (l->num_sections == EIT_SCHED_SEGMENT_SECTIONS) {
+				ts_LOGf("EIT schedule: service %d segment %d is full, event_id %d is dropped!\n",
+					service_id, seg_idx, ev->event_id);
+				continue;
+			}
+			l->num_sections++;
+			sec_len = 9 + 6;
+			sec_events = 0;
+		}
+		sec_len += ev_size;
+		sec_events++;
+		ev_section[i] = l->num_sections - 1;
+		l->num_events++;
+		l->hash = ts_eit_sched_hash_event(l->hash, ev);
+		l->hash = ts_eit_sched_hash(l->hash, &ev_section[i], 1);
+	}
+
+	// Calculate last_table_id and last_section_number of every table
+	uint8_t last_table_id = 0;
+	uint8_t last_section_number[EIT_SCHED_MAX_TABLES];
+	memset(last_section_number, 0, sizeof(last_section_number));
+	for (s=0;s<sched->segments_num;s++) {
+		if (!layout[s].num_events)
+			continue;
+		t = s / EIT_SCHED_TABLE_SEGMENTS;
+		last_table_id = 0x50 + t;
+		last_section_number[t] = (s % EIT_SCHED_TABLE_SEGMENTS) * EIT_SCHED_SEGMENT_SECTIONS + layout[s].num_sections - 1;
+	}
+
+	// Empty segments before the last used segment in the table are sent
+	// as one empty section, the rest of the segments are not sent at all
+	for (s=0;s<sched->segments_num;s++) {
+		t = s / EIT_SCHED_TABLE_SEGMENTS;
+		int first_section = (s % EIT_SCHED_TABLE_SEGMENTS) * EIT_SCHED_SEGMENT_SECTIONS;
+		if (layout[s].num_events)
+			continue;
+		layout[s].num_sections = 0;
+		if (last_table_id && 0x50 + t <= last_table_id && first_section <= last_section_number[t])
+			layout[s].num_sections = 1;
+	}
+
+	// Find what is changed and bump table versions
+	uint8_t table_changed[EIT_SCHED_MAX_TABLES];
+	memset(table_changed, 0, sizeof(table_changed));
+	for (s=0;s<sched->segments_num;s++) {
+		struct ts_eit_sched_segment *seg = &svc->segments[s];
+		if (seg->hash != layout[s].hash || seg->num_sections != layout[s].num_sections)
+			table_changed[s / EIT_SCHED_TABLE_SEGMENTS] = 1;
+	}
+	for (t=0;t<EIT_SCHED_MAX_TABLES;t++) {
+		if (0x50 + t > last_table_id)
+			continue;
+		if (svc->last_table_id != last_table_id || svc->last_section_number[t] != last_section_number[t])
+			table_changed[t] = 1;
+		if (table_changed[t])
+			svc->version[t] = (svc->version[t] + 1) & 0x1f;
+		svc->last_section_number[t] = last_section_number[t];
+	}
+	svc->last_table_id = last_table_id;
+
+	// Regenerate changed segments and patch the rest of the segments in changed tables
+	for (s=0;s<sched->segments_num;s++) {
+		struct ts_eit_sched_segment *seg = &svc->segments[s];
+		if (!table_changed[s / EIT_SCHED_TABLE_SEGMENTS])
+			continue;
+		if (!layout[s].num_sections) {
+			FREE(seg->packets);
+			seg->num_packets  = 0;
+			seg->num_sections = 0;
+			seg->hash         = layout[s].hash;
+			continue;
+		}
+		if (seg->hash != layout[s].hash || seg->num_sections != layout[s].num_sections)
+			ts_eit_sched_generate_segment(sched, svc, s, &layout[s], events, ev_section);
+		else
+			ts_eit_sched_patch_segment(sched, svc, s);
+	}
+
+	FREE(ev_section);
+	FREE(layout);
+	return 1;
+}
+
+// Move the schedule to the day of now. Segments are numbered from the
+// midnight of the current day, so on a new day the events of every service
+// must be set again with ts_eit_sched_set_events(). It regenerates all
+// segments and bumps the versions of the tables. Until then the old
+// segments are kept. Returns 1 if the day has changed.
+int ts_eit_sched_set_time(struct ts_eit_sched *sched, time_t now) {
+	time_t start_time = now - (now % 86400);
+	int i, s;
+	if (start_time <= sched->start_time)
+		return 0;
+	sched->start_time = start_time;
+	for (i=0;i<sched->services_num;i++) {
+		struct ts_eit_sched_service *svc = sched->services[i];
+		for (s=0;s<sched->segments_num;s++) {
+			svc->segments[s].hash = 0; // Never equal to the layout hash
+		}
+	}
+	return 1;
+}
+
+void ts_eit_sched_dump(struct ts_eit_sched *sched) {
+	int i, s;
+	ts_LOGf("EIT schedule\n");
+	ts_LOGf("  * TS id     : 0x%04x (%d)\n", sched->transport_stream_id, sched->transport_stream_id);
+	ts_LOGf("  * Org net id: 0x%04x (%d)\n", sched->original_network_id, sched->original_network_id);
+	ts_LOGf("  * Days      : %d (%d segments)\n", sched->days, sched->segments_num);
+	ts_LOGf("  * Segments  : %llu regenerated, %llu patched\n",
+		(unsigned long long)sched->segments_regenerated,
+		(unsigned long long)sched->segments_patched);
+	for (i=0;i<sched->services_num;i++) {
+		struct ts_eit_sched_service *svc = sched->services[i];
+		ts_LOGf("    * Service 0x%04x (%d) last_table_id 0x%02x\n", svc->service_id, svc->service_id, svc->last_table_id);
+		for (s=0;s<sched->segments_num;s++) {
+			struct ts_eit_sched_segment *seg = &svc->segments[s];
+			int t = s / EIT_SCHED_TABLE_SEGMENTS;
+			if (!seg->num_sections)
+				continue;
+			ts_LOGf("      - Segment %3d table_id 0x%02x version %2d sections %3d-%3d last_section_number %3d packets %d\n",
+				s, 0x50 + t, svc->version[t],
+				(s % EIT_SCHED_TABLE_SEGMENTS) * EIT_SCHED_SEGMENT_SECTIONS,
+				(s % EIT_SCHED_TABLE_SEGMENTS) * EIT_SCHED_SEGMENT_SECTIONS + seg->num_sections - 1,
+				svc->last_section_number[t],
+				seg->num_packets);
+		}
+	}
+}
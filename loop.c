@@ -0,0 +1,340 @@
+/*
+ * Looped TS file playout
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tsfuncs.h"
+
+// Returns the section in ts_packet if the whole section is in the packet
+static uint8_t *ts_loop_get_section(uint8_t *ts_packet, int *section_len) {
+	if (!ts_packet_is_pusi(ts_packet))
+		return NULL;
+	int ofs = ts_packet_get_payload_offset(ts_packet);
+	if (!ofs)
+		return NULL;
+	ofs += 1 + ts_packet[ofs]; // pointer_field
+	if (ofs + 8 + 4 > TS_PACKET_SIZE)
+		return NULL;
+	uint8_t *section = ts_packet + ofs;
+	if (section[0] == 0xff || !bit_on(section[1], bit_8)) // Stuffing or no section_syntax_indicator
+		return NULL;
+	*section_len = 3 + (((section[1] &~ 0xf0) << 8) | section[2]); // 1111xxxx xxxxxxxx
+	if (*section_len < 8 + 4 || ofs + *section_len > TS_PACKET_SIZE)
+		return NULL;
+	return section;
+}
+
+static uint32_t ts_loop_section_crc(uint8_t *section, int section_len) {
+	uint8_t *crc = section + section_len - 4;
+	return ((uint32_t)crc[0] << 24) | (crc[1] << 16) | (crc[2] << 8) | crc[3];
+}
+
+static struct ts_loop_table *ts_loop_get_table(struct ts_loop *l, uint16_t pid, uint8_t *section, int add) {
+	int i;
+	uint16_t ts_id = (section[3] << 8) | section[4];
+	for (i=0;i<l->tables_num;i++) {
+		struct ts_loop_table *t = &l->tables[i];
+		if (t->pid == pid && t->table_id == section[0] && t->ts_id == ts_id && t->section_number == section[6])
+			return t;
+	}
+	if (!add)
+		return NULL;
+	struct ts_loop_table *tables = realloc(l->tables, (l->tables_num + 1) * sizeof(struct ts_loop_table));
+	if (!tables)
+		return NULL;
+	l->tables = tables;
+	struct ts_loop_table *t = &l->tables[l->tables_num++];
+	memset(t, 0, sizeof(struct ts_loop_table));
+	t->pid            = pid;
+	t->table_id       = section[0];
+	t->ts_id          = ts_id;
+	t->section_number = section[6];
+	t->first_version  = 0xff; // Not set
+	return t;
+}
+
+// Mark PAT and PMT PIDs from the first PAT in the file
+static void ts_loop_find_psi(struct ts_loop *l) {
+	struct ts_pat *pat = ts_pat_alloc();
+	uint32_t i;
+	int j;
+	l->pids[0].flags |= TS_LOOP_PID_PSI;
+	for (i=0;i<l->num_packets && !pat->initialized;i++) {
+		uint8_t *ts_packet = l->packets + i * TS_PACKET_SIZE;
+		if (ts_packet_get_pid(ts_packet) == 0)
+			pat = ts_pat_push_packet(pat, ts_packet);
+	}
+	for (j=0;j<pat->programs_num;j++) {
+		if (pat->programs[j]->program)
+			l->pids[pat->programs[j]->pid].flags |= TS_LOOP_PID_PSI;
+	}
+	ts_pat_free(&pat);
+}
+
+// Find the loop duration, continuity counter steps and the tables that must change version
+static void ts_loop_scan(struct ts_loop *l) {
+	uint64_t first_pcr = 0, last_pcr = 0;
+	uint32_t first_pcr_pos = 0, last_pcr_pos = 0;
+	uint8_t *first_cc = calloc(0x2000, 1);
+	uint8_t *last_cc  = calloc(0x2000, 1);
+	uint32_t i;
+	int n;
+
+	if (!first_cc || !last_cc)
+		goto OUT;
+
+	ts_loop_find_psi(l);
+	for (i=0;i<l->num_packets;i++) {
+		uint8_t *ts_packet = l->packets + i * TS_PACKET_SIZE;
+		uint16_t pid = ts_packet_get_pid(ts_packet);
+		struct ts_loop_pid *lpid = &l->pids[pid];
+
+		if (ts_packet_has_payload(ts_packet)) {
+			if (!(lpid->flags & TS_LOOP_PID_PAYLOAD)) {
+				lpid->flags |= TS_LOOP_PID_PAYLOAD;
+				first_cc[pid] = ts_packet_get_cont(ts_packet);
+			}
+			last_cc[pid] = ts_packet_get_cont(ts_packet);
+		}
+
+		if (ts_packet_has_pcr(ts_packet)) {
+			if (l->pcr_pid == NULL_PID) {
+				l->pcr_pid    = pid;
+				first_pcr     = ts_packet_get_pcr(ts_packet);
+				first_pcr_pos = i;
+			}
+			if (pid == l->pcr_pid) {
+				last_pcr     = ts_packet_get_pcr(ts_packet);
+				last_pcr_pos = i;
+			}
+		}
+
+		if (lpid->flags & TS_LOOP_PID_PSI) {
+			uint8_t *section = ts_loop_get_section(ts_packet, &n);
+			struct ts_loop_table *t = section ? ts_loop_get_table(l, pid, section, 1) : NULL;
+			if (t) {
+				uint8_t version = (section[5] &~ 0xc1) >> 1; // 11xxxxx1
+				uint32_t crc = ts_loop_section_crc(section, n);
+				if (t->first_version == 0xff) {
+					t->first_version = version;
+					t->first_crc     = crc;
+				}
+				t->last_version = version;
+				t->last_crc     = crc;
+			}
+		}
+	}
+
+	// Next loop continues the counters after the last packet
+	for (i=0;i<0x2000;i++) {
+		if (l->pids[i].flags & TS_LOOP_PID_PAYLOAD)
+			l->pids[i].cc_delta = (last_cc[i] + 1 - first_cc[i]) &~ 0xf0;
+	}
+
+	// The table changes at the loop point but the version stays the same
+	for (n=0;n<l->tables_num;n++) {
+		struct ts_loop_table *t = &l->tables[n];
+		t->bump = t->first_version == t->last_version && t->first_crc != t->last_crc;
+	}
+
+	// The time of the whole file from the mean bitrate between the first and the last PCR
+	if (last_pcr_pos > first_pcr_pos) {
+		uint64_t pcr_span = (last_pcr - first_pcr + TS_CLOCK_PCR_WRAP) % TS_CLOCK_PCR_WRAP;
+		// pcr_span * num_packets does not fit in 64 bits for long files
+		l->duration = (double)pcr_span / 300 * l->num_packets / (last_pcr_pos - first_pcr_pos);
+	}
+
+OUT:
+	FREE(first_cc);
+	FREE(last_cc);
+}
+
+// Rewrite the copy of a packet for the current loop
+static void ts_loop_rewrite(struct ts_loop *l, uint8_t *ts_packet) {
+	int n;
+	uint16_t pid = ts_packet_get_pid(ts_packet);
+	struct ts_loop_pid *lpid = &l->pids[pid];
+	if (pid == NULL_PID)
+		return;
+
+	ts_packet_inc_cont(ts_packet, lpid->cc_delta * (l->loops & 0x0f));
+
+	if (!(lpid->flags & TS_LOOP_PID_PSI))
+		return;
+	uint8_t *section = ts_loop_get_section(ts_packet, &n);
+	struct ts_loop_table *t = section ? ts_loop_get_table(l, pid, section, 0) : NULL;
+	if (!t || !t->bump)
+		return;
+	uint8_t version = ((section[5] &~ 0xc1) >> 1) + l->loops;
+	section[5] = (section[5] & 0xc1) | ((version & 0x1f) << 1);
+	ts_section_data_calculate_crc(section, n - 4);
+}
+
+// Adaptation field only packet with discontinuity_indicator for PID without
+// adaptation field in its first packet. The continuity counter is not incremented.
+static void ts_loop_discontinuity_packet(struct ts_loop *l, uint8_t *ts_packet, uint8_t *next_packet) {
+	uint16_t pid = ts_packet_get_pid(next_packet);
+	uint8_t cc = ts_packet_get_cont(next_packet) + l->pids[pid].cc_delta * (l->loops & 0x0f) - 1;
+	ts_packet_init_null(ts_packet);
+	ts_packet_set_pid(ts_packet, pid);
+	ts_packet[3] = 0x20 | (cc & 0x0f); // Adaptation field only
+	ts_packet[4] = TS_PACKET_SIZE - 5;
+	ts_packet[5] = 0x80; // discontinuity_indicator
+	l->discontinuity_packets++;
+}
+
+// Copy up to max_packets packets of the next loop into *buf and rewrite them
+static int ts_loop_copy(struct ts_loop *l, int max_packets) {
+	int num = 0;
+	if (max_packets > l->buf_size) {
+		uint8_t *buf = realloc(l->buf, max_packets * TS_PACKET_SIZE);
+		if (!buf)
+			return 0;
+		l->buf      = buf;
+		l->buf_size = max_packets;
+	}
+	while (num < max_packets && l->pos < l->num_packets) {
+		uint8_t *src = l->packets + l->pos * TS_PACKET_SIZE;
+		uint8_t *ts_packet = l->buf + num * TS_PACKET_SIZE;
+		uint16_t pid = ts_packet_get_pid(src);
+		struct ts_loop_pid *lpid = &l->pids[pid];
+		int first = pid != NULL_PID && !(lpid->flags & TS_LOOP_PID_SEEN);
+		lpid->flags |= TS_LOOP_PID_SEEN;
+		num++;
+
+		// Timestamps can not continue, signal the jump on the first packet of each PID
+		int has_af = bit_on(src[3], bit_6) && src[4] > 0;
+		if (!l->duration && first && !has_af) {
+			ts_loop_discontinuity_packet(l, ts_packet, src);
+			continue;
+		}
+		memcpy(ts_packet, src, TS_PACKET_SIZE);
+		if (!l->duration && first)
+			ts_packet[5] |= 0x80; // discontinuity_indicator
+		ts_loop_rewrite(l, ts_packet);
+		l->pos++;
+	}
+	if (l->ts_offset)
+		ts_packets_shift_timestamps(l->buf, num, l->ts_offset);
+	return num;
+}
+
+// Map the TS file in fd, the fd can be closed after this.
+// Returns NULL on error or if the file has no TS packets.
+struct ts_loop *ts_loop_open_fd(int fd) {
+	struct stat st;
+	uint32_t i;
+	if (fstat(fd, &st) < 0 || st.st_size < TS_PACKET_SIZE)
+		return NULL;
+
+	struct ts_loop *l = calloc(1, sizeof(struct ts_loop));
+	if (!l)
+		return NULL;
+	l->pcr_pid  = NULL_PID;
+	l->map_size = st.st_size;
+	l->map = mmap(NULL, l->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (l->map == MAP_FAILED) {
+		l->map = NULL;
+		goto ERR;
+	}
+
+	// Find the first packet
+	for (i=0;i<TS_PACKET_SIZE;i++) {
+		if (l->map[i] != 0x47)
+			continue;
+		if (i + TS_PACKET_SIZE < l->map_size && l->map[i + TS_PACKET_SIZE] != 0x47)
+			continue;
+		l->packets     = l->map + i;
+		l->num_packets = (l->map_size - i) / TS_PACKET_SIZE;
+		break;
+	}
+	if (!l->num_packets)
+		goto ERR;
+
+	l->pids = calloc(0x2000, sizeof(struct ts_loop_pid));
+	if (!l->pids)
+		goto ERR;
+	ts_loop_scan(l);
+	return l;
+
+ERR:
+	ts_loop_free(&l);
+	return NULL;
+}
+
+struct ts_loop *ts_loop_open(char *filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct ts_loop *l = ts_loop_open_fd(fd);
+	close(fd);
+	return l;
+}
+
+void ts_loop_free(struct ts_loop **pl) {
+	struct ts_loop *l = *pl;
+	if (l) {
+		if (l->map)
+			munmap(l->map, l->map_size);
+		FREE(l->pids);
+		FREE(l->tables);
+		FREE(l->buf);
+		FREE(*pl);
+	}
+}
+
+// Get up to max_packets next packets. In the first loop *ts_packets points
+// into the mapped file, the next loops are rewritten in a buffer of
+// max_packets packets (continuity counters, timestamps and table versions
+// continue the previous loop). If the file has no PCR an adaptation field
+// only packet with the discontinuity_indicator is inserted before the first
+// packet of a PID that has no adaptation field. The packets must not be
+// modified and stay valid until the next call. Returns the number of
+// packets, it is less than max_packets at the loop point and 0 on error.
+int ts_loop_read(struct ts_loop *l, uint8_t **ts_packets, int max_packets) {
+	int i, num;
+	if (max_packets <= 0)
+		return 0;
+	if (l->pos == l->num_packets) {
+		l->pos = 0;
+		l->loops++;
+		l->ts_offset = (l->ts_offset + l->duration) & (TS_TIMESTAMP_WRAP - 1);
+		for (i=0;i<0x2000;i++) {
+			l->pids[i].flags &= ~TS_LOOP_PID_SEEN;
+		}
+	}
+	if (l->loops) {
+		num = ts_loop_copy(l, max_packets);
+		*ts_packets = l->buf;
+		return num;
+	}
+	num = l->num_packets - l->pos;
+	if (num > max_packets)
+		num = max_packets;
+	*ts_packets = l->packets + l->pos * TS_PACKET_SIZE;
+	l->pos += num;
+	return num;
+}
+
+void ts_loop_dump(struct ts_loop *l) {
+	int i;
+	ts_LOGf("Loop packets:%u pos:%u loops:%"PRIu64" pcr_pid:%04x duration:%"PRId64" ms discontinuity_packets:%"PRIu64"\n",
+		l->num_packets, l->pos, l->loops, l->pcr_pid, l->duration / 90, l->discontinuity_packets);
+	for (i=0;i<l->tables_num;i++) {
+		struct ts_loop_table *t = &l->tables[i];
+		ts_LOGf("    * PID %04x table_id:%02x ts_id:%04x section:%d version:%d..%d%s\n",
+			t->pid, t->table_id, t->ts_id, t->section_number, t->first_version, t->last_version,
+			t->bump ? " bump" : "");
+	}
+}
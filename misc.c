@@ -102,12 +102,51 @@ int ts_is_psi_pid(uint16_t pid, struct ts_pat *pat) {
 	return 0;
 }
 
+// ISO/IEC 13818-1 : 2000 (E) | Table 2-29 - Stream type assignments, Page 66 (48)
+// and the commonly used user private stream types.
+static const struct ts_stream_type_info stream_types[256] = {
+	[0x01] = { 1, 0, 1, CODEC_MPEG1_VIDEO,       "11172-2 video (MPEG-1)" },
+	[0x02] = { 1, 0, 1, CODEC_MPEG2_VIDEO,       "H.262/13818-2 video (MPEG-2) or 11172-2 constrained video" },
+	[0x03] = { 0, 1, 1, CODEC_MPEG1_AUDIO,       "11172-3 audio (MPEG-1)" },
+	[0x04] = { 0, 1, 1, CODEC_MPEG2_AUDIO,       "13818-3 audio (MPEG-2)" },
+	[0x05] = { 0, 0, 0, CODEC_UNKNOWN,           "H.222.0/13818-1  private sections" },
+	// Private data, AC-3, E-AC-3, AC-4, DTS, Opus, teletext and subtitles are signalled by descriptors
+	[0x06] = { 0, 1, 1, CODEC_UNKNOWN,           "H.222.0/13818-1 PES private data" },
+	[0x07] = { 0, 0, 1, CODEC_UNKNOWN,           "13522 MHEG" },
+	[0x08] = { 0, 0, 1, CODEC_UNKNOWN,           "H.222.0/13818-1 Annex A - DSM CC" },
+	[0x09] = { 0, 0, 1, CODEC_UNKNOWN,           "H.222.1" },
+	[0x0A] = { 0, 0, 1, CODEC_UNKNOWN,           "13818-6 type A" },
+	[0x0B] = { 0, 0, 1, CODEC_UNKNOWN,           "13818-6 type B" },
+	[0x0C] = { 0, 0, 1, CODEC_UNKNOWN,           "13818-6 type C" },
+	[0x0D] = { 0, 0, 1, CODEC_UNKNOWN,           "13818-6 type D" },
+	[0x0E] = { 0, 0, 1, CODEC_UNKNOWN,           "H.222.0/13818-1 auxiliary" },
+	[0x0F] = { 0, 1, 1, CODEC_AAC_ADTS_AUDIO,    "13818-7 Audio with ADTS transport syntax" },
+	[0x10] = { 1, 0, 1, CODEC_MPEG4_PART2_VIDEO, "14496-2 Visual (MPEG-4 part 2 video)" },
+	[0x11] = { 0, 1, 1, CODEC_AAC_LATM_AUDIO,    "14496-3 Audio with LATM transport syntax (14496-3/AMD 1)" },
+	[0x12] = { 0, 0, 0, CODEC_UNKNOWN,           "14496-1 SL-packetized or FlexMux stream in PES packets" },
+	[0x13] = { 0, 0, 0, CODEC_UNKNOWN,           "14496-1 SL-packetized or FlexMux stream in 14496 sections" },
+	[0x14] = { 0, 0, 0, CODEC_UNKNOWN,           "ISO/IEC 13818-6 Synchronized Download Protocol" },
+	[0x15] = { 0, 0, 1, CODEC_UNKNOWN,           "Metadata in PES packets" },
+	[0x16] = { 0, 0, 0, CODEC_UNKNOWN,           "Metadata in metadata_sections" },
+	[0x17] = { 0, 0, 0, CODEC_UNKNOWN,           "Metadata in 13818-6 Data Carousel" },
+	[0x18] = { 0, 0, 0, CODEC_UNKNOWN,           "Metadata in 13818-6 Object Carousel" },
+	[0x19] = { 0, 0, 0, CODEC_UNKNOWN,           "Metadata in 13818-6 Synchronized Download Protocol" },
+	[0x1A] = { 0, 0, 0, CODEC_UNKNOWN,           "13818-11 MPEG-2 IPMP stream" },
+	[0x1B] = { 1, 0, 1, CODEC_AVC_VIDEO,         "H.264/14496-10 video (MPEG-4/AVC)" },
+	[0x24] = { 1, 0, 1, CODEC_HEVC_VIDEO,        "H.265/23008-2 video (HEVC)" },
+	[0x42] = { 1, 0, 1, CODEC_AVS_VIDEO,         "AVS Video" },
+	[0x7F] = { 0, 0, 0, CODEC_UNKNOWN,           "IPMP stream" },
+	[0x81] = { 0, 1, 1, CODEC_AC3_AUDIO,         "ATSC A/52 audio (AC-3)" },
+	[0x87] = { 0, 1, 1, CODEC_EAC3_AUDIO,        "ATSC A/52 enhanced audio (E-AC-3)" },
+};
+
+// Returns stream type information, desc is NULL for unknown stream types
+const struct ts_stream_type_info *ts_get_stream_type_info(uint8_t stream_type) {
+	return &stream_types[stream_type];
+}
+
 int ts_is_stream_type_video(uint8_t stream_type) {
-	return	stream_type == STREAM_TYPE_MPEG1_VIDEO ||
-			stream_type == STREAM_TYPE_MPEG2_VIDEO ||
-			stream_type == STREAM_TYPE_AVC_VIDEO   ||
-			stream_type == STREAM_TYPE_AVS_VIDEO   ||
-			stream_type == STREAM_TYPE_MPEG4_PART2_VIDEO;
+	return stream_types[stream_type].is_video;
 }
 
 // This is not enough! Must look at stream descriptors to be sure!!!
@@ -117,48 +156,20 @@ int ts_is_stream_type_ac3(uint8_t stream_type) {
 }
 
 int ts_is_stream_type_audio(uint8_t stream_type) {
-	return	stream_type == STREAM_TYPE_MPEG1_AUDIO ||
-			stream_type == STREAM_TYPE_MPEG2_AUDIO ||
-			stream_type == STREAM_TYPE_ADTS_AUDIO  ||
-			ts_is_stream_type_ac3(stream_type);
+	return stream_types[stream_type].is_audio;
+}
+
+// Returns 1 if the elementary stream is carried in PES packets
+int ts_is_stream_type_pes(uint8_t stream_type) {
+	return stream_types[stream_type].is_pes;
 }
 
-// ISO/IEC 13818-1 : 2000 (E) | Table 2-29 - Stream type assignments, Page 66 (48)
 char *h222_stream_type_desc(uint8_t stream_type) {
-	if (stream_type == 0 || (stream_type > 0x1c && stream_type < 0x7e))
+	if (stream_types[stream_type].desc)
+		return stream_types[stream_type].desc;
+	if (stream_type < 0x7e)
 		return "Reserved";
-	switch (stream_type) {
-		case 0x01: return "11172-2 video (MPEG-1)";
-		case 0x02: return "H.262/13818-2 video (MPEG-2) or 11172-2 constrained video";
-		case 0x03: return "11172-3 audio (MPEG-1)";
-		case 0x04: return "13818-3 audio (MPEG-2)";
-		case 0x05: return "H.222.0/13818-1  private sections";
-		case 0x06: return "H.222.0/13818-1 PES private data";
-		case 0x07: return "13522 MHEG";
-		case 0x08: return "H.222.0/13818-1 Annex A - DSM CC";
-		case 0x09: return "H.222.1";
-		case 0x0A: return "13818-6 type A";
-		case 0x0B: return "13818-6 type B";
-		case 0x0C: return "13818-6 type C";
-		case 0x0D: return "13818-6 type D";
-		case 0x0E: return "H.222.0/13818-1 auxiliary";
-		case 0x0F: return "13818-7 Audio with ADTS transport syntax";
-		case 0x10: return "14496-2 Visual (MPEG-4 part 2 video)";
-		case 0x11: return "14496-3 Audio with LATM transport syntax (14496-3/AMD 1)";
-		case 0x12: return "14496-1 SL-packetized or FlexMux stream in PES packets";
-		case 0x13: return "14496-1 SL-packetized or FlexMux stream in 14496 sections";
-		case 0x14: return "ISO/IEC 13818-6 Synchronized Download Protocol";
-		case 0x15: return "Metadata in PES packets";
-		case 0x16: return "Metadata in metadata_sections";
-		case 0x17: return "Metadata in 13818-6 Data Carousel";
-		case 0x18: return "Metadata in 13818-6 Object Carousel";
-		case 0x19: return "Metadata in 13818-6 Synchronized Download Protocol";
-		case 0x1A: return "13818-11 MPEG-2 IPMP stream";
-		case 0x1B: return "H.264/14496-10 video (MPEG-4/AVC)";
-		case 0x42: return "AVS Video";
-		case 0x7F: return "IPMP stream";
-		default  : return "Unknown";
-	}
+	return "Unknown";
 }
 
 // System start codes, ISO 13818-1, Table 2-18
@@ -216,3 +227,52 @@ int pidmap_get(pidmap_t *pm, uint16_t pid) {
 		return (*pm)[pid];
 	return 0;
 }
+
+void ts_bits_init(struct ts_bits *bits, uint8_t *data, uint32_t size) {
+	bits->data  = data;
+	bits->size  = size;
+	bits->pos   = 0;
+	bits->error = 0;
+}
+
+// Read n (up to 32) bits, MSB first. Returns 0 and sets error when there is not enough data.
+uint32_t ts_bits_get(struct ts_bits *bits, int n) {
+	uint32_t val = 0;
+	if (bits->pos + n > bits->size * 8) {
+		bits->pos   = bits->size * 8;
+		bits->error = 1;
+		return 0;
+	}
+	while (n-- > 0) {
+		val = (val << 1) | ((bits->data[bits->pos >> 3] >> (7 - (bits->pos & 7))) & 1);
+		bits->pos++;
+	}
+	return val;
+}
+
+void ts_bits_skip(struct ts_bits *bits, uint32_t n) {
+	if (bits->pos + n > bits->size * 8) {
+		bits->pos   = bits->size * 8;
+		bits->error = 1;
+		return;
+	}
+	bits->pos += n;
+}
+
+// Exp-Golomb coded unsigned value, ue(v) in H.264 and HEVC
+uint32_t ts_bits_get_ue(struct ts_bits *bits) {
+	int zeros = 0;
+	while (!ts_bits_get(bits, 1)) {
+		if (bits->error || ++zeros > 31) {
+			bits->error = 1;
+			return 0;
+		}
+	}
+	return ((1u << zeros) - 1) + ts_bits_get(bits, zeros);
+}
+
+// Exp-Golomb coded signed value, se(v) in H.264 and HEVC
+int32_t ts_bits_get_se(struct ts_bits *bits) {
+	uint32_t v = ts_bits_get_ue(bits);
+	return v & 1 ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+}
@@ -0,0 +1,523 @@
+/*
+ * MPTS multiplexer
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsfuncs.h"
+
+static struct ts_mux_packet *ts_mux_queue_add(struct ts_mux_queue *q) {
+	int i;
+	if (q->num == q->size) {
+		int size = q->size ? q->size * 2 : 64;
+		struct ts_mux_packet *packets = malloc(size * sizeof(struct ts_mux_packet));
+		if (!packets)
+			return NULL;
+		for (i=0;i<q->num;i++) {
+			packets[i] = q->packets[(q->head + i) % q->size];
+		}
+		FREE(q->packets);
+		q->packets = packets;
+		q->size    = size;
+		q->head    = 0;
+	}
+	struct ts_mux_packet *p = &q->packets[(q->head + q->num) % q->size];
+	q->num++;
+	return p;
+}
+
+static struct ts_mux_packet *ts_mux_queue_packet(struct ts_mux_queue *q, uint64_t deadline, uint8_t *ts_packet, int set_cc) {
+	struct ts_mux_packet *p = ts_mux_queue_add(q);
+	if (!p)
+		return NULL;
+	p->deadline = deadline;
+	p->set_cc   = set_cc;
+	memcpy(p->data, ts_packet, TS_PACKET_SIZE);
+	return p;
+}
+
+static void ts_mux_queue_packets(struct ts_mux_queue *q, uint64_t deadline, uint8_t *ts_packets, int num_packets, int set_cc) {
+	int i;
+	for (i=0;i<num_packets;i++) {
+		if (!ts_mux_queue_packet(q, deadline, ts_packets + i * TS_PACKET_SIZE, set_cc))
+			return;
+	}
+}
+
+static struct ts_mux_packet *ts_mux_queue_head(struct ts_mux_queue *q) {
+	return q->num ? &q->packets[q->head] : NULL;
+}
+
+static void ts_mux_queue_pop(struct ts_mux_queue *q) {
+	q->head = (q->head + 1) % q->size;
+	q->num--;
+}
+
+struct ts_mux *ts_mux_alloc(uint16_t transport_stream_id, uint16_t org_network_id) {
+	int i;
+	struct ts_mux *m = calloc(1, sizeof(struct ts_mux));
+	if (!m)
+		return NULL;
+	m->transport_stream_id = transport_stream_id;
+	m->original_network_id = org_network_id;
+	// PSI/SI PIDs and the null PID are never used for the inputs
+	for (i=0;i<0x20;i++) {
+		m->pid_used[i] = 1;
+	}
+	m->pid_used[NULL_PID] = 1;
+	m->pat_changed = 1;
+	m->sdt_changed = 1;
+	return m;
+}
+
+static void ts_mux_input_free(struct ts_mux_input *in) {
+	FREE(in->pid_map);
+	ts_pat_free(&in->pat);
+	ts_pmt_free(&in->pmt);
+	ts_pmt_free(&in->out_pmt);
+	ts_sdt_free(&in->sdt);
+	if (in->service) {
+		FREE(in->service->descriptor_data);
+		FREE(in->service);
+	}
+	ts_eit_free(&in->eit);
+	ts_clock_free(&in->clock);
+	FREE(in->queue.packets);
+}
+
+void ts_mux_free(struct ts_mux **pm) {
+	struct ts_mux *m = *pm;
+	int i;
+	if (m) {
+		for (i=0;i<m->inputs_num;i++) {
+			ts_mux_input_free(&m->inputs[i]);
+		}
+		FREE(m->inputs);
+		ts_pat_free(&m->pat);
+		ts_sdt_free(&m->sdt);
+		FREE(m->psi.packets);
+		FREE(*pm);
+	}
+}
+
+static int ts_mux_program_used(struct ts_mux *m, uint16_t program) {
+	int i;
+	for (i=0;i<m->inputs_num;i++) {
+		if (m->inputs[i].program == program)
+			return 1;
+	}
+	return 0;
+}
+
+// Add SPTS input. The input program gets program_number program, or its own
+// program_number if program is 0 (the next free one if it is already used).
+// Returns the input index or -1 if program is already used.
+int ts_mux_add_input(struct ts_mux *m, uint16_t program) {
+	int i;
+	if (program && ts_mux_program_used(m, program))
+		return -1;
+	struct ts_mux_input *inputs = realloc(m->inputs, (m->inputs_num + 1) * sizeof(struct ts_mux_input));
+	if (!inputs)
+		return -1;
+	m->inputs = inputs;
+	struct ts_mux_input *in = &m->inputs[m->inputs_num];
+	memset(in, 0, sizeof(struct ts_mux_input));
+	in->program    = program;
+	in->in_pmt_pid = NULL_PID;
+	in->pid_map    = malloc(0x2000 * sizeof(uint16_t));
+	in->pat        = ts_pat_alloc();
+	in->pmt        = ts_pmt_alloc();
+	in->sdt        = ts_sdt_alloc();
+	in->eit        = ts_eit_alloc();
+	in->clock      = ts_clock_alloc(NULL_PID);
+	if (!in->pid_map || !in->clock) {
+		ts_mux_input_free(in);
+		return -1;
+	}
+	for (i=0;i<0x2000;i++) {
+		in->pid_map[i] = NULL_PID;
+	}
+	return m->inputs_num++;
+}
+
+// Output PID for input pid, the input PID is kept unless it is already used
+static uint16_t ts_mux_map_pid(struct ts_mux *m, struct ts_mux_input *in, uint16_t pid) {
+	uint16_t out_pid = pid & 0x1fff;
+	if (in->pid_map[out_pid] != NULL_PID || out_pid == NULL_PID)
+		return in->pid_map[out_pid];
+	if (m->pid_used[out_pid]) {
+		for (out_pid=0x20;out_pid<NULL_PID;out_pid++) {
+			if (!m->pid_used[out_pid])
+				break;
+		}
+		if (out_pid == NULL_PID) {
+			ts_LOGf("!!! No free output PID for input PID 0x%04x!\n", pid);
+			return NULL_PID;
+		}
+	}
+	m->pid_used[out_pid] = 1;
+	in->pid_map[pid & 0x1fff] = out_pid;
+	return out_pid;
+}
+
+// Copy of the descriptors with ECM PIDs in CA descriptors changed to output PIDs
+static uint8_t *ts_mux_map_descriptors(struct ts_mux *m, struct ts_mux_input *in, uint8_t *desc, int desc_size) {
+	if (!desc || desc_size <= 0)
+		return NULL;
+	uint8_t *data = malloc(desc_size);
+	if (!data)
+		return NULL;
+	memcpy(data, desc, desc_size);
+	desc = data;
+	while (desc_size >= 2) {
+		uint8_t tag         = desc[0];
+		uint8_t this_length = desc[1];
+		desc      += 2;
+		desc_size -= 2;
+		if (tag == 9 && this_length >= 4 && this_length <= desc_size) {
+			uint16_t pid = ts_mux_map_pid(m, in, ((desc[2] & 0x1F) << 8) | desc[3]);
+			desc[2] = (desc[2] & 0xe0) | (pid >> 8);	// 111xxxxx
+			desc[3] = pid &~ 0xff00;
+		}
+		desc_size -= this_length;
+		desc += this_length;
+	}
+	return data;
+}
+
+// New input PAT, the first program in it is the input program
+static void ts_mux_input_set_pat(struct ts_mux *m, struct ts_mux_input *in) {
+	struct ts_pat *pat = in->pat;
+	struct ts_pat_program *prg = NULL;
+	int i;
+	for (i=0;i<pat->programs_num;i++) {
+		if (pat->programs[i]->program) {
+			prg = pat->programs[i];
+			break;
+		}
+	}
+	if (!prg)
+		return;
+	if (!in->program) {
+		uint16_t program = prg->program;
+		while (!program || ts_mux_program_used(m, program))
+			program++;
+		in->program = program;
+	}
+	if (prg->program != in->in_program) {
+		in->in_program = prg->program;
+		in->sdt_crc    = 0;	// Find the service again in the next SDT
+	}
+	if (prg->pid != in->in_pmt_pid) {
+		in->in_pmt_pid = prg->pid;
+		in->pmt_crc    = 0;
+		ts_pmt_clear(in->pmt);
+		ts_pmt_free(&in->out_pmt);
+		ts_mux_map_pid(m, in, prg->pid);
+		m->pat_changed = 1;
+	}
+}
+
+// New input PMT, build the output PMT with output program_number and PIDs
+static void ts_mux_input_set_pmt(struct ts_mux *m, struct ts_mux_input *in) {
+	struct ts_pmt *pmt = in->pmt;
+	uint8_t *desc;
+	int i;
+
+	ts_pmt_free(&in->out_pmt);
+	in->out_pmt = ts_pmt_alloc_init(in->program, in->pid_map[in->in_pmt_pid], ts_mux_map_pid(m, in, pmt->PCR_pid));
+	ts_pmt_begin_update(in->out_pmt);
+	desc = ts_mux_map_descriptors(m, in, pmt->program_info, pmt->program_info_size);
+	ts_pmt_add_program_descriptor(in->out_pmt, desc, pmt->program_info_size);
+	FREE(desc);
+	for (i=0;i<pmt->streams_num;i++) {
+		struct ts_pmt_stream *stream = pmt->streams[i];
+		uint16_t pid = ts_mux_map_pid(m, in, stream->pid);
+		ts_pmt_add_stream(in->out_pmt, stream->stream_type, pid);
+		desc = ts_mux_map_descriptors(m, in, stream->ES_info, stream->ES_info_size);
+		ts_pmt_add_es_descriptor(in->out_pmt, pid, desc, stream->ES_info_size);
+		FREE(desc);
+	}
+	ts_pmt_commit(in->out_pmt);
+	// The output changes when the input changes
+	in->out_pmt->section_header->version_number = pmt->section_header->version_number;
+	ts_pmt_regenerate_packets(in->out_pmt);
+
+	if (in->clock->pcr_pid != pmt->PCR_pid) {
+		in->clock->pcr_pid = pmt->PCR_pid;
+		ts_clock_reset(in->clock);
+	}
+}
+
+// New input SDT, keep the entry of the input program
+static void ts_mux_input_set_sdt(struct ts_mux *m, struct ts_mux_input *in) {
+	struct ts_sdt *sdt = in->sdt;
+	int i;
+	for (i=0;i<sdt->streams_num;i++) {
+		struct ts_sdt_stream *stream = sdt->streams[i];
+		if (stream->service_id != in->in_program)
+			continue;
+		if (in->service) {
+			FREE(in->service->descriptor_data);
+			FREE(in->service);
+		}
+		in->service = malloc(sizeof(struct ts_sdt_stream));
+		if (!in->service)
+			return;
+		*in->service = *stream;
+		in->service->descriptor_data = NULL;
+		if (stream->descriptor_size) {
+			in->service->descriptor_data = malloc(stream->descriptor_size);
+			if (!in->service->descriptor_data) {
+				in->service->descriptor_size = 0;
+			} else {
+				memcpy(in->service->descriptor_data, stream->descriptor_data, stream->descriptor_size);
+			}
+		}
+		m->sdt_changed = 1;
+		return;
+	}
+}
+
+// Complete input EIT section, pass it with output ids if it belongs to the input program
+static void ts_mux_input_set_eit(struct ts_mux *m, struct ts_mux_input *in, uint64_t deadline) {
+	struct ts_eit *eit = in->eit;
+	uint8_t table_id = eit->section_header->table_id;
+	uint8_t *ts_packets;
+	int num_packets;
+
+	// Only event_information_section actual_transport_stream, present/following and schedule
+	if (table_id != 0x4e && (table_id < 0x50 || table_id > 0x5f))
+		return;
+	if (!in->program || eit->section_header->ts_id_number != in->in_program)
+		return;
+	eit->section_header->ts_id_number = in->program;
+	eit->transport_stream_id          = m->transport_stream_id;
+	eit->original_network_id          = m->original_network_id;
+	ts_eit_generate(eit, &ts_packets, &num_packets);
+	ts_mux_queue_packets(&in->queue, deadline, ts_packets, num_packets, 1);
+	FREE(ts_packets);
+}
+
+// Output time of the next input packet from the input PCR model
+static uint64_t ts_mux_input_deadline(struct ts_mux *m, struct ts_mux_input *in, uint8_t *ts_packet) {
+	struct ts_clock *c = in->clock;
+	uint64_t pos = c->packets;
+	uint32_t discontinuities = c->discontinuities;
+	uint64_t deadline = in->last_deadline > m->now ? in->last_deadline : m->now;
+
+	ts_clock_push_packet(c, ts_packet, TS_CLOCK_NO_TIME);
+	if (c->discontinuities != discontinuities)
+		in->offset_set = 0;
+
+	if (c->initialized) {
+		double pcr = c->ref_pcr + c->ticks_per_packet * ((double)pos - c->ref_pos);
+		// The first packet of the model continues the previous deadlines
+		if (!in->offset_set) {
+			in->offset     = pcr - deadline;
+			in->offset_set = 1;
+		}
+		in->ticks_per_packet = c->ticks_per_packet;
+		if (pcr - in->offset > deadline)
+			deadline = pcr - in->offset;
+	} else if (in->ticks_per_packet > 0 && in->last_deadline) {
+		// Model restarts, keep the last known rate
+		if (in->last_deadline + in->ticks_per_packet > deadline)
+			deadline = in->last_deadline + in->ticks_per_packet;
+	}
+	in->last_deadline = deadline;
+	return deadline;
+}
+
+// Queue num_packets packets of input. Input PAT, PMT, SDT and EIT are replaced
+// by the output tables, other SI and PIDs that are not in the PMT are dropped.
+// Returns the number of queued input packets or -1 if input is not valid.
+int ts_mux_push_packets(struct ts_mux *m, int input, uint8_t *ts_packets, int num_packets) {
+	int i, queued = 0;
+	if (input < 0 || input >= m->inputs_num)
+		return -1;
+	struct ts_mux_input *in = &m->inputs[input];
+
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		uint16_t pid = ts_packet_get_pid(ts_packet);
+		uint64_t deadline = ts_mux_input_deadline(m, in, ts_packet);
+		in->packets_in++;
+
+		if (pid == 0x00) {
+			in->pat = ts_pat_push_packet(in->pat, ts_packet);
+			if (in->pat->initialized && in->pat->section_header->CRC != in->pat_crc) {
+				in->pat_crc = in->pat->section_header->CRC;
+				ts_mux_input_set_pat(m, in);
+			}
+		} else if (pid == in->in_pmt_pid && pid != NULL_PID) {
+			in->pmt = ts_pmt_push_packet(in->pmt, ts_packet);
+			if (in->pmt->initialized && in->pmt->section_header->CRC != in->pmt_crc) {
+				in->pmt_crc = in->pmt->section_header->CRC;
+				ts_mux_input_set_pmt(m, in);
+			}
+			// The output PMT is sent instead of the input PMT
+			if (ts_packet_is_pusi(ts_packet) && in->out_pmt)
+				ts_mux_queue_packets(&in->queue, deadline, in->out_pmt->section_header->packet_data,
+					in->out_pmt->section_header->num_packets, 1);
+		} else if (pid == 0x11) {
+			in->sdt = ts_sdt_push_packet(in->sdt, ts_packet);
+			if (in->sdt->initialized && in->sdt->section_header->CRC != in->sdt_crc) {
+				in->sdt_crc = in->sdt->section_header->CRC;
+				ts_mux_input_set_sdt(m, in);
+			}
+		} else if (pid == 0x12) {
+			in->eit = ts_eit_push_packet(in->eit, ts_packet);
+			if (in->eit->initialized) {
+				ts_mux_input_set_eit(m, in, deadline);
+				ts_eit_clear(in->eit);
+			}
+		} else if (in->pid_map[pid] != NULL_PID) {
+			struct ts_mux_packet *p = ts_mux_queue_packet(&in->queue, deadline, ts_packet, 0);
+			if (p) {
+				ts_packet_set_pid(p->data, in->pid_map[pid]);
+				queued++;
+				continue;
+			}
+		}
+		in->packets_dropped++;
+	}
+	return queued;
+}
+
+static void ts_mux_add_service(struct ts_sdt *sdt, struct ts_sdt_stream *service, uint16_t program) {
+	// One SDT section must fit in 1024 bytes
+	if (sdt->streams_num == sdt->streams_max || sdt->section_header->section_length + 5 + service->descriptor_size > 1021) {
+		ts_LOGf("!!! No space for service %d in SDT!\n", program);
+		return;
+	}
+	struct ts_sdt_stream *stream = malloc(sizeof(struct ts_sdt_stream));
+	if (!stream)
+		return;
+	*stream = *service;
+	stream->service_id      = program;
+	stream->descriptor_data = NULL;
+	if (service->descriptor_size) {
+		stream->descriptor_data = malloc(service->descriptor_size);
+		if (!stream->descriptor_data) {
+			FREE(stream);
+			return;
+		}
+		memcpy(stream->descriptor_data, service->descriptor_data, service->descriptor_size);
+	}
+	sdt->streams[sdt->streams_num++] = stream;
+	sdt->section_header->section_length += 5 + stream->descriptor_size;
+}
+
+static void ts_mux_build_psi(struct ts_mux *m) {
+	uint8_t *ts_packets;
+	int i, num_packets;
+
+	if (m->pat_changed) {
+		ts_pat_free(&m->pat);
+		m->pat = ts_pat_alloc_init(m->transport_stream_id);
+		for (i=0;i<m->inputs_num;i++) {
+			struct ts_mux_input *in = &m->inputs[i];
+			if (in->in_pmt_pid != NULL_PID)
+				ts_pat_add_program(m->pat, in->program, in->pid_map[in->in_pmt_pid]);
+		}
+		m->pat->section_header->version_number = m->pat_version;
+		m->pat_version = (m->pat_version + 1) &~ 0xe0; // xxx11111
+		ts_pat_regenerate_packets(m->pat);
+		m->pat_changed = 0;
+		m->next_pat    = m->now;
+	}
+
+	if (m->sdt_changed) {
+		ts_sdt_free(&m->sdt);
+		m->sdt = ts_sdt_alloc_init(m->original_network_id, m->transport_stream_id);
+		for (i=0;i<m->inputs_num;i++) {
+			struct ts_mux_input *in = &m->inputs[i];
+			if (in->service)
+				ts_mux_add_service(m->sdt, in->service, in->program);
+		}
+		m->sdt->section_header->version_number = m->sdt_version;
+		m->sdt_version = (m->sdt_version + 1) &~ 0xe0; // xxx11111
+		ts_sdt_generate(m->sdt, &ts_packets, &num_packets);
+		FREE(m->sdt->section_header->packet_data);
+		m->sdt->section_header->packet_data = ts_packets;
+		m->sdt->section_header->num_packets = num_packets;
+		m->sdt_changed = 0;
+		m->next_sdt    = m->now;
+	}
+}
+
+// Get the packets with deadline up to until (27MHz mux time) in deadline order
+// and advance the mux time to until. PAT and SDT are inserted every
+// TS_MUX_PAT_INTERVAL and TS_MUX_SDT_INTERVAL. out_packets must have room for
+// max_out packets, packets that do not fit stay queued and are late.
+// Returns the number of packets in out_packets.
+int ts_mux_get_packets(struct ts_mux *m, uint64_t until, uint8_t *out_packets, int max_out) {
+	int i, out_num = 0;
+
+	if (m->pat_changed || m->sdt_changed)
+		ts_mux_build_psi(m);
+	if (m->next_pat < m->now)
+		m->next_pat = m->now;
+	while (m->next_pat <= until) {
+		ts_mux_queue_packets(&m->psi, m->next_pat, m->pat->section_header->packet_data, m->pat->section_header->num_packets, 1);
+		m->next_pat += TS_MUX_PAT_INTERVAL;
+	}
+	if (m->next_sdt < m->now)
+		m->next_sdt = m->now;
+	while (m->next_sdt <= until) {
+		ts_mux_queue_packets(&m->psi, m->next_sdt, m->sdt->section_header->packet_data, m->sdt->section_header->num_packets, 1);
+		m->next_sdt += TS_MUX_SDT_INTERVAL;
+	}
+
+	while (out_num < max_out) {
+		struct ts_mux_queue *q = NULL;
+		struct ts_mux_packet *p = ts_mux_queue_head(&m->psi);
+		if (p && p->deadline <= until)
+			q = &m->psi;
+		for (i=0;i<m->inputs_num;i++) {
+			struct ts_mux_packet *ip = ts_mux_queue_head(&m->inputs[i].queue);
+			if (ip && ip->deadline <= until && (!q || ip->deadline < p->deadline)) {
+				q = &m->inputs[i].queue;
+				p = ip;
+			}
+		}
+		if (!q)
+			break;
+		uint8_t *ts_packet = out_packets + out_num++ * TS_PACKET_SIZE;
+		memcpy(ts_packet, p->data, TS_PACKET_SIZE);
+		if (p->set_cc) {
+			uint16_t pid = ts_packet_get_pid(ts_packet);
+			ts_packet_set_cont(ts_packet, m->cc[pid]++);
+		}
+		ts_mux_queue_pop(q);
+	}
+
+	if (until > m->now)
+		m->now = until;
+	m->packets_out += out_num;
+	return out_num;
+}
+
+void ts_mux_dump(struct ts_mux *m) {
+	int i, j;
+	ts_LOGf("MPTS mux ts_id:%04x onid:%04x inputs:%d now:%"PRIu64" packets_out:%"PRIu64"\n",
+		m->transport_stream_id, m->original_network_id, m->inputs_num, m->now, m->packets_out);
+	for (i=0;i<m->inputs_num;i++) {
+		struct ts_mux_input *in = &m->inputs[i];
+		char pids[256] = "";
+		int pos = 0;
+		for (j=0;j<0x2000 && pos < (int)sizeof(pids) - 12;j++) {
+			if (in->pid_map[j] != NULL_PID)
+				pos += snprintf(pids + pos, sizeof(pids) - pos, " %04x->%04x", j, in->pid_map[j]);
+		}
+		ts_LOGf("    * Input %d program %d->%d in:%"PRIu64" dropped:%"PRIu64" queued:%d PIDs:%s\n",
+			i, in->in_program, in->program, in->packets_in, in->packets_dropped, in->queue.num, pids);
+	}
+}
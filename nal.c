@@ -0,0 +1,278 @@
+/*
+ * H.264/HEVC NAL unit scanner
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "tsfuncs.h"
+
+// Returns pointer to the first 00 00 01 start code in data or NULL if there is none
+uint8_t *ts_nal_find_start_code(uint8_t *data, uint8_t *end) {
+	uint8_t *p = data;
+#ifdef __SSE2__
+	// Compare 16 positions at once: p[i] == 0 && p[i+1] == 0 && p[i+2] == 1
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one  = _mm_set1_epi8(1);
+	while (end - p >= 18) {
+		__m128i b0 = _mm_loadu_si128((const __m128i *)p);
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+		__m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+		__m128i sc = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)), _mm_cmpeq_epi8(b2, one));
+		int mask = _mm_movemask_epi8(sc);
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (end - p >= 3) {
+		if (p[2] > 1) { // No start code can begin at p, p+1 or p+2
+			p += 3;
+			continue;
+		}
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+		p++;
+	}
+	return NULL;
+}
+
+void ts_nal_iter_init(struct ts_nal_iter *it, uint8_t *data, uint32_t size, enum ts_nal_codec codec) {
+	it->data  = data;
+	it->end   = data + size;
+	it->codec = codec;
+	it->next  = ts_nal_find_start_code(data, it->end);
+}
+
+static void ts_nal_classify(struct ts_nal *nal, enum ts_nal_codec codec) {
+	uint8_t t;
+	if (codec == NAL_CODEC_HEVC) {
+		t = (nal->data[0] >> 1) & 0x3f;			// x111111x
+		nal->type   = t;
+		nal->is_vcl = t < 32;
+		nal->is_rap = t >= NAL_HEVC_BLA_W_LP && t <= 23;
+		nal->is_idr = t == NAL_HEVC_IDR_W_RADL || t == NAL_HEVC_IDR_N_LP;
+		nal->is_vps = t == NAL_HEVC_VPS;
+		nal->is_sps = t == NAL_HEVC_SPS;
+		nal->is_pps = t == NAL_HEVC_PPS;
+		nal->is_aud = t == NAL_HEVC_AUD;
+		nal->is_sei = t == NAL_HEVC_SEI_PREFIX || t == NAL_HEVC_SEI_SUFFIX;
+	} else {
+		t = nal->data[0] &~ 0xe0;					// xxx11111
+		nal->type   = t;
+		nal->is_vcl = t >= NAL_AVC_SLICE && t <= NAL_AVC_IDR;
+		nal->is_idr = t == NAL_AVC_IDR;
+		nal->is_rap = t == NAL_AVC_IDR;
+		nal->is_sps = t == NAL_AVC_SPS;
+		nal->is_pps = t == NAL_AVC_PPS;
+		nal->is_vps = 0;
+		nal->is_aud = t == NAL_AVC_AUD;
+		nal->is_sei = t == NAL_AVC_SEI;
+	}
+}
+
+// Get the next NAL unit. Returns 0 when there are no more NAL units.
+int ts_nal_next(struct ts_nal_iter *it, struct ts_nal *nal) {
+	while (it->next) {
+		uint8_t *start = it->next + 3;
+		uint8_t *end;
+		it->next = ts_nal_find_start_code(start, it->end);
+		end = it->next ? it->next : it->end;
+		// The zero bytes before the start code (zero_byte, trailing_zero_8bits) are not part of the NAL
+		while (end > start && end[-1] == 0)
+			end--;
+		if (end == start) // Empty NAL unit
+			continue;
+		nal->data = start;
+		nal->size = end - start;
+		ts_nal_classify(nal, it->codec);
+		return 1;
+	}
+	return 0;
+}
+
+// Returns 1 if the access unit in data starts with random access point.
+// Only the NAL units up to the first slice are checked.
+int ts_nal_is_rap(uint8_t *data, uint32_t size, enum ts_nal_codec codec) {
+	struct ts_nal_iter it;
+	struct ts_nal nal;
+	ts_nal_iter_init(&it, data, size, codec);
+	while (ts_nal_next(&it, &nal)) {
+		if (nal.is_vcl)
+			return nal.is_rap;
+	}
+	return 0;
+}
+
+// Copy NAL unit payload without the emulation prevention bytes (00 00 03 -> 00 00).
+// Returns the size of the RBSP in dst.
+static int ts_nal_unescape(uint8_t *dst, int dst_size, uint8_t *src, int src_size) {
+	int i, len = 0, zeros = 0;
+	for (i=0;i<src_size && len<dst_size;i++) {
+		if (zeros >= 2 && src[i] == 3) {
+			zeros = 0;
+			continue;
+		}
+		zeros = src[i] ? 0 : zeros + 1;
+		dst[len++] = src[i];
+	}
+	return len;
+}
+
+static void ts_nal_skip_scaling_list(struct ts_bits *b, int size) {
+	int j, last_scale = 8, next_scale = 8;
+	for (j=0;j<size && !b->error;j++) {
+		if (next_scale)
+			next_scale = (last_scale + ts_bits_get_se(b) + 256) % 256;
+		last_scale = next_scale ? next_scale : last_scale;
+	}
+}
+
+// ISO/IEC 14496-10 7.3.2.1.1 seq_parameter_set_data()
+static int ts_nal_parse_avc_sps(struct ts_bits *b, struct es_video_sps *sps) {
+	uint32_t i, n;
+	sps->profile_idc = ts_bits_get(b, 8);
+	ts_bits_skip(b, 8); // constraint_set_flags, reserved_zero_2bits
+	sps->level_idc = ts_bits_get(b, 8);
+	ts_bits_get_ue(b); // seq_parameter_set_id
+	sps->chroma_format_idc = 1;
+	sps->bit_depth = 8;
+	int separate_colour_plane = 0;
+	switch (sps->profile_idc) {
+		case 100: case 110: case 122: case 244: case 44:
+		case 83: case 86: case 118: case 128: case 138:
+		case 139: case 134: case 135:
+			sps->chroma_format_idc = ts_bits_get_ue(b);
+			if (sps->chroma_format_idc == 3)
+				separate_colour_plane = ts_bits_get(b, 1);
+			sps->bit_depth = ts_bits_get_ue(b) + 8;
+			ts_bits_get_ue(b); // bit_depth_chroma_minus8
+			ts_bits_skip(b, 1); // qpprime_y_zero_transform_bypass_flag
+			if (ts_bits_get(b, 1)) { // seq_scaling_matrix_present_flag
+				n = sps->chroma_format_idc != 3 ? 8 : 12;
+				for (i=0;i<n;i++) {
+					if (ts_bits_get(b, 1))
+						ts_nal_skip_scaling_list(b, i < 6 ? 16 : 64);
+				}
+			}
+			break;
+	}
+	ts_bits_get_ue(b); // log2_max_frame_num_minus4
+	switch (ts_bits_get_ue(b)) { // pic_order_cnt_type
+		case 0:
+			ts_bits_get_ue(b); // log2_max_pic_order_cnt_lsb_minus4
+			break;
+		case 1:
+			ts_bits_skip(b, 1); // delta_pic_order_always_zero_flag
+			ts_bits_get_se(b); // offset_for_non_ref_pic
+			ts_bits_get_se(b); // offset_for_top_to_bottom_field
+			n = ts_bits_get_ue(b); // num_ref_frames_in_pic_order_cnt_cycle
+			for (i=0;i<n && !b->error;i++)
+				ts_bits_get_se(b);
+			break;
+	}
+	ts_bits_get_ue(b); // max_num_ref_frames
+	ts_bits_skip(b, 1); // gaps_in_frame_num_value_allowed_flag
+	uint32_t width_mbs  = ts_bits_get_ue(b) + 1;
+	uint32_t height_mbs = ts_bits_get_ue(b) + 1;
+	int frame_mbs_only  = ts_bits_get(b, 1);
+	if (!frame_mbs_only)
+		ts_bits_skip(b, 1); // mb_adaptive_frame_field_flag
+	ts_bits_skip(b, 1); // direct_8x8_inference_flag
+	uint32_t width  = width_mbs * 16;
+	uint32_t height = (2 - frame_mbs_only) * height_mbs * 16;
+	if (ts_bits_get(b, 1)) { // frame_cropping_flag
+		uint32_t crop_x = 1, crop_y = 2 - frame_mbs_only;
+		if (!separate_colour_plane && sps->chroma_format_idc) {
+			crop_x = sps->chroma_format_idc == 3 ? 1 : 2;
+			crop_y = (sps->chroma_format_idc == 1 ? 2 : 1) * (2 - frame_mbs_only);
+		}
+		uint32_t left   = ts_bits_get_ue(b);
+		uint32_t right  = ts_bits_get_ue(b);
+		uint32_t top    = ts_bits_get_ue(b);
+		uint32_t bottom = ts_bits_get_ue(b);
+		width  -= crop_x * (left + right);
+		height -= crop_y * (top + bottom);
+	}
+	sps->width  = width;
+	sps->height = height;
+	return !b->error;
+}
+
+// ISO/IEC 23008-2 7.3.2.2 seq_parameter_set_rbsp() up to the conformance window and bit depth
+static int ts_nal_parse_hevc_sps(struct ts_bits *b, struct es_video_sps *sps) {
+	int i;
+	ts_bits_skip(b, 4); // sps_video_parameter_set_id
+	int max_sub_layers_minus1 = ts_bits_get(b, 3);
+	ts_bits_skip(b, 1); // sps_temporal_id_nesting_flag
+	// profile_tier_level(1, sps_max_sub_layers_minus1)
+	ts_bits_skip(b, 2); // general_profile_space
+	sps->tier = ts_bits_get(b, 1);
+	sps->profile_idc = ts_bits_get(b, 5);
+	ts_bits_skip(b, 32 + 4 + 43 + 1); // compatibility flags, source flags, reserved bits
+	sps->level_idc = ts_bits_get(b, 8);
+	int sub_layer_profile[8], sub_layer_level[8];
+	for (i=0;i<max_sub_layers_minus1;i++) {
+		sub_layer_profile[i] = ts_bits_get(b, 1);
+		sub_layer_level[i]   = ts_bits_get(b, 1);
+	}
+	if (max_sub_layers_minus1 > 0)
+		ts_bits_skip(b, (8 - max_sub_layers_minus1) * 2); // reserved_zero_2bits
+	for (i=0;i<max_sub_layers_minus1;i++) {
+		if (sub_layer_profile[i])
+			ts_bits_skip(b, 88);
+		if (sub_layer_level[i])
+			ts_bits_skip(b, 8);
+	}
+	ts_bits_get_ue(b); // sps_seq_parameter_set_id
+	sps->chroma_format_idc = ts_bits_get_ue(b);
+	if (sps->chroma_format_idc == 3)
+		ts_bits_skip(b, 1); // separate_colour_plane_flag
+	uint32_t width  = ts_bits_get_ue(b);
+	uint32_t height = ts_bits_get_ue(b);
+	if (ts_bits_get(b, 1)) { // conformance_window_flag
+		uint32_t crop_x = sps->chroma_format_idc == 1 || sps->chroma_format_idc == 2 ? 2 : 1;
+		uint32_t crop_y = sps->chroma_format_idc == 1 ? 2 : 1;
+		uint32_t left   = ts_bits_get_ue(b);
+		uint32_t right  = ts_bits_get_ue(b);
+		uint32_t top    = ts_bits_get_ue(b);
+		uint32_t bottom = ts_bits_get_ue(b);
+		width  -= crop_x * (left + right);
+		height -= crop_y * (top + bottom);
+	}
+	sps->bit_depth = ts_bits_get_ue(b) + 8;
+	sps->width  = width;
+	sps->height = height;
+	return !b->error;
+}
+
+// Parse sequence parameter set NAL unit. Returns 1 on success.
+int ts_nal_parse_sps(struct ts_nal *nal, enum ts_nal_codec codec, struct es_video_sps *sps) {
+	uint8_t rbsp[512];
+	struct ts_bits b;
+	int hdr_len = codec == NAL_CODEC_HEVC ? 2 : 1;
+	memset(sps, 0, sizeof(struct es_video_sps));
+	if (!nal->is_sps || nal->size <= (uint32_t)hdr_len)
+		return 0;
+	ts_bits_init(&b, rbsp, ts_nal_unescape(rbsp, sizeof(rbsp), nal->data + hdr_len, nal->size - hdr_len));
+	if (codec == NAL_CODEC_HEVC)
+		sps->initialized = ts_nal_parse_hevc_sps(&b, sps);
+	else
+		sps->initialized = ts_nal_parse_avc_sps(&b, sps);
+	return sps->initialized;
+}
+
+void ts_nal_sps_dump(struct es_video_sps *sps) {
+	if (!sps->initialized)
+		return;
+	ts_LOGf("  - ES analyze video SPS\n");
+	ts_LOGf("    - Profile       : %d level:%d tier:%d\n", sps->profile_idc, sps->level_idc, sps->tier);
+	ts_LOGf("    - Picture       : %dx%d chroma_format:%d bit_depth:%d\n", sps->width, sps->height, sps->chroma_format_idc, sps->bit_depth);
+}
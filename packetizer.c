@@ -0,0 +1,155 @@
+/*
+ * ES to PES to TS packetizer
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsfuncs.h"
+
+#define PES_HEADER_MAX_SIZE (9 + 10)
+
+// Write PES header for es_size bytes of ES data. pts/dts can be NO_PTS/NO_DTS,
+// dts is written only if it differs from pts. pes_header must have room for
+// PES_HEADER_MAX_SIZE (19) bytes. Returns the header size.
+int ts_pes_header_generate(uint8_t *pes_header, uint8_t stream_id, uint32_t es_size, uint64_t pts, uint64_t dts, int data_alignment) {
+	uint32_t pes_len;
+	int hdr_len = 6;
+
+	pes_header[0] = 0x00;
+	pes_header[1] = 0x00;
+	pes_header[2] = 0x01;
+	pes_header[3] = stream_id;
+
+	if (IS_PES_STREAM_SUPPORTED(stream_id)) {
+		uint8_t flags_2 = 0;
+		uint8_t pes_header_len = 0;
+		if (pts != NO_PTS) {
+			flags_2 = 0x80; // PTS
+			pes_header_len = 5;
+			if (dts != NO_DTS && dts != pts) {
+				flags_2 = 0xc0; // PTS and DTS
+				pes_header_len = 10;
+			}
+		}
+		pes_header[6] = 0x80 | (data_alignment ? 0x04 : 0x00);	// 10xxxxxx, data_alignment_indicator
+		pes_header[7] = flags_2;
+		pes_header[8] = pes_header_len;
+		if (flags_2 == 0x80) {
+			ts_encode_pts_dts(pes_header + 9, 2, pts & (TS_TIMESTAMP_WRAP - 1));
+		} else if (flags_2 == 0xc0) {
+			ts_encode_pts_dts(pes_header + 9, 3, pts & (TS_TIMESTAMP_WRAP - 1));
+			ts_encode_pts_dts(pes_header + 14, 1, dts & (TS_TIMESTAMP_WRAP - 1));
+		}
+		hdr_len = 9 + pes_header_len;
+	}
+
+	pes_len = hdr_len - 6 + es_size;
+	if (pes_len > 0xffff) // Unbounded, allowed only for video streams
+		pes_len = 0;
+	pes_header[4] = pes_len >> 8;
+	pes_header[5] = pes_len &~ 0xff00;
+	return hdr_len;
+}
+
+void ts_packetizer_init(struct ts_packetizer *p, uint16_t pid, uint8_t stream_id) {
+	memset(p, 0, sizeof(struct ts_packetizer));
+	p->pid            = pid;
+	p->stream_id      = stream_id;
+	p->data_alignment = 1;
+	p->unbounded      = IS_VIDEO_STREAM_ID(stream_id);
+}
+
+static int ts_packetizer_pes_size(struct ts_packetizer *p, uint32_t es_size, uint64_t pts, uint64_t dts) {
+	uint8_t pes_header[PES_HEADER_MAX_SIZE];
+	return ts_pes_header_generate(pes_header, p->stream_id, es_size, pts, dts, 0) + es_size;
+}
+
+// Adaptation field of the first TS packet, returns its size (0 if it is not needed)
+static int ts_packetizer_first_adapt(struct ts_packetizer *p, uint64_t pcr, struct ts_adapt_field *af) {
+	memset(af, 0, sizeof(struct ts_adapt_field));
+	af->random_access = p->random_access;
+	af->pcr_flag      = pcr != NO_PCR;
+	af->pcr           = pcr;
+	if (!af->random_access && !af->pcr_flag)
+		return 0;
+	return ts_adapt_field_size(af);
+}
+
+// Returns the number of TS packets that ts_packetizer_push() generates
+int ts_packetizer_num_packets(struct ts_packetizer *p, uint32_t es_size, uint64_t pts, uint64_t dts, uint64_t pcr) {
+	struct ts_adapt_field af;
+	int size = ts_packetizer_pes_size(p, es_size, pts, dts) + ts_packetizer_first_adapt(p, pcr, &af);
+	return (size + TS_MAX_PAYLOAD_SIZE - 1) / TS_MAX_PAYLOAD_SIZE;
+}
+
+// Packetize one ES buffer (access unit) into PES packet carried in TS packets.
+// pts, dts and pcr can be NO_PTS, NO_DTS and NO_PCR. PCR (27MHz) and
+// random_access_indicator (if p->random_access is set) are put into the first
+// TS packet. The last packet is filled using adaptation field stuffing.
+// Returns the number of TS packets written in ts_packets or -1 if max_packets
+// is not enough (see ts_packetizer_num_packets).
+int ts_packetizer_push(struct ts_packetizer *p, uint8_t *es_data, uint32_t es_size, uint64_t pts, uint64_t dts, uint64_t pcr, uint8_t *ts_packets, int max_packets) {
+	uint8_t pes_header[PES_HEADER_MAX_SIZE];
+	struct ts_header ts_header;
+	struct ts_adapt_field af;
+	int i, num_packets;
+
+	num_packets = ts_packetizer_num_packets(p, es_size, pts, dts, pcr);
+	if (num_packets > max_packets)
+		return -1;
+
+	int hdr_len = ts_pes_header_generate(pes_header, p->stream_id, es_size, pts, dts, p->data_alignment);
+	if (p->unbounded && IS_VIDEO_STREAM_ID(p->stream_id)) {
+		pes_header[4] = 0;
+		pes_header[5] = 0;
+	}
+	uint32_t pes_size = hdr_len + es_size;
+	uint32_t pes_pos = 0;
+
+	memset(&ts_header, 0, sizeof(struct ts_header));
+	ts_header.pid           = p->pid;
+	ts_header.payload_field = 1;
+
+	int first_adapt = ts_packetizer_first_adapt(p, pcr, &af);
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		uint32_t left = pes_size - pes_pos;
+		int adapt_size = i == 0 ? first_adapt : 0; // Including the adaptation_field_length byte
+		if (left < (uint32_t)(TS_MAX_PAYLOAD_SIZE - adapt_size)) // Stuffing
+			adapt_size = TS_MAX_PAYLOAD_SIZE - left;
+		if (i == 1) // Only stuffing after the first packet
+			memset(&af, 0, sizeof(struct ts_adapt_field));
+
+		ts_header.pusi        = i == 0;
+		ts_header.continuity  = p->continuity;
+		ts_packet_header_generate(ts_packet, &ts_header);
+		if (adapt_size)
+			ts_adapt_field_generate(ts_packet, &af, adapt_size);
+
+		uint8_t *payload = ts_packet + 4 + adapt_size;
+		uint32_t payload_size = TS_MAX_PAYLOAD_SIZE - adapt_size;
+		while (payload_size) {
+			uint32_t n;
+			if (pes_pos < (uint32_t)hdr_len) {
+				n = hdr_len - pes_pos < payload_size ? hdr_len - pes_pos : payload_size;
+				memcpy(payload, pes_header + pes_pos, n);
+			} else {
+				n = payload_size;
+				memcpy(payload, es_data + (pes_pos - hdr_len), n);
+			}
+			payload      += n;
+			payload_size -= n;
+			pes_pos      += n;
+		}
+		p->continuity = (p->continuity + 1) & 0x0f;
+	}
+
+	p->packets += num_packets;
+	p->pes_packets++;
+	p->random_access = 0;
+	return num_packets;
+}
@@ -0,0 +1,234 @@
+/*
+ * PCR accuracy, jitter, frequency offset and drift rate (TR 101 290)
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsfuncs.h"
+
+#define TICKS_TO_NS(x) ((x) * 1000 / 27)
+
+static void ts_histogram_init(struct ts_histogram *h, int64_t bin_width) {
+	memset(h, 0, sizeof(struct ts_histogram));
+	h->bin_width = bin_width;
+	h->min       = -bin_width * (TS_HISTOGRAM_BINS / 2);
+}
+
+static void ts_histogram_add(struct ts_histogram *h, int64_t value) {
+	int64_t bin = value - h->min;
+	bin = bin < 0 ? 0 : bin / h->bin_width;
+	if (bin >= TS_HISTOGRAM_BINS)
+		bin = TS_HISTOGRAM_BINS - 1;
+	h->bins[bin]++;
+	if (!h->count || value < h->lowest)
+		h->lowest = value;
+	if (!h->count || value > h->highest)
+		h->highest = value;
+	h->count++;
+}
+
+struct ts_pcr_metrics *ts_pcr_metrics_alloc(void) {
+	return calloc(1, sizeof(struct ts_pcr_metrics));
+}
+
+void ts_pcr_metrics_free(struct ts_pcr_metrics **pm) {
+	struct ts_pcr_metrics *m = *pm;
+	int i;
+	if (m) {
+		for (i=0;i<m->pids_num;i++) {
+			FREE(m->pids[i]);
+		}
+		FREE(m->pids);
+		FREE(*pm);
+	}
+}
+
+struct ts_pcr_metrics_pid *ts_pcr_metrics_get_pid(struct ts_pcr_metrics *m, uint16_t pid) {
+	int i;
+	for (i=0;i<m->pids_num;i++) {
+		if (m->pids[i]->pid == pid)
+			return m->pids[i];
+	}
+	return NULL;
+}
+
+static struct ts_pcr_metrics_pid *ts_pcr_metrics_add_pid(struct ts_pcr_metrics *m, uint16_t pid) {
+	struct ts_pcr_metrics_pid **pids = realloc(m->pids, (m->pids_num + 1) * sizeof(struct ts_pcr_metrics_pid *));
+	if (!pids)
+		return NULL;
+	m->pids = pids;
+	struct ts_pcr_metrics_pid *mp = calloc(1, sizeof(struct ts_pcr_metrics_pid));
+	if (!mp)
+		return NULL;
+	mp->pid = pid;
+	ts_histogram_init(&mp->ac_hist, 50);	// +-800 ns
+	ts_histogram_init(&mp->oj_hist, 100);	// +-1600 ns
+	ts_histogram_init(&mp->fo_hist, 50);	// +-800 Hz
+	ts_histogram_init(&mp->dr_hist, 10);	// +-160 mHz/s
+	m->pids[m->pids_num++] = mp;
+	return mp;
+}
+
+// Start new segment with pcr as the first value
+static void ts_pcr_metrics_start(struct ts_pcr_metrics_pid *mp, uint64_t pos, uint64_t pcr, uint64_t arrival_ns) {
+	mp->pcrs         = 1;
+	mp->first_pos    = pos;
+	mp->first_pcr    = pcr;
+	mp->last_pos     = pos;
+	mp->last_pcr     = pcr;
+	mp->last_raw_pcr = pcr;
+	mp->last_arrival = arrival_ns;
+	mp->sw           = 1;
+	mp->sx           = 0;
+	mp->sy           = 0;
+	mp->sxx          = 0;
+	mp->sxy          = 0;
+	mp->fo_valid     = 0;
+	mp->dr_fo_sum    = 0;
+	mp->dr_fo_count  = 0;
+}
+
+// Slope of the PCR over arrival time, returns 0 if it is not known
+static int ts_pcr_metrics_slope(struct ts_pcr_metrics_pid *mp, double *slope) {
+	double d = mp->sw * mp->sxx - mp->sx * mp->sx;
+	if (d <= 0)
+		return 0;
+	*slope = (mp->sw * mp->sxy - mp->sx * mp->sy) / d;
+	return 1;
+}
+
+static void ts_pcr_metrics_measure(struct ts_pcr_metrics_pid *mp, uint64_t pos, uint64_t pcr, uint64_t arrival_ns) {
+	uint64_t delta = (pcr - mp->last_raw_pcr + TS_CLOCK_PCR_WRAP) % TS_CLOCK_PCR_WRAP;
+	uint64_t unwrapped = mp->last_pcr + delta;
+	double dx = (double)(arrival_ns - mp->last_arrival) * 27 / 1000;
+	double dy = delta;
+	double slope;
+
+	// PCR_AC: PCR against the value expected from the packet position and the mean transport rate
+	if (mp->last_pos > mp->first_pos) {
+		double ticks_per_packet = (double)(mp->last_pcr - mp->first_pcr) / (mp->last_pos - mp->first_pos);
+		double expected = (double)(pos - mp->last_pos) * ticks_per_packet;
+		mp->ac = TICKS_TO_NS(dy - expected);
+		ts_histogram_add(&mp->ac_hist, mp->ac);
+		if (mp->ac > TS_PCR_AC_LIMIT || mp->ac < -TS_PCR_AC_LIMIT)
+			mp->ac_errors++;
+	}
+
+	// PCR_OJ: PCR against the value predicted from the arrival time by the clock model
+	if (mp->pcrs >= 2 && ts_pcr_metrics_slope(mp, &slope)) {
+		double predicted = (mp->sy - slope * mp->sx) / mp->sw + slope * dx;
+		mp->oj = TICKS_TO_NS(dy - predicted);
+		ts_histogram_add(&mp->oj_hist, mp->oj);
+	}
+
+	// Move the origin to the new PCR, forget the old values a bit and add the new one
+	mp->sxx = mp->sxx - 2 * dx * mp->sx + dx * dx * mp->sw;
+	mp->sxy = mp->sxy - dx * mp->sy - dy * mp->sx + dx * dy * mp->sw;
+	mp->sx  = mp->sx - dx * mp->sw;
+	mp->sy  = mp->sy - dy * mp->sw;
+	mp->sw  *= TS_PCR_METRICS_DECAY;
+	mp->sx  *= TS_PCR_METRICS_DECAY;
+	mp->sy  *= TS_PCR_METRICS_DECAY;
+	mp->sxx *= TS_PCR_METRICS_DECAY;
+	mp->sxy *= TS_PCR_METRICS_DECAY;
+	mp->sw  += 1;
+
+	mp->pcrs++;
+	mp->last_pos     = pos;
+	mp->last_pcr     = unwrapped;
+	mp->last_raw_pcr = pcr;
+	mp->last_arrival = arrival_ns;
+
+	// PCR_FO: PCR clock against 27MHz arrival clock, the model needs some PCR values first
+	if (mp->pcrs < TS_PCR_FO_MIN_PCRS || !ts_pcr_metrics_slope(mp, &slope))
+		return;
+	mp->fo = (slope - 1) * 27000000;
+	ts_histogram_add(&mp->fo_hist, mp->fo);
+	if (mp->fo > TS_PCR_FO_LIMIT || mp->fo < -TS_PCR_FO_LIMIT)
+		mp->fo_errors++;
+
+	// PCR_DR: change of mean PCR_FO between TS_PCR_DR_INTERVAL long intervals
+	if (!mp->dr_fo_count)
+		mp->dr_arrival = arrival_ns;
+	mp->dr_fo_sum += mp->fo;
+	mp->dr_fo_count++;
+	if (arrival_ns - mp->dr_arrival >= TS_PCR_DR_INTERVAL) {
+		double fo = mp->dr_fo_sum / mp->dr_fo_count;
+		if (mp->fo_valid) {
+			mp->dr = (fo - mp->dr_fo) * 1000 * 1000000000 / (arrival_ns - mp->dr_arrival);
+			ts_histogram_add(&mp->dr_hist, mp->dr);
+			if (mp->dr > TS_PCR_DR_LIMIT || mp->dr < -TS_PCR_DR_LIMIT)
+				mp->dr_errors++;
+		}
+		mp->fo_valid    = 1;
+		mp->dr_fo       = fo;
+		mp->dr_fo_sum   = 0;
+		mp->dr_fo_count = 0;
+	}
+}
+
+// Count TS packet and measure its PCR. All packets of the stream must be
+// pushed, arrival_ns is the packet arrival time in nanoseconds.
+// Returns 1 if the packet had PCR.
+int ts_pcr_metrics_push_packet(struct ts_pcr_metrics *m, uint8_t *ts_packet, uint64_t arrival_ns) {
+	uint64_t pos = m->packets++;
+	if (!ts_packet_has_pcr(ts_packet))
+		return 0;
+
+	uint16_t pid = ts_packet_get_pid(ts_packet);
+	uint64_t pcr = ts_packet_get_pcr(ts_packet);
+	struct ts_pcr_metrics_pid *mp = ts_pcr_metrics_get_pid(m, pid);
+	if (!mp) {
+		mp = ts_pcr_metrics_add_pid(m, pid);
+		if (mp)
+			ts_pcr_metrics_start(mp, pos, pcr, arrival_ns);
+		return 1;
+	}
+
+	// PCR stepped back, jumped or the arrival time did not increase
+	uint64_t delta = (pcr - mp->last_raw_pcr + TS_CLOCK_PCR_WRAP) % TS_CLOCK_PCR_WRAP;
+	if (ts_packet_has_discontinuity(ts_packet) || delta > TS_CLOCK_MAX_GAP || arrival_ns <= mp->last_arrival) {
+		mp->discontinuities++;
+		ts_pcr_metrics_start(mp, pos, pcr, arrival_ns);
+		return 1;
+	}
+
+	ts_pcr_metrics_measure(mp, pos, pcr, arrival_ns);
+	mp->measured++;
+	return 1;
+}
+
+static void ts_histogram_dump(char *name, char *unit, struct ts_histogram *h) {
+	char bins[TS_HISTOGRAM_BINS * 24 + 1];
+	int i, pos = 0;
+	if (!h->count)
+		return;
+	for (i=0;i<TS_HISTOGRAM_BINS;i++) {
+		if (h->bins[i])
+			pos += snprintf(bins + pos, sizeof(bins) - pos, " %"PRId64":%u", h->min + i * h->bin_width, h->bins[i]);
+		if (pos >= (int)sizeof(bins))
+			break;
+	}
+	ts_LOGf("      - %s count:%u lowest:%"PRId64" highest:%"PRId64" %s, bins:%s\n",
+		name, h->count, h->lowest, h->highest, unit, bins);
+}
+
+void ts_pcr_metrics_dump(struct ts_pcr_metrics *m) {
+	int i;
+	ts_LOGf("PCR metrics, packets:%"PRIu64"\n", m->packets);
+	for (i=0;i<m->pids_num;i++) {
+		struct ts_pcr_metrics_pid *mp = m->pids[i];
+		ts_LOGf("    * PID %04x measured:%u discontinuities:%u ac_errors:%u fo_errors:%u dr_errors:%u\n",
+			mp->pid, mp->measured, mp->discontinuities, mp->ac_errors, mp->fo_errors, mp->dr_errors);
+		ts_histogram_dump("PCR_AC", "ns", &mp->ac_hist);
+		ts_histogram_dump("PCR_OJ", "ns", &mp->oj_hist);
+		ts_histogram_dump("PCR_FO", "Hz", &mp->fo_hist);
+		ts_histogram_dump("PCR_DR", "mHz/s", &mp->dr_hist);
+	}
+}
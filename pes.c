@@ -6,6 +6,7 @@
  * See LICENSE-MIT.txt for license terms.
  */
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <stdlib.h>
@@ -17,6 +18,8 @@
 #define pes_data_size_buffer (1024)
 #define pes_max_data_size    (1024*1024)
 
+#define min(a,b) ((a < b) ? a : b)
+
 struct ts_pes *ts_pes_alloc() {
 	struct ts_pes *pes = calloc(1, sizeof(struct ts_pes));
 	pes->pes_data_size = pes_data_size_buffer;
@@ -25,10 +28,64 @@ struct ts_pes *ts_pes_alloc() {
 	return pes;
 }
 
+struct ts_pes_chunk_pool *ts_pes_chunk_pool_alloc(void) {
+	return calloc(1, sizeof(struct ts_pes_chunk_pool));
+}
+
+// All PES packets using the pool must be freed before the pool
+void ts_pes_chunk_pool_free(struct ts_pes_chunk_pool **ppool) {
+	struct ts_pes_chunk_pool *pool = *ppool;
+	if (pool) {
+		while (pool->free) {
+			struct ts_pes_chunk *chunk = pool->free;
+			pool->free = chunk->next;
+			FREE(chunk);
+		}
+		FREE(*ppool);
+	}
+}
+
+static struct ts_pes_chunk *ts_pes_chunk_get(struct ts_pes_chunk_pool *pool) {
+	struct ts_pes_chunk *chunk = pool->free;
+	if (chunk) {
+		pool->free = chunk->next;
+		pool->free_num--;
+	} else {
+		chunk = malloc(sizeof(struct ts_pes_chunk));
+		if (!chunk)
+			return NULL;
+		pool->allocated++;
+	}
+	chunk->next = NULL;
+	chunk->used = 0;
+	return chunk;
+}
+
+// Return PES chunks into the pool
+static void ts_pes_chunks_release(struct ts_pes *pes) {
+	struct ts_pes_chunk_pool *pool = pes->chunk_pool;
+	if (!pes->chunks)
+		return;
+	pes->last_chunk->next = pool->free;
+	pool->free = pes->chunks;
+	pool->free_num += pes->chunks_num;
+	pes->chunks = NULL;
+	pes->last_chunk = NULL;
+	pes->chunks_num = 0;
+}
+
+// Assemble the PES into chunks from the pool instead of the realloc()'ed *pes_data.
+void ts_pes_use_chunks(struct ts_pes *pes, struct ts_pes_chunk_pool *pool) {
+	ts_pes_chunks_release(pes);
+	pes->chunk_pool = pool;
+}
+
 void ts_pes_free(struct ts_pes **ppes) {
 	struct ts_pes *pes = *ppes;
 	if (pes) {
+		ts_pes_chunks_release(pes);
 		FREE(pes->pes_data);
+		FREE(pes->ext);
 		FREE(*ppes);
 	}
 }
@@ -36,18 +93,105 @@ void ts_pes_free(struct ts_pes **ppes) {
 void ts_pes_clear(struct ts_pes *pes) {
 	if (!pes)
 		return;
-	// save
-	uint8_t *pes_data = pes->pes_data;
-	uint32_t pes_data_size = pes->pes_data_size;
-	// clear
-	memset(pes_data, 0x33, pes_data_size);
-	memset(pes, 0, sizeof(struct ts_pes));
-	// restore
-	pes->pes_data = pes_data;
-	pes->pes_data_size = pes_data_size;
+	ts_pes_chunks_release(pes);
+	// Only the used part needs to be poisoned again
+	memset(pes->pes_data, 0x33, min(pes->pes_data_pos, pes->pes_data_size));
+	// Clear the reassembly state, buffers and *ext are kept for the next PES
+	memset(pes, 0, offsetof(struct ts_pes, es_data));
+	pes->es_data = NULL;
+	pes->es_data_chunk_size = 0;
+	pes->mpeg_audio_header.initialized = 0;
+	pes->mpeg_video_header.initialized = 0;
+	pes->audio_header.initialized = 0;
+	pes->video_sps.initialized = 0;
+}
+
+// Start of the PES data (PES header)
+static uint8_t *ts_pes_data_start(struct ts_pes *pes) {
+	return pes->chunks ? pes->chunks->data : pes->pes_data;
+}
+
+static int ts_pes_add_payload_to_chunks(struct ts_pes *pes, uint8_t *payload, uint8_t payload_size) {
+	struct ts_pes_chunk *chunk = pes->last_chunk;
+	while (payload_size) {
+		if (!chunk || chunk->used == TS_PES_CHUNK_SIZE) {
+			chunk = ts_pes_chunk_get(pes->chunk_pool);
+			if (!chunk)
+				return 0;
+			if (pes->last_chunk)
+				pes->last_chunk->next = chunk;
+			else
+				pes->chunks = chunk;
+			pes->last_chunk = chunk;
+			pes->chunks_num++;
+		}
+		uint32_t copy = TS_PES_CHUNK_SIZE - chunk->used;
+		if (copy > payload_size)
+			copy = payload_size;
+		memcpy(chunk->data + chunk->used, payload, copy);
+		chunk->used       += copy;
+		pes->pes_data_pos += copy;
+		payload           += copy;
+		payload_size      -= copy;
+	}
+	return 1;
+}
+
+// Fill iov with the PES data starting at offset. Returns the number of iov entries used.
+int ts_pes_get_iovec(struct ts_pes *pes, uint32_t offset, struct iovec *iov, int iov_max) {
+	int n = 0;
+	if (!pes->chunks) {
+		if (iov_max < 1 || offset >= pes->pes_data_pos)
+			return 0;
+		iov[0].iov_base = pes->pes_data + offset;
+		iov[0].iov_len  = pes->pes_data_pos - offset;
+		return 1;
+	}
+	struct ts_pes_chunk *chunk;
+	for (chunk = pes->chunks; chunk && n < iov_max; chunk = chunk->next) {
+		if (offset >= chunk->used) {
+			offset -= chunk->used;
+			continue;
+		}
+		iov[n].iov_base = chunk->data + offset;
+		iov[n].iov_len  = chunk->used - offset;
+		offset = 0;
+		n++;
+	}
+	return n;
+}
+
+// Copy chunked PES data into contiguous *pes_data and return it
+uint8_t *ts_pes_linearize(struct ts_pes *pes) {
+	if (!pes->chunks)
+		return pes->pes_data;
+	if (pes->pes_data_pos > pes->pes_data_size) {
+		pes->pes_data_size = pes->pes_data_pos;
+		pes->pes_data = realloc(pes->pes_data, pes->pes_data_size);
+	}
+	uint8_t *old_data = pes->chunks->data;
+	uint32_t pos = 0;
+	struct ts_pes_chunk *chunk;
+	for (chunk = pes->chunks; chunk; chunk = chunk->next) {
+		memcpy(pes->pes_data + pos, chunk->data, chunk->used);
+		pos += chunk->used;
+	}
+	// Move the pointers from the first chunk into *pes_data
+	if (pes->es_data) {
+		pes->es_data            = pes->pes_data + (pes->es_data - old_data);
+		pes->es_data_chunk_size = pes->es_data_size;
+	}
+	pes->ext_decoded = 0; // *ext pointers are into the first chunk
+	ts_pes_chunks_release(pes);
+	return pes->pes_data;
 }
 
 static void ts_pes_add_payload_to_pes_data(struct ts_pes *pes, uint8_t *payload, uint8_t payload_size) {
+	if (pes->chunk_pool) {
+		if (!ts_pes_add_payload_to_chunks(pes, payload, payload_size))
+			ts_LOGf("!!! Can't allocate PES chunk!\n");
+		goto OUT;
+	}
 	uint32_t new_data_pos = pes->pes_data_pos + payload_size;
 	// Check if there is enough space in pes->pes_data
 	if (new_data_pos > pes->pes_data_size) {
@@ -60,9 +204,10 @@ static void ts_pes_add_payload_to_pes_data(struct ts_pes *pes, uint8_t *payload,
 	}
 	memcpy(pes->pes_data + pes->pes_data_pos, payload, payload_size);
 	pes->pes_data_pos += payload_size;
+OUT:
 	if (pes->pes_packet_len) {
-		// If packet size is known, mark the packet as initialized
-		if (pes->pes_data_pos >= pes->pes_packet_len) {
+		// If packet size is known, mark the packet as initialized (6 bytes before PES_packet_length are not counted in it)
+		if (pes->pes_data_pos >= (uint32_t)pes->pes_packet_len + 6) {
 			pes->pes_data_initialized = 1;
 		}
 	}
@@ -90,6 +235,69 @@ int ts_pes_is_finished(struct ts_pes *pes, uint8_t *ts_packet) {
 	return 0;
 }
 
+// Set is_audio_xxx, is_video_xxx flags for the codec
+static void ts_pes_set_codec(struct ts_pes *pes, enum ts_codec codec) {
+	switch (codec) {
+		case CODEC_MPEG1_VIDEO:			pes->is_video = 1; pes->is_video_mpeg1 = 1; break;
+		case CODEC_MPEG2_VIDEO:			pes->is_video = 1; pes->is_video_mpeg2 = 1; break;
+		case CODEC_MPEG4_PART2_VIDEO:	pes->is_video = 1; pes->is_video_mpeg4 = 1; break;
+		case CODEC_AVC_VIDEO:			pes->is_video = 1; pes->is_video_h264  = 1; break;
+		case CODEC_HEVC_VIDEO:			pes->is_video = 1; pes->is_video_hevc  = 1; break;
+		case CODEC_AVS_VIDEO:			pes->is_video = 1; pes->is_video_avs   = 1; break;
+		case CODEC_MPEG1_AUDIO:			pes->is_audio = 1; pes->is_audio_mpeg1 = 1; break;
+		case CODEC_MPEG2_AUDIO:			pes->is_audio = 1; pes->is_audio_mpeg2 = 1; break;
+		case CODEC_AAC_ADTS_AUDIO:		pes->is_audio = 1; pes->is_audio_aac   = 1; break;
+		case CODEC_AAC_LATM_AUDIO:		pes->is_audio = 1; pes->is_audio_aac   = 1; pes->is_audio_latm = 1; break;
+		case CODEC_AC3_AUDIO:			pes->is_audio = 1; pes->is_audio_ac3   = 1; break;
+		case CODEC_EAC3_AUDIO:			pes->is_audio = 1; pes->is_audio_eac3  = 1; break;
+		case CODEC_AC4_AUDIO:			pes->is_audio = 1; pes->is_audio_ac4   = 1; break;
+		case CODEC_DTS_AUDIO:			pes->is_audio = 1; pes->is_audio_dts   = 1; break;
+		case CODEC_OPUS_AUDIO:			pes->is_audio = 1; pes->is_audio_opus  = 1; break;
+		case CODEC_TELETEXT:			pes->is_teletext = 1; break;
+		case CODEC_SUBTITLE:			pes->is_subtitle = 1; break;
+		case CODEC_UNKNOWN:				break;
+	}
+}
+
+// Stream descriptors that identify the codec of private streams
+static const struct {
+	uint8_t		tag;
+	uint8_t		codec;
+} codec_descriptors[] = {
+	{ 0x56, CODEC_TELETEXT },		// Teletext descriptor
+	{ 0x59, CODEC_SUBTITLE },		// Subtitling descriptor
+	{ 0x6a, CODEC_AC3_AUDIO },		// AC-3 descriptor
+	{ 0x7a, CODEC_EAC3_AUDIO },		// Enhanced AC-3 descriptor
+	{ 0x7b, CODEC_DTS_AUDIO },		// DTS descriptor
+	{ 0, 0 }
+};
+
+// Extension descriptor (0x7f) tags, ETSI EN 300 468 Table 109
+static const struct {
+	uint8_t		tag_ext;
+	uint8_t		codec;
+} codec_ext_descriptors[] = {
+	{ 0x15, CODEC_AC4_AUDIO },		// AC-4 descriptor
+	{ 0x80, CODEC_OPUS_AUDIO },		// User defined, used by DVB for Opus audio
+	{ 0, 0 }
+};
+
+// Registration descriptor format identifiers, see http://smpte-ra.org/mpegreg/mpegreg.html
+static const struct {
+	uint32_t	reg_ident;
+	uint8_t		codec;
+} codec_registrations[] = {
+	{ 0x41432D33, CODEC_AC3_AUDIO },	// AC-3
+	{ 0x44545331, CODEC_DTS_AUDIO },	// DTS1
+	{ 0x44545332, CODEC_DTS_AUDIO },	// DTS2
+	{ 0x44545333, CODEC_DTS_AUDIO },	// DTS3
+	{ 0x45414333, CODEC_EAC3_AUDIO },	// EAC3
+	{ 0x41432D34, CODEC_AC4_AUDIO },	// AC-4
+	{ 0x4F707573, CODEC_OPUS_AUDIO },	// Opus
+	{ 0x48455643, CODEC_HEVC_VIDEO },	// HEVC
+	{ 0, 0 }
+};
+
 // Fill is_video, is_audio, is_ac3, etc..flags in PES packet
 void ts_pes_fill_type(struct ts_pes *pes, struct ts_pmt *pmt, uint16_t pid) {
 	int i;
@@ -101,19 +309,13 @@ void ts_pes_fill_type(struct ts_pes *pes, struct ts_pmt *pmt, uint16_t pid) {
 			if (stream->pid != pid)
 				continue;
 
-			pes->is_audio       = pes->is_audio && ts_is_stream_type_audio(stream->stream_type);
-			pes->is_audio_mpeg1 = pes->is_audio && stream->stream_type == STREAM_TYPE_MPEG1_AUDIO;
-			pes->is_audio_mpeg2 = pes->is_audio && stream->stream_type == STREAM_TYPE_MPEG2_AUDIO;
-			// To determine if type is AC3 we need to check descriptors
-			//pes->is_audio_ac3   = ts_is_stream_type_ac3(stream->stream_type); // We need to also check descriptors because this is not ENOUGH!
-			pes->is_audio_aac   = pes->is_audio && stream->stream_type == STREAM_TYPE_ADTS_AUDIO;
-
-			pes->is_video       = pes->is_video && ts_is_stream_type_video(stream->stream_type);
-			pes->is_video_mpeg1 = pes->is_video && stream->stream_type == STREAM_TYPE_MPEG1_VIDEO;
-			pes->is_video_mpeg2 = pes->is_video && stream->stream_type == STREAM_TYPE_MPEG2_VIDEO;
-			pes->is_video_mpeg4 = pes->is_video && stream->stream_type == STREAM_TYPE_MPEG4_PART2_VIDEO;
-			pes->is_video_h264  = pes->is_video && stream->stream_type == STREAM_TYPE_AVC_VIDEO;
-			pes->is_video_avs   = pes->is_video && stream->stream_type == STREAM_TYPE_AVS_VIDEO;
+			const struct ts_stream_type_info *info = ts_get_stream_type_info(stream->stream_type);
+			pes->is_audio = pes->is_audio && info->is_audio;
+			pes->is_video = pes->is_video && info->is_video;
+			// ATSC AC-3 and E-AC-3 are carried in private_stream_1, the rest of
+			// the private streams are identified by the descriptors below.
+			if (pes->is_audio || pes->is_video || pes->stream_id == STREAM_ID_PRIVATE_STREAM_1)
+				ts_pes_set_codec(pes, info->codec);
 
 			if (!stream->ES_info)
 				break;
@@ -157,45 +359,35 @@ void ts_pes_fill_type(struct ts_pes *pes, struct ts_pmt *pmt, uint16_t pid) {
 						break;
 					}
 					case  5: { // Registration descriptor
-						if (this_length == 4) {
+						if (this_length >= 4) {
 							uint32_t reg_ident  = data[0] << 24;
 							reg_ident          |= data[1] << 16;
 							reg_ident          |= data[2] << 8;
 							reg_ident          |= data[3];
-							// See http://smpte-ra.org/mpegreg/mpegreg.html
-							if (reg_ident == 0x41432D33) { // AC-3
-								pes->is_audio = 1;
-								pes->is_audio_ac3 = 1;
-								//ts_LOGf("reg_desc says AC-3\n");
-							}
-							if (reg_ident == 0x44545331 || reg_ident == 0x44545332 || reg_ident == 0x44545333) { // DTS1, DTS2, DTS2
-								pes->is_audio = 1;
-								pes->is_audio_dts = 1;
-								//ts_LOGf("reg_desc says DTSx\n");
+							int j;
+							for (j=0;codec_registrations[j].reg_ident;j++) {
+								if (codec_registrations[j].reg_ident == reg_ident)
+									ts_pes_set_codec(pes, codec_registrations[j].codec);
 							}
 						}
 						break;
 					}
-					case 0x6a: { // AC-3 descriptor
-						//ts_LOGf("ac3_desc found\n");
-						pes->is_audio = 1;
-						pes->is_audio_ac3 = 1;
-						break;
-					}
-					case 0x7b: { // DTS descriptor
-						//ts_LOGf("ac3_desc found\n");
-						pes->is_audio = 1;
-						pes->is_audio_dts = 1;
-						break;
-					}
-					case 0x56: { // teletext
-						//ts_LOGf("teletext_desc found\n");
-						pes->is_teletext = 1;
+					case 0x7f: { // Extension descriptor
+						if (this_length >= 1) {
+							int j;
+							for (j=0;codec_ext_descriptors[j].tag_ext;j++) {
+								if (codec_ext_descriptors[j].tag_ext == data[0])
+									ts_pes_set_codec(pes, codec_ext_descriptors[j].codec);
+							}
+						}
 						break;
 					}
-					case 0x59: { // Subtitling descriptor
-						//ts_LOGf("subtitle_desc found\n");
-						pes->is_subtitle = 1;
+					default: {
+						int j;
+						for (j=0;codec_descriptors[j].tag;j++) {
+							if (codec_descriptors[j].tag == tag)
+								ts_pes_set_codec(pes, codec_descriptors[j].codec);
+						}
 						break;
 					}
 				} // switch
@@ -232,7 +424,7 @@ struct ts_pes *ts_pes_push_packet(struct ts_pes *pes, uint8_t *ts_packet, struct
 				goto ERROR;
 			}
 			if (pes_packet_len > 0) {
-				pes->real_pes_packet_len = pes_packet_len;
+				pes->real_pes_packet_len = pes_packet_len + 6;
 			} else {
 				pes->real_pes_packet_len = -1;
 			}
@@ -269,24 +461,10 @@ ERROR:
 	return pes;
 }
 
-int ts_pes_parse(struct ts_pes *pes) {
-	uint8_t *data = pes->pes_data;
-
-	if (!pes->pes_data_initialized) {
-		ts_LOGf("!!! pes_data_initialized not true\n");
-		return 0;
-	}
-
-	if (pes->real_pes_packet_len == -1) {
-		ts_LOGf("!!! real_pes_data_len is == -1\n");
-		return 0;
-	}
-
-	if (pes->pes_data_size < 6) {
-		ts_LOGf("!!! PES data_size < 6\n");
-		return 0;
-	}
-
+// Parse PES header up to PTS/DTS, the rest is decoded by ts_pes_get_ext().
+// data must contain at least 9 + data[8] (pes_header_len) bytes.
+// Returns the position after PTS/DTS or 0 on error.
+static int ts_pes_parse_header(struct ts_pes *pes, uint8_t *data) {
 	if (!(data[0] == 0x00 && data[1] == 0x00 && data[2] == 0x01)) { // pes_start_code_prefix
 		ts_LOGf("!!! PES_start_code_prefix error! Expected 0x00 0x00 0x01 but get 0x%02x 0x%02x 0x%02x! PID %03x\n",
 			data[0], data[1], data[2], pes->ts_header.pid);
@@ -352,121 +530,257 @@ int ts_pes_parse(struct ts_pes *pes) {
 		dpos += 5;
 	}
 
+	return dpos;
+}
+
+int ts_pes_parse(struct ts_pes *pes) {
+	uint8_t *data = ts_pes_data_start(pes);
+
+	if (!pes->pes_data_initialized) {
+		ts_LOGf("!!! pes_data_initialized not true\n");
+		return 0;
+	}
+
+	if (pes->real_pes_packet_len == -1) {
+		ts_LOGf("!!! real_pes_data_len is == -1\n");
+		return 0;
+	}
+
+	if (pes->pes_data_pos < 6) {
+		ts_LOGf("!!! PES data_size < 6\n");
+		return 0;
+	}
+
+	if (!ts_pes_parse_header(pes, data))
+		return 0;
+
+	// pes_header_len covers the optional fields and the stuffing bytes
+	int dpos = 9 + pes->pes_header_len;
+	if ((uint32_t)dpos > pes->pes_data_pos) {
+		ts_LOGf("!!! PES header len %d is bigger than PES data %u! PID %03x\n",
+			dpos, pes->pes_data_pos, pes->ts_header.pid);
+		return 0;
+	}
+
+	pes->es_data      = data + dpos;
+	pes->es_data_size = pes->real_pes_packet_len > dpos ? pes->real_pes_packet_len - dpos : 0;
+	pes->es_data_chunk_size = pes->es_data_size;
+	// In chunk mode only the first chunk is contiguous
+	if (pes->chunks && dpos + pes->es_data_size > pes->chunks->used)
+		pes->es_data_chunk_size = pes->chunks->used - dpos;
+	pes->initialized  = 1;
+
+	if (pes->data_alignment)
+		ts_pes_es_parse(pes);
+
+	return 1;
+}
+
+// Decode the rarely used PES header fields (ESCR, ES_rate, PES extension...)
+// The fields are decoded once per PES, returns NULL if the PES header is not parsed.
+struct ts_pes_ext *ts_pes_get_ext(struct ts_pes *pes) {
+	if (!pes->initialized && !pes->stream_header_done)
+		return NULL;
+	if (pes->ext_decoded)
+		return pes->ext;
+	if (!pes->ext) {
+		pes->ext = malloc(sizeof(struct ts_pes_ext));
+		if (!pes->ext)
+			return NULL;
+	}
+
+	struct ts_pes_ext *ext = pes->ext;
+	memset(ext, 0, sizeof(struct ts_pes_ext));
+
+	uint8_t *data = ts_pes_data_start(pes);
+	int dpos = 9;
+	if (pes->PTS_flag)
+		dpos += 5;
+	if (pes->DTS_flag)
+		dpos += 5;
+
 	if (pes->ESCR_flag) {
 		uint64_t ESCR_base;
 		uint32_t ESCR_extn;
-		ESCR_base = (data[dpos+4] >>  3) |
-					(data[dpos+3] <<  5) |
-					(data[dpos+2] << 13) |
+		ESCR_base = ((((uint64_t)data[dpos]) & 0x38) << 27) |	// xx111x11 (bits 32..30 and 29..28)
+					((((uint64_t)data[dpos]) & 0x03) << 28) |
 					(data[dpos+1] << 20) |
-				((((uint64_t)data[dpos]) & 0x03) << 28) |
-				((((uint64_t)data[dpos]) & 0x38) << 27);
-		ESCR_extn = (data[dpos+5] >> 1) | (data[dpos+4] << 7);
-		pes->ESCR = ESCR_base * 300 + ESCR_extn;
+					((data[dpos+2] >> 3) << 15) |				// 11111x11
+					((data[dpos+2] & 0x03) << 13) |
+					(data[dpos+3] <<  5) |
+					(data[dpos+4] >>  3);						// 11111x11
+		ESCR_extn = ((data[dpos+4] & 0x03) << 7) | (data[dpos+5] >> 1);
+		ext->ESCR = ESCR_base * 300 + ESCR_extn;
 		dpos += 6;
 	}
 
 	if (pes->ES_rate_flag) {
-		// Not decoded...
+		ext->ES_rate = ((data[dpos] &~ 0x80) << 15) | (data[dpos+1] << 7) | (data[dpos+2] >> 1); // x1111111 ... 1111111x
 		dpos += 3;
 	}
 
 	if (pes->trick_mode_flag) {
-		// Not decoded...
+		ext->trick_mode_control = data[dpos] >> 5;		// 111xxxxx, the rest is not decoded...
 		dpos += 1;
 	}
 
 	if (pes->add_copy_info_flag) {
-		// Not decoded...
+		ext->add_copy_info = data[dpos] &~ 0x80;		// x1111111
 		dpos += 1;
 	}
 
 	if (pes->pes_crc_flag) {
-		// Not decoded...
+		ext->prev_pes_crc = (data[dpos] << 8) | data[dpos+1];
 		dpos += 2;
 	}
 
 	if (pes->pes_extension_flag) {
 		// data[dpos] = 0xff;
-		pes->flags_3							= data[dpos];
-		pes->pes_private_data_flag				= bit_on(data[dpos], bit_8);	// 1xxxxxxx
-		pes->pack_header_field_flag				= bit_on(data[dpos], bit_7);	// x1xxxxxx
-		pes->program_packet_seq_counter_flag	= bit_on(data[dpos], bit_6);	// xx1xxxxx
-		pes->p_std_buffer_flag					= bit_on(data[dpos], bit_5);	// xxx1xxxx
-		pes->reserved2							= (data[dpos] &~ 0x0e) >> 1;	// xxxx111x
-		pes->pes_extension2_flag				= bit_on(data[dpos], bit_1);	// xxxxxxx1
-
-		if (pes->pes_private_data_flag) {
-			pes->pes_private_data_1 = (pes->pes_private_data_1 << 8) | data[dpos+7];
-			pes->pes_private_data_1 = (pes->pes_private_data_1 << 8) | data[dpos+6];
-			pes->pes_private_data_1 = (pes->pes_private_data_1 << 8) | data[dpos+5];
-			pes->pes_private_data_1 = (pes->pes_private_data_1 << 8) | data[dpos+4];
-			pes->pes_private_data_1 = (pes->pes_private_data_1 << 8) | data[dpos+3];
-			pes->pes_private_data_1 = (pes->pes_private_data_1 << 8) | data[dpos+2];
-			pes->pes_private_data_1 = (pes->pes_private_data_1 << 8) | data[dpos+1];
-			pes->pes_private_data_1 = (pes->pes_private_data_1 << 8) | data[dpos+0];
+		ext->flags_3							= data[dpos];
+		ext->pes_private_data_flag				= bit_on(data[dpos], bit_8);	// 1xxxxxxx
+		ext->pack_header_field_flag				= bit_on(data[dpos], bit_7);	// x1xxxxxx
+		ext->program_packet_seq_counter_flag	= bit_on(data[dpos], bit_6);	// xx1xxxxx
+		ext->p_std_buffer_flag					= bit_on(data[dpos], bit_5);	// xxx1xxxx
+		ext->reserved2							= (data[dpos] &~ 0xf1) >> 1;	// xxxx111x
+		ext->pes_extension2_flag				= bit_on(data[dpos], bit_1);	// xxxxxxx1
+		dpos += 1;
+
+		if (ext->pes_private_data_flag) {
+			int i;
+			for (i=7;i>=0;i--)
+				ext->pes_private_data_1 = (ext->pes_private_data_1 << 8) | data[dpos+i];
 			dpos += 8;
-			pes->pes_private_data_2 = (pes->pes_private_data_2 << 8) | data[dpos+7];
-			pes->pes_private_data_2 = (pes->pes_private_data_2 << 8) | data[dpos+6];
-			pes->pes_private_data_2 = (pes->pes_private_data_2 << 8) | data[dpos+5];
-			pes->pes_private_data_2 = (pes->pes_private_data_2 << 8) | data[dpos+4];
-			pes->pes_private_data_2 = (pes->pes_private_data_2 << 8) | data[dpos+3];
-			pes->pes_private_data_2 = (pes->pes_private_data_2 << 8) | data[dpos+2];
-			pes->pes_private_data_2 = (pes->pes_private_data_2 << 8) | data[dpos+1];
-			pes->pes_private_data_2 = (pes->pes_private_data_2 << 8) | data[dpos+0];
+			for (i=7;i>=0;i--)
+				ext->pes_private_data_2 = (ext->pes_private_data_2 << 8) | data[dpos+i];
 			dpos += 8;
 		}
 
-		if (pes->pack_header_field_flag) {
-			pes->pack_header_len = data[dpos];
-			pes->pack_header = pes->pes_data + 1 + dpos;	// Pointer into *pes_data
-			dpos += 1 + pes->pack_header_len;
+		if (ext->pack_header_field_flag) {
+			ext->pack_header_len = data[dpos];
+			ext->pack_header = data + 1 + dpos;	// Pointer into the PES data
+			dpos += 1 + ext->pack_header_len;
 		}
 
-		if (pes->program_packet_seq_counter_flag) {
-			// Not decoded
+		if (ext->program_packet_seq_counter_flag) {
+			ext->program_packet_seq_counter	= data[dpos] &~ 0x80;			// x1111111
+			ext->mpeg1_mpeg2_identifier		= bit_on(data[dpos+1], bit_7);	// x1xxxxxx
+			ext->original_stuff_length		= data[dpos+1] &~ 0xc0;			// xx111111
 			dpos += 2;
 		}
 
-		if (pes->p_std_buffer_flag) {
-			if ((data[dpos] &~ 0x3f) != 0x40) {		// 01xxxxxx (first two bits must be 01 eq 0x40
-				return 0;
-			}
-			// Not decoded...
+		if (ext->p_std_buffer_flag) {
+			ext->p_std_reserved		= data[dpos] >> 6;							// 11xxxxxx
+			ext->p_std_buffer_scale	= bit_on(data[dpos], bit_6);				// xx1xxxxx
+			ext->p_std_buffer_size	= ((data[dpos] &~ 0xe0) << 8) | data[dpos+1];	// xxx11111 11111111
 			dpos += 2;
 		}
 
-		if (pes->pes_extension2_flag) {
-			pes->pes_extension_field_len = data[dpos] &~ 0x80;		// x1111111
-			pes->pes_extension2 = pes->pes_data + 1 + dpos;	// Pointer into *pes_data
-			dpos += 1 + pes->pes_extension_field_len;
+		if (ext->pes_extension2_flag) {
+			ext->pes_extension_field_len = data[dpos] &~ 0x80;		// x1111111
+			ext->pes_extension2 = data + 1 + dpos;	// Pointer into the PES data
+			dpos += 1 + ext->pes_extension_field_len;
 		}
 	}
 
-	int maxstuffing = 32; // Maximum 32 stuffing bytes
-	// Skip stuffing bytes (8 is minimum PES header len)
-	while ((--maxstuffing > 0) && (dpos-8 <= pes->pes_header_len) && (data[dpos] == 0xff)) {
-		dpos++;
+	if (dpos > 9 + pes->pes_header_len)
+		ts_LOGf("!!! PES optional fields end at %d, after PES header len %d! PID %03x\n",
+			dpos, 9 + pes->pes_header_len, pes->ts_header.pid);
+
+	pes->ext_decoded = 1;
+	return ext;
+}
+
+static void ts_pes_stream_end(struct ts_pes *pes, struct ts_pes_stream_cb *cb) {
+	if (pes->stream_header_done && cb->end)
+		cb->end(cb->data, pes);
+	ts_pes_clear(pes);
+}
+
+// Call the end callback for the unfinished PES (for example at the end of the input)
+void ts_pes_stream_flush(struct ts_pes *pes, struct ts_pes_stream_cb *cb) {
+	if (pes->stream_id)
+		ts_pes_stream_end(pes, cb);
+}
+
+// Size of the PES header that is gathered before calling the header callback
+static int ts_pes_stream_header_size(struct ts_pes *pes) {
+	if (!IS_PES_STREAM_SUPPORTED(pes->stream_id))
+		return 6;
+	if (pes->pes_data_pos < 9)
+		return 9;
+	return 9 + pes->pes_data[8]; // pes_header_len
+}
+
+// Streaming mode, the PES is not assembled. The header callback is called as soon
+// as the PES header is received and the payload callback for every TS packet after that.
+// The end callback is called when the PES length is reached or when the next PES starts.
+int ts_pes_stream_push_packet(struct ts_pes *pes, uint8_t *ts_packet, struct ts_pmt *pmt, uint16_t pid, struct ts_pes_stream_cb *cb) {
+	struct ts_header ts_header;
+	memset(&ts_header, 0, sizeof(struct ts_header));
+
+	uint8_t *payload = ts_packet_header_parse(ts_packet, &ts_header);
+	int payload_size = ts_header.payload_size;
+
+	if (!payload || !payload_size)
+		return 0;
+
+	if (ts_header.pusi) {
+		// The previous PES is finished (needed for PES with unknown length)
+		if (pes->stream_id)
+			ts_pes_stream_end(pes, cb);
+		if (payload_size < 6 || !(payload[0] == 0x00 && payload[1] == 0x00 && payload[2] == 0x01)) { // pes_start_code_prefix
+			ts_LOGf("!!! PES_start_code_prefix not found. PID %03x\n", ts_header.pid);
+			return 0;
+		}
+		pes->ts_header           = ts_header;
+		pes->stream_id           = payload[3];
+		pes->pes_packet_len      = (payload[4] << 8) | payload[5];
+		pes->real_pes_packet_len = pes->pes_packet_len ? pes->pes_packet_len + 6 : -1;
+		ts_pes_fill_type(pes, pmt, pid);
 	}
 
-	pes->es_data      = pes->pes_data + dpos;
-	pes->es_data_size = pes->real_pes_packet_len - dpos;
-	pes->initialized  = 1;
+	if (!pes->stream_id) // Waiting for PES start
+		return 0;
 
-	if (pes->data_alignment)
-		ts_pes_es_parse(pes);
+	if (pes->pes_packet_len) { // Ignore the data after the end of the PES
+		uint32_t left = pes->pes_packet_len + 6 - pes->stream_pos;
+		if ((uint32_t)payload_size > left)
+			payload_size = left;
+	}
+	pes->stream_pos += payload_size;
+
+	while (!pes->stream_header_done && payload_size > 0) {
+		int copy = min(ts_pes_stream_header_size(pes) - (int)pes->pes_data_pos, payload_size);
+		memcpy(pes->pes_data + pes->pes_data_pos, payload, copy);
+		pes->pes_data_pos += copy;
+		payload           += copy;
+		payload_size      -= copy;
+		if ((int)pes->pes_data_pos < ts_pes_stream_header_size(pes))
+			continue;
+		if (IS_PES_STREAM_SUPPORTED(pes->stream_id) && !ts_pes_parse_header(pes, pes->pes_data)) {
+			ts_pes_clear(pes);
+			return 0;
+		}
+		pes->stream_header_done = 1;
+		if (cb->header)
+			cb->header(cb->data, pes);
+	}
+
+	if (pes->stream_header_done && payload_size > 0 && cb->payload)
+		cb->payload(cb->data, pes, payload, payload_size);
+
+	if (pes->pes_packet_len && pes->stream_pos >= (uint32_t)pes->pes_packet_len + 6)
+		ts_pes_stream_end(pes, cb);
 
 	return 1;
 }
 
-#define min(a,b) ((a < b) ? a : b)
-
 void ts_pes_dump(struct ts_pes *pes) {
 	if (!pes->initialized)
 		return;
 	ts_LOGf("PES packet\n");
 	ts_packet_header_dump(&pes->ts_header);
-	ts_LOGf("  * Content    : %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
+	ts_LOGf("  * Content    : %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
 		pes->is_audio			? "Audio "		: "",
 		pes->is_audio_mpeg1		? "MP1 "		: "",
 		pes->is_audio_mpeg1l1	? "Layer1 "		: "",
@@ -474,13 +788,18 @@ void ts_pes_dump(struct ts_pes *pes) {
 		pes->is_audio_mpeg1l3	? "Layer3 "		: "",
 		pes->is_audio_mpeg2		? "MP2 "		: "",
 		pes->is_audio_aac		? "AAC "		: "",
+		pes->is_audio_latm		? "LATM "		: "",
 		pes->is_audio_ac3		? "AC3 "		: "",
+		pes->is_audio_eac3		? "E-AC3 "		: "",
+		pes->is_audio_ac4		? "AC4 "		: "",
 		pes->is_audio_dts		? "DTS "		: "",
+		pes->is_audio_opus		? "Opus "		: "",
 		pes->is_video			? "Video "		: "",
 		pes->is_video_mpeg1		? "MPEG1 "		: "",
 		pes->is_video_mpeg2		? "MPEG2 "		: "",
 		pes->is_video_mpeg4		? "MPEG4p2 "	: "",
 		pes->is_video_h264		? "H.264 "		: "",
+		pes->is_video_hevc		? "HEVC "		: "",
 		pes->is_video_avs		? "AVS "		: "",
 		pes->is_teletext		? "Teletext "	: "",
 		pes->is_subtitle		? "Subtitles "	: ""
@@ -522,42 +841,47 @@ void ts_pes_dump(struct ts_pes *pes) {
 			pes->DTS / 90,
 			pes->DTS / 90000, (pes->DTS % 90000) / 9
 		);
+	struct ts_pes_ext *ext = ts_pes_get_ext(pes);
+	if (!ext)
+		goto PRIVATE;
+
 	if (pes->ESCR_flag)
-		ts_LOGf("  * ESCR       : %"PRIu64"\n", pes->ESCR);
+		ts_LOGf("  * ESCR       : %"PRIu64"\n", ext->ESCR);
 	if (pes->ES_rate_flag)
-		ts_LOGf("  * ES_rate    : %lu\n" , (unsigned long)pes->ES_rate * 50); // In units of 50 bytes
+		ts_LOGf("  * ES_rate    : %lu\n" , (unsigned long)ext->ES_rate * 50); // In units of 50 bytes
 
 	if (pes->pes_extension_flag) {
 		ts_LOGf("  * Ext flags  : 0x%02x | %s%s%s%s%s\n",
-			pes->flags_3,
-			pes->pes_private_data_flag				? "Private_data_flag "	: "",
-			pes->pack_header_field_flag				? "Pack_header_flag "	: "",
-			pes->program_packet_seq_counter_flag	? "Prg_pack_seq_flag "	: "",
-			pes->p_std_buffer_flag					? "P-STD_buf_flag "		: "",
-			pes->pes_extension2_flag				? "Ext2_flag "			: ""
+			ext->flags_3,
+			ext->pes_private_data_flag				? "Private_data_flag "	: "",
+			ext->pack_header_field_flag				? "Pack_header_flag "	: "",
+			ext->program_packet_seq_counter_flag	? "Prg_pack_seq_flag "	: "",
+			ext->p_std_buffer_flag					? "P-STD_buf_flag "		: "",
+			ext->pes_extension2_flag				? "Ext2_flag "			: ""
 		);
 	}
 
-	if (pes->pes_private_data_flag) {
+	if (ext->pes_private_data_flag) {
 		ts_LOGf("  * PES priv_data : 0x%08llx%08llx\n",
-			(unsigned long long)pes->pes_private_data_1,
-			(unsigned long long)pes->pes_private_data_2);
+			(unsigned long long)ext->pes_private_data_1,
+			(unsigned long long)ext->pes_private_data_2);
 	}
 
-	if (pes->pack_header_field_flag) {
+	if (ext->pack_header_field_flag) {
 		ts_LOGf("  * Pack_header ... \n");
 	}
 
-	if (pes->program_packet_seq_counter_flag) {
-		ts_LOGf("  * Prg_seq_cnt : %d\n", pes->program_packet_seq_counter);
+	if (ext->program_packet_seq_counter_flag) {
+		ts_LOGf("  * Prg_seq_cnt : %d\n", ext->program_packet_seq_counter);
 	}
 
+PRIVATE:
 	ts_LOGf("  - Private    : pes_data_pos:%u es_data_size:%u\n",
 		pes->pes_data_pos,
 		pes->es_data_size
 	);
 
-	char *phex = ts_hex_dump(pes->pes_data, min(32, pes->pes_data_pos), 0);
+	char *phex = ts_hex_dump(ts_pes_data_start(pes), min(32, pes->pes_data_pos), 0);
 	ts_LOGf("  - PES dump   : %s...\n", phex);
 	free(phex);
 
@@ -11,14 +11,38 @@
 #include "tsdata.h"
 #include "tsfuncs.h"
 
-#define START_ENTRIES 1
-#define ENTRIES_INCREMENT 1
+#define START_ENTRIES 16
+
+// Get PES from the free list or allocate new one
+static struct ts_pes *pes_array_pes_alloc(struct pes_array *pa) {
+	struct ts_pes *pes;
+	if (pa->pes_pool_num)
+		return pa->pes_pool[--pa->pes_pool_num];
+	pes = ts_pes_alloc();
+	if (pa->chunk_pool)
+		ts_pes_use_chunks(pes, pa->chunk_pool);
+	return pes;
+}
+
+// Return PES into the free list, its pes_data buffer is reused
+static void pes_array_pes_release(struct pes_array *pa, struct ts_pes **ppes) {
+	struct ts_pes *pes = *ppes;
+	if (!pes)
+		return;
+	*ppes = NULL;
+	if (pa->pes_pool_num == pa->pes_pool_max) {
+		pa->pes_pool_max = pa->pes_pool_max ? pa->pes_pool_max * 2 : START_ENTRIES;
+		pa->pes_pool = realloc(pa->pes_pool, pa->pes_pool_max * sizeof(struct ts_pes *));
+	}
+	ts_pes_clear(pes);
+	pa->pes_pool[pa->pes_pool_num++] = pes;
+}
 
-static struct pes_entry *pes_entry_alloc(uint16_t pid) {
+static struct pes_entry *pes_entry_alloc(struct pes_array *pa, uint16_t pid) {
 	//ts_LOGf("Alloc pes_entry pid = %03x\n", pid);
 	struct pes_entry *e = malloc(sizeof(struct pes_entry));
 	e->pid = pid;
-	e->pes = ts_pes_alloc();
+	e->pes = pes_array_pes_alloc(pa);
 	e->pes_next = NULL;
 	return e;
 }
@@ -33,29 +57,26 @@ static void pes_entry_free(struct pes_entry **pentry) {
 }
 
 static struct pes_entry *pes_entry_find(struct pes_array *pa, uint16_t pid) {
-	int i;
-	for (i=0;i<pa->max;i++) {
-		struct pes_entry *e = pa->entries[i];
-		if (e && e->pid == pid) {
-			return e;
-		}
-	}
-	return NULL;
+	return pa->pid_index[pid & 0x1fff];
 }
 
-
-
 struct pes_array *pes_array_alloc() {
 	struct pes_array *pa = calloc(1, sizeof(struct pes_array));
 	pa->max = START_ENTRIES;
 	pa->entries = calloc(pa->max, sizeof(struct pes_entry *));
+	pa->pid_index = calloc(0x2000, sizeof(struct pes_entry *));
 	return pa;
 }
 
-struct pes_array *pes_array_realloc(struct pes_array *pa) {
-	pa->max += ENTRIES_INCREMENT;
+// PES packets are assembled in chunks from the pool. The pool must be freed after the pes_array.
+void pes_array_use_chunks(struct pes_array *pa, struct ts_pes_chunk_pool *pool) {
+	pa->chunk_pool = pool;
+}
+
+static struct pes_array *pes_array_realloc(struct pes_array *pa) {
+	pa->max *= 2;
 	pa->entries = realloc(pa->entries, sizeof(struct pes_entry *) * pa->max);
-	memset(&pa->entries[pa->cur], 0, sizeof(struct pes_entry *) * ((pa->max-1) - pa->cur));
+	memset(&pa->entries[pa->cur], 0, sizeof(struct pes_entry *) * (pa->max - pa->cur));
 	return pa;
 }
 
@@ -63,7 +84,8 @@ void pes_array_dump(struct pes_array *pa) {
 	int i;
 	ts_LOGf("pa->max=%d\n", pa->max);
 	ts_LOGf("pa->cur=%d\n", pa->cur);
-	for (i=0;i<pa->max;i++) {
+	ts_LOGf("pa->pes_pool_num=%d\n", pa->pes_pool_num);
+	for (i=0;i<pa->cur;i++) {
 		ts_LOGf("pa->entry[%d]=0x%p\n", i, pa->entries[i]);
 		if (pa->entries[i]) {
 			ts_LOGf("pa->entry[%d]->pid=%03x\n", i, pa->entries[i]->pid);
@@ -77,10 +99,15 @@ void pes_array_free(struct pes_array **ppa) {
 	int i;
 	struct pes_array *pa = *ppa;
 	if (pa) {
-		for (i=0;i<pa->max;i++) {
+		for (i=0;i<pa->cur;i++) {
 			pes_entry_free(&pa->entries[i]);
 		}
-		free(pa->entries);
+		for (i=0;i<pa->pes_pool_num;i++) {
+			ts_pes_free(&pa->pes_pool[i]);
+		}
+		FREE(pa->pes_pool);
+		FREE(pa->pid_index);
+		FREE(pa->entries);
 		FREE(*ppa);
 	}
 }
@@ -99,28 +126,7 @@ struct pes_entry *pes_array_push_packet(struct pes_array *pa, uint16_t pid, stru
 			// Stream_type 0x80..0xff - user private
 			// Stream_type 0x05       - private sections
 			if (stream->pid == pid) {
-				switch (stream->stream_type) {
-					case 0x01: // return "11172-2 video (MPEG-1)";
-					case 0x02: // return "H.262/13818-2 video (MPEG-2) or 11172-2 constrained video";
-					case 0x03: // return "11172-3 audio (MPEG-1)";
-					case 0x04: // return "13818-3 audio (MPEG-2)";
-					case 0x06: // return "H.222.0/13818-1 PES private data";
-					case 0x07: // return "13522 MHEG";
-					case 0x08: // return "H.222.0/13818-1 Annex A - DSM CC";
-					case 0x09: // return "H.222.1";
-					case 0x0A: // return "13818-6 type A";
-					case 0x0B: // return "13818-6 type B";
-					case 0x0C: // return "13818-6 type C";
-					case 0x0D: // return "13818-6 type D";
-					case 0x0E: // return "H.222.0/13818-1 auxiliary";
-					case 0x0F: // return "13818-7 Audio with ADTS transport syntax";
-					case 0x10: // return "14496-2 Visual (MPEG-4 part 2 video)";
-					case 0x11: // return "14496-3 Audio with LATM transport syntax (14496-3/AMD 1)";
-					case 0x15: // return "Metadata in PES packets";
-					case 0x1B: // return "H.264/14496-10 video (MPEG-4/AVC)";
-					case 0x42: // return "AVS Video";
-						pes_carrying_pid = 1;
-				}
+				pes_carrying_pid = ts_is_stream_type_pes(stream->stream_type);
 				break;
 			}
 		}
@@ -130,13 +136,14 @@ struct pes_entry *pes_array_push_packet(struct pes_array *pa, uint16_t pid, stru
 		if (pa->cur >= pa->max) // Is there enough space in pes_array
 			pa = pes_array_realloc(pa); // Try to get some more
 
-		p = pes_entry_alloc(pid);
+		p = pes_entry_alloc(pa, pid);
 		pa->entries[pa->cur++] = p;
+		pa->pid_index[pid & 0x1fff] = p;
 	}
 
 	// Last packet finished video PES and we saved it here
 	if (p->pes_next) {
-		ts_pes_free(&p->pes);
+		pes_array_pes_release(pa, &p->pes);
 		p->pes = p->pes_next;
 		p->pes_next = NULL;
 	}
@@ -144,7 +151,7 @@ struct pes_entry *pes_array_push_packet(struct pes_array *pa, uint16_t pid, stru
 	// Video PES packets have unknown size, so we need to look one packet in the
 	// future to know when video PES is finished.
 	if (ts_pes_is_finished(p->pes, ts_packet)) {
-		p->pes_next = ts_pes_alloc();
+		p->pes_next = pes_array_pes_alloc(pa);
 		p->pes_next = ts_pes_push_packet(p->pes_next, ts_packet, pmt, pid);
 	} else {
 		p->pes = ts_pes_push_packet(p->pes, ts_packet, pmt, pid);
@@ -94,10 +94,532 @@ void ts_pes_es_mpeg_audio_header_dump(struct mpeg_audio_header *mpghdr) {
 	);
 }
 
+// Parse MPEG-1/2 video sequence, GOP and picture headers up to the first slice.
+// Returns 1 if any of the headers is found.
+int ts_pes_es_mpeg_video_header_parse(struct mpeg_video_header *vhdr, uint8_t *data, int datasz) {
+	uint8_t *end = data + datasz;
+	uint8_t *p = data;
+	while ((p = ts_nal_find_start_code(p, end)) && p + 4 <= end) {
+		uint8_t code = p[3];
+		uint8_t *d = p + 4;
+		int len = end - d;
+		p += 3;
+		if (code >= 0x01 && code <= 0xaf) // slice_start_code
+			break;
+		switch (code) {
+			case 0xb3: { // sequence_header_code
+				if (len < 8)
+					break;
+				vhdr->width				= (d[0] << 4) | (d[1] >> 4);				// 12 bits
+				vhdr->height			= ((d[1] &~ 0xf0) << 8) | d[2];			// 12 bits
+				vhdr->aspect_ratio		= d[3] >> 4;							// 4 bits
+				vhdr->frame_rate_code	= d[3] &~ 0xf0;							// 4 bits
+				vhdr->bit_rate			= (d[4] << 10) | (d[5] << 2) | (d[6] >> 6);	// 18 bits
+				vhdr->vbv_buffer_size	= ((d[6] &~ 0xe0) << 5) | (d[7] >> 3);	// 1 bit marker, 10 bits
+				vhdr->have_sequence		= 1;
+				break;
+			}
+			case 0xb5: { // extension_start_code
+				if (len < 6 || (d[0] >> 4) != 1 || !vhdr->have_sequence) // Only sequence_extension
+					break;
+				vhdr->progressive_sequence	= bit_on(d[1], bit_4);
+				vhdr->chroma_format			= (d[1] &~ 0xf9) >> 1;						// xxxxx11x
+				vhdr->width				   |= (((d[1] & 0x01) << 1) | (d[2] >> 7)) << 12;
+				vhdr->height			   |= ((d[2] &~ 0x9f) >> 5) << 12;				// x11xxxxx
+				vhdr->bit_rate			   |= (((d[2] &~ 0xe0) << 7) | (d[3] >> 1)) << 18;	// 12 bits
+				vhdr->vbv_buffer_size	   |= d[4] << 10;
+				vhdr->have_sequence_ext		= 1;
+				break;
+			}
+			case 0xb8: { // group_start_code
+				if (len < 4)
+					break;
+				vhdr->drop_frame	= bit_on(d[0], bit_8);
+				vhdr->tc_hours		= (d[0] &~ 0x83) >> 2;						// x11111xx
+				vhdr->tc_minutes	= ((d[0] &~ 0xfc) << 4) | (d[1] >> 4);
+				vhdr->tc_seconds	= ((d[1] &~ 0xf8) << 3) | (d[2] >> 5);		// 1 bit marker before
+				vhdr->tc_pictures	= ((d[2] &~ 0xe0) << 1) | (d[3] >> 7);
+				vhdr->closed_gop	= bit_on(d[3], bit_7);
+				vhdr->broken_link	= bit_on(d[3], bit_6);
+				vhdr->have_gop		= 1;
+				break;
+			}
+			case 0x00: { // picture_start_code
+				if (len < 4)
+					break;
+				vhdr->temporal_reference	= (d[0] << 2) | (d[1] >> 6);					// 10 bits
+				vhdr->picture_coding_type	= (d[1] &~ 0xc7) >> 3;						// xx111xxx
+				vhdr->vbv_delay				= ((d[1] &~ 0xf8) << 13) | (d[2] << 5) | (d[3] >> 3);
+				vhdr->have_picture			= 1;
+				break;
+			}
+		}
+	}
+	vhdr->initialized = vhdr->have_sequence || vhdr->have_gop || vhdr->have_picture;
+	return vhdr->initialized;
+}
+
+void ts_pes_es_mpeg_video_header_dump(struct mpeg_video_header *vhdr) {
+	static const char *frame_rates[16] = {
+		"forbidden", "23.976", "24", "25", "29.97", "30", "50", "59.94", "60",
+		"reserved", "reserved", "reserved", "reserved", "reserved", "reserved", "reserved"
+	};
+	if (!vhdr->initialized)
+		return;
+	ts_LOGf("  - ES analyze video frame\n");
+	if (vhdr->have_sequence) {
+		ts_LOGf("    - Sequence      : %dx%d aspect_ratio:%d frame_rate:%s progressive:%d chroma_format:%d%s\n",
+			vhdr->width, vhdr->height,
+			vhdr->aspect_ratio,
+			frame_rates[vhdr->frame_rate_code],
+			vhdr->progressive_sequence,
+			vhdr->chroma_format,
+			vhdr->have_sequence_ext ? "" : " (MPEG-1)");
+		ts_LOGf("    - Bitrate       : %llu bit/s vbv_buffer_size:%u (%u bytes)\n",
+			(unsigned long long)vhdr->bit_rate * 400,
+			vhdr->vbv_buffer_size, vhdr->vbv_buffer_size * 2048);
+	}
+	if (vhdr->have_gop) {
+		ts_LOGf("    - GOP           : time_code:%02d:%02d:%02d%s%02d closed_gop:%d broken_link:%d\n",
+			vhdr->tc_hours, vhdr->tc_minutes, vhdr->tc_seconds,
+			vhdr->drop_frame ? ";" : ":", vhdr->tc_pictures,
+			vhdr->closed_gop, vhdr->broken_link);
+	}
+	if (vhdr->have_picture) {
+		ts_LOGf("    - Picture       : %c temporal_reference:%d vbv_delay:%d\n",
+			vhdr->picture_coding_type == 1 ? 'I' :
+			vhdr->picture_coding_type == 2 ? 'P' :
+			vhdr->picture_coding_type == 3 ? 'B' : '?',
+			vhdr->temporal_reference, vhdr->vbv_delay);
+	}
+}
+
+static const uint32_t aac_sample_rates[16] = {
+	96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+	16000, 12000, 11025,  8000,  7350,     0,     0,     0
+};
+
+// Channels without LFE for AAC channel_configuration
+static const uint8_t aac_channels[8] = { 0, 1, 2, 3, 4, 5, 5, 7 };
+
+// ISO/IEC 13818-7 ADTS fixed and variable header
+static int es_adts_header_parse(struct es_audio_header *ahdr, uint8_t *d, int len) {
+	if (len < 7 || d[0] != 0xff || (d[1] &~ 0x09) != 0xf0)	// 1111x00x, layer must be 0
+		return 0;
+	uint8_t sf_index = (d[2] &~ 0xc3) >> 2;						// xx1111xx
+	uint8_t channel_config = ((d[2] &~ 0xfe) << 2) | (d[3] >> 6);
+	uint16_t frame_length = ((d[3] &~ 0xfc) << 11) | (d[4] << 3) | (d[5] >> 5);
+	if (!aac_sample_rates[sf_index] || frame_length < 7)
+		return 0;
+	ahdr->profile		= (d[2] >> 6) + 1;						// audio object type
+	ahdr->sample_rate	= aac_sample_rates[sf_index];
+	ahdr->channels		= aac_channels[channel_config];
+	ahdr->lfe			= channel_config >= 6;
+	ahdr->frame_size	= frame_length;
+	ahdr->samples		= 1024 * ((d[6] &~ 0xfc) + 1);			// number_of_raw_data_blocks_in_frame
+	return 1;
+}
+
+// ISO/IEC 14496-3 AudioSpecificConfig, only the part needed for the sample rate and channels
+static int es_aac_audio_specific_config_parse(struct es_audio_header *ahdr, struct ts_bits *b) {
+	uint8_t aot = ts_bits_get(b, 5);
+	if (aot == 31)
+		aot = 32 + ts_bits_get(b, 6);
+	uint8_t sf_index = ts_bits_get(b, 4);
+	uint32_t sample_rate = sf_index == 0xf ? ts_bits_get(b, 24) : aac_sample_rates[sf_index];
+	uint8_t channel_config = ts_bits_get(b, 4);
+	ahdr->samples = 1024;
+	if (aot == 5 || aot == 29) { // SBR, PS - the output sample rate is the extension sample rate
+		sf_index = ts_bits_get(b, 4);
+		sample_rate = sf_index == 0xf ? ts_bits_get(b, 24) : aac_sample_rates[sf_index];
+		aot = ts_bits_get(b, 5);
+		ahdr->samples = 2048;
+	}
+	if (b->error || !sample_rate || channel_config > 7)
+		return 0;
+	ahdr->profile		= aot;
+	ahdr->sample_rate	= sample_rate;
+	ahdr->channels		= aac_channels[channel_config];
+	ahdr->lfe			= channel_config >= 6;
+	return 1;
+}
+
+// ISO/IEC 14496-3 AudioSyncStream (LOAS) with AudioMuxElement(1).
+// Only audioMuxVersion 0 StreamMuxConfig is supported.
+static int es_latm_header_parse(struct es_audio_header *ahdr, uint8_t *d, int len) {
+	struct ts_bits b;
+	if (len < 3 || d[0] != 0x56 || (d[1] &~ 0x1f) != 0xe0)		// 11 bit syncword 0x2b7
+		return 0;
+	uint16_t mux_length = ((d[1] &~ 0xe0) << 8) | d[2];
+	ts_bits_init(&b, d + 3, len - 3 < mux_length ? len - 3 : mux_length);
+	if (ts_bits_get(&b, 1)) { // useSameStreamMux, the config is in some of the previous frames
+		if (!ahdr->sample_rate) // The caller has not passed the previous config
+			return 0;
+		ahdr->frame_size = 3 + mux_length;
+		return 1;
+	}
+	if (ts_bits_get(&b, 1)) // audioMuxVersion
+		return 0;
+	ts_bits_skip(&b, 1); // allStreamsSameTimeFraming
+	uint8_t num_subframes = ts_bits_get(&b, 6) + 1;
+	ts_bits_skip(&b, 4 + 3); // numProgram, numLayer
+	if (!es_aac_audio_specific_config_parse(ahdr, &b))
+		return 0;
+	ahdr->frame_size	= 3 + mux_length;
+	ahdr->samples	   *= num_subframes;
+	return 1;
+}
+
+static const uint16_t ac3_bitrates[19] = {
+	32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 576, 640
+};
+
+// Channels without LFE for AC-3/E-AC-3 acmod
+static const uint8_t ac3_channels[8] = { 2, 1, 2, 3, 3, 4, 4, 5 };
+
+// ATSC A/52 syncinfo and bsi, bsid 0..10 is AC-3, 11..16 is E-AC-3 (Annex E)
+static int es_ac3_header_parse(struct es_audio_header *ahdr, uint8_t *d, int len) {
+	struct ts_bits b;
+	if (len < 8 || d[0] != 0x0b || d[1] != 0x77)
+		return 0;
+	uint8_t bsid = d[5] >> 3;
+	if (bsid <= 10) {
+		uint8_t fscod = d[4] >> 6;
+		uint8_t frmsizecod = d[4] &~ 0xc0;						// xx111111
+		if (fscod == 3 || frmsizecod > 37)
+			return 0;
+		uint16_t kbps = ac3_bitrates[frmsizecod >> 1];
+		uint16_t words;
+		switch (fscod) {
+			case 0: ahdr->sample_rate = 48000; words = kbps * 2; break;
+			case 1: ahdr->sample_rate = 44100; words = kbps * 320 / 147 + (frmsizecod & 1); break;
+			default: ahdr->sample_rate = 32000; words = kbps * 3; break;
+		}
+		ts_bits_init(&b, d + 5, len - 5);
+		ts_bits_skip(&b, 5 + 3); // bsid, bsmod
+		uint8_t acmod = ts_bits_get(&b, 3);
+		if ((acmod & 1) && acmod != 1)
+			ts_bits_skip(&b, 2); // cmixlev
+		if (acmod & 4)
+			ts_bits_skip(&b, 2); // surmixlev
+		if (acmod == 2)
+			ts_bits_skip(&b, 2); // dsurmod
+		ahdr->lfe			= ts_bits_get(&b, 1);
+		ahdr->codec			= CODEC_AC3_AUDIO;
+		ahdr->channels		= ac3_channels[acmod];
+		ahdr->bitrate		= kbps * 1000;
+		ahdr->frame_size	= words * 2;
+		ahdr->samples		= 1536;
+		ahdr->profile		= bsid;
+		return 1;
+	}
+	if (bsid <= 16) {
+		static const uint8_t blocks[4] = { 1, 2, 3, 6 };
+		static const uint32_t sample_rates[4] = { 48000, 44100, 32000, 0 };
+		static const uint32_t reduced_sample_rates[4] = { 24000, 22050, 16000, 0 };
+		ts_bits_init(&b, d + 2, len - 2);
+		ts_bits_skip(&b, 2 + 3); // strmtyp, substreamid
+		uint16_t frmsiz = ts_bits_get(&b, 11);
+		uint8_t fscod = ts_bits_get(&b, 2);
+		uint8_t numblkscod = 3;
+		if (fscod == 3)
+			ahdr->sample_rate = reduced_sample_rates[ts_bits_get(&b, 2)];
+		else {
+			ahdr->sample_rate = sample_rates[fscod];
+			numblkscod = ts_bits_get(&b, 2);
+		}
+		uint8_t acmod = ts_bits_get(&b, 3);
+		ahdr->lfe			= ts_bits_get(&b, 1);
+		if (!ahdr->sample_rate)
+			return 0;
+		ahdr->codec			= CODEC_EAC3_AUDIO;
+		ahdr->channels		= ac3_channels[acmod];
+		ahdr->frame_size	= (frmsiz + 1) * 2;
+		ahdr->samples		= 256 * blocks[numblkscod];
+		ahdr->profile		= bsid;
+		return 1;
+	}
+	return 0;
+}
+
+// ETSI TS 102 114 DTS core frame header
+static int es_dts_header_parse(struct es_audio_header *ahdr, uint8_t *d, int len) {
+	static const uint32_t sample_rates[16] = {
+		0, 8000, 16000, 32000, 0, 0, 11025, 22050, 44100, 0, 0, 12000, 24000, 48000, 0, 0
+	};
+	static const uint8_t channels[16] = { 1, 2, 2, 2, 2, 3, 3, 4, 4, 5, 6, 6, 6, 7, 8, 8 };
+	struct ts_bits b;
+	if (len < 11 || d[0] != 0x7f || d[1] != 0xfe || d[2] != 0x80 || d[3] != 0x01)
+		return 0;
+	ts_bits_init(&b, d + 4, len - 4);
+	ts_bits_skip(&b, 1 + 5 + 1); // FTYPE, SHORT, CPF
+	uint8_t nblks = ts_bits_get(&b, 7);
+	uint16_t fsize = ts_bits_get(&b, 14);
+	uint8_t amode = ts_bits_get(&b, 6);
+	uint8_t sfreq = ts_bits_get(&b, 4);
+	ts_bits_skip(&b, 5 + 1 + 1 + 1 + 1 + 1 + 3 + 1 + 1); // RATE, MIX, DYNF, TIMEF, AUXF, HDCD, EXT_AUDIO_ID, EXT_AUDIO, ASPF
+	uint8_t lff = ts_bits_get(&b, 2);
+	if (b.error || !sample_rates[sfreq] || nblks < 5 || fsize < 95)
+		return 0;
+	ahdr->sample_rate	= sample_rates[sfreq];
+	ahdr->channels		= amode < 16 ? channels[amode] : 0;
+	ahdr->lfe			= lff == 1 || lff == 2;
+	ahdr->frame_size	= fsize + 1;
+	ahdr->samples		= (nblks + 1) * 32;
+	return 1;
+}
+
+// ETSI TS 103 190 AC-4 sync frame and the start of ac4_toc
+static int es_ac4_header_parse(struct es_audio_header *ahdr, uint8_t *d, int len) {
+	// Samples per frame for frame_rate_index, 0 for non integer values
+	static const uint16_t samples[16] = {
+		2002, 2000, 1920, 0, 1600, 1001, 1000, 960, 0, 800, 480, 0, 400, 2048, 0, 0
+	};
+	struct ts_bits b;
+	uint32_t frame_size;
+	int hdr_len = 4;
+	if (len < 4 || d[0] != 0xac || (d[1] != 0x40 && d[1] != 0x41))
+		return 0;
+	frame_size = (d[2] << 8) | d[3];
+	if (frame_size == 0xffff) {
+		if (len < 7)
+			return 0;
+		frame_size = (d[4] << 16) | (d[5] << 8) | d[6];
+		hdr_len = 7;
+	}
+	ts_bits_init(&b, d + hdr_len, len - hdr_len);
+	uint8_t bitstream_version = ts_bits_get(&b, 2);
+	if (bitstream_version == 3) // Extended with variable_bits(2), not used yet
+		return 0;
+	ts_bits_skip(&b, 10); // sequence_counter
+	if (ts_bits_get(&b, 1)) { // b_wait_frames
+		if (ts_bits_get(&b, 3)) // wait_frames
+			ts_bits_skip(&b, 2); // br_code
+	}
+	uint8_t fs_index = ts_bits_get(&b, 1);
+	uint8_t frame_rate_index = ts_bits_get(&b, 4);
+	if (b.error)
+		return 0;
+	ahdr->profile		= bitstream_version;
+	ahdr->sample_rate	= fs_index ? 48000 : 44100;
+	ahdr->channels		= 0; // Signalled in the presentation info
+	ahdr->frame_size	= hdr_len + frame_size + (d[1] == 0x41 ? 2 : 0);
+	ahdr->samples		= fs_index ? samples[frame_rate_index] : (frame_rate_index == 13 ? 2048 : 0);
+	return 1;
+}
+
+// Opus access unit in TS: opus_control_header followed by the Opus packet TOC byte (RFC 6716)
+static int es_opus_header_parse(struct es_audio_header *ahdr, uint8_t *d, int len) {
+	uint32_t au_size = 0;
+	int pos = 2;
+	if (len < 3 || d[0] != 0x7f || (d[1] &~ 0x1f) != 0xe0)		// 11 bit prefix 0x3ff
+		return 0;
+	do {
+		if (pos >= len)
+			return 0;
+		au_size += d[pos];
+	} while (d[pos++] == 0xff);
+	if (bit_on(d[1], bit_5)) // start_trim_flag
+		pos += 2;
+	if (bit_on(d[1], bit_4)) // end_trim_flag
+		pos += 2;
+	if (bit_on(d[1], bit_3)) { // control_extension_flag
+		if (pos >= len)
+			return 0;
+		pos += 1 + d[pos];
+	}
+	if (pos >= len || !au_size)
+		return 0;
+	uint8_t toc = d[pos];
+	uint8_t config = toc >> 3;
+	uint32_t frame_samples;
+	if (config < 12) {			// SILK 10, 20, 40, 60 ms
+		static const uint16_t silk[4] = { 480, 960, 1920, 2880 };
+		frame_samples = silk[config & 3];
+	} else if (config < 16) {	// Hybrid 10, 20 ms
+		frame_samples = config & 1 ? 960 : 480;
+	} else {					// CELT 2.5, 5, 10, 20 ms
+		frame_samples = 120 << (config & 3);
+	}
+	uint8_t frames = 1;
+	switch (toc &~ 0xfc) {
+		case 0: frames = 1; break;
+		case 1:
+		case 2: frames = 2; break;
+		case 3: {
+			if (pos + 1 >= len)
+				return 0;
+			frames = d[pos + 1] &~ 0xc0;						// xx111111
+			break;
+		}
+	}
+	ahdr->sample_rate	= 48000;
+	ahdr->channels		= bit_on(toc, bit_3) ? 2 : 1;
+	ahdr->lfe			= 0;
+	ahdr->frame_size	= pos + au_size;
+	ahdr->samples		= frame_samples * frames;
+	return 1;
+}
+
+typedef int (*es_audio_header_parser)(struct es_audio_header *ahdr, uint8_t *d, int len);
+
+static es_audio_header_parser es_audio_get_parser(enum ts_codec codec) {
+	switch (codec) {
+		case CODEC_AAC_ADTS_AUDIO: return es_adts_header_parse;
+		case CODEC_AAC_LATM_AUDIO: return es_latm_header_parse;
+		case CODEC_AC3_AUDIO:
+		case CODEC_EAC3_AUDIO:     return es_ac3_header_parse;
+		case CODEC_DTS_AUDIO:      return es_dts_header_parse;
+		case CODEC_AC4_AUDIO:      return es_ac4_header_parse;
+		case CODEC_OPUS_AUDIO:     return es_opus_header_parse;
+		default:                   return NULL;
+	}
+}
+
+// Parse the audio frame header at the start of d. LATM frames that reuse the
+// stream mux config take it from prev (can be NULL).
+static int es_audio_frame_header_parse(es_audio_header_parser parse, struct es_audio_header *ahdr, enum ts_codec codec, uint8_t *d, int len, struct es_audio_header *prev) {
+	if (prev && prev->initialized && codec == CODEC_AAC_LATM_AUDIO)
+		*ahdr = *prev;
+	else
+		memset(ahdr, 0, sizeof(struct es_audio_header));
+	ahdr->codec       = codec;
+	ahdr->bitrate     = 0;
+	ahdr->initialized = 0;
+	if (!parse(ahdr, d, len))
+		return 0;
+	if (!ahdr->bitrate && ahdr->samples)
+		ahdr->bitrate = (uint64_t)ahdr->frame_size * 8 * ahdr->sample_rate / ahdr->samples;
+	ahdr->initialized = 1;
+	return 1;
+}
+
+// Find and parse the first audio frame header of codec in data.
+// Returns offset of the frame in data or -1 if no frame header was found.
+int ts_pes_es_audio_header_parse(struct es_audio_header *ahdr, enum ts_codec codec, uint8_t *data, int datasz) {
+	es_audio_header_parser parse = es_audio_get_parser(codec);
+	int i;
+	if (parse) {
+		for (i=0;i<datasz;i++) {
+			if (es_audio_frame_header_parse(parse, ahdr, codec, data + i, datasz - i, NULL))
+				return i;
+		}
+	}
+	memset(ahdr, 0, sizeof(struct es_audio_header));
+	return -1;
+}
+
+void ts_audio_frame_iter_init(struct ts_audio_frame_iter *it, enum ts_codec codec, uint8_t *data, uint32_t size, uint64_t pts) {
+	memset(it, 0, sizeof(struct ts_audio_frame_iter));
+	it->data  = data;
+	it->size  = size;
+	it->codec = codec;
+	it->pts   = pts;
+}
+
+// Get the next audio frame. Returns 0 when there are no more frames.
+// Frames found while searching for sync must be followed by another
+// frame (or the end of data) to be accepted. Skipped bytes are counted
+// in it->skipped.
+int ts_audio_frame_next(struct ts_audio_frame_iter *it, struct ts_audio_frame *frame) {
+	es_audio_header_parser parse = es_audio_get_parser(it->codec);
+	struct es_audio_header next;
+	if (!parse)
+		return 0;
+	while (it->pos < it->size) {
+		uint8_t *d = it->data + it->pos;
+		uint32_t len = it->size - it->pos;
+		if (!es_audio_frame_header_parse(parse, &frame->hdr, it->codec, d, len, &it->last)) {
+			it->locked = 0;
+			it->pos++;
+			it->skipped++;
+			continue;
+		}
+		uint32_t frame_size = frame->hdr.frame_size;
+		if (!it->locked && frame_size < len) {
+			if (!es_audio_frame_header_parse(parse, &next, it->codec, d + frame_size, len - frame_size, &frame->hdr)) {
+				it->pos++; // False sync
+				it->skipped++;
+				continue;
+			}
+		}
+		frame->data      = d;
+		frame->offset    = it->pos;
+		frame->truncated = frame_size > len;
+		frame->size      = frame->truncated ? len : frame_size;
+		frame->pts       = NO_PTS;
+
+		if (it->last.initialized && it->last.sample_rate != frame->hdr.sample_rate) {
+			if (it->last.sample_rate)
+				it->pts_offset += it->samples * 90000 / it->last.sample_rate;
+			it->samples = 0;
+		}
+		if (it->pts != NO_PTS)
+			frame->pts = (it->pts + it->pts_offset + it->samples * 90000 / frame->hdr.sample_rate) & (TS_TIMESTAMP_WRAP - 1);
+		if (!frame->hdr.samples) // Unknown frame duration, the following PTS can not be interpolated
+			it->pts = NO_PTS;
+		it->samples += frame->hdr.samples;
+
+		it->last   = frame->hdr;
+		it->locked = 1;
+		it->pos   += frame->size;
+		it->frames++;
+		return 1;
+	}
+	return 0;
+}
+
+// Returns the codec of the audio frames in PES or CODEC_UNKNOWN
+enum ts_codec ts_pes_es_audio_codec(struct ts_pes *pes) {
+	if (!pes->is_audio)			return CODEC_UNKNOWN;
+	if (pes->is_audio_latm)		return CODEC_AAC_LATM_AUDIO;
+	if (pes->is_audio_aac)		return CODEC_AAC_ADTS_AUDIO;
+	if (pes->is_audio_eac3)		return CODEC_EAC3_AUDIO;
+	if (pes->is_audio_ac3)		return CODEC_AC3_AUDIO;
+	if (pes->is_audio_ac4)		return CODEC_AC4_AUDIO;
+	if (pes->is_audio_dts)		return CODEC_DTS_AUDIO;
+	if (pes->is_audio_opus)		return CODEC_OPUS_AUDIO;
+	return CODEC_UNKNOWN;
+}
+
+// Iterate over the audio frames in PES elementary stream data. Returns 0
+// if the PES does not carry audio with known frame format.
+int ts_pes_es_audio_frame_iter_init(struct ts_audio_frame_iter *it, struct ts_pes *pes) {
+	enum ts_codec codec = ts_pes_es_audio_codec(pes);
+	if (codec == CODEC_UNKNOWN || !pes->es_data)
+		return 0;
+	if (pes->es_data_chunk_size < pes->es_data_size)
+		ts_pes_linearize(pes);
+	ts_audio_frame_iter_init(it, codec, pes->es_data, pes->es_data_size, pes->have_pts ? pes->PTS : NO_PTS);
+	return 1;
+}
+
+void ts_pes_es_audio_header_dump(struct es_audio_header *ahdr) {
+	static const char *codecs[] = {
+		[CODEC_AAC_ADTS_AUDIO]	= "AAC ADTS",
+		[CODEC_AAC_LATM_AUDIO]	= "AAC LATM",
+		[CODEC_AC3_AUDIO]		= "AC-3",
+		[CODEC_EAC3_AUDIO]		= "E-AC-3",
+		[CODEC_AC4_AUDIO]		= "AC-4",
+		[CODEC_DTS_AUDIO]		= "DTS",
+		[CODEC_OPUS_AUDIO]		= "Opus",
+	};
+	if (!ahdr->initialized)
+		return;
+	ts_LOGf("  - ES analyze audio frame\n");
+	ts_LOGf("    - Codec         : %s profile:%d\n", codecs[ahdr->codec] ? codecs[ahdr->codec] : "unknown", ahdr->profile);
+	ts_LOGf("    - Sample rate   : %u Hz channels:%d%s\n", ahdr->sample_rate, ahdr->channels, ahdr->lfe ? "+LFE" : "");
+	ts_LOGf("    - Frame         : %u bytes %u samples bitrate:%u bit/s\n", ahdr->frame_size, ahdr->samples, ahdr->bitrate);
+}
+
 void ts_pes_es_parse(struct ts_pes *pes) {
 	if (!pes->es_data)
 		return;
 
+	// The parsers need contiguous ES data
+	if (pes->es_data_chunk_size < pes->es_data_size)
+		ts_pes_linearize(pes);
+
 	// Parse MPEG audio packet header
 	if ((pes->is_audio_mpeg1 || pes->is_audio_mpeg2) && pes->es_data_size > 4) {
 		struct mpeg_audio_header mpghdr;
@@ -128,10 +650,50 @@ void ts_pes_es_parse(struct ts_pes *pes) {
 			pes->is_audio_dts = 1;
 		}
 	}
+
+	// Parse ADTS, LATM, AC-3, E-AC-3, AC-4, DTS and Opus frame header
+	enum ts_codec audio_codec = ts_pes_es_audio_codec(pes);
+	if (audio_codec != CODEC_UNKNOWN)
+		ts_pes_es_audio_header_parse(&pes->audio_header, audio_codec, pes->es_data, pes->es_data_size);
+
+	// Look into video elementary stream for random access points and sequence parameters
+	if (pes->is_video_h264 || pes->is_video_hevc) {
+		enum ts_nal_codec codec = pes->is_video_hevc ? NAL_CODEC_HEVC : NAL_CODEC_AVC;
+		struct ts_nal_iter it;
+		struct ts_nal nal;
+		ts_nal_iter_init(&it, pes->es_data, pes->es_data_size, codec);
+		while (ts_nal_next(&it, &nal)) {
+			if (nal.is_sps && !pes->video_sps.initialized)
+				ts_nal_parse_sps(&nal, codec, &pes->video_sps);
+			if (nal.is_vcl) {
+				pes->is_rap = nal.is_rap;
+				break;
+			}
+		}
+	}
+
+	// Parse MPEG video sequence, GOP and picture headers
+	if (pes->is_video_mpeg1 || pes->is_video_mpeg2) {
+		struct mpeg_video_header vhdr;
+		memset(&vhdr, 0, sizeof(struct mpeg_video_header));
+		if (ts_pes_es_mpeg_video_header_parse(&vhdr, pes->es_data, pes->es_data_size)) {
+			pes->mpeg_video_header = vhdr;
+			pes->is_rap = vhdr.have_picture && vhdr.picture_coding_type == 1;
+		}
+	}
 }
 
 void ts_pes_es_dump(struct ts_pes *pes) {
 	if (pes->is_audio && pes->mpeg_audio_header.initialized) {
 		ts_pes_es_mpeg_audio_header_dump(&pes->mpeg_audio_header);
 	}
+	if (pes->is_video && pes->mpeg_video_header.initialized) {
+		ts_pes_es_mpeg_video_header_dump(&pes->mpeg_video_header);
+	}
+	if (pes->is_audio && pes->audio_header.initialized) {
+		ts_pes_es_audio_header_dump(&pes->audio_header);
+	}
+	if (pes->is_video && pes->video_sps.initialized) {
+		ts_nal_sps_dump(&pes->video_sps);
+	}
 }
@@ -166,8 +166,9 @@ int ts_pmt_parse(struct ts_pmt *pmt) {
 	return 1;
 }
 
-void ts_pmt_generate(struct ts_pmt *pmt, uint8_t **ts_packets, int *num_packets) {
-	uint8_t *secdata = ts_section_data_alloc_section();
+// Generate PMT packets into ts_packets buffer (must be at least 5120 bytes)
+void ts_pmt_generate_buf(struct ts_pmt *pmt, uint8_t *ts_packets, int *num_packets) {
+	uint8_t secdata[4096];
 	ts_section_header_generate(secdata, pmt->section_header, 0);
 	int curpos = 8; // Compensate for the section header, frist data byte is at offset 8
 
@@ -207,9 +208,12 @@ void ts_pmt_generate(struct ts_pmt *pmt, uint8_t **ts_packets, int *num_packets)
     pmt->section_header->CRC = ts_section_data_calculate_crc(secdata, curpos);
     curpos += 4; // CRC
 
-    ts_section_data_gen_ts_packets(&pmt->ts_header, secdata, curpos, pmt->section_header->pointer_field, ts_packets, num_packets);
+    ts_section_data_gen_ts_packets_buf(&pmt->ts_header, secdata, curpos, pmt->section_header->pointer_field, ts_packets, num_packets);
+}
 
-    FREE(secdata);
+void ts_pmt_generate(struct ts_pmt *pmt, uint8_t **ts_packets, int *num_packets) {
+	*ts_packets = ts_section_data_alloc_packet();
+	ts_pmt_generate_buf(pmt, *ts_packets, num_packets);
 }
 
 void ts_pmt_regenerate_packets(struct ts_pmt *pmt) {
@@ -0,0 +1,206 @@
+/*
+ * PMT descriptor generator
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsfuncs.h"
+
+#define PMT_MAX_SECTION_LENGTH 1021
+
+static void ts_pmt_regenerate_packet_data(struct ts_pmt *pmt) {
+	if (pmt->update_deferred) // Packets are generated by ts_pmt_commit()
+		return;
+	ts_pmt_generate_buf(pmt, pmt->section_header->packet_data, &pmt->section_header->num_packets);
+}
+
+// Increment the version once per update and regenerate the packets
+static void ts_pmt_changed(struct ts_pmt *pmt) {
+	if (!pmt->version_changed)
+		pmt->section_header->version_number++;
+	if (pmt->update_deferred) {
+		pmt->version_changed = 1;
+		return;
+	}
+	ts_pmt_regenerate_packet_data(pmt);
+}
+
+// Batch several changes and generate the packets only once in ts_pmt_commit()
+void ts_pmt_begin_update(struct ts_pmt *pmt) {
+	pmt->update_deferred = 1;
+	pmt->version_changed = 0;
+}
+
+void ts_pmt_commit(struct ts_pmt *pmt) {
+	pmt->update_deferred = 0;
+	pmt->version_changed = 0;
+	ts_pmt_regenerate_packet_data(pmt);
+}
+
+struct ts_pmt *ts_pmt_init(struct ts_pmt *pmt, uint16_t program_number, uint16_t pmt_pid, uint16_t pcr_pid) {
+	pmt->ts_header.pid            = pmt_pid;
+	pmt->ts_header.pusi           = 1;
+	pmt->ts_header.payload_field  = 1;
+	pmt->ts_header.payload_offset = 4;
+
+	pmt->section_header->table_id                 = 0x02;
+	pmt->section_header->version_number           = 1;
+	pmt->section_header->current_next_indicator   = 1;
+	pmt->section_header->section_syntax_indicator = 1;
+	pmt->section_header->private_indicator        = 0;
+	pmt->section_header->section_length           = 9 + 4;	// Empty section (9) + 4 (3+13+4+12 bits) for PMT table data
+	pmt->section_header->ts_id_number             = program_number;
+	pmt->section_header->reserved1                = 3;
+	pmt->section_header->reserved2                = 3;
+
+	pmt->reserved1         = 7;			// 3 bits
+	pmt->PCR_pid           = pcr_pid;	// 13 bits
+	pmt->reserved2         = 0xf;		// 4 bits
+	pmt->program_info_size = 0;			// 12 bits
+	pmt->program_info      = NULL;
+
+	pmt->streams_num = 0;
+
+	pmt->initialized = 1;
+
+	ts_pmt_regenerate_packet_data(pmt);
+
+	return pmt;
+}
+
+struct ts_pmt *ts_pmt_alloc_init(uint16_t program_number, uint16_t pmt_pid, uint16_t pcr_pid) {
+	struct ts_pmt *pmt = ts_pmt_alloc();
+	if (!pmt)
+		return NULL;
+	return ts_pmt_init(pmt, program_number, pmt_pid, pcr_pid);
+}
+
+int ts_pmt_set_pcr_pid(struct ts_pmt *pmt, uint16_t pcr_pid) {
+	if (pmt->PCR_pid == pcr_pid)
+		return 1;
+	pmt->PCR_pid = pcr_pid;
+	ts_pmt_changed(pmt);
+	return 1;
+}
+
+static struct ts_pmt_stream *ts_pmt_find_stream(struct ts_pmt *pmt, uint16_t pid) {
+	int i;
+	for (i=0;i<pmt->streams_num;i++) {
+		if (pmt->streams[i]->pid == pid)
+			return pmt->streams[i];
+	}
+	return NULL;
+}
+
+static int ts_pmt_has_space(struct ts_pmt *pmt, int size) {
+	if (pmt->section_header->section_length + size > PMT_MAX_SECTION_LENGTH) {
+		ts_LOGf("PMT no space left, max %d, current %d will become %d!\n",
+			PMT_MAX_SECTION_LENGTH,
+			pmt->section_header->section_length,
+			pmt->section_header->section_length + size);
+		return 0;
+	}
+	return 1;
+}
+
+// desc must contain whole descriptor(s) including tag and length bytes
+int ts_pmt_add_program_descriptor(struct ts_pmt *pmt, uint8_t *desc, int desc_size) {
+	if (!desc || desc_size <= 0)
+		return 0;
+	if (!ts_pmt_has_space(pmt, desc_size))
+		return 0;
+
+	pmt->program_info = realloc(pmt->program_info, pmt->program_info_size + desc_size);
+	memcpy(pmt->program_info + pmt->program_info_size, desc, desc_size);
+	pmt->program_info_size += desc_size;
+	pmt->section_header->section_length += desc_size;
+
+	ts_pmt_changed(pmt);
+	return 1;
+}
+
+int ts_pmt_add_stream(struct ts_pmt *pmt, uint8_t stream_type, uint16_t pid) {
+	if (pmt->streams_num == pmt->streams_max)
+		return 0;
+
+	if (ts_pmt_find_stream(pmt, pid)) {
+		ts_LOGf("!!! Stream with pid 0x%04x (%d) already exists in PMT!\n", pid, pid);
+		return 0;
+	}
+	if (!ts_pmt_has_space(pmt, 5))
+		return 0;
+
+	struct ts_pmt_stream *sinfo = calloc(1, sizeof(struct ts_pmt_stream));
+	sinfo->stream_type  = stream_type;
+	sinfo->reserved1    = 7;		// 3 bits
+	sinfo->pid          = pid;		// 13 bits
+	sinfo->reserved2    = 0xf;		// 4 bits
+	sinfo->ES_info_size = 0;		// 12 bits
+	sinfo->ES_info      = NULL;
+
+	pmt->streams[pmt->streams_num] = sinfo;
+	pmt->streams_num++;
+	pmt->section_header->section_length += 5;
+
+	ts_pmt_changed(pmt);
+	return 1;
+}
+
+// desc must contain whole descriptor(s) including tag and length bytes
+int ts_pmt_add_es_descriptor(struct ts_pmt *pmt, uint16_t pid, uint8_t *desc, int desc_size) {
+	if (!desc || desc_size <= 0)
+		return 0;
+	struct ts_pmt_stream *sinfo = ts_pmt_find_stream(pmt, pid);
+	if (!sinfo) {
+		ts_LOGf("!!! Stream with pid 0x%04x (%d) does not exist in PMT!\n", pid, pid);
+		return 0;
+	}
+	if (!ts_pmt_has_space(pmt, desc_size))
+		return 0;
+
+	sinfo->ES_info = realloc(sinfo->ES_info, sinfo->ES_info_size + desc_size);
+	memcpy(sinfo->ES_info + sinfo->ES_info_size, desc, desc_size);
+	sinfo->ES_info_size += desc_size;
+	pmt->section_header->section_length += desc_size;
+
+	ts_pmt_changed(pmt);
+	return 1;
+}
+
+int ts_pmt_del_stream(struct ts_pmt *pmt, uint16_t pid) {
+	int i;
+	for (i=0;i<pmt->streams_num;i++) {
+		struct ts_pmt_stream *sinfo = pmt->streams[i];
+		if (sinfo->pid != pid)
+			continue;
+		pmt->section_header->section_length -= 5 + sinfo->ES_info_size;
+		FREE(sinfo->ES_info);
+		FREE(sinfo);
+		for (;i+1<pmt->streams_num;i++) {
+			pmt->streams[i] = pmt->streams[i+1];
+		}
+		pmt->streams_num--;
+		ts_pmt_changed(pmt);
+		return 1;
+	}
+	return 0;
+}
+
+int ts_pmt_add_ca_descriptor(struct ts_pmt *pmt, uint16_t CA_id, uint16_t CA_pid) {
+	uint8_t desc[6];
+	ts_descriptor_gen_ca(desc, CA_id, CA_pid);
+	return ts_pmt_add_program_descriptor(pmt, desc, sizeof(desc));
+}
+
+int ts_pmt_add_es_ca_descriptor(struct ts_pmt *pmt, uint16_t pid, uint16_t CA_id, uint16_t CA_pid) {
+	uint8_t desc[6];
+	ts_descriptor_gen_ca(desc, CA_id, CA_pid);
+	return ts_pmt_add_es_descriptor(pmt, pid, desc, sizeof(desc));
+}
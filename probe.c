@@ -0,0 +1,251 @@
+/*
+ * TS file duration and bitrate probe
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "tsfuncs.h"
+
+// Find the first offset with three TS packets in a row
+static int ts_probe_find_sync(uint8_t *buf, int len) {
+	int i;
+	for (i=0;i<TS_PACKET_SIZE && i<len;i++) {
+		if (buf[i] != 0x47)
+			continue;
+		if (i + TS_PACKET_SIZE < len && buf[i + TS_PACKET_SIZE] != 0x47)
+			continue;
+		if (i + TS_PACKET_SIZE * 2 < len && buf[i + TS_PACKET_SIZE * 2] != 0x47)
+			continue;
+		return i;
+	}
+	return -1;
+}
+
+// Feed the file data between offset and end into the timestamps tracker
+static void ts_probe_scan(int fd, uint64_t offset, uint64_t end, uint8_t *buf, int buf_size, struct ts_times *t, struct ts_probe *probe) {
+	while (offset < end) {
+		int len = end - offset < (uint64_t)buf_size ? (int)(end - offset) : buf_size;
+		ssize_t readen = pread(fd, buf, len, offset);
+		if (readen <= 0)
+			break;
+		probe->bytes_read += readen;
+		int sync = ts_probe_find_sync(buf, readen);
+		if (sync < 0) {
+			offset += readen;
+			continue;
+		}
+		int packets = (readen - sync) / TS_PACKET_SIZE;
+		if (!packets)
+			break;
+		ts_times_push_packets(t, buf + sync, packets);
+		offset += sync + packets * TS_PACKET_SIZE;
+	}
+}
+
+static struct ts_timestamp *ts_probe_timestamp(struct ts_pid_times *pt, int use_pcr) {
+	if (!pt)
+		return NULL;
+	struct ts_timestamp *ts = use_pcr ? &pt->pcr : &pt->pts;
+	return ts->count ? ts : NULL;
+}
+
+// Select the PID used for the duration, PCR is preferred. Returns -1 if there is none.
+static int ts_probe_time_pid(struct ts_times *head, struct ts_times *tail, int *use_pcr) {
+	int i;
+	for (*use_pcr=1;*use_pcr>=0;(*use_pcr)--) {
+		for (i=0;i<head->pids_num;i++) {
+			struct ts_pid_times *pt = head->pids[i];
+			if (ts_probe_timestamp(pt, *use_pcr) && ts_probe_timestamp(ts_times_get_pid(tail, pt->pid), *use_pcr))
+				return pt->pid;
+		}
+	}
+	return -1;
+}
+
+static struct ts_probe_pid *ts_probe_add_pid(struct ts_probe *probe, uint16_t pid) {
+	int i;
+	for (i=0;i<probe->pids_num;i++) {
+		if (probe->pids[i].pid == pid)
+			return &probe->pids[i];
+	}
+	probe->pids = realloc(probe->pids, (probe->pids_num + 1) * sizeof(struct ts_probe_pid));
+	struct ts_probe_pid *ppid = &probe->pids[probe->pids_num++];
+	ppid->pid       = pid;
+	ppid->first_pts = NO_PTS;
+	ppid->last_pts  = NO_PTS;
+	ppid->first_pcr = NO_PCR;
+	ppid->last_pcr  = NO_PCR;
+	return ppid;
+}
+
+// First values are taken from head, last values from tail (head and tail can be the same)
+static void ts_probe_fill_pids(struct ts_probe *probe, struct ts_times *head, struct ts_times *tail) {
+	int i;
+	for (i=0;i<head->pids_num;i++) {
+		struct ts_pid_times *pt = head->pids[i];
+		struct ts_probe_pid *ppid = ts_probe_add_pid(probe, pt->pid);
+		if (pt->pts.count) {
+			ppid->first_pts = pt->pts.first_raw;
+			ppid->last_pts  = pt->pts.last_raw;
+		}
+		if (pt->pcr.count) {
+			ppid->first_pcr = pt->first_pcr;
+			ppid->last_pcr  = pt->last_pcr;
+		}
+	}
+	if (tail == head)
+		return;
+	for (i=0;i<tail->pids_num;i++) {
+		struct ts_pid_times *pt = tail->pids[i];
+		struct ts_probe_pid *ppid = ts_probe_add_pid(probe, pt->pid);
+		if (pt->pts.count) {
+			if (ppid->first_pts == NO_PTS)
+				ppid->first_pts = pt->pts.first_raw;
+			ppid->last_pts = pt->pts.last_raw;
+		}
+		if (pt->pcr.count) {
+			if (ppid->first_pcr == NO_PCR)
+				ppid->first_pcr = pt->first_pcr;
+			ppid->last_pcr = pt->last_pcr;
+		}
+	}
+}
+
+// Duration from the head and tail windows, returns 0 if full scan is needed
+static int ts_probe_head_tail(struct ts_probe *probe, struct ts_times *head, struct ts_times *tail, uint64_t head_bytes) {
+	int use_pcr;
+	int pid = ts_probe_time_pid(head, tail, &use_pcr);
+	if (pid < 0)
+		return 0;
+	struct ts_timestamp *first = ts_probe_timestamp(ts_times_get_pid(head, pid), use_pcr);
+	struct ts_timestamp *last  = ts_probe_timestamp(ts_times_get_pid(tail, pid), use_pcr);
+	// Discontinuity inside of the windows, the time between them is unknown
+	if (first->discontinuities || last->discontinuities)
+		return 0;
+
+	uint64_t duration = (last->last_raw - first->first_raw) & (TS_TIMESTAMP_WRAP - 1);
+
+	// Compare with the duration estimated from the head bitrate to catch
+	// discontinuities and multiple wraps between the windows.
+	uint64_t head_duration = first->max - first->min;
+	if (head_duration >= 90000 / 10) {
+		uint64_t estimate = probe->file_size * head_duration / head_bytes;
+		if (duration < estimate / 2 || duration > estimate * 2)
+			return 0;
+	}
+
+	probe->time_pid      = pid;
+	probe->time_from_pcr = use_pcr;
+	probe->duration      = duration;
+	return 1;
+}
+
+static int ts_probe_full_scan(struct ts_probe *probe, struct ts_times *t) {
+	int use_pcr;
+	int pid = ts_probe_time_pid(t, t, &use_pcr);
+	probe->full_scan = 1;
+	if (pid < 0)
+		return 0;
+	probe->time_pid      = pid;
+	probe->time_from_pcr = use_pcr;
+	probe->duration      = ts_timestamp_duration(ts_probe_timestamp(ts_times_get_pid(t, pid), use_pcr));
+	return 1;
+}
+
+// Probe opened TS file. Only window_size bytes from the start and from the end of
+// the file are read, unless the timestamps are discontinuous.
+// window_size 0 means TS_PROBE_WINDOW. Returns NULL on error.
+struct ts_probe *ts_probe_fd(int fd, uint32_t window_size) {
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	if (!window_size)
+		window_size = TS_PROBE_WINDOW;
+	if (window_size < TS_PACKET_SIZE * 16)
+		window_size = TS_PACKET_SIZE * 16;
+
+	struct ts_probe *probe = calloc(1, sizeof(struct ts_probe));
+	uint8_t *buf = malloc(window_size);
+	if (!probe || !buf) {
+		FREE(buf);
+		FREE(probe);
+		return NULL;
+	}
+	probe->file_size = st.st_size;
+
+	struct ts_times *head = ts_times_alloc();
+	struct ts_times *tail = NULL;
+	int ok = 0;
+
+	if (probe->file_size > (uint64_t)window_size * 2) {
+		tail = ts_times_alloc();
+		ts_probe_scan(fd, 0, window_size, buf, window_size, head, probe);
+		ts_probe_scan(fd, probe->file_size - window_size, probe->file_size, buf, window_size, tail, probe);
+		ok = ts_probe_head_tail(probe, head, tail, window_size);
+		if (ok) {
+			ts_probe_fill_pids(probe, head, tail);
+		} else {
+			ts_times_free(&head);
+			ts_times_free(&tail);
+			head = ts_times_alloc();
+		}
+	}
+
+	if (!ok) {
+		ts_probe_scan(fd, 0, probe->file_size, buf, window_size, head, probe);
+		ts_probe_full_scan(probe, head);
+		ts_probe_fill_pids(probe, head, head);
+	}
+
+	if (probe->duration)
+		probe->bitrate = probe->file_size * 8 * 90000 / probe->duration;
+
+	ts_times_free(&head);
+	ts_times_free(&tail);
+	FREE(buf);
+	return probe;
+}
+
+struct ts_probe *ts_probe_file(char *filename, uint32_t window_size) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct ts_probe *probe = ts_probe_fd(fd, window_size);
+	close(fd);
+	return probe;
+}
+
+void ts_probe_free(struct ts_probe **pprobe) {
+	struct ts_probe *probe = *pprobe;
+	if (probe) {
+		FREE(probe->pids);
+		FREE(*pprobe);
+	}
+}
+
+void ts_probe_dump(struct ts_probe *probe) {
+	int i;
+	ts_LOGf("TS probe\n");
+	ts_LOGf("  * File size  : %"PRIu64" (read %"PRIu64"%s)\n", probe->file_size, probe->bytes_read, probe->full_scan ? ", full scan" : "");
+	ts_LOGf("  * Duration   : %"PRIu64" ms (from %s on PID %03x)\n", probe->duration / 90, probe->time_from_pcr ? "PCR" : "PTS", probe->time_pid);
+	ts_LOGf("  * Bitrate    : %u\n", probe->bitrate);
+	for (i=0;i<probe->pids_num;i++) {
+		struct ts_probe_pid *ppid = &probe->pids[i];
+		char pts[64] = "", pcr[64] = "";
+		if (ppid->first_pts != NO_PTS)
+			snprintf(pts, sizeof(pts), " PTS %"PRIu64"..%"PRIu64, ppid->first_pts, ppid->last_pts);
+		if (ppid->first_pcr != NO_PCR)
+			snprintf(pcr, sizeof(pcr), " PCR %"PRIu64"..%"PRIu64, ppid->first_pcr, ppid->last_pcr);
+		ts_LOGf("    * PID %04x (%d)%s%s\n", ppid->pid, ppid->pid, pts, pcr);
+	}
+}
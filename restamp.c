@@ -0,0 +1,108 @@
+/*
+ * PCR restamping
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsfuncs.h"
+
+#define TS_BITS_PER_PACKET (TS_PACKET_SIZE * 8)
+
+struct ts_pcr_restamp *ts_pcr_restamp_alloc(uint32_t bitrate) {
+	struct ts_pcr_restamp *r = calloc(1, sizeof(struct ts_pcr_restamp));
+	if (!r)
+		return NULL;
+	ts_pcr_restamp_set_bitrate(r, bitrate);
+	return r;
+}
+
+void ts_pcr_restamp_free(struct ts_pcr_restamp **pr) {
+	struct ts_pcr_restamp *r = *pr;
+	if (r) {
+		FREE(r->pids);
+		FREE(*pr);
+	}
+}
+
+// The output clock continues from the current packet with the new bitrate
+void ts_pcr_restamp_set_bitrate(struct ts_pcr_restamp *r, uint32_t bitrate) {
+	if (!bitrate)
+		bitrate = 1;
+	uint64_t ticks = (uint64_t)TS_BITS_PER_PACKET * 27000000;
+	r->bitrate  = bitrate;
+	r->step     = ticks / bitrate;
+	r->step_rem = ticks % bitrate;
+	r->rem      = 0;
+}
+
+static struct ts_pcr_restamp_pid *ts_pcr_restamp_get_pid(struct ts_pcr_restamp *r, uint16_t pid) {
+	int i;
+	for (i=0;i<r->pids_num;i++) {
+		if (r->pids[i].pid == pid)
+			return &r->pids[i];
+	}
+	return NULL;
+}
+
+static struct ts_pcr_restamp_pid *ts_pcr_restamp_add_pid(struct ts_pcr_restamp *r, uint16_t pid) {
+	struct ts_pcr_restamp_pid *rpid = realloc(r->pids, (r->pids_num + 1) * sizeof(struct ts_pcr_restamp_pid));
+	if (!rpid)
+		return NULL;
+	r->pids = rpid;
+	rpid = &r->pids[r->pids_num++];
+	rpid->pid    = pid;
+	rpid->offset = 0;
+	return rpid;
+}
+
+// Rewrite PCR values in num_packets consecutive output TS packets from
+// their position in the output and the output bitrate. Every PCR PID keeps
+// its own time base: the first PCR of a PID (and PCR with
+// discontinuity_indicator) is left unchanged and sets the PID offset
+// against the output clock. Returns the number of rewritten PCR values.
+int ts_pcr_restamp_packets(struct ts_pcr_restamp *r, uint8_t *ts_packets, int num_packets) {
+	int i, restamped = 0;
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (ts_packet_has_pcr(ts_packet)) {
+			uint16_t pid = ts_packet_get_pid(ts_packet);
+			struct ts_pcr_restamp_pid *rpid = ts_pcr_restamp_get_pid(r, pid);
+			if (!rpid || ts_packet_has_discontinuity(ts_packet)) {
+				if (!rpid)
+					rpid = ts_pcr_restamp_add_pid(r, pid);
+				if (rpid)
+					rpid->offset = (ts_packet_get_pcr(ts_packet) + TS_CLOCK_PCR_WRAP - r->clock) % TS_CLOCK_PCR_WRAP;
+			} else {
+				uint64_t pcr = (r->clock + rpid->offset) % TS_CLOCK_PCR_WRAP;
+				ts_packet_set_pcr_ex(ts_packet, pcr / 300, pcr % 300);
+				restamped++;
+			}
+		}
+		// Advance the output clock by one packet
+		r->clock += r->step;
+		r->rem   += r->step_rem;
+		if (r->rem >= r->bitrate) {
+			r->rem -= r->bitrate;
+			r->clock++;
+		}
+		r->clock %= TS_CLOCK_PCR_WRAP;
+		r->packets++;
+	}
+	r->restamped += restamped;
+	return restamped;
+}
+
+void ts_pcr_restamp_dump(struct ts_pcr_restamp *r) {
+	int i;
+	ts_LOGf("*** PCR restamp bitrate:%u packets:%"PRIu64" restamped:%u clock:%"PRIu64"\n",
+		r->bitrate, r->packets, r->restamped, r->clock);
+	for (i=0;i<r->pids_num;i++) {
+		ts_LOGf("    * PID %04x offset:%"PRIu64"\n", r->pids[i].pid, r->pids[i].offset);
+	}
+}
@@ -86,11 +86,10 @@ uint32_t ts_section_data_calculate_crc(uint8_t *section_data, int secdata_size)
 
 #define min(a,b) ((a < b) ? a : b)
 
-// Returns alllocated and build ts packets in *packets "ts_header"
+// Builds ts packets in packets buffer which must have room for the whole section (5120 bytes)
 // Returns number of packets in *num_packets
-void ts_section_data_gen_ts_packets(struct ts_header *ts_header, uint8_t *section_data, int section_data_sz, uint8_t pointer_field, uint8_t **packets, int *num_packets) {
+void ts_section_data_gen_ts_packets_buf(struct ts_header *ts_header, uint8_t *section_data, int section_data_sz, uint8_t pointer_field, uint8_t *packets, int *num_packets) {
 	struct ts_header tshdr = *ts_header;
-	*packets = ts_section_data_alloc_packet();
 	int np = 1; // Minimum 1 TS packet
 	int section_sz = section_data_sz; // Add 4 bytes CRC!
 	int sect = section_sz - (TS_PACKET_SIZE - 5);
@@ -102,7 +101,7 @@ void ts_section_data_gen_ts_packets(struct ts_header *ts_header, uint8_t *sectio
 	*num_packets = np;
 	int dataofs;
 	for (i=0;i<np;i++) {
-		uint8_t *curpacket = *packets + (i * TS_PACKET_SIZE);	// Start of the current packet
+		uint8_t *curpacket = packets + (i * TS_PACKET_SIZE);	// Start of the current packet
 
 		dataofs = 4; // Start after the TS header
 		if (i == 0) { // First packet have pointer field
@@ -134,6 +133,13 @@ void ts_section_data_gen_ts_packets(struct ts_header *ts_header, uint8_t *sectio
 	}
 }
 
+// Returns alllocated and build ts packets in *packets "ts_header"
+// Returns number of packets in *num_packets
+void ts_section_data_gen_ts_packets(struct ts_header *ts_header, uint8_t *section_data, int section_data_sz, uint8_t pointer_field, uint8_t **packets, int *num_packets) {
+	*packets = ts_section_data_alloc_packet();
+	ts_section_data_gen_ts_packets_buf(ts_header, section_data, section_data_sz, pointer_field, *packets, num_packets);
+}
+
 void ts_section_add_packet(struct ts_section_header *sec, struct ts_header *ts_header, uint8_t *ts_packet) {
 	uint8_t payload_offset = ts_header->payload_offset;
 	if (!sec->section_length)
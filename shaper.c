@@ -0,0 +1,132 @@
+/*
+ * CBR output shaper
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsfuncs.h"
+
+#define TS_BITS_PER_PACKET (TS_PACKET_SIZE * 8)
+
+// Shape to bitrate with a buffer of buffer_size packets. Returns NULL on error.
+struct ts_shaper *ts_shaper_alloc(uint32_t bitrate, int buffer_size) {
+	if (buffer_size <= 0)
+		return NULL;
+	struct ts_shaper *s = calloc(1, sizeof(struct ts_shaper));
+	if (!s)
+		return NULL;
+	s->buffer      = malloc(buffer_size * TS_PACKET_SIZE);
+	s->buffer_size = buffer_size;
+	s->restamp     = ts_pcr_restamp_alloc(bitrate);
+	if (!s->buffer || !s->restamp) {
+		ts_shaper_free(&s);
+		return NULL;
+	}
+	ts_shaper_set_bitrate(s, bitrate);
+	return s;
+}
+
+void ts_shaper_free(struct ts_shaper **ps) {
+	struct ts_shaper *s = *ps;
+	if (s) {
+		ts_pcr_restamp_free(&s->restamp);
+		FREE(s->buffer);
+		FREE(*ps);
+	}
+}
+
+// The next ts_shaper_tick starts new time base with the new bitrate
+void ts_shaper_set_bitrate(struct ts_shaper *s, uint32_t bitrate) {
+	if (!bitrate)
+		bitrate = 1;
+	s->bitrate    = bitrate;
+	s->start_time = TS_CLOCK_NO_TIME;
+	ts_pcr_restamp_set_bitrate(s->restamp, bitrate);
+}
+
+// Add VBR input packets to the buffer. Null packets are removed, the output
+// stuffing replaces them. Packets that do not fit in the buffer are dropped.
+// Returns the number of buffered packets.
+int ts_shaper_push_packets(struct ts_shaper *s, uint8_t *ts_packets, int num_packets) {
+	int i, buffered = 0;
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		s->packets_in++;
+		if (ts_packet_get_pid(ts_packet) == NULL_PID) {
+			s->null_in++;
+			continue;
+		}
+		if (s->fill == s->buffer_size) {
+			s->dropped++;
+			continue;
+		}
+		memcpy(s->buffer + ((s->head + s->fill) % s->buffer_size) * TS_PACKET_SIZE, ts_packet, TS_PACKET_SIZE);
+		s->fill++;
+		if (s->fill > s->fill_max)
+			s->fill_max = s->fill;
+		buffered++;
+	}
+	return buffered;
+}
+
+// Fill out_packets with exactly num_packets output packets, buffered packets
+// first and null packets when the buffer is empty. PCR values are restamped
+// from the position in the output. Returns the number of null packets.
+int ts_shaper_get_packets(struct ts_shaper *s, uint8_t *out_packets, int num_packets) {
+	int i, null_packets = 0;
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = out_packets + i * TS_PACKET_SIZE;
+		s->fill_sum += s->fill;
+		if (s->fill) {
+			memcpy(ts_packet, s->buffer + s->head * TS_PACKET_SIZE, TS_PACKET_SIZE);
+			s->head = (s->head + 1) % s->buffer_size;
+			s->fill--;
+			s->sending = 1;
+			continue;
+		}
+		if (s->sending)
+			s->underflows++;
+		s->sending = 0;
+		ts_packet_init_null(ts_packet);
+		null_packets++;
+	}
+	ts_pcr_restamp_packets(s->restamp, out_packets, num_packets);
+	s->packets_out += num_packets;
+	s->null_out    += null_packets;
+	return null_packets;
+}
+
+// Get the output packets that are due at now_us (microseconds) according to
+// the bitrate. The first call sets the time base. If more than max_out packets
+// are due, the rest is sent on the next call. Returns the number of packets
+// in out_packets.
+int ts_shaper_tick(struct ts_shaper *s, uint64_t now_us, uint8_t *out_packets, int max_out) {
+	if (s->start_time == TS_CLOCK_NO_TIME) {
+		s->start_time    = now_us;
+		s->start_packets = s->packets_out;
+	}
+	uint64_t elapsed = now_us > s->start_time ? now_us - s->start_time : 0;
+	uint64_t bits = (elapsed / 1000000) * s->bitrate + (elapsed % 1000000) * s->bitrate / 1000000;
+	uint64_t due = s->start_packets + bits / TS_BITS_PER_PACKET;
+	int num_packets = due > s->packets_out ? due - s->packets_out : 0;
+	if (num_packets > max_out)
+		num_packets = max_out;
+	ts_shaper_get_packets(s, out_packets, num_packets);
+	return num_packets;
+}
+
+void ts_shaper_dump(struct ts_shaper *s) {
+	char fill_mean[32] = "";
+	if (s->packets_out)
+		snprintf(fill_mean, sizeof(fill_mean), " mean:%.1f", (double)s->fill_sum / s->packets_out);
+	ts_LOGf("CBR shaper bitrate:%u in:%"PRIu64" out:%"PRIu64" null_in:%"PRIu64" null_out:%"PRIu64" dropped:%"PRIu64" restamped:%u\n",
+		s->bitrate, s->packets_in, s->packets_out, s->null_in, s->null_out, s->dropped, s->restamp->restamped);
+	ts_LOGf("    * Buffer fill:%d/%d max:%d%s underflows:%u\n",
+		s->fill, s->buffer_size, s->fill_max, fill_mean, s->underflows);
+}
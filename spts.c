@@ -0,0 +1,290 @@
+/*
+ * SPTS extraction from MPTS
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsfuncs.h"
+
+void ts_spts_free(struct ts_spts **ps) {
+	struct ts_spts *s = *ps;
+	int i;
+	if (s) {
+		for (i=0;i<s->programs_num;i++) {
+			ts_pmt_free(&s->programs[i].pmt);
+			FREE(s->programs[i].pids);
+		}
+		FREE(s->programs);
+		ts_pat_free(&s->pat);
+		ts_pat_free(&s->out_pat);
+		ts_sdt_free(&s->sdt);
+		FREE(s->sdt_packets);
+		FREE(*ps);
+	}
+}
+
+static struct ts_spts_program *ts_spts_get_program(struct ts_spts *s, uint16_t program) {
+	int i;
+	for (i=0;i<s->programs_num;i++) {
+		if (s->programs[i].program == program)
+			return &s->programs[i];
+	}
+	return NULL;
+}
+
+static void ts_spts_program_add_pid(struct ts_spts_program *prg, uint16_t pid) {
+	int i;
+	for (i=0;i<prg->pids_num;i++) {
+		if (prg->pids[i] == (pid & 0x1fff))
+			return;
+	}
+	uint16_t *pids = realloc(prg->pids, (prg->pids_num + 1) * sizeof(uint16_t));
+	if (!pids)
+		return;
+	prg->pids = pids;
+	prg->pids[prg->pids_num++] = pid & 0x1fff;
+}
+
+// Add ECM PIDs from CA descriptors
+static void ts_spts_program_add_ca_pids(struct ts_spts_program *prg, uint8_t *data, int data_len) {
+	while (data && data_len >= 2) {
+		uint8_t tag         = data[0];
+		uint8_t this_length = data[1];
+		data     += 2;
+		data_len -= 2;
+		if (tag == 9 && this_length >= 4 && this_length <= data_len)
+			ts_spts_program_add_pid(prg, ((data[2] & 0x1F) << 8) | data[3]);
+		data_len -= this_length;
+		data += this_length;
+	}
+}
+
+// Collect PCR, ES and ECM PIDs of the program
+static void ts_spts_program_set_pmt(struct ts_spts_program *prg) {
+	struct ts_pmt *pmt = prg->pmt;
+	int i;
+	prg->pids_num = 0;
+	ts_spts_program_add_pid(prg, pmt->PCR_pid);
+	ts_spts_program_add_ca_pids(prg, pmt->program_info, pmt->program_info_size);
+	for (i=0;i<pmt->streams_num;i++) {
+		struct ts_pmt_stream *stream = pmt->streams[i];
+		ts_spts_program_add_pid(prg, stream->pid);
+		ts_spts_program_add_ca_pids(prg, stream->ES_info, stream->ES_info_size);
+	}
+}
+
+static void ts_spts_build_map(struct ts_spts *s) {
+	int i, j;
+	memset(s->pid_map, SPTS_PID_DROP, sizeof(s->pid_map));
+	s->pid_map[0x00] = SPTS_PID_PAT;
+	s->pid_map[0x10] = SPTS_PID_PASS; // NIT
+	s->pid_map[0x11] = s->filter_si ? SPTS_PID_SDT : SPTS_PID_PASS;
+	s->pid_map[0x12] = s->filter_si ? SPTS_PID_EIT : SPTS_PID_PASS;
+	s->pid_map[0x14] = SPTS_PID_PASS; // TDT, TOT
+	for (i=0;i<s->programs_num;i++) {
+		struct ts_spts_program *prg = &s->programs[i];
+		if (prg->pmt_pid == NULL_PID)
+			continue;
+		s->pid_map[prg->pmt_pid] = SPTS_PID_PMT;
+		for (j=0;j<prg->pids_num;j++) {
+			if (s->pid_map[prg->pids[j]] == SPTS_PID_DROP)
+				s->pid_map[prg->pids[j]] = SPTS_PID_PASS;
+		}
+	}
+}
+
+// Extract programs from MPTS. If filter_si is set, SDT is reduced to the
+// selected services and EIT sections of other services are dropped.
+struct ts_spts *ts_spts_alloc(uint16_t *programs, int programs_num, int filter_si) {
+	int i;
+	struct ts_spts *s = calloc(1, sizeof(struct ts_spts));
+	if (!s)
+		return NULL;
+	s->filter_si    = filter_si;
+	s->programs     = calloc(programs_num, sizeof(struct ts_spts_program));
+	s->programs_num = programs_num;
+	s->pat          = ts_pat_alloc();
+	s->sdt          = ts_sdt_alloc();
+	for (i=0;i<programs_num;i++) {
+		struct ts_spts_program *prg = &s->programs[i];
+		prg->program = programs[i];
+		prg->pmt_pid = NULL_PID;
+		prg->pmt     = ts_pmt_alloc();
+	}
+	ts_spts_build_map(s);
+	return s;
+}
+
+// New input PAT, find the PMT PIDs and build the reduced PAT
+static void ts_spts_set_pat(struct ts_spts *s) {
+	struct ts_pat *pat = s->pat;
+	int i;
+	ts_pat_free(&s->out_pat);
+	s->out_pat = ts_pat_alloc_init(pat->section_header->ts_id_number);
+	for (i=0;i<s->programs_num;i++) {
+		struct ts_spts_program *prg = &s->programs[i];
+		uint16_t pmt_pid = NULL_PID;
+		int j;
+		for (j=0;j<pat->programs_num;j++) {
+			if (pat->programs[j]->program == prg->program) {
+				pmt_pid = pat->programs[j]->pid;
+				ts_pat_add_program(s->out_pat, prg->program, pmt_pid);
+				break;
+			}
+		}
+		if (pmt_pid != prg->pmt_pid) {
+			prg->pmt_pid  = pmt_pid;
+			prg->pmt_crc  = 0;
+			prg->pids_num = 0;
+			ts_pmt_clear(prg->pmt);
+		}
+	}
+	// The output changes when the input changes
+	s->out_pat->section_header->version_number = pat->section_header->version_number;
+	ts_pat_regenerate_packets(s->out_pat);
+	ts_spts_build_map(s);
+}
+
+// New input SDT, build the reduced SDT
+static void ts_spts_set_sdt(struct ts_spts *s) {
+	struct ts_sdt *sdt = ts_sdt_copy(s->sdt);
+	int i, j = 0;
+	if (!sdt)
+		return;
+	for (i=0;i<sdt->streams_num;i++) {
+		struct ts_sdt_stream *stream = sdt->streams[i];
+		if (ts_spts_get_program(s, stream->service_id)) {
+			sdt->streams[j++] = stream;
+			continue;
+		}
+		sdt->section_header->section_length -= 5 + stream->descriptor_size;
+		FREE(stream->descriptor_data);
+		FREE(stream);
+	}
+	sdt->streams_num = j;
+	FREE(s->sdt_packets);
+	ts_sdt_generate(sdt, &s->sdt_packets, &s->sdt_num_packets);
+	ts_sdt_free(&sdt);
+}
+
+// Returns 1 if the EIT section that starts at section belongs to selected service
+static int ts_spts_eit_keep(struct ts_spts *s, uint8_t *section, int len) {
+	if (len < 5)
+		return 0;
+	// Only event_information_section actual_transport_stream, present/following and schedule
+	if (section[0] != 0x4e && (section[0] < 0x50 || section[0] > 0x5f))
+		return 0;
+	return ts_spts_get_program(s, (section[3] << 8) | section[4]) != NULL;
+}
+
+static int ts_spts_eit_packet(struct ts_spts *s, uint8_t *ts_packet) {
+	if (!ts_packet_is_pusi(ts_packet))
+		return s->eit_keep;
+	int ofs = ts_packet_get_payload_offset(ts_packet);
+	if (!ofs)
+		return s->eit_keep;
+	int prev_keep = ts_packet[ofs] ? s->eit_keep : 0; // The packet ends previous section
+	ofs += 1 + ts_packet[ofs];
+	s->eit_keep = ofs < TS_PACKET_SIZE ? ts_spts_eit_keep(s, ts_packet + ofs, TS_PACKET_SIZE - ofs) : 0;
+	return prev_keep || s->eit_keep;
+}
+
+static void ts_spts_out(uint8_t *out_packets, int *out_num, int max_out, uint8_t *ts_packets, int num_packets, uint8_t *cc) {
+	int i;
+	if (*out_num + num_packets > max_out)
+		return;
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = out_packets + (*out_num)++ * TS_PACKET_SIZE;
+		memcpy(ts_packet, ts_packets + i * TS_PACKET_SIZE, TS_PACKET_SIZE);
+		if (cc)
+			ts_packet_set_cont(ts_packet, (*cc)++);
+	}
+}
+
+// Filter num_packets input TS packets into out_packets. out_packets must have
+// room for max_out packets, the output is never bigger than the input unless
+// the reduced SDT is bigger than the input SDT packets. Returns the number of
+// packets in out_packets.
+// EIT packets are kept or dropped whole. A packet that ends a kept section
+// and starts the section of another service is kept, so the output can
+// contain the head of a dropped section without its continuation packets.
+// Decoders discard such incomplete sections.
+int ts_spts_push_packets(struct ts_spts *s, uint8_t *ts_packets, int num_packets, uint8_t *out_packets, int max_out) {
+	int i, out_num = 0;
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		uint16_t pid = ts_packet_get_pid(ts_packet);
+		struct ts_spts_program *prg;
+		int j;
+
+		switch (s->pid_map[pid]) {
+		case SPTS_PID_DROP:
+			continue;
+		case SPTS_PID_PASS:
+			ts_spts_out(out_packets, &out_num, max_out, ts_packet, 1, NULL);
+			continue;
+		case SPTS_PID_PAT:
+			s->pat = ts_pat_push_packet(s->pat, ts_packet);
+			if (s->pat->initialized && (!s->out_pat || s->pat->section_header->CRC != s->pat_crc)) {
+				s->pat_crc = s->pat->section_header->CRC;
+				ts_spts_set_pat(s);
+			}
+			if (ts_packet_is_pusi(ts_packet) && s->out_pat)
+				ts_spts_out(out_packets, &out_num, max_out, s->out_pat->section_header->packet_data,
+					s->out_pat->section_header->num_packets, &s->pat_cc);
+			continue;
+		case SPTS_PID_PMT:
+			for (j=0;j<s->programs_num;j++) {
+				prg = &s->programs[j];
+				if (prg->pmt_pid != pid)
+					continue;
+				prg->pmt = ts_pmt_push_packet(prg->pmt, ts_packet);
+				if (prg->pmt->initialized && prg->pmt->section_header->CRC != prg->pmt_crc) {
+					prg->pmt_crc = prg->pmt->section_header->CRC;
+					ts_spts_program_set_pmt(prg);
+					ts_spts_build_map(s);
+				}
+			}
+			ts_spts_out(out_packets, &out_num, max_out, ts_packet, 1, NULL);
+			continue;
+		case SPTS_PID_SDT:
+			s->sdt = ts_sdt_push_packet(s->sdt, ts_packet);
+			if (s->sdt->initialized && (!s->sdt_packets || s->sdt->section_header->CRC != s->sdt_crc)) {
+				s->sdt_crc = s->sdt->section_header->CRC;
+				ts_spts_set_sdt(s);
+			}
+			// The reduced SDT is sent instead of the input SDT actual
+			if (s->sdt->ts_header.pusi && ts_packet_is_pusi(ts_packet) && s->sdt_packets)
+				ts_spts_out(out_packets, &out_num, max_out, s->sdt_packets, s->sdt_num_packets, &s->sdt_cc);
+			continue;
+		case SPTS_PID_EIT:
+			// Dropped sections would leave gaps in the continuity counter
+			if (ts_spts_eit_packet(s, ts_packet))
+				ts_spts_out(out_packets, &out_num, max_out, ts_packet, 1, &s->eit_cc);
+			continue;
+		}
+	}
+	s->packets_in  += num_packets;
+	s->packets_out += out_num;
+	return out_num;
+}
+
+void ts_spts_dump(struct ts_spts *s) {
+	int i, j;
+	ts_LOGf("SPTS packets in:%"PRIu64" out:%"PRIu64" filter_si:%d\n", s->packets_in, s->packets_out, s->filter_si);
+	for (i=0;i<s->programs_num;i++) {
+		struct ts_spts_program *prg = &s->programs[i];
+		char pids[256] = "";
+		int pos = 0;
+		for (j=0;j<prg->pids_num && pos < (int)sizeof(pids) - 8;j++) {
+			pos += snprintf(pids + pos, sizeof(pids) - pos, " %04x", prg->pids[j]);
+		}
+		ts_LOGf("    * Program %d PMT PID %04x PIDs:%s\n", prg->program, prg->pmt_pid, pids);
+	}
+}
@@ -173,8 +173,8 @@ void ts_tdt_check_generator(struct ts_tdt *tdt) {
 	struct ts_tdt *tdt1 = ts_tdt_alloc();
 	int i;
 
-	char *prefix1 = "TDT (tspacket->struct)";
-	char *prefix2 = "TDT (struct->tspacket)";
+	char prefix1[] = "TDT (tspacket->struct)";
+	char prefix2[] = "TDT (struct->tspacket)";
 	if (tdt->section_header->table_id == 0x73) {
 		prefix1[1] = 'O';
 		prefix2[1] = 'O';
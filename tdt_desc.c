@@ -67,9 +67,64 @@ struct ts_tdt *ts_tot_alloc_init(time_t ts) {
 	return ts_tdt_init_empty(ts_tdt_alloc(), ts, 1);
 }
 
+// Returns pointer to the TDT/TOT section in ts_packet or NULL if the
+// section does not fit completely in the packet.
+static uint8_t *ts_tdt_packet_section(uint8_t *ts_packet) {
+	uint8_t payload_ofs = ts_packet_get_payload_offset(ts_packet);
+	if (!payload_ofs || !ts_packet_is_pusi(ts_packet))
+		return NULL;
+
+	uint8_t *sec = ts_packet + payload_ofs + 1 + ts_packet[payload_ofs]; // Skip pointer field
+	if (sec + 8 > ts_packet + TS_PACKET_SIZE)
+		return NULL;
+	if (sec[0] != 0x70 && sec[0] != 0x73)
+		return NULL;
+	int section_length = ((sec[1] &~ 0xF0) << 8) | sec[2];	// 1111xxxx xxxxxxxx
+	if (section_length < 5 || sec + 3 + section_length > ts_packet + TS_PACKET_SIZE)
+		return NULL;
+	if (sec[0] == 0x73 && section_length < 5 + 2 + 4) // TOT must have CRC
+		return NULL;
+	return sec;
+}
+
+static int ts_tdt_packet_set_time_mjd(uint8_t *ts_packet, uint16_t mjd, uint32_t bcd, uint32_t *CRC) {
+	uint8_t *sec = ts_tdt_packet_section(ts_packet);
+	if (!sec)
+		return 0;
+
+	sec[3] = mjd >> 8;
+	sec[4] = mjd &~ 0xff00;
+	sec[5] = bcd >> 16;
+	sec[6] = (bcd >> 8) &~ 0xff00;
+	sec[7] = bcd &~ 0xffff00;
+
+	if (sec[0] == 0x73) { // TOT, TDT do not have CRC
+		int section_length = ((sec[1] &~ 0xF0) << 8) | sec[2];
+		uint32_t crc = ts_section_data_calculate_crc(sec, 3 + section_length - 4);
+		if (CRC)
+			*CRC = crc;
+	}
+	return 1;
+}
+
+// Rewrite UTC_time in already generated TDT/TOT packet without
+// regenerating it. For TOT only the CRC is recalculated.
+// Returns 1 on success, 0 if the packet can not be patched in place.
+int ts_tdt_packet_set_time(uint8_t *ts_packet, time_t now) {
+	uint16_t mjd;
+	uint32_t bcd;
+	ts_time_encode_mjd(&mjd, &bcd, &now, NULL);
+	return ts_tdt_packet_set_time_mjd(ts_packet, mjd, bcd, NULL);
+}
+
 void ts_tdt_set_time(struct ts_tdt *tdt, time_t now) {
-	ts_time_encode_mjd(&tdt->mjd, &tdt->bcd, &now, NULL);
-	tdt->utc = ts_time_decode_mjd(tdt->mjd, tdt->bcd, &tdt->tm);
+	tdt->utc = now;
+	gmtime_r(&now, &tdt->tm);
+	ts_time_encode_mjd(&tdt->mjd, &tdt->bcd, NULL, &tdt->tm);
+	// Fast path, patch the time directly in the generated packet
+	if (tdt->section_header->num_packets == 1 &&
+		ts_tdt_packet_set_time_mjd(tdt->section_header->packet_data, tdt->mjd, tdt->bcd, &tdt->section_header->CRC))
+		return;
 	ts_tdt_regenerate_packet_data(tdt);
 }
 
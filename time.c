@@ -38,10 +38,10 @@ void ts_time_decode_bcd(int duration_bcd, int *duration_sec, int *hour, int *min
 
 void ts_time_encode_mjd(uint16_t *mjd, uint32_t *bcd, time_t *ts, struct tm *tm) {
 	struct tm *ltm = tm;
+	struct tm dectm;
 	if (!ts && !tm)
 		return;
 	if (ts) { // Decompose ts into struct tm
-		struct tm dectm;
 		gmtime_r(ts, &dectm);
 		ltm = &dectm;
 	}
@@ -0,0 +1,186 @@
+/*
+ * PTS, DTS and PCR timestamps tracker
+ * Copyright (C) 2010-2011 Unix Solutions Ltd.
+ *
+ * Released under MIT license.
+ * See LICENSE-MIT.txt for license terms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsfuncs.h"
+
+#define START_PIDS 16
+
+struct ts_times *ts_times_alloc(void) {
+	struct ts_times *t = calloc(1, sizeof(struct ts_times));
+	if (!t)
+		return NULL;
+	t->max_jump  = TS_TIMESTAMP_MAX_JUMP;
+	t->pid_index = calloc(0x2000, sizeof(struct ts_pid_times *));
+	t->pids_max  = START_PIDS;
+	t->pids      = calloc(t->pids_max, sizeof(struct ts_pid_times *));
+	return t;
+}
+
+void ts_times_free(struct ts_times **pt) {
+	struct ts_times *t = *pt;
+	int i;
+	if (t) {
+		for (i=0;i<t->pids_num;i++) {
+			FREE(t->pids[i]);
+		}
+		FREE(t->pids);
+		FREE(t->pid_index);
+		FREE(*pt);
+	}
+}
+
+struct ts_pid_times *ts_times_get_pid(struct ts_times *t, uint16_t pid) {
+	return t->pid_index[pid & 0x1fff];
+}
+
+static struct ts_pid_times *ts_times_add_pid(struct ts_times *t, uint16_t pid) {
+	struct ts_pid_times *pt = t->pid_index[pid & 0x1fff];
+	if (pt)
+		return pt;
+	if (t->pids_num == t->pids_max) {
+		t->pids_max *= 2;
+		t->pids = realloc(t->pids, t->pids_max * sizeof(struct ts_pid_times *));
+	}
+	pt = calloc(1, sizeof(struct ts_pid_times));
+	pt->pid = pid & 0x1fff;
+	t->pids[t->pids_num++] = pt;
+	t->pid_index[pt->pid] = pt;
+	return pt;
+}
+
+// Add 33 bit value. Returns 1 if new segment is started (discontinuity).
+static int ts_timestamp_add(struct ts_timestamp *ts, uint64_t raw, uint64_t max_jump, int discontinuity) {
+	raw &= TS_TIMESTAMP_WRAP - 1;
+	if (!ts->count) {
+		ts->count     = 1;
+		ts->first_raw = raw;
+		ts->last_raw  = raw;
+		ts->last      = raw;
+		ts->first     = raw;
+		ts->min       = raw;
+		ts->max       = raw;
+		return 0;
+	}
+
+	// Shortest distance between the values, positive if raw is after last_raw
+	int64_t delta = (raw - ts->last_raw) & (TS_TIMESTAMP_WRAP - 1);
+	if (delta >= (int64_t)(TS_TIMESTAMP_WRAP / 2))
+		delta -= TS_TIMESTAMP_WRAP;
+
+	int jump = discontinuity || delta > (int64_t)max_jump || delta < -(int64_t)max_jump;
+	if (!jump) {
+		if (delta > 0 && raw < ts->last_raw) {
+			ts->wraps++;
+		} else if (delta < 0 && raw > ts->last_raw) {
+			if (!ts->wraps) // Stepped back before the first value
+				jump = 1;
+			else
+				ts->wraps--;
+		}
+	}
+
+	ts->count++;
+	ts->last_raw = raw;
+	ts->last     = raw + ts->wraps * TS_TIMESTAMP_WRAP;
+
+	if (jump) {
+		// Start new segment
+		ts->discontinuities++;
+		ts->prev_duration += ts->max - ts->min;
+		ts->first = ts->last;
+		ts->min   = ts->last;
+		ts->max   = ts->last;
+		return 1;
+	}
+
+	if (ts->last < ts->min)
+		ts->min = ts->last;
+	if (ts->last > ts->max)
+		ts->max = ts->last;
+	return 0;
+}
+
+// Duration of all segments in 90kHz units
+uint64_t ts_timestamp_duration(struct ts_timestamp *ts) {
+	if (!ts->count)
+		return 0;
+	return ts->prev_duration + (ts->max - ts->min);
+}
+
+// Returns 1 if the packet contains PTS or PCR
+int ts_times_push_packet(struct ts_times *t, uint8_t *ts_packet) {
+	uint64_t pts, dts;
+	uint16_t pid = ts_packet_get_pid(ts_packet);
+	struct ts_pid_times *pt;
+	int found = 0;
+
+	if (ts_packet_has_discontinuity(ts_packet)) {
+		pt = ts_times_add_pid(t, pid);
+		pt->discontinuity = 1;
+	}
+
+	if (ts_packet_has_pcr(ts_packet)) {
+		uint64_t pcr = ts_packet_get_pcr(ts_packet);
+		pt = ts_times_add_pid(t, pid);
+		if (!pt->pcr.count)
+			pt->first_pcr = pcr;
+		pt->last_pcr = pcr;
+		// The discontinuity_indicator is in the same packet as the new PCR
+		ts_timestamp_add(&pt->pcr, pcr / 300, t->max_jump, ts_packet_has_discontinuity(ts_packet));
+		found = 1;
+	}
+
+	if (!ts_packet_is_pusi(ts_packet))
+		return found;
+	if (!ts_packet_has_pts_dts(ts_packet, &pts, &dts) || pts == NO_PTS)
+		return found;
+
+	pt = ts_times_add_pid(t, pid);
+	int jump = ts_timestamp_add(&pt->pts, pts, t->max_jump, pt->discontinuity);
+	if (dts != NO_DTS)
+		ts_timestamp_add(&pt->dts, dts, t->max_jump, pt->discontinuity || jump);
+	pt->discontinuity = 0;
+	return 1;
+}
+
+// Process num_packets consecutive TS packets. Returns the number of packets with PTS or PCR.
+int ts_times_push_packets(struct ts_times *t, uint8_t *ts_packets, int num_packets) {
+	int i, found = 0;
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		// Only packets with PUSI or adaptation field are interesting
+		if (!(ts_packet[1] & 0x40) && !(ts_packet[3] & 0x20))
+			continue;
+		found += ts_times_push_packet(t, ts_packet);
+	}
+	return found;
+}
+
+static void ts_timestamp_dump(char *name, struct ts_timestamp *ts) {
+	if (!ts->count)
+		return;
+	ts_LOGf("      - %s count:%u first:%"PRIu64" last:%"PRIu64" min:%"PRIu64" max:%"PRIu64" wraps:%u discontinuities:%u duration:%"PRIu64" ms\n",
+		name, ts->count, ts->first, ts->last, ts->min, ts->max, ts->wraps, ts->discontinuities,
+		ts_timestamp_duration(ts) / 90);
+}
+
+void ts_times_dump(struct ts_times *t) {
+	int i;
+	ts_LOGf("Timestamps\n");
+	for (i=0;i<t->pids_num;i++) {
+		struct ts_pid_times *pt = t->pids[i];
+		ts_LOGf("    * PID %04x (%d)\n", pt->pid, pt->pid);
+		ts_timestamp_dump("PTS", &pt->pts);
+		ts_timestamp_dump("DTS", &pt->dts);
+		ts_timestamp_dump("PCR", &pt->pcr);
+	}
+}
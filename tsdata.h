@@ -18,6 +18,7 @@
 
 #define TS_PACKET_SIZE       188
 #define TS_MAX_PAYLOAD_SIZE  (TS_PACKET_SIZE-4)
+#define NULL_PID             0x1fff
 
 struct ts_header {
 	uint8_t		sync_byte;			// Always 0x47
@@ -40,6 +41,34 @@ struct ts_header {
 	uint8_t		payload_offset;		// Payload offset inside the packet
 };
 
+// Adaptation field, ISO/IEC 13818-1 2.4.3.4 (see ts_adapt_field_parse, ts_adapt_field_generate)
+struct ts_adapt_field {
+	uint8_t		len;					// adaptation_field_length, the bytes after it
+	uint8_t		discontinuity		: 1,	// discontinuity_indicator
+				random_access		: 1,	// random_access_indicator
+				es_priority			: 1,	// elementary_stream_priority_indicator
+				pcr_flag			: 1,
+				opcr_flag			: 1,
+				splicing_point_flag	: 1,
+				private_data_flag	: 1,
+				extension_flag		: 1;
+	uint64_t	pcr;					// 27MHz, if (pcr_flag)
+	uint64_t	opcr;					// 27MHz, if (opcr_flag)
+	int8_t		splice_countdown;		// if (splicing_point_flag)
+	uint8_t		private_data_len;		// if (private_data_flag)
+	uint8_t		*private_data;			// Points into the parsed packet
+
+	// Adaptation field extension, if (extension_flag)
+	uint8_t		ltw_flag			: 1,
+				piecewise_rate_flag	: 1,
+				seamless_splice_flag: 1;
+	uint8_t		ltw_valid;				// if (ltw_flag)
+	uint16_t	ltw_offset;				// 15 bits
+	uint32_t	piecewise_rate;			// 22 bits, if (piecewise_rate_flag)
+	uint8_t		splice_type;			// 4 bits, if (seamless_splice_flag)
+	uint64_t	dts_next_au;			// 33 bits
+};
+
 struct ts_section_header {
 	uint8_t		pointer_field;
 
@@ -117,6 +146,8 @@ struct ts_cat {
 
 	// The variables bellow are nor part of the physical packet
 	uint8_t						initialized;	// Set to 1 when full table is initialized
+	uint8_t						update_deferred;	// Set by ts_cat_begin_update(), packets are not regenerated until ts_cat_commit()
+	uint8_t						version_changed;	// version_number is already incremented in this update
 };
 
 struct ts_pmt_stream {
@@ -148,6 +179,8 @@ struct ts_pmt {
 	int							streams_max;	// How much streams are allocated
 	int							streams_num;	// How much streams are initialized
 	uint8_t						initialized;	// Set to 1 when full table is initialized
+	uint8_t						update_deferred;	// Set by ts_pmt_begin_update(), packets are not regenerated until ts_pmt_commit()
+	uint8_t						version_changed;	// version_number is already incremented in this update
 };
 
 
@@ -241,6 +274,85 @@ struct ts_eit {
 	int							streams_max;	// How much streams are allocated
 	int							streams_num;	// How much streams are initialized
 	uint8_t						initialized;	// Set to 1 when full eit table is initialized
+	uint8_t						update_deferred;	// Set by ts_eit_begin_update(), packets are not regenerated until ts_eit_commit()
+};
+
+// Event used by EIT schedule and present/following generators
+struct ts_eit_event {
+	uint16_t	event_id;
+	time_t		start_time;
+	int			duration_sec;
+	uint8_t		running;				// 1 == running, 0 == not running
+	char		*event_name;
+	char		*event_short_descr;
+};
+
+#define EIT_SCHED_SEGMENT_SEC		(3 * 3600)	// Each segment covers 3 hours
+#define EIT_SCHED_SEGMENT_SECTIONS	8			// Sections in segment
+#define EIT_SCHED_TABLE_SEGMENTS	32			// Segments in one table_id (4 days)
+#define EIT_SCHED_MAX_TABLES		16			// table_id 0x50 - 0x5f
+
+struct ts_eit_sched_segment {
+	uint32_t	hash;					// Hash of the events in the segment, used to detect changes
+	uint8_t		num_sections;			// 0 == segment is not transmitted
+	uint8_t		section_packets[EIT_SCHED_SEGMENT_SECTIONS];	// Number of TS packets of every section
+	int			num_packets;
+	uint8_t		*packets;				// TS packets of all segment sections
+};
+
+struct ts_eit_sched_service {
+	uint16_t						service_id;
+	uint8_t							last_table_id;							// 0 == no schedule
+	uint8_t							version[EIT_SCHED_MAX_TABLES];			// version_number of every table_id
+	uint8_t							last_section_number[EIT_SCHED_MAX_TABLES];
+	struct ts_eit_sched_segment		*segments;
+};
+
+struct ts_eit_sched {
+	uint16_t						transport_stream_id;
+	uint16_t						original_network_id;
+	time_t							start_time;		// Midnight UTC of the first schedule day
+	int								days;
+	int								segments_num;	// days * 8
+
+	struct ts_eit_sched_service		**services;
+	int								services_max;
+	int								services_num;
+
+	struct ts_eit					*eit;			// Used to generate the sections
+
+	// Statistics
+	uint64_t						segments_regenerated;
+	uint64_t						segments_patched;
+};
+
+struct ts_eit_pf_service {
+	uint16_t				service_id;
+	struct ts_eit_event		*events;		// Sorted by start_time, owned by the service
+	int						events_num;
+	int						pos;			// First event that is not finished
+	int						present;		// Index of the present event, -1 == none
+	int						following;		// Index of the following event, -1 == none
+	time_t					next_change;	// When present/following changes, 0 == never
+	uint8_t					version;
+	struct ts_eit			*eit_present;	// Section 0
+	struct ts_eit			*eit_following;	// Section 1
+	int						heap_pos;		// Position in ts_eit_pf heap, -1 == not in the heap
+};
+
+struct ts_eit_pf {
+	uint16_t					transport_stream_id;
+	uint16_t					original_network_id;
+
+	struct ts_eit_pf_service	**services;
+	int							services_max;
+	int							services_num;
+
+	struct ts_eit_pf_service	**heap;			// Min heap keyed by next_change
+	int							heap_num;
+
+	struct ts_eit_pf_service	**changed;		// Services which sections were regenerated by the last ts_eit_pf_tick()
+	int							changed_num;
 };
 
 struct ts_tdt {
@@ -278,12 +390,45 @@ enum ts_stream_type {
 
 	STREAM_TYPE_ADTS_AUDIO			= 0x0F,	// AAC ADTS
 	STREAM_TYPE_MPEG4_PART2_VIDEO	= 0x10, // DIVX - MPEG-4 part 2
+	STREAM_TYPE_LATM_AUDIO			= 0x11,	// AAC LATM
 
 	STREAM_TYPE_AVC_VIDEO			= 0x1B,	// H.264 - MPEG-4 part 10
+	STREAM_TYPE_HEVC_VIDEO			= 0x24,	// H.265 - HEVC
 	STREAM_TYPE_AVS_VIDEO			= 0x42,	// Chinese AVS
 
-	STREAM_TYPE_DOLBY_DVB_AUDIO		= 0x06, // 0x06 - Private stream, look at stream descriptors for AC-3 descriptor
+	STREAM_TYPE_DOLBY_DVB_AUDIO		= 0x06, // 0x06 - Private stream, look at stream descriptors for AC-3, E-AC-3, AC-4 descriptors
 	STREAM_TYPE_DOLBY_ATSC_AUDIO	= 0x81, // 0x81 - Private stream in ATSC (US system, probably we shouldn't care)
+	STREAM_TYPE_EAC3_ATSC_AUDIO		= 0x87, // 0x87 - E-AC-3 in ATSC
+};
+
+// Codecs, set from the PMT stream type and descriptors (see ts_get_stream_type_info)
+enum ts_codec {
+	CODEC_UNKNOWN = 0,
+	CODEC_MPEG1_VIDEO,
+	CODEC_MPEG2_VIDEO,
+	CODEC_MPEG4_PART2_VIDEO,
+	CODEC_AVC_VIDEO,
+	CODEC_HEVC_VIDEO,
+	CODEC_AVS_VIDEO,
+	CODEC_MPEG1_AUDIO,
+	CODEC_MPEG2_AUDIO,
+	CODEC_AAC_ADTS_AUDIO,
+	CODEC_AAC_LATM_AUDIO,
+	CODEC_AC3_AUDIO,
+	CODEC_EAC3_AUDIO,
+	CODEC_AC4_AUDIO,
+	CODEC_DTS_AUDIO,
+	CODEC_OPUS_AUDIO,
+	CODEC_TELETEXT,
+	CODEC_SUBTITLE,
+};
+
+struct ts_stream_type_info {
+	uint8_t		is_video	: 1,	// Video stream type
+				is_audio	: 1,	// Audio stream type (0x06 may be audio, descriptors must be checked)
+				is_pes		: 1;	// Stream is carried in PES packets
+	uint8_t		codec;				// enum ts_codec, CODEC_UNKNOWN if descriptors must be checked
+	char		*desc;				// NULL for reserved and unknown stream types
 };
 
 // ------------------------------------------------------------
@@ -335,6 +480,207 @@ struct mpeg_audio_header {
 	uint8_t		initialized;
 };
 
+// MPEG-1/2 video headers (ISO/IEC 13818-2), from the start of the PES up to the first slice
+struct mpeg_video_header {
+	uint8_t		have_sequence		: 1,	// Sequence header is found
+				have_sequence_ext	: 1,	// Sequence extension is found (MPEG-2)
+				have_gop			: 1,	// GOP header is found
+				have_picture		: 1;	// Picture header is found
+
+	// Sequence header (+ sequence extension)
+	uint16_t	width;						// horizontal_size
+	uint16_t	height;						// vertical_size
+	uint8_t		aspect_ratio;				// aspect_ratio_information
+	uint8_t		frame_rate_code;
+	uint32_t	bit_rate;					// In units of 400 bits/s (0x3ffff in MPEG-1 means variable)
+	uint32_t	vbv_buffer_size;			// In units of 16 kbit
+	uint8_t		progressive_sequence;
+	uint8_t		chroma_format;
+
+	// GOP header
+	uint8_t		closed_gop			: 1,
+				broken_link			: 1,
+				drop_frame			: 1;
+	uint8_t		tc_hours;					// time_code
+	uint8_t		tc_minutes;
+	uint8_t		tc_seconds;
+	uint8_t		tc_pictures;
+
+	// Picture header
+	uint16_t	temporal_reference;
+	uint8_t		picture_coding_type;		// 1 - I, 2 - P, 3 - B
+	uint16_t	vbv_delay;
+
+	uint8_t		initialized;
+};
+
+// Bit reader (see ts_bits_get)
+struct ts_bits {
+	uint8_t		*data;
+	uint32_t	size;				// In bytes
+	uint32_t	pos;				// In bits
+	uint8_t		error;				// Set when reading after the end of data
+};
+
+// Audio frame header of ADTS, LATM, AC-3, E-AC-3, AC-4, DTS and Opus streams (see ts_pes_es_audio_header_parse)
+struct es_audio_header {
+	uint8_t		codec;				// enum ts_codec
+	uint32_t	sample_rate;		// Hz, 0 if unknown
+	uint8_t		channels;			// Without LFE, 0 if unknown
+	uint8_t		lfe;				// LFE channel is present
+	uint32_t	bitrate;			// Bits per second, 0 if unknown
+	uint32_t	frame_size;			// Bytes including the header, 0 if unknown
+	uint32_t	samples;			// Samples per frame, 0 if unknown
+	uint8_t		profile;			// AAC audio object type, AC-3/E-AC-3 bsid, AC-4 bitstream_version
+	uint8_t		initialized;
+};
+
+// Audio frame found by ts_audio_frame_next()
+struct ts_audio_frame {
+	uint8_t		*data;
+	uint32_t	offset;				// Offset of the frame in the iterated data
+	uint32_t	size;				// Bytes in data, less than hdr.frame_size if the frame is truncated
+	uint8_t		truncated;			// Frame continues after the end of data
+	uint64_t	pts;				// Interpolated from the PTS of the first frame, NO_PTS if unknown
+	struct es_audio_header hdr;
+};
+
+struct ts_audio_frame_iter {
+	uint8_t		*data;
+	uint32_t	size;
+	uint32_t	pos;
+	uint8_t		codec;				// enum ts_codec
+	uint8_t		locked;				// Previous frame ended at pos
+	uint64_t	pts;				// PTS of the first frame
+	uint64_t	pts_offset;			// 90kHz ticks before the last sample rate change
+	uint64_t	samples;			// Samples since the last sample rate change
+	uint32_t	frames;				// Frames found
+	uint32_t	skipped;			// Bytes skipped while looking for frame sync
+	struct es_audio_header last;	// Header of the previous frame
+};
+
+// H.264/HEVC sequence parameter set (see ts_nal_parse_sps)
+struct es_video_sps {
+	uint8_t		profile_idc;
+	uint8_t		level_idc;
+	uint8_t		tier;				// HEVC only
+	uint8_t		chroma_format_idc;
+	uint8_t		bit_depth;			// Luma bit depth
+	uint16_t	width;				// After cropping
+	uint16_t	height;
+	uint8_t		initialized;
+};
+
+enum ts_nal_codec {
+	NAL_CODEC_AVC,		// H.264 - MPEG-4 part 10
+	NAL_CODEC_HEVC,		// H.265
+};
+
+// AVC nal_unit_type
+#define NAL_AVC_SLICE		1
+#define NAL_AVC_IDR			5
+#define NAL_AVC_SEI			6
+#define NAL_AVC_SPS			7
+#define NAL_AVC_PPS			8
+#define NAL_AVC_AUD			9
+
+// HEVC nal_unit_type
+#define NAL_HEVC_BLA_W_LP	16		// 16..23 are IRAP
+#define NAL_HEVC_IDR_W_RADL	19
+#define NAL_HEVC_IDR_N_LP	20
+#define NAL_HEVC_CRA		21
+#define NAL_HEVC_VPS		32
+#define NAL_HEVC_SPS		33
+#define NAL_HEVC_PPS		34
+#define NAL_HEVC_AUD		35
+#define NAL_HEVC_SEI_PREFIX	39
+#define NAL_HEVC_SEI_SUFFIX	40
+
+struct ts_nal {
+	uint8_t		*data;				// NAL unit starting with the NAL header (after 00 00 01)
+	uint32_t	size;				// NAL unit size without the zero bytes before the next start code
+	uint8_t		type;				// nal_unit_type
+	uint8_t		is_vcl		: 1,	// Coded slice
+				is_idr		: 1,	// IDR picture
+				is_rap		: 1,	// Random access point (AVC IDR, HEVC IRAP)
+				is_sps		: 1,
+				is_pps		: 1,
+				is_vps		: 1,	// HEVC only
+				is_sei		: 1,
+				is_aud		: 1;
+};
+
+// Iterator over the NAL units in ES data (see ts_nal_iter_init)
+struct ts_nal_iter {
+	uint8_t				*data;
+	uint8_t				*end;
+	uint8_t				*next;		// Next start code, NULL when there are no more NAL units
+	enum ts_nal_codec	codec;
+};
+
+#define TS_PES_CHUNK_SIZE (64 * 1024)
+
+struct ts_pes_chunk {
+	struct ts_pes_chunk		*next;
+	uint32_t				used;		// How much data is filled in the chunk
+	uint8_t					data[TS_PES_CHUNK_SIZE];
+};
+
+struct ts_pes_chunk_pool {
+	struct ts_pes_chunk		*free;		// Unused chunks
+	int						free_num;
+	int						allocated;	// Total number of allocated chunks
+};
+
+// Rarely used PES header fields, decoded on demand by ts_pes_get_ext()
+struct ts_pes_ext {
+	uint64_t	ESCR;						// if (ESCR_flag)
+	uint32_t	ES_rate;					// if (ES_rate_flag)
+
+	uint16_t	trick_mode_control	: 2,	// if (trick_mode_flag)
+				field_id			: 2,
+				intra_slice_refresh	: 1,
+				freq_truncation		: 2,
+				rep_ctrl			: 5,
+				tm_reserved			: 4;
+
+	uint8_t		reserved_add		: 1,	// if (add_copy_info_flag)
+				add_copy_info		: 7;
+
+	uint16_t	prev_pes_crc;				// if (pes_crc_flag)
+
+	// PES extension
+	uint8_t		flags_3;					// Bellow flags
+	uint8_t		pes_private_data_flag			: 1,
+				pack_header_field_flag			: 1,
+				program_packet_seq_counter_flag	: 1,
+				p_std_buffer_flag				: 1,
+				reserved2						: 3,
+				pes_extension2_flag				: 1;
+
+	uint64_t	pes_private_data_1;					// if (pes_private_data_flag)
+	uint64_t	pes_private_data_2;					// The whole field is 128 bits
+
+	uint8_t		pack_header_len;					// if (pack_header_field_flag)
+	uint8_t		*pack_header;						// Pointer into the PES data
+
+	uint8_t		reserved3					: 1,	// if (program_packet_seq_counter_flag)
+				program_packet_seq_counter	: 7;
+
+	uint8_t		mpeg1_mpeg2_identifier		: 1,
+				original_stuff_length		: 6;
+
+	uint16_t	p_std_reserved				: 2,	// Always 1, if (p_std_buffer_flag)
+				p_std_buffer_scale			: 1,
+				p_std_buffer_size			: 13;
+
+	uint16_t	reserved4					: 1,	// if (pes_extension2_flag)
+				pes_extension_field_len		: 7;
+	uint8_t		*pes_extension2;					// Pointer into the PES data
+};
+
+// The fields up to *es_data are the per PES reassembly state, they are zeroed
+// by ts_pes_clear() for every PES, so keep them within 64 bytes.
 struct ts_pes {
 	struct ts_header ts_header;
 
@@ -356,7 +702,13 @@ struct ts_pes {
 				is_video_h264	: 1,		// PES carries H.264 video (init from PES stream_id)
 				is_video_avs	: 1,		// PES carries AVS video (init from PES stream_id)
 				is_teletext		: 1,		// PES carries teletext (init from PMT descriptors)
-				is_subtitle		: 1;		// PES carries subtitles (init from PMT descriptors)
+				is_subtitle		: 1,		// PES carries subtitles (init from PMT descriptors)
+				is_rap			: 1,		// PES contains random access point (IDR/IRAP NAL unit or MPEG-2 I picture) (init from elementary stream)
+				is_video_hevc	: 1,		// PES carries HEVC video (init from PMT stream_type and descriptors)
+				is_audio_latm	: 1,		// PES carries AAC LATM audio (init from PMT stream_type)
+				is_audio_eac3	: 1,		// PES carries E-AC-3 audio (init from PMT stream_type and descriptors)
+				is_audio_ac4	: 1,		// PES carries AC-4 audio (init from PMT descriptors)
+				is_audio_opus	: 1;		// PES carries Opus audio (init from PMT descriptors)
 
 	uint8_t		stream_id;					// If !0 then the PES has started initializing
 	uint16_t	pes_packet_len;				// Allowed to be 0 for video streams
@@ -382,66 +734,63 @@ struct ts_pes {
 				pes_extension_flag	: 1;
 
 	uint8_t		pes_header_len;
+	uint8_t		pes_data_initialized;	// Set to 1 when all of the pes_data is in *pes_data and the parsing can start
+	uint8_t		initialized;			// Set to 1 when the packet is fully assembled
+	uint8_t		ext_decoded;			// Set to 1 when *ext contains the fields of this PES
+	uint8_t		stream_header_done;		// Set to 1 when the PES header is parsed (streaming mode)
+
+	uint32_t	stream_pos;				// How much bytes of the PES are received (streaming mode)
+	uint32_t	pes_data_pos;			// How much data is filled in pes_data
+	uint32_t	es_data_size;			// Full pes packet length (used for video streams, otherwise equal to pes_packet_len)
 
 	uint64_t	PTS;						// if (PTS_flag)
 	uint64_t	DTS;						// if (DTS_flag)
-	uint64_t	ESCR;						// if (ESCR_flag)
-	uint32_t	ES_rate;					// if (ES_rate_flag)
-
-	uint16_t	trick_mode_control	: 2,	// if (trick_mode_flag)
-				field_id			: 2,
-				intra_slice_refresh	: 1,
-				freq_truncation		: 2,
-				rep_ctrl			: 5,
-				tm_reserved			: 4;
-
-	uint8_t		reserved_add		: 1,	// if (add_copy_info_flag)
-				add_copy_info		: 7;
-
-	uint16_t	prev_pes_crc;				// if (pes_crc_flag)
-
-	// PES extension
-	uint8_t		flags_3;					// Bellow flags
-	uint8_t		pes_private_data_flag			: 1,
-				pack_header_field_flag			: 1,
-				program_packet_seq_counter_flag	: 1,
-				p_std_buffer_flag				: 1,
-				reserved2						: 3,
-				pes_extension2_flag				: 1;
-
-	uint64_t	pes_private_data_1;					// if (pes_private_data_flag)
-	uint64_t	pes_private_data_2;					// The whole field is 128 bits
-
-	uint8_t		pack_header_len;					// if (pack_header_field_flag)
-	uint8_t		*pack_header;						// Pointer into *pes_data
-
-	uint8_t		reserved3					: 1,	// if (program_packet_seq_counter_flag)
-				program_packet_seq_counter	: 7;
 
-	uint8_t		mpeg1_mpeg2_identifier		: 1,
-				original_stuff_length		: 6;
-
-	uint16_t	p_std_reserved				: 2,	// Always 1, if (p_std_buffer_flag)
-				p_std_buffer_scale			: 1,
-				p_std_buffer_size			: 13;
-
-	uint16_t	reserved4					: 1,	// if (pes_extension2_flag)
-				pes_extension_field_len		: 7;
-	uint8_t		*pes_extension2;					// Pointer into *pes_data
-
-	// Private data
+	// The fields bellow are not zeroed by ts_pes_clear(), *es_data, es_data_chunk_size and *chunks are reset separately
+	uint8_t		*es_data;				// Pointer to start of data after PES header, initialized when the packet is fully assembled
+	uint32_t	es_data_chunk_size;		// How much of es_data_size is contiguous at *es_data (see chunk mode)
+
+	// Chunk mode (see ts_pes_use_chunks), the data is kept in chunks and *pes_data is not
+	// used until ts_pes_linearize() is called. *es_data points into the first chunk and
+	// only es_data_chunk_size bytes are readable there, es_data_size is the whole ES data.
+	// ts_pes_es_parse() and ts_pes_es_audio_frame_iter_init() linearize the PES when the
+	// ES data does not fit in the first chunk.
+	struct ts_pes_chunk_pool	*chunk_pool;
+	struct ts_pes_chunk			*chunks;		// The first chunk contains the PES header
+	struct ts_pes_chunk			*last_chunk;
+	int							chunks_num;
+
+	// In streaming mode (see ts_pes_stream_push_packet) only the PES header is kept in *pes_data
 	uint8_t		*pes_data;				// Whole packet is stored here
-	uint32_t	pes_data_pos;			// How much data is filled in pes_data
 	uint32_t	pes_data_size;			// Total allocated for pes_data
-	uint8_t		pes_data_initialized;	// Set to 1 when all of the pes_data is in *pes_data and the parsing can start
 
-	// More private data
-	uint8_t		*es_data;				// Pointer to start of data after PES header, initialized when the packet is fully assembled
-	uint32_t	es_data_size;			// Full pes packet length (used for video streams, otherwise equal to pes_packet_len)
-	uint8_t		initialized;			// Set to 1 when the packet is fully assembled
+	struct ts_pes_ext			*ext;	// Rarely used header fields, use ts_pes_get_ext() to access them
 
 	// Extra data
 	struct mpeg_audio_header mpeg_audio_header;
+	struct mpeg_video_header mpeg_video_header;
+	struct es_audio_header	audio_header;
+	struct es_video_sps		video_sps;
+};
+
+// Callbacks used by ts_pes_stream_push_packet()
+struct ts_pes_stream_cb {
+	void	(*header)	(void *data, struct ts_pes *pes);								// PES header is parsed, PTS/DTS are known
+	void	(*payload)	(void *data, struct ts_pes *pes, uint8_t *es_data, int size);	// ES data after the PES header, called for every TS packet
+	void	(*end)		(void *data, struct ts_pes *pes);								// PES is finished
+	void	*data;
+};
+
+// ES to PES to TS packetizer (see ts_packetizer_push)
+struct ts_packetizer {
+	uint16_t	pid;
+	uint8_t		stream_id;
+	uint8_t		continuity;			// Continuity counter of the next packet
+	uint8_t		data_alignment;		// Set data_alignment_indicator, each ES buffer starts with an access unit
+	uint8_t		unbounded;			// Always set PES_packet_length to 0 (video streams only, default for video)
+	uint8_t		random_access;		// Set random_access_indicator in the next PES, cleared by ts_packetizer_push
+	uint32_t	packets;			// Generated TS packets
+	uint32_t	pes_packets;		// Generated PES packets
 };
 
 struct pes_entry {
@@ -454,8 +803,389 @@ struct pes_array {
 	int max;
 	int cur;
 	struct pes_entry **entries;
+	struct pes_entry **pid_index;			// 0x2000 entries, direct PID lookup
+	struct ts_pes **pes_pool;				// Free list of cleared PES packets
+	int pes_pool_num;
+	int pes_pool_max;
+	struct ts_pes_chunk_pool *chunk_pool;	// If set PES packets are assembled in chunk mode
 };
 
 typedef uint8_t pidmap_t[0x2000];
 
+#define TS_TIMESTAMP_WRAP		(1ull << 33)	// PTS/DTS are 33 bits
+#define TS_TIMESTAMP_MAX_JUMP	(5 * 90000)		// Bigger jumps are treated as discontinuity
+
+// Unwrapped (continuous) view of 33 bit PTS, DTS or PCR base values
+struct ts_timestamp {
+	uint32_t	count;				// How much values are seen
+	uint32_t	wraps;				// How much times the 33 bit value wrapped
+	uint32_t	discontinuities;	// Number of segments - 1
+	uint64_t	first_raw;			// First value as found in the stream
+	uint64_t	last_raw;			// Last value as found in the stream
+	uint64_t	last;				// Last value, unwrapped
+	uint64_t	first;				// First value of the current segment, unwrapped
+	uint64_t	min;				// Min/max value of the current segment, unwrapped
+	uint64_t	max;
+	uint64_t	prev_duration;		// Sum of the durations of the segments before the last discontinuity
+};
+
+struct ts_pid_times {
+	uint16_t			pid;
+	uint8_t				discontinuity;		// Set by adaptation field discontinuity_indicator, cleared by the next PTS
+	struct ts_timestamp	pts;
+	struct ts_timestamp	dts;
+	struct ts_timestamp	pcr;				// PCR base (90kHz)
+	uint64_t			first_pcr;			// Full 27MHz PCR as found in the stream
+	uint64_t			last_pcr;
+};
+
+struct ts_times {
+	uint64_t				max_jump;		// Default TS_TIMESTAMP_MAX_JUMP
+	struct ts_pid_times		**pid_index;	// 0x2000 entries, direct PID lookup
+	struct ts_pid_times		**pids;			// PIDs in order of appearance
+	int						pids_num;
+	int						pids_max;
+};
+
+#define TS_PROBE_WINDOW		(4 * 1024 * 1024)	// Default size of the head and tail windows
+
+// PCR clock recovery (see ts_clock_push_pcr)
+#define TS_CLOCK_WINDOW		64						// PCR values used by the model
+#define TS_CLOCK_MAX_GAP	(27000000ull)			// Bigger PCR step (1 s) starts new model
+#define TS_CLOCK_PCR_WRAP	(TS_TIMESTAMP_WRAP * 300)
+#define TS_CLOCK_NO_TIME	(-1ull)
+
+struct ts_clock_sample {
+	uint64_t	pos;				// Packet index
+	uint64_t	pcr;				// Unwrapped 27MHz
+	uint64_t	time;				// Arrival time in microseconds or TS_CLOCK_NO_TIME
+};
+
+struct ts_clock {
+	uint16_t	pcr_pid;
+	uint64_t	packets;			// Packets pushed with ts_clock_push_packet
+	uint64_t	last_raw_pcr;
+	uint64_t	last_pcr;			// Unwrapped
+	uint32_t	pcrs;				// PCR values pushed
+	uint32_t	discontinuities;	// Models restarted because of PCR jumps or discontinuity_indicator
+	struct ts_clock_sample samples[TS_CLOCK_WINDOW];
+	int			samples_num;
+	int			samples_pos;		// Next sample slot
+
+	// Linear regression of PCR over the packet index: pcr = ref_pcr + ticks_per_packet * (pos - ref_pos)
+	int			initialized;		// Model needs at least two PCR values
+	double		ticks_per_packet;
+	double		ref_pos;
+	double		ref_pcr;
+	uint32_t	bitrate;			// Smoothed transport bitrate (bits per second)
+	uint32_t	bitrate_instant;	// Bitrate between the last two PCR values
+	int			have_drift;			// Model needs at least two PCR values with arrival time
+	double		drift_ppm;			// PCR clock against arrival time, positive if PCR clock is faster
+};
+
+// PCR restamping (see ts_pcr_restamp_packets)
+struct ts_pcr_restamp_pid {
+	uint16_t	pid;
+	uint64_t	offset;				// Input PCR - output clock (modulo TS_CLOCK_PCR_WRAP)
+};
+
+struct ts_pcr_restamp {
+	uint32_t	bitrate;			// Output bits per second
+	uint64_t	packets;			// Output packets processed
+	uint64_t	clock;				// 27MHz output clock of the next packet (modulo TS_CLOCK_PCR_WRAP)
+	uint64_t	step;				// 27MHz ticks per packet
+	uint32_t	step_rem;			// Remainder of the ticks per packet in 1/bitrate units
+	uint32_t	rem;				// Accumulated remainder
+	uint32_t	restamped;			// PCR values rewritten
+	int			pids_num;
+	struct ts_pcr_restamp_pid *pids;
+};
+
+// PCR measurements (TR 101 290 PCR_AC, PCR_OJ, PCR_FO and PCR_DR)
+#define TS_HISTOGRAM_BINS		32
+#define TS_PCR_AC_LIMIT			500			// ns
+#define TS_PCR_FO_LIMIT			810			// Hz
+#define TS_PCR_DR_LIMIT			75			// mHz/s
+#define TS_PCR_DR_INTERVAL		10000000000ull	// ns between PCR_DR measurements
+#define TS_PCR_METRICS_DECAY	0.98		// Weight of older PCR values in PCR_FO, about 50 PCR values
+#define TS_PCR_FO_MIN_PCRS		50			// PCR values before PCR_FO is measured
+
+struct ts_histogram {
+	int64_t		min;				// Lower edge of the first bin
+	int64_t		bin_width;
+	uint32_t	bins[TS_HISTOGRAM_BINS];	// Values outside of the range are in the first or the last bin
+	uint32_t	count;
+	int64_t		lowest;
+	int64_t		highest;
+};
+
+struct ts_pcr_metrics_pid {
+	uint16_t	pid;
+	uint32_t	pcrs;				// PCR values in the current segment
+	uint64_t	first_pos;
+	uint64_t	first_pcr;			// Unwrapped
+	uint64_t	last_pos;
+	uint64_t	last_pcr;			// Unwrapped
+	uint64_t	last_raw_pcr;
+	uint64_t	last_arrival;		// ns
+	// Exponentially weighted regression of PCR over arrival time (27MHz), origin at the last PCR
+	double		sw, sx, sy, sxx, sxy;
+	double		fo;					// Hz
+	uint64_t	dr_arrival;			// Start of the PCR_DR interval
+	double		dr_fo_sum;			// PCR_FO values in the PCR_DR interval
+	uint32_t	dr_fo_count;
+	int			fo_valid;			// dr_fo is known
+	double		dr_fo;				// Mean PCR_FO of the previous interval
+	// Last values
+	int64_t		ac;					// ns
+	int64_t		oj;					// ns
+	int64_t		dr;					// mHz/s
+	uint32_t	measured;			// PCR values measured
+	uint32_t	ac_errors;
+	uint32_t	fo_errors;
+	uint32_t	dr_errors;
+	uint32_t	discontinuities;
+	struct ts_histogram ac_hist;	// ns
+	struct ts_histogram oj_hist;	// ns
+	struct ts_histogram fo_hist;	// Hz
+	struct ts_histogram dr_hist;	// mHz/s
+};
+
+struct ts_pcr_metrics {
+	uint64_t	packets;			// Packets pushed
+	int			pids_num;
+	struct ts_pcr_metrics_pid **pids;
+};
+
+// Looped file playout (see ts_loop_read)
+#define TS_LOOP_PID_PSI			0x01		// PAT or PMT PID
+#define TS_LOOP_PID_SEEN		0x02		// PID was seen in the current loop
+#define TS_LOOP_PID_PAYLOAD		0x04		// Packet with payload was seen in the first pass
+
+struct ts_loop_pid {
+	uint8_t		flags;				// TS_LOOP_PID_xxx
+	uint8_t		cc_delta;			// Added to the continuity counters on every loop
+};
+
+// PSI section that fits in one TS packet, identified by PID, table_id, extension and section_number
+struct ts_loop_table {
+	uint16_t	pid;
+	uint8_t		table_id;
+	uint16_t	ts_id;
+	uint8_t		section_number;
+	uint8_t		first_version;
+	uint8_t		last_version;
+	uint32_t	first_crc;
+	uint32_t	last_crc;
+	int			bump;				// version_number is incremented on every loop
+};
+
+struct ts_loop {
+	uint8_t		*map;				// Read only, the packets of the next loops are rewritten in *buf
+	uint64_t	map_size;
+	uint8_t		*packets;			// First packet in map
+	uint32_t	num_packets;
+	uint32_t	pos;				// Next packet
+	uint64_t	loops;				// Finished loops
+	uint16_t	pcr_pid;			// NULL_PID if there is no PCR
+	int64_t		duration;			// Loop duration in 90kHz, added to timestamps on every loop (0 if unknown)
+	int64_t		ts_offset;			// duration * loops, wrapped at 2^33
+	uint8_t		*buf;				// Rewritten packets returned by ts_loop_read
+	int			buf_size;			// In packets
+	uint64_t	discontinuity_packets;	// Inserted packets that carry the discontinuity_indicator
+	struct ts_loop_pid *pids;		// 0x2000 entries
+	int			tables_num;
+	struct ts_loop_table *tables;
+};
+
+// SPTS extraction (see ts_spts_push_packets)
+enum ts_spts_pid_type {
+	SPTS_PID_DROP = 0,
+	SPTS_PID_PASS,
+	SPTS_PID_PAT,					// Replaced by the reduced PAT
+	SPTS_PID_PMT,					// Parsed and passed
+	SPTS_PID_SDT,					// Replaced by the reduced SDT
+	SPTS_PID_EIT,					// Sections of other services are dropped
+};
+
+struct ts_spts_program {
+	uint16_t	program;
+	uint16_t	pmt_pid;			// NULL_PID if the program is not in the PAT
+	struct ts_pmt *pmt;
+	uint32_t	pmt_crc;			// CRC of the PMT that built the PID map
+	int			pids_num;			// PCR, ES and ECM PIDs from the PMT
+	uint16_t	*pids;
+};
+
+struct ts_spts {
+	int			filter_si;			// Rewrite SDT and filter EIT, otherwise they are passed
+	int			programs_num;
+	struct ts_spts_program *programs;
+	uint8_t		pid_map[0x2000];	// enum ts_spts_pid_type
+	uint8_t		eit_keep;			// Current EIT section is passed
+	uint8_t		eit_cc;
+
+	struct ts_pat *pat;				// Input
+	uint32_t	pat_crc;
+	struct ts_pat *out_pat;
+	uint8_t		pat_cc;
+
+	struct ts_sdt *sdt;				// Input
+	uint32_t	sdt_crc;
+	uint8_t		*sdt_packets;		// Output
+	int			sdt_num_packets;
+	uint8_t		sdt_cc;
+
+	uint64_t	packets_in;
+	uint64_t	packets_out;
+};
+
+// MPTS multiplexer (see ts_mux_push_packets and ts_mux_get_packets)
+#define TS_MUX_PAT_INTERVAL	(27000000ull / 10)		// PAT every 100 ms
+#define TS_MUX_SDT_INTERVAL	(27000000ull * 2)		// SDT actual every 2 s
+
+struct ts_mux_packet {
+	uint64_t	deadline;			// 27MHz mux time
+	uint8_t		set_cc;				// Generated packet, continuity counter is set on output
+	uint8_t		data[TS_PACKET_SIZE];
+};
+
+struct ts_mux_queue {
+	struct ts_mux_packet *packets;
+	int			size;
+	int			head;
+	int			num;
+};
+
+struct ts_mux_input {
+	uint16_t	program;			// Output program_number, 0 until the input PAT is known
+	uint16_t	in_program;
+	uint16_t	in_pmt_pid;			// NULL_PID until the input PAT is known
+	uint16_t	*pid_map;			// 0x2000 entries, input PID -> output PID or NULL_PID
+
+	struct ts_pat *pat;				// Input
+	uint32_t	pat_crc;
+	struct ts_pmt *pmt;				// Input
+	uint32_t	pmt_crc;
+	struct ts_pmt *out_pmt;			// With output program_number and PIDs
+	struct ts_sdt *sdt;				// Input
+	uint32_t	sdt_crc;
+	struct ts_sdt_stream *service;	// SDT entry of the input program
+	struct ts_eit *eit;				// Input, cleared after each section
+
+	struct ts_clock *clock;			// Input PCR model for the deadlines
+	double		ticks_per_packet;	// Last known input rate, used while the model restarts
+	int			offset_set;
+	double		offset;				// Input PCR - mux time
+	uint64_t	last_deadline;
+	struct ts_mux_queue queue;
+
+	uint64_t	packets_in;
+	uint64_t	packets_dropped;	// SI, PSI and unknown PIDs
+};
+
+struct ts_mux {
+	uint16_t	transport_stream_id;
+	uint16_t	original_network_id;
+	int			inputs_num;
+	struct ts_mux_input *inputs;
+	uint8_t		pid_used[0x2000];	// Output PIDs
+	uint8_t		cc[0x2000];			// Continuity counters of the generated PIDs
+
+	struct ts_pat *pat;				// Output
+	uint8_t		pat_version;
+	struct ts_sdt *sdt;				// Output
+	uint8_t		sdt_version;
+	int			pat_changed;		// Rebuild the output tables
+	int			sdt_changed;
+	struct ts_mux_queue psi;		// Output PAT and SDT
+
+	uint64_t	now;				// 27MHz mux time, advanced by ts_mux_get_packets
+	uint64_t	next_pat;
+	uint64_t	next_sdt;
+	uint64_t	packets_out;
+};
+
+// CBR shaper (see ts_shaper_push_packets and ts_shaper_get_packets)
+struct ts_shaper {
+	uint32_t	bitrate;			// Output bits per second
+	struct ts_pcr_restamp *restamp;	// Output PCR from the packet position
+	uint8_t		*buffer;			// Leaky bucket, buffer_size packets
+	int			buffer_size;
+	int			head;
+	int			fill;				// Packets in the buffer
+	uint64_t	start_time;			// Microseconds, time base of ts_shaper_tick or TS_CLOCK_NO_TIME
+	uint64_t	start_packets;		// Output packets at start_time
+
+	uint64_t	packets_in;
+	uint64_t	packets_out;
+	uint64_t	null_in;			// Input null packets, not buffered
+	uint64_t	null_out;			// Stuffing
+	uint64_t	dropped;			// Input packets that did not fit in the buffer
+	uint32_t	underflows;			// Times the buffer became empty while sending
+	int			sending;			// Last output packet was from the buffer
+	int			fill_max;
+	uint64_t	fill_sum;			// Buffer fill before each output packet
+};
+
+struct ts_probe_pid {
+	uint16_t	pid;
+	uint64_t	first_pts;				// NO_PTS if the PID has no PTS
+	uint64_t	last_pts;
+	uint64_t	first_pcr;				// 27MHz, NO_PCR if the PID has no PCR
+	uint64_t	last_pcr;
+};
+
+struct ts_probe {
+	uint64_t			file_size;
+	uint64_t			bytes_read;		// How much of the file was read
+	uint64_t			duration;		// In 90kHz units
+	uint32_t			bitrate;		// Average bitrate (bits per second)
+	uint16_t			time_pid;		// PID used to calculate the duration
+	uint8_t				time_from_pcr;	// The duration is from PCR (otherwise from PTS)
+	uint8_t				full_scan;		// The whole file was read
+	struct ts_probe_pid	*pids;
+	int					pids_num;
+};
+
+struct ts_carousel_entry;
+
+struct ts_carousel_pid {
+	uint16_t					pid;
+	uint8_t						cc;				// Next continuity counter
+	uint32_t					min_gap;		// Minimum slots between two packets (from max bitrate)
+	uint64_t					next_slot;		// First slot in which the PID is allowed to send
+	struct ts_carousel_entry	*active;		// Table that is being sent at the moment
+};
+
+struct ts_carousel_entry {
+	struct ts_section_header	*section_header;	// Table packets are taken from here
+	struct ts_carousel_pid		*pid;
+
+	uint32_t					interval_ms;	// Requested repetition interval
+	uint64_t					interval;		// Repetition interval in output slots
+	uint64_t					deadline;		// Slot in which the next repetition is due
+	uint32_t					sent;			// How much times the table was sent
+
+	uint8_t						*packets;		// Snapshot of the table packets that are being sent
+	int							num_packets;
+	int							packet_pos;		// Next packet to send
+};
+
+struct ts_carousel {
+	uint32_t					bitrate;		// Output bitrate, used to convert intervals into slots
+
+	struct ts_carousel_entry	**entries;
+	int							entries_max;
+	int							entries_num;
+
+	struct ts_carousel_pid		**pids;
+	int							pids_max;
+	int							pids_num;
+
+	int							active_num;		// How much tables are being sent at the moment
+	uint64_t					next_deadline;	// Nothing is due before this slot
+	uint64_t					packets_sent;
+};
+
 #endif
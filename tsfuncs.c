@@ -20,7 +20,7 @@ void ts_packet_init_null(uint8_t *ts_packet) {
 	ts_packet[0] = 0x47;
 	ts_packet[1] = 0x1f;
 	ts_packet[2] = 0xff;
-	ts_packet[3] = 0x00;
+	ts_packet[3] = 0x10; // Payload only, as required for null packets
 }
 
 void ts_packet_set_scrambled(uint8_t *ts_packet, enum ts_scrambled_type stype) {
@@ -167,6 +167,99 @@ void ts_packet_change_pts_dts(uint8_t *ts_packet, uint64_t pts, uint64_t dts) {
 	ts_encode_pts_dts(&data[14], 1, dts);
 }
 
+// Add offset to 33 bit PCR base, the extension is not changed
+static void ts_shift_pcr(uint8_t *data, uint64_t offset) {
+	uint64_t base = ((uint64_t)data[0] << 25) | ((uint64_t)data[1] << 17) | (data[2] << 9) | (data[3] << 1) | (data[4] >> 7);
+	base = (base + offset) & (TS_TIMESTAMP_WRAP - 1);
+	data[0] = (base >> 25) & 0xFF;
+	data[1] = (base >> 17) & 0xFF;
+	data[2] = (base >> 9)  & 0xFF;
+	data[3] = (base >> 1)  & 0xFF;
+	data[4] = (data[4] &~ 0x80) | ((base & 0x01) << 7); // x1111111
+}
+
+// Add offset to PTS or DTS, the guard bits are not changed
+static void ts_shift_pts_dts(uint8_t *data, uint64_t offset) {
+	uint64_t value;
+	ts_decode_pts_dts(data, &value);
+	ts_encode_pts_dts(data, data[0] >> 4, (value + offset) & (TS_TIMESTAMP_WRAP - 1));
+}
+
+// Add offset to 33 bit ESCR base, the extension and marker bits are not changed
+static void ts_shift_escr(uint8_t *data, uint64_t offset) {
+	uint64_t base = ((((uint64_t)data[0]) & 0x38) << 27) |	// xx111x11 (bits 32..30 and 29..28)
+	                ((((uint64_t)data[0]) & 0x03) << 28) |
+	                ((uint64_t)data[1] << 20) |				// bits 27..20
+	                ((uint64_t)(data[2] & 0xf8) << 12) |	// 11111x11 (bits 19..15 and 14..13)
+	                ((uint64_t)(data[2] & 0x03) << 13) |
+	                ((uint64_t)data[3] << 5) |				// bits 12..5
+	                ((uint64_t)(data[4] & 0xf8) >> 3);		// 11111x11 (bits 4..0)
+	base = (base + offset) & (TS_TIMESTAMP_WRAP - 1);
+	data[0] = (data[0] &~ 0x3b) | ((base >> 27) & 0x38) | ((base >> 28) & 0x03);
+	data[1] = (base >> 20) & 0xFF;
+	data[2] = (data[2] &~ 0xfb) | ((base >> 12) & 0xf8) | ((base >> 13) & 0x03);
+	data[3] = (base >> 5) & 0xFF;
+	data[4] = (data[4] &~ 0xf8) | ((base << 3) & 0xf8);
+}
+
+// Add signed 90kHz offset to every PCR, OPCR, PTS, DTS and ESCR in
+// num_packets consecutive TS packets. The values wrap at 2^33.
+// Returns the number of changed timestamps.
+int ts_packets_shift_timestamps(uint8_t *ts_packets, int num_packets, int64_t offset) {
+	uint64_t shift = (uint64_t)offset & (TS_TIMESTAMP_WRAP - 1);
+	int i, changed = 0;
+	for (i=0;i<num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (ts_packet[0] != 0x47)
+			continue;
+
+		// Adaptation field with PCR or OPCR
+		if (bit_on(ts_packet[3], bit_6) && ts_packet[4] && ts_packet[4] <= 183) {
+			int end = 5 + ts_packet[4];
+			int pos = 6;
+			if (bit_on(ts_packet[5], bit_5) && pos + 6 <= end) {
+				ts_shift_pcr(ts_packet + pos, shift);
+				pos += 6;
+				changed++;
+			}
+			if (bit_on(ts_packet[5], bit_4) && pos + 6 <= end) {
+				ts_shift_pcr(ts_packet + pos, shift);
+				changed++;
+			}
+		}
+
+		// PES header with PTS, DTS or ESCR
+		int payload_ofs = ts_packet_has_pes(ts_packet, NULL);
+		if (!payload_ofs)
+			continue;
+		uint8_t *data = ts_packet + payload_ofs;
+		if ((data[6] &~ 0x3f) != 0x80) // 10xxxxxx
+			continue;
+		uint8_t pts_flag  = bit_on(data[7], bit_8);
+		uint8_t dts_flag  = bit_on(data[7], bit_7);
+		uint8_t escr_flag = bit_on(data[7], bit_6);
+		int hdr_end = 9 + data[8];
+		int pos = 9;
+		if (payload_ofs + hdr_end > TS_PACKET_SIZE)
+			hdr_end = TS_PACKET_SIZE - payload_ofs;
+		if (pts_flag && pos + 5 <= hdr_end) {
+			ts_shift_pts_dts(data + pos, shift);
+			pos += 5;
+			changed++;
+			if (dts_flag && pos + 5 <= hdr_end) {
+				ts_shift_pts_dts(data + pos, shift);
+				pos += 5;
+				changed++;
+			}
+		}
+		if (escr_flag && pos + 6 <= hdr_end) {
+			ts_shift_escr(data + pos, shift);
+			changed++;
+		}
+	}
+	return changed;
+}
+
 
 int ts_packet_has_pcr(uint8_t *ts_packet) {
 	if (ts_packet[0] == 0x47) { // TS packet
@@ -11,6 +11,7 @@
 #include <time.h>
 #include <netdb.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "tsdata.h"
 
@@ -69,6 +70,16 @@ static inline int ts_packet_has_payload(uint8_t *ts_packet) {
 	return !!(ts_packet[3] & 0x10);
 }
 
+static inline int ts_packet_has_discontinuity(uint8_t *ts_packet) {
+	// Adaptation field with discontinuity_indicator set
+	return (ts_packet[3] & 0x20) && ts_packet[4] > 0 && (ts_packet[5] & 0x80);
+}
+
+static inline int ts_packet_is_random_access(uint8_t *ts_packet) {
+	// Adaptation field with random_access_indicator set
+	return (ts_packet[3] & 0x20) && ts_packet[4] > 0 && (ts_packet[5] & 0x40);
+}
+
 static inline uint8_t ts_packet_get_cont(uint8_t *ts_packet) {
 	return (ts_packet[3] &~ 0xF0);	// 1111xxxx
 }
@@ -117,11 +128,19 @@ int				ts_packet_has_pts_dts	(uint8_t *ts_packet, uint64_t *pts, uint64_t *dts);
 void			ts_packet_change_pts		(uint8_t *ts_packet, uint64_t pts);
 void			ts_packet_change_pts_dts	(uint8_t *ts_packet, uint64_t pts, uint64_t dts);
 
+int				ts_packets_shift_timestamps	(uint8_t *ts_packets, int num_packets, int64_t offset);
+
 // TS packet headers
 uint8_t *       ts_packet_header_parse    (uint8_t *ts_packet, struct ts_header *ts_header);
 void            ts_packet_header_generate (uint8_t *ts_packet, struct ts_header *ts_header);
 void            ts_packet_header_dump     (struct ts_header *ts_header);
 
+// Adaptation field
+int				ts_adapt_field_parse	(uint8_t *ts_packet, struct ts_adapt_field *af);
+int				ts_adapt_field_size		(struct ts_adapt_field *af);
+int				ts_adapt_field_generate	(uint8_t *ts_packet, struct ts_adapt_field *af, int size);
+void			ts_adapt_field_dump		(struct ts_adapt_field *af);
+
 // Sections
 uint8_t *					ts_section_header_parse		(uint8_t *ts_packet, struct ts_header *ts_header, struct ts_section_header *ts_section_header);
 void						ts_section_header_generate	(uint8_t *ts_packet, struct ts_section_header *ts_section_header, uint8_t start);
@@ -144,6 +163,7 @@ void						ts_section_add_packet		(struct ts_section_header *sec, struct ts_heade
 
 uint32_t					ts_section_data_calculate_crc	(uint8_t *section_data, int section_data_size);
 void						ts_section_data_gen_ts_packets	(struct ts_header *ts_header, uint8_t *section_data, int section_data_sz, uint8_t pointer_field, uint8_t **packets, int *num_packets);
+void						ts_section_data_gen_ts_packets_buf(struct ts_header *ts_header, uint8_t *section_data, int section_data_sz, uint8_t pointer_field, uint8_t *packets, int *num_packets);
 
 
 // PAT
@@ -172,9 +192,22 @@ void            ts_cat_clear		(struct ts_cat *cat);
 void            ts_cat_free			(struct ts_cat **cat);
 int				ts_cat_parse		(struct ts_cat *cat);
 void            ts_cat_dump			(struct ts_cat *cat);
+void			ts_cat_generate		(struct ts_cat *cat, uint8_t **ts_packets, int *num_packets);
+void			ts_cat_generate_buf	(struct ts_cat *cat, uint8_t *ts_packets, int *num_packets);
+void			ts_cat_regenerate_packets	(struct ts_cat *cat);
 struct ts_cat *	ts_cat_copy			(struct ts_cat *cat);
 int				ts_cat_is_same		(struct ts_cat *cat1, struct ts_cat *cat2);
 
+struct ts_cat *	ts_cat_init			(struct ts_cat *cat);
+struct ts_cat *	ts_cat_alloc_init	(void);
+
+void			ts_cat_begin_update	(struct ts_cat *cat);
+void			ts_cat_commit		(struct ts_cat *cat);
+
+int				ts_cat_add_descriptor		(struct ts_cat *cat, uint8_t *desc, int desc_size);
+int				ts_cat_add_ca_descriptor	(struct ts_cat *cat, uint16_t CA_id, uint16_t CA_pid);
+int				ts_cat_del_ca_descriptor	(struct ts_cat *cat, uint16_t CA_id);
+
 enum CA_system	ts_get_CA_sys		(uint16_t CA_id);
 char *			ts_get_CA_sys_txt	(enum CA_system CA_sys);
 
@@ -195,10 +228,25 @@ void            ts_pmt_free			(struct ts_pmt **pmt);
 int				ts_pmt_parse		(struct ts_pmt *pmt);
 void            ts_pmt_dump			(struct ts_pmt *pmt);
 void			ts_pmt_generate		(struct ts_pmt *pmt, uint8_t **ts_packets, int *num_packets);
+void			ts_pmt_generate_buf	(struct ts_pmt *pmt, uint8_t *ts_packets, int *num_packets);
 
 struct ts_pmt *	ts_pmt_copy					(struct ts_pmt *pmt);
 void			ts_pmt_regenerate_packets	(struct ts_pmt *pmt);
 
+struct ts_pmt *	ts_pmt_init			(struct ts_pmt *pmt, uint16_t program_number, uint16_t pmt_pid, uint16_t pcr_pid);
+struct ts_pmt *	ts_pmt_alloc_init	(uint16_t program_number, uint16_t pmt_pid, uint16_t pcr_pid);
+
+void			ts_pmt_begin_update	(struct ts_pmt *pmt);
+void			ts_pmt_commit		(struct ts_pmt *pmt);
+
+int				ts_pmt_set_pcr_pid				(struct ts_pmt *pmt, uint16_t pcr_pid);
+int				ts_pmt_add_program_descriptor	(struct ts_pmt *pmt, uint8_t *desc, int desc_size);
+int				ts_pmt_add_ca_descriptor		(struct ts_pmt *pmt, uint16_t CA_id, uint16_t CA_pid);
+int				ts_pmt_add_stream				(struct ts_pmt *pmt, uint8_t stream_type, uint16_t pid);
+int				ts_pmt_add_es_descriptor		(struct ts_pmt *pmt, uint16_t pid, uint8_t *desc, int desc_size);
+int				ts_pmt_add_es_ca_descriptor		(struct ts_pmt *pmt, uint16_t pid, uint16_t CA_id, uint16_t CA_pid);
+int				ts_pmt_del_stream				(struct ts_pmt *pmt, uint16_t pid);
+
 int				ts_pmt_is_same		(struct ts_pmt *pmt1, struct ts_pmt *pmt2);
 
 // NIT
@@ -257,15 +305,35 @@ void			ts_eit_free			(struct ts_eit **eit);
 int				ts_eit_parse		(struct ts_eit *eit);
 void			ts_eit_dump			(struct ts_eit *eit);
 void			ts_eit_generate		(struct ts_eit *eit, uint8_t **ts_packets, int *num_packets);
+void			ts_eit_generate_buf	(struct ts_eit *eit, uint8_t *ts_packets, int *num_packets);
 
 struct ts_eit *	ts_eit_copy					(struct ts_eit *eit);
 void			ts_eit_regenerate_packets	(struct ts_eit *eit);
 
+void			ts_eit_begin_update	(struct ts_eit *eit);
+void			ts_eit_commit		(struct ts_eit *eit);
+
 int				ts_eit_add_short_event_descriptor	(struct ts_eit *eit, uint16_t event_id, uint8_t running, time_t start_time, int duration_sec, char *event_name, char *event_short_descr);
 int				ts_eit_add_extended_event_descriptor(struct ts_eit *eit, uint16_t event_id, uint8_t running, time_t start_time, int duration_sec, char *text);
 
 int				ts_eit_is_same		(struct ts_eit *eit1, struct ts_eit *eit2);
 
+// EIT schedule
+struct ts_eit_sched *			ts_eit_sched_alloc_init		(uint16_t transport_stream_id, uint16_t org_network_id, time_t now, int days);
+void							ts_eit_sched_free			(struct ts_eit_sched **sched);
+struct ts_eit_sched_service *	ts_eit_sched_get_service	(struct ts_eit_sched *sched, uint16_t service_id);
+int								ts_eit_sched_set_events		(struct ts_eit_sched *sched, uint16_t service_id, struct ts_eit_event *events, int num_events);
+int								ts_eit_sched_set_time		(struct ts_eit_sched *sched, time_t now);
+void							ts_eit_sched_dump			(struct ts_eit_sched *sched);
+
+// EIT present/following
+struct ts_eit_pf *				ts_eit_pf_alloc_init		(uint16_t transport_stream_id, uint16_t org_network_id);
+void							ts_eit_pf_free				(struct ts_eit_pf **pf);
+struct ts_eit_pf_service *		ts_eit_pf_get_service		(struct ts_eit_pf *pf, uint16_t service_id);
+int								ts_eit_pf_set_events		(struct ts_eit_pf *pf, uint16_t service_id, struct ts_eit_event *events, int num_events, time_t now);
+int								ts_eit_pf_tick				(struct ts_eit_pf *pf, time_t now);
+void							ts_eit_pf_dump				(struct ts_eit_pf *pf);
+
 // TDT
 struct ts_tdt *	ts_tdt_alloc(void);
 struct ts_tdt *	ts_tdt_init			(struct ts_tdt *tdt, time_t ts);
@@ -281,6 +349,7 @@ void			ts_tdt_generate		(struct ts_tdt *tdt, uint8_t **ts_packets, int *num_pack
 void			ts_tdt_dump			(struct ts_tdt *tdt);
 
 void			ts_tdt_set_time		(struct ts_tdt *tdt, time_t ts);
+int				ts_tdt_packet_set_time	(uint8_t *ts_packet, time_t ts);
 
 void			ts_tot_set_localtime_offset			(struct ts_tdt *tdt, time_t now, time_t change_time, uint8_t polarity, uint16_t ofs, uint16_t ofs_next);
 void			ts_tot_set_localtime_offset_sofia	(struct ts_tdt *tdt, time_t now);
@@ -299,6 +368,26 @@ void				ts_privsec_dump			(struct ts_privsec *privsec);
 
 void				ts_privsec_copy			(struct ts_privsec *src, struct ts_privsec *dst);
 
+// Carousel
+struct ts_carousel *	ts_carousel_alloc		(uint32_t bitrate);
+void					ts_carousel_free		(struct ts_carousel **c);
+
+int						ts_carousel_add_section	(struct ts_carousel *c, struct ts_header *ts_header, struct ts_section_header *section_header, uint32_t interval_ms);
+int						ts_carousel_del_section	(struct ts_carousel *c, struct ts_section_header *section_header);
+int						ts_carousel_add_pat		(struct ts_carousel *c, struct ts_pat *pat, uint32_t interval_ms);
+int						ts_carousel_add_cat		(struct ts_carousel *c, struct ts_cat *cat, uint32_t interval_ms);
+int						ts_carousel_add_pmt		(struct ts_carousel *c, struct ts_pmt *pmt, uint32_t interval_ms);
+int						ts_carousel_add_nit		(struct ts_carousel *c, struct ts_nit *nit, uint32_t interval_ms);
+int						ts_carousel_add_sdt		(struct ts_carousel *c, struct ts_sdt *sdt, uint32_t interval_ms);
+int						ts_carousel_add_eit		(struct ts_carousel *c, struct ts_eit *eit, uint32_t interval_ms);
+int						ts_carousel_add_tdt		(struct ts_carousel *c, struct ts_tdt *tdt, uint32_t interval_ms);
+
+int						ts_carousel_set_pid_max_bitrate	(struct ts_carousel *c, uint16_t pid, uint32_t max_bitrate);
+
+// Returns 1 and fills ts_packet if there is a packet for this output slot
+int						ts_carousel_next_packet	(struct ts_carousel *c, uint64_t slot, uint8_t *ts_packet);
+void					ts_carousel_dump		(struct ts_carousel *c);
+
 // Time
 uint32_t		ts_time_encode_bcd	(int duration_sec);
 void			ts_time_decode_bcd	(int duration_bcd, int *duration_sec, int *hour, int *min, int *sec);
@@ -308,9 +397,12 @@ time_t			ts_time_decode_mjd	(uint16_t mjd, uint32_t bcd, struct tm *tm);
 
 // Descriptors
 void            ts_descriptor_dump      (uint8_t *desc_data, int desc_data_len);
+int             ts_descriptor_gen_ca    (uint8_t *desc, uint16_t CA_id, uint16_t CA_pid);
 int             ts_is_stream_type_video (uint8_t stream_type);
 int             ts_is_stream_type_ac3   (uint8_t stream_type);
 int             ts_is_stream_type_audio (uint8_t stream_type);
+int             ts_is_stream_type_pes   (uint8_t stream_type);
+const struct ts_stream_type_info *ts_get_stream_type_info (uint8_t stream_type);
 char *          h222_stream_type_desc   (uint8_t stream_type);
 char *			h222_stream_id_desc		(uint8_t stream_id);
 
@@ -324,21 +416,122 @@ int					ts_pes_is_finished		(struct ts_pes *pes, uint8_t *ts_packet);
 struct ts_pes *		ts_pes_push_packet		(struct ts_pes *pes, uint8_t *ts_packet, struct ts_pmt *pmt, uint16_t pid);
 
 int					ts_pes_parse			(struct ts_pes *pes);
+struct ts_pes_ext *	ts_pes_get_ext			(struct ts_pes *pes);
 void				ts_pes_dump				(struct ts_pes *pes);
 
+struct ts_pes_chunk_pool *	ts_pes_chunk_pool_alloc	(void);
+void						ts_pes_chunk_pool_free	(struct ts_pes_chunk_pool **pool);
+void						ts_pes_use_chunks		(struct ts_pes *pes, struct ts_pes_chunk_pool *pool);
+int							ts_pes_get_iovec		(struct ts_pes *pes, uint32_t offset, struct iovec *iov, int iov_max);
+uint8_t *					ts_pes_linearize		(struct ts_pes *pes);
+
+int					ts_pes_stream_push_packet	(struct ts_pes *pes, uint8_t *ts_packet, struct ts_pmt *pmt, uint16_t pid, struct ts_pes_stream_cb *cb);
+void				ts_pes_stream_flush			(struct ts_pes *pes, struct ts_pes_stream_cb *cb);
+
 struct pes_array *		pes_array_alloc			(void);
 void					pes_array_dump			(struct pes_array *pa);
 void					pes_array_free			(struct pes_array **ppa);
+void					pes_array_use_chunks	(struct pes_array *pa, struct ts_pes_chunk_pool *pool);
 
 struct pes_entry *		pes_array_push_packet	(struct pes_array *pa, uint16_t pid, struct ts_pat *pat, struct ts_pmt *pmt, uint8_t *ts_packet);
 
+// Packetizer
+int			ts_pes_header_generate		(uint8_t *pes_header, uint8_t stream_id, uint32_t es_size, uint64_t pts, uint64_t dts, int data_alignment);
+void		ts_packetizer_init			(struct ts_packetizer *p, uint16_t pid, uint8_t stream_id);
+int			ts_packetizer_num_packets	(struct ts_packetizer *p, uint32_t es_size, uint64_t pts, uint64_t dts, uint64_t pcr);
+int			ts_packetizer_push			(struct ts_packetizer *p, uint8_t *es_data, uint32_t es_size, uint64_t pts, uint64_t dts, uint64_t pcr, uint8_t *ts_packets, int max_packets);
+
+// Timestamps tracker
+struct ts_times *		ts_times_alloc			(void);
+void					ts_times_free			(struct ts_times **pt);
+struct ts_pid_times *	ts_times_get_pid		(struct ts_times *t, uint16_t pid);
+int						ts_times_push_packet	(struct ts_times *t, uint8_t *ts_packet);
+int						ts_times_push_packets	(struct ts_times *t, uint8_t *ts_packets, int num_packets);
+void					ts_times_dump			(struct ts_times *t);
+uint64_t				ts_timestamp_duration	(struct ts_timestamp *ts);
+
+// PCR clock recovery
+struct ts_clock *		ts_clock_alloc			(uint16_t pcr_pid);
+void					ts_clock_free			(struct ts_clock **pc);
+void					ts_clock_reset			(struct ts_clock *c);
+int						ts_clock_push_pcr		(struct ts_clock *c, uint64_t pos, uint64_t pcr, uint64_t arrival_us);
+int						ts_clock_push_packet	(struct ts_clock *c, uint8_t *ts_packet, uint64_t arrival_us);
+uint64_t				ts_clock_predict_pcr	(struct ts_clock *c, uint64_t pos);
+void					ts_clock_dump			(struct ts_clock *c);
+
+// PCR restamping
+struct ts_pcr_restamp *	ts_pcr_restamp_alloc		(uint32_t bitrate);
+void					ts_pcr_restamp_free			(struct ts_pcr_restamp **pr);
+void					ts_pcr_restamp_set_bitrate	(struct ts_pcr_restamp *r, uint32_t bitrate);
+int						ts_pcr_restamp_packets		(struct ts_pcr_restamp *r, uint8_t *ts_packets, int num_packets);
+void					ts_pcr_restamp_dump			(struct ts_pcr_restamp *r);
+
+// PCR measurements
+struct ts_pcr_metrics *		ts_pcr_metrics_alloc		(void);
+void						ts_pcr_metrics_free			(struct ts_pcr_metrics **pm);
+struct ts_pcr_metrics_pid *	ts_pcr_metrics_get_pid		(struct ts_pcr_metrics *m, uint16_t pid);
+int							ts_pcr_metrics_push_packet	(struct ts_pcr_metrics *m, uint8_t *ts_packet, uint64_t arrival_ns);
+void						ts_pcr_metrics_dump			(struct ts_pcr_metrics *m);
+
+// Looped file playout
+struct ts_loop *		ts_loop_open_fd			(int fd);
+struct ts_loop *		ts_loop_open			(char *filename);
+void					ts_loop_free			(struct ts_loop **pl);
+int						ts_loop_read			(struct ts_loop *l, uint8_t **ts_packets, int max_packets);
+void					ts_loop_dump			(struct ts_loop *l);
+
+// SPTS extraction
+struct ts_spts *		ts_spts_alloc			(uint16_t *programs, int programs_num, int filter_si);
+void					ts_spts_free			(struct ts_spts **ps);
+int						ts_spts_push_packets	(struct ts_spts *s, uint8_t *ts_packets, int num_packets, uint8_t *out_packets, int max_out);
+void					ts_spts_dump			(struct ts_spts *s);
+
+// MPTS multiplexer
+struct ts_mux *			ts_mux_alloc			(uint16_t transport_stream_id, uint16_t org_network_id);
+void					ts_mux_free				(struct ts_mux **pm);
+int						ts_mux_add_input		(struct ts_mux *m, uint16_t program);
+int						ts_mux_push_packets		(struct ts_mux *m, int input, uint8_t *ts_packets, int num_packets);
+int						ts_mux_get_packets		(struct ts_mux *m, uint64_t until, uint8_t *out_packets, int max_out);
+void					ts_mux_dump				(struct ts_mux *m);
+
+// CBR shaper
+struct ts_shaper *		ts_shaper_alloc			(uint32_t bitrate, int buffer_size);
+void					ts_shaper_free			(struct ts_shaper **ps);
+void					ts_shaper_set_bitrate	(struct ts_shaper *s, uint32_t bitrate);
+int						ts_shaper_push_packets	(struct ts_shaper *s, uint8_t *ts_packets, int num_packets);
+int						ts_shaper_get_packets	(struct ts_shaper *s, uint8_t *out_packets, int num_packets);
+int						ts_shaper_tick			(struct ts_shaper *s, uint64_t now_us, uint8_t *out_packets, int max_out);
+void					ts_shaper_dump			(struct ts_shaper *s);
+
+// File probe
+struct ts_probe *		ts_probe_fd				(int fd, uint32_t window_size);
+struct ts_probe *		ts_probe_file			(char *filename, uint32_t window_size);
+void					ts_probe_free			(struct ts_probe **pprobe);
+void					ts_probe_dump			(struct ts_probe *probe);
+
 // ES functions
 int		ts_pes_es_mpeg_audio_header_parse		(struct mpeg_audio_header *mpghdr, uint8_t *data, int datasz);
 void	ts_pes_es_mpeg_audio_header_dump		(struct mpeg_audio_header *mpghdr);
+int		ts_pes_es_mpeg_video_header_parse		(struct mpeg_video_header *vhdr, uint8_t *data, int datasz);
+void	ts_pes_es_mpeg_video_header_dump		(struct mpeg_video_header *vhdr);
+int		ts_pes_es_audio_header_parse			(struct es_audio_header *ahdr, enum ts_codec codec, uint8_t *data, int datasz);
+void	ts_pes_es_audio_header_dump				(struct es_audio_header *ahdr);
+enum ts_codec	ts_pes_es_audio_codec			(struct ts_pes *pes);
+int		ts_pes_es_audio_frame_iter_init			(struct ts_audio_frame_iter *it, struct ts_pes *pes);
+void	ts_audio_frame_iter_init				(struct ts_audio_frame_iter *it, enum ts_codec codec, uint8_t *data, uint32_t size, uint64_t pts);
+int		ts_audio_frame_next						(struct ts_audio_frame_iter *it, struct ts_audio_frame *frame);
 void	ts_pes_es_parse							(struct ts_pes *pes);
 void	ts_pes_es_dump							(struct ts_pes *pes);
 
 
+// NAL units
+uint8_t *	ts_nal_find_start_code	(uint8_t *data, uint8_t *end);
+void		ts_nal_iter_init		(struct ts_nal_iter *it, uint8_t *data, uint32_t size, enum ts_nal_codec codec);
+int			ts_nal_next				(struct ts_nal_iter *it, struct ts_nal *nal);
+int			ts_nal_is_rap			(uint8_t *data, uint32_t size, enum ts_nal_codec codec);
+int			ts_nal_parse_sps		(struct ts_nal *nal, enum ts_nal_codec codec, struct es_video_sps *sps);
+void		ts_nal_sps_dump			(struct es_video_sps *sps);
+
 // CRC
 uint32_t        ts_crc32      (uint8_t *data, int data_size);
 uint32_t		ts_crc32_section			(struct ts_section_header *section_header);
@@ -360,4 +553,10 @@ void			pidmap_set					(pidmap_t *pm, uint16_t pid);
 void			pidmap_set_val				(pidmap_t *pm, uint16_t pid, uint8_t val);
 int				pidmap_get					(pidmap_t *pm, uint16_t pid);
 
+void			ts_bits_init				(struct ts_bits *bits, uint8_t *data, uint32_t size);
+uint32_t		ts_bits_get					(struct ts_bits *bits, int n);
+void			ts_bits_skip				(struct ts_bits *bits, uint32_t n);
+uint32_t		ts_bits_get_ue				(struct ts_bits *bits);
+int32_t			ts_bits_get_se				(struct ts_bits *bits);
+
 #endif
@@ -5,6 +5,11 @@
  * Released under MIT license.
  * See LICENSE-MIT.txt for license terms.
  */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "tsfuncs.h"
 
 #define NOW 1234567890
@@ -35,6 +40,43 @@ void ts_pat_test(void) {
 	ts_pat_free(&pat);
 }
 
+void ts_pmt_test(void) {
+	uint8_t lang_desc[6] = { 0x0a, 4, 'b', 'u', 'l', 0 };	// ISO_639_language_descriptor
+	struct ts_pmt *pmt = ts_pmt_alloc_init(1, 0x100, 0x101);
+	ts_pmt_dump(pmt);
+
+	ts_pmt_begin_update(pmt);
+	ts_pmt_add_stream(pmt, 0x02, 0x101);
+	ts_pmt_add_stream(pmt, 0x04, 0x102);
+	ts_pmt_add_stream(pmt, 0x06, 0x103);
+	ts_pmt_add_es_descriptor(pmt, 0x102, lang_desc, sizeof(lang_desc));
+	ts_pmt_add_es_ca_descriptor(pmt, 0x101, 0x0500, 0x201);
+	ts_pmt_add_ca_descriptor(pmt, 0x0b00, 0x202);
+	ts_pmt_commit(pmt);
+	ts_pmt_dump(pmt);
+
+	ts_pmt_del_stream(pmt, 0x103);
+	ts_pmt_set_pcr_pid(pmt, 0x102);
+	ts_pmt_dump(pmt);
+
+	ts_pmt_free(&pmt);
+}
+
+void ts_cat_test(void) {
+	struct ts_cat *cat = ts_cat_alloc_init();
+	ts_cat_begin_update(cat);
+	ts_cat_add_ca_descriptor(cat, 0x0500, 0x301);
+	ts_cat_add_ca_descriptor(cat, 0x0b00, 0x302);
+	ts_cat_add_ca_descriptor(cat, 0x0d00, 0x303);
+	ts_cat_commit(cat);
+	ts_cat_dump(cat);
+
+	ts_cat_del_ca_descriptor(cat, 0x0b00);
+	ts_cat_dump(cat);
+
+	ts_cat_free(&cat);
+}
+
 void ts_tdt_test(void) {
 	struct ts_tdt *tdt = ts_tdt_alloc_init(NOW);
 	ts_tdt_dump(tdt);
@@ -58,6 +100,8 @@ void ts_tot_test(void) {
 	tot = ts_tot_alloc_init(NOW2);
 	ts_tot_set_localtime_offset_sofia(tot, NOW2);
 	ts_tdt_dump(tot);
+	ts_tdt_set_time(tot, NOW);
+	ts_tdt_dump(tot);
 	ts_tdt_free(&tot);
 }
 
@@ -141,11 +185,1463 @@ void ts_eit_test(void) {
 //	write(1, eit->section_header->packet_data, eit->section_header->num_packets * TS_PACKET_SIZE);
 }
 
+void ts_carousel_test(void) {
+	int i, pat_packets = 0, sdt_packets = 0, tdt_packets = 0, cc_errors = 0;
+	uint8_t ts_packet[TS_PACKET_SIZE];
+	uint8_t last_cc[3] = { 0x0f, 0x0f, 0x0f };
+
+	struct ts_pat *pat = ts_pat_alloc_init(0x7878);
+	ts_pat_add_program(pat, 1, 0x100);
+	struct ts_sdt *sdt = ts_sdt_alloc_init(1, 0x7878);
+	ts_sdt_add_service_descriptor(sdt, 1, 1, "PROVIDER", "SERVICE");
+	struct ts_tdt *tdt = ts_tdt_alloc_init(NOW);
+
+	// 1 Mbit/s output, ~665 packets per second
+	struct ts_carousel *c = ts_carousel_alloc(1000000);
+	ts_carousel_add_pat(c, pat, 100);
+	ts_carousel_add_sdt(c, sdt, 500);
+	ts_carousel_add_tdt(c, tdt, 1000);
+	ts_carousel_set_pid_max_bitrate(c, 0x11, 8 * TS_PACKET_SIZE * 10); // Max 10 packets per second
+
+	for (i=0;i<2000;i++) {
+		if (!ts_carousel_next_packet(c, i, ts_packet))
+			continue;
+		int idx = -1;
+		switch (ts_packet_get_pid(ts_packet)) {
+			case 0x00: pat_packets++; idx = 0; break;
+			case 0x11: sdt_packets++; idx = 1; break;
+			case 0x14: tdt_packets++; idx = 2; break;
+		}
+		if (idx >= 0) {
+			if (ts_packet_get_cont(ts_packet) != ((last_cc[idx] + 1) & 0x0f))
+				cc_errors++;
+			last_cc[idx] = ts_packet_get_cont(ts_packet);
+		}
+	}
+	ts_carousel_dump(c);
+	ts_LOGf("Carousel packets PAT:%d SDT:%d TDT:%d cc_errors:%d\n", pat_packets, sdt_packets, tdt_packets, cc_errors);
+	ts_carousel_free(&c);
+
+	// Table added at runtime is sent without waiting for the other deadlines
+	int sdt_slot = -1;
+	c = ts_carousel_alloc(1000000);
+	ts_carousel_add_pat(c, pat, 1000);
+	for (i=0;i<2000 && sdt_slot < 0;i++) {
+		if (i == 10)
+			ts_carousel_add_sdt(c, sdt, 500);
+		if (ts_carousel_next_packet(c, i, ts_packet) && ts_packet_get_pid(ts_packet) == 0x11)
+			sdt_slot = i;
+	}
+	ts_LOGf("Carousel SDT added at slot 10, sent at slot %d\n", sdt_slot);
+
+	ts_carousel_free(&c);
+	ts_pat_free(&pat);
+	ts_sdt_free(&sdt);
+	ts_tdt_free(&tdt);
+}
+
+void ts_eit_sched_test(void) {
+	int i;
+	char names[32][32];
+	struct ts_eit_event events[32];
+	time_t start = NOW - (NOW % 86400);
+
+	// Two days, event every 90 minutes
+	for (i=0;i<32;i++) {
+		snprintf(names[i], sizeof(names[i]), "Event %d", i);
+		events[i].event_id          = 100 + i;
+		events[i].start_time        = start + i * 90 * 60;
+		events[i].duration_sec      = 90 * 60;
+		events[i].running           = 0;
+		events[i].event_name        = names[i];
+		events[i].event_short_descr = "Short event description";
+	}
+
+	struct ts_eit_sched *sched = ts_eit_sched_alloc_init(0x7878, 0x1234, NOW, 2);
+	ts_eit_sched_set_events(sched, 1, events, 32);
+	ts_eit_sched_dump(sched);
+
+	// Change one event in the second day, only its segment must be regenerated
+	strcpy(names[20], "Changed event");
+	ts_eit_sched_set_events(sched, 1, events, 32);
+	ts_eit_sched_dump(sched);
+
+	// Check the first section of the patched segment
+	struct ts_eit_sched_service *svc = ts_eit_sched_get_service(sched, 1);
+	struct ts_eit *eit = ts_eit_alloc();
+	for (i=0;i<svc->segments[0].section_packets[0];i++) {
+		eit = ts_eit_push_packet(eit, svc->segments[0].packets + i * TS_PACKET_SIZE);
+	}
+	ts_eit_dump(eit);
+	ts_eit_free(&eit);
+
+	// Next day, the second day becomes the first one
+	ts_LOGf("EIT schedule same day:%d next day:%d\n",
+		ts_eit_sched_set_time(sched, NOW + 60), ts_eit_sched_set_time(sched, start + 86400));
+	ts_eit_sched_set_events(sched, 1, events, 32);
+	ts_eit_sched_dump(sched);
+
+	ts_eit_sched_free(&sched);
+}
+
+void ts_eit_pf_test(void) {
+	int i, changed;
+	struct ts_eit_event events[3];
+	char *names[3] = { "News", "Movie", "Weather" };
+	int durations[3] = { 1800, 5400, 600 };
+	time_t start = NOW;
+
+	for (i=0;i<3;i++) {
+		events[i].event_id          = 200 + i;
+		events[i].start_time        = start;
+		events[i].duration_sec      = durations[i];
+		events[i].running           = 0;
+		events[i].event_name        = names[i];
+		events[i].event_short_descr = NULL;
+		start += durations[i];
+	}
+
+	struct ts_eit_pf *pf = ts_eit_pf_alloc_init(0x7878, 0x1234);
+	ts_eit_pf_set_events(pf, 1, events, 3, NOW - 60);	// Before the first event
+	ts_eit_pf_set_events(pf, 2, events, 1, NOW);		// Only one event
+	ts_eit_pf_dump(pf);
+
+	time_t ticks[5] = { NOW - 1, NOW, NOW + 1799, NOW + 1800, NOW + 7200 };
+	for (i=0;i<5;i++) {
+		changed = ts_eit_pf_tick(pf, ticks[i]);
+		ts_LOGf("EIT p/f tick %ld changed %d\n", (long)(ticks[i] - NOW), changed);
+	}
+	ts_eit_pf_dump(pf);
+
+	struct ts_eit_pf_service *svc = ts_eit_pf_get_service(pf, 1);
+	ts_eit_dump(svc->eit_present);
+	ts_eit_dump(svc->eit_following);
+
+	// Overlapping events and events with the same start_time
+	struct ts_eit_event overlap[4];
+	time_t starts[4] = { NOW, NOW + 600, NOW + 600, NOW + 3000 };
+	int overlap_durations[4] = { 1800, 1800, 600, 600 };
+	for (i=0;i<4;i++) {
+		overlap[i] = events[0];
+		overlap[i].event_id     = 300 + i;
+		overlap[i].start_time   = starts[i];
+		overlap[i].duration_sec = overlap_durations[i];
+	}
+	ts_eit_pf_set_events(pf, 3, overlap, 4, NOW);
+	svc = ts_eit_pf_get_service(pf, 3);
+	time_t overlap_ticks[4] = { NOW + 1, NOW + 600, NOW + 700, NOW + 1800 };
+	for (i=0;i<4;i++) {
+		changed = ts_eit_pf_tick(pf, overlap_ticks[i]);
+		ts_LOGf("EIT p/f overlap tick %ld changed %d present %d following %d next_change %ld\n",
+			(long)(overlap_ticks[i] - NOW), changed,
+			svc->present   >= 0 ? svc->events[svc->present].event_id   : -1,
+			svc->following >= 0 ? svc->events[svc->following].event_id : -1,
+			(long)(svc->next_change - NOW));
+	}
+
+	ts_eit_pf_free(&pf);
+}
+
+// Generate video PES (pes_packet_len == 0) with pes_size bytes (must be multiple of 184) in TS packets
+int ts_gen_test_pes(uint8_t *ts_packets, uint16_t pid, uint8_t *pes_data, int pes_size, uint64_t pts) {
+	struct ts_header ts_header;
+	int i, num_packets = pes_size / 184;
+	memset(&ts_header, 0, sizeof(ts_header));
+	ts_header.pid           = pid;
+	ts_header.payload_field = 1;
+
+	memcpy(pes_data, "\x00\x00\x01\xe0\x00\x00\x80\x80\x05", 9);
+	ts_encode_pts_dts(pes_data + 9, 2, pts);
+	for (i=14;i<pes_size;i++) {
+		pes_data[i] = i * 7;
+	}
+	for (i=0;i<num_packets;i++) {
+		ts_header.pusi       = i == 0;
+		ts_header.continuity = i;
+		ts_packet_header_generate(ts_packets + i * TS_PACKET_SIZE, &ts_header);
+		memcpy(ts_packets + i * TS_PACKET_SIZE + 4, pes_data + i * 184, 184);
+	}
+	return num_packets;
+}
+
+void ts_pes_chunks_test(void) {
+	int i, pes_size = 184 * 1100;
+	uint8_t *pes_data   = malloc(pes_size);
+	uint8_t *ts_packets = malloc((pes_size / 184 + 1) * TS_PACKET_SIZE);
+	int num_packets = ts_gen_test_pes(ts_packets, 0x100, pes_data, pes_size, 900000);
+	// The next PES start finishes the video PES
+	uint8_t next_pes[184];
+	ts_gen_test_pes(ts_packets + num_packets * TS_PACKET_SIZE, 0x100, next_pes, 184, 903600);
+
+	struct ts_pes_chunk_pool *pool = ts_pes_chunk_pool_alloc();
+	struct ts_pes *pes = ts_pes_alloc();
+	ts_pes_use_chunks(pes, pool);
+	for (i=0;i<=num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (ts_pes_is_finished(pes, ts_packet))
+			break;
+		pes = ts_pes_push_packet(pes, ts_packet, NULL, 0x100);
+	}
+
+	struct iovec iov[8];
+	int iovcnt = ts_pes_get_iovec(pes, 0, iov, 8);
+	int pos = 0, same = 1;
+	for (i=0;i<iovcnt;i++) {
+		same = same && memcmp(pes_data + pos, iov[i].iov_base, iov[i].iov_len) == 0;
+		pos += iov[i].iov_len;
+	}
+	ts_LOGf("PES chunks: initialized:%d PTS:%llu size:%u chunks:%d iovcnt:%d iov_size:%d same:%d pool allocated:%d\n",
+		pes->initialized, (unsigned long long)pes->PTS, pes->pes_data_pos, pes->chunks_num, iovcnt, pos, same, pool->allocated);
+
+	uint8_t *data = ts_pes_linearize(pes);
+	ts_LOGf("PES linearized: same:%d es_data_ok:%d chunks:%d pool free:%d\n",
+		memcmp(data, pes_data, pes_size) == 0, pes->es_data == data + 14, pes->chunks_num, pool->free_num);
+
+	ts_pes_free(&pes);
+	ts_pes_chunk_pool_free(&pool);
+	free(ts_packets);
+	free(pes_data);
+}
+
+// ES parsing of PES bigger than one chunk must see the whole ES data
+void ts_pes_chunks_es_test(void) {
+	int i, pes_size = 184 * 800;
+	uint8_t *pes_data   = malloc(pes_size);
+	uint8_t *ts_packets = malloc((pes_size / 184 + 1) * TS_PACKET_SIZE);
+	int num_packets = ts_gen_test_pes(ts_packets, 0x100, pes_data, pes_size, 900000);
+	uint8_t next_pes[184];
+	ts_gen_test_pes(ts_packets + num_packets * TS_PACKET_SIZE, 0x100, next_pes, 184, 903600);
+	ts_packets[4 + 6] |= 0x04; // data_alignment_indicator, the ES data is parsed
+
+	struct ts_pmt *pmt = ts_pmt_alloc_init(1, 0x30, 0x100);
+	ts_pmt_add_stream(pmt, 0x1b, 0x100); // H.264, NAL units are searched in the whole ES data
+	struct ts_pes_chunk_pool *pool = ts_pes_chunk_pool_alloc();
+	struct ts_pes *pes = ts_pes_alloc();
+	ts_pes_use_chunks(pes, pool);
+	for (i=0;i<=num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (ts_pes_is_finished(pes, ts_packet))
+			break;
+		pes = ts_pes_push_packet(pes, ts_packet, pmt, 0x100);
+	}
+	ts_LOGf("PES chunks ES: initialized:%d h264:%d chunks:%d es_data_size:%u es_data_chunk_size:%u es_data_ok:%d\n",
+		pes->initialized, pes->is_video_h264, pes->chunks_num, pes->es_data_size, pes->es_data_chunk_size,
+		pes->es_data == pes->pes_data + 14 && memcmp(pes->es_data, pes_data + 14, pes->es_data_size) == 0);
+
+	ts_pes_free(&pes);
+	ts_pes_chunk_pool_free(&pool);
+	ts_pmt_free(&pmt);
+	free(ts_packets);
+	free(pes_data);
+}
+
+void ts_pes_ext_test(void) {
+	uint8_t ts_packets[2 * TS_PACKET_SIZE];
+	uint8_t pes_data[184], next_pes[184];
+	uint64_t escr_base = 2700000, escr_ext = 123;
+	int i;
+
+	ts_gen_test_pes(ts_packets + TS_PACKET_SIZE, 0x100, next_pes, 184, 903600);
+	// PES with PTS, ESCR, two stuffing bytes and ES data that starts with 0xff
+	memset(pes_data, 0xff, sizeof(pes_data));
+	memcpy(pes_data, "\x00\x00\x01\xe0\x00\x00\x80\xa0\x0d", 9);
+	ts_encode_pts_dts(pes_data + 9, 2, 900000);
+	pes_data[14] = 0xc4 | ((escr_base >> 27) & 0x38) | ((escr_base >> 28) & 0x03);
+	pes_data[15] = escr_base >> 20;
+	pes_data[16] = (((escr_base >> 15) & 0x1f) << 3) | 0x04 | ((escr_base >> 13) & 0x03);
+	pes_data[17] = escr_base >> 5;
+	pes_data[18] = ((escr_base & 0x1f) << 3) | 0x04 | ((escr_ext >> 7) & 0x03);
+	pes_data[19] = (escr_ext << 1) | 0x01;
+	pes_data[23] = 0xf1;
+	memcpy(ts_packets, ts_packets + TS_PACKET_SIZE, 4);
+	ts_packets[3] = 0x10;
+	memcpy(ts_packets + 4, pes_data, 184);
+
+	struct ts_pes *pes = ts_pes_alloc();
+	for (i=0;i<2;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (ts_pes_is_finished(pes, ts_packet))
+			break;
+		pes = ts_pes_push_packet(pes, ts_packet, NULL, 0x100);
+	}
+
+	struct ts_pes_ext *ext = ts_pes_get_ext(pes);
+	ts_LOGf("PES ext: PTS:%llu es_data_pos:%d es_data:%02x%02x ESCR:%llu ext_decoded:%d\n",
+		(unsigned long long)pes->PTS, (int)(pes->es_data - pes->pes_data), pes->es_data[0], pes->es_data[1],
+		ext ? (unsigned long long)ext->ESCR : 0, pes->ext_decoded);
+	ts_pes_clear(pes);
+	ts_LOGf("PES ext cleared: ext_decoded:%d ext_kept:%d get_ext:%d hot_size:%d\n",
+		pes->ext_decoded, pes->ext == ext, ts_pes_get_ext(pes) != NULL, (int)offsetof(struct ts_pes, es_data));
+	ts_pes_free(&pes);
+}
+
+struct pes_stream_stats {
+	int			headers;
+	int			ends;
+	uint32_t	payload_size;
+	uint32_t	payload_sum;
+	uint64_t	first_pts;
+};
+
+static void pes_stream_header(void *data, struct ts_pes *pes) {
+	struct pes_stream_stats *st = data;
+	if (!st->headers++)
+		st->first_pts = pes->PTS;
+}
+
+static void pes_stream_payload(void *data, struct ts_pes *pes, uint8_t *es_data, int size) {
+	struct pes_stream_stats *st = data;
+	int i;
+	(void)pes;
+	for (i=0;i<size;i++) {
+		st->payload_sum += es_data[i];
+	}
+	st->payload_size += size;
+}
+
+static void pes_stream_end(void *data, struct ts_pes *pes) {
+	struct pes_stream_stats *st = data;
+	(void)pes;
+	st->ends++;
+}
+
+void ts_pes_stream_test(void) {
+	int i, pes_size = 184 * 100;
+	uint8_t *pes_data   = malloc(pes_size);
+	uint8_t *ts_packets = malloc((pes_size / 184 + 1) * TS_PACKET_SIZE);
+	int num_packets = ts_gen_test_pes(ts_packets, 0x100, pes_data, pes_size, 900000);
+	uint8_t next_pes[184];
+	ts_gen_test_pes(ts_packets + num_packets * TS_PACKET_SIZE, 0x100, next_pes, 184, 903600);
+
+	struct pes_stream_stats st;
+	memset(&st, 0, sizeof(st));
+	struct ts_pes_stream_cb cb = { pes_stream_header, pes_stream_payload, pes_stream_end, &st };
+
+	uint32_t expected_sum = 0;
+	for (i=14;i<pes_size;i++)
+		expected_sum += pes_data[i];
+	for (i=14;i<184;i++)
+		expected_sum += next_pes[i];
+
+	struct ts_pes *pes = ts_pes_alloc();
+	for (i=0;i<=num_packets;i++) {
+		ts_pes_stream_push_packet(pes, ts_packets + i * TS_PACKET_SIZE, NULL, 0x100, &cb);
+	}
+	ts_pes_stream_flush(pes, &cb);
+	ts_LOGf("PES stream: headers:%d ends:%d first_pts:%llu payload_size:%u sum_ok:%d\n",
+		st.headers, st.ends, (unsigned long long)st.first_pts, st.payload_size, st.payload_sum == expected_sum);
+
+	ts_pes_free(&pes);
+	free(ts_packets);
+	free(pes_data);
+}
+
+void pes_array_test(void) {
+	int i, j, finished = 0, num_packets = 0;
+	uint8_t pes_data[184 * 10];
+	uint8_t *ts_packets = malloc(41 * TS_PACKET_SIZE);
+
+	struct ts_pat *pat = ts_pat_alloc_init(0x7878);
+	ts_pat_add_program(pat, 1, 0x100);
+	struct ts_pmt *pmt = ts_pmt_alloc_init(1, 0x100, 0x101);
+	ts_pmt_add_stream(pmt, 0x02, 0x101);
+
+	for (i=0;i<4;i++) {
+		num_packets += ts_gen_test_pes(ts_packets + num_packets * TS_PACKET_SIZE, 0x101, pes_data, i < 3 ? sizeof(pes_data) : 184, 900000 + i * 3600);
+	}
+
+	struct pes_array *pa = pes_array_alloc();
+	for (j=0;j<3;j++) { // Loop the input to check PES reuse
+		for (i=0;i<num_packets;i++) {
+			struct pes_entry *e = pes_array_push_packet(pa, 0x101, pat, pmt, ts_packets + i * TS_PACKET_SIZE);
+			if (e && e->pes_next && e->pes->initialized)
+				finished++;
+		}
+	}
+	ts_LOGf("pes_array: entries:%d finished:%d pes_pool:%d\n", pa->cur, finished, pa->pes_pool_num);
+
+	pes_array_free(&pa);
+	ts_pmt_free(&pmt);
+	ts_pat_free(&pat);
+	free(ts_packets);
+}
+
+void ts_times_test(void) {
+	uint8_t ts_packets[32 * TS_PACKET_SIZE];
+	uint8_t pes_data[184];
+	uint64_t pts = TS_TIMESTAMP_WRAP - 3 * 3600;
+	int i, n = 0;
+
+	// Video PID with PTS wrap, then discontinuity_indicator and a jump without it
+	for (i=0;i<20;i++) {
+		uint8_t *ts_packet = ts_packets + n++ * TS_PACKET_SIZE;
+		if (i == 10) {
+			memset(ts_packet, 0xff, TS_PACKET_SIZE);
+			ts_packet[0] = 0x47;
+			ts_packet_set_pid(ts_packet, 0x100);
+			ts_packet[3] = 0x20; // Adaptation field only
+			ts_packet[4] = 183;
+			ts_packet[5] = 0x80; // discontinuity_indicator
+			pts = 900000;
+			continue;
+		}
+		if (i == 15)
+			pts += 60 * 90000;
+		ts_gen_test_pes(ts_packet, 0x100, pes_data, 184, pts & (TS_TIMESTAMP_WRAP - 1));
+		pts += 3600;
+	}
+	// Second PID with PTS and DTS
+	for (i=0;i<5;i++) {
+		uint8_t *ts_packet = ts_packets + n++ * TS_PACKET_SIZE;
+		ts_gen_test_pes(ts_packet, 0x101, pes_data, 184, 0);
+		ts_packet[4 + 7] = 0xc0; // PTS and DTS
+		ts_packet[4 + 8] = 10;
+		ts_packet_change_pts_dts(ts_packet, 180000 + i * 3600 + 7200, 180000 + i * 3600);
+	}
+
+	struct ts_times *t = ts_times_alloc();
+	int found = ts_times_push_packets(t, ts_packets, n);
+	ts_LOGf("Timestamps found:%d pids:%d\n", found, t->pids_num);
+	ts_times_dump(t);
+	ts_times_free(&t);
+}
+
+// 1000 packets per second, PCR on PID 0x100 every 10 packets, PTS on PID 0x101 every 40 packets
+static void ts_gen_test_file(FILE *f, int num_packets, int jump_at, uint64_t jump) {
+	uint8_t ts_packet[TS_PACKET_SIZE], pes_data[184];
+	uint64_t pcr = 27000000;
+	int i;
+	for (i=0;i<num_packets;i++) {
+		if (i == jump_at)
+			pcr += jump * 300;
+		if (i % 40 == 5) {
+			ts_gen_test_pes(ts_packet, 0x101, pes_data, 184, pcr / 300 + 45000);
+		} else {
+			memset(ts_packet, 0xff, TS_PACKET_SIZE);
+			ts_packet[0] = 0x47;
+			ts_packet_set_pid(ts_packet, 0x100);
+			ts_packet[3] = 0x10 | (i & 0x0f);
+			if (i % 10 == 0) {
+				ts_packet[3] |= 0x20;
+				ts_packet[4] = 7;
+				ts_packet[5] = 0x10; // PCR flag
+				ts_packet_set_pcr(ts_packet, pcr);
+			}
+		}
+		fwrite(ts_packet, TS_PACKET_SIZE, 1, f);
+		pcr += 27000;
+	}
+}
+
+void ts_probe_test(void) {
+	FILE *f = tmpfile();
+	ts_gen_test_file(f, 20000, -1, 0);
+	fflush(f);
+	struct ts_probe *probe = ts_probe_fd(fileno(f), 64 * 1024);
+	ts_probe_dump(probe);
+	ts_probe_free(&probe);
+	fclose(f);
+
+	// Discontinuity between the head and tail windows needs full scan
+	f = tmpfile();
+	ts_gen_test_file(f, 20000, 10000, 3600 * 90000);
+	fflush(f);
+	probe = ts_probe_fd(fileno(f), 64 * 1024);
+	ts_probe_dump(probe);
+	ts_probe_free(&probe);
+	fclose(f);
+}
+
+void ts_nal_test(void) {
+	static const uint8_t avc_au[] = {
+		0x00, 0x00, 0x00, 0x01, 0x09, 0xf0,								// AUD
+		0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x28, 0xac, 0x00, 0x00,	// SPS ending with zero bytes
+		0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,						// PPS
+		0x00, 0x00, 0x01, 0x06, 0x05, 0x00, 0x00, 0x03, 0x01, 0x80,		// SEI with emulation prevention
+		0x00, 0x00, 0x01, 0x65, 0x88, 0x84, 0x00, 0x33, 0xff,			// IDR slice
+	};
+	static const uint8_t hevc_au[] = {
+		0x00, 0x00, 0x00, 0x01, 0x46, 0x01, 0x10,						// AUD
+		0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0c,						// VPS
+		0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01,						// SPS
+		0x00, 0x00, 0x00, 0x01, 0x44, 0x01, 0xc1,						// PPS
+		0x00, 0x00, 0x00, 0x01, 0x2a, 0x01, 0xaf,						// CRA slice
+	};
+	struct ts_nal_iter it;
+	struct ts_nal nal;
+	char types[256];
+	int i, pos;
+
+	pos = 0;
+	ts_nal_iter_init(&it, (uint8_t *)avc_au, sizeof(avc_au), NAL_CODEC_AVC);
+	while (ts_nal_next(&it, &nal))
+		pos += snprintf(types + pos, sizeof(types) - pos, " %d/%d%s%s%s%s%s%s", nal.type, nal.size,
+			nal.is_aud ? "aud" : "", nal.is_sps ? "sps" : "", nal.is_pps ? "pps" : "",
+			nal.is_sei ? "sei" : "", nal.is_idr ? "idr" : "", nal.is_rap ? "+rap" : "");
+	ts_LOGf("NAL AVC:%s rap:%d\n", types, ts_nal_is_rap((uint8_t *)avc_au, sizeof(avc_au), NAL_CODEC_AVC));
+
+	pos = 0;
+	ts_nal_iter_init(&it, (uint8_t *)hevc_au, sizeof(hevc_au), NAL_CODEC_HEVC);
+	while (ts_nal_next(&it, &nal))
+		pos += snprintf(types + pos, sizeof(types) - pos, " %d/%d%s%s%s%s%s", nal.type, nal.size,
+			nal.is_aud ? "aud" : "", nal.is_vps ? "vps" : "", nal.is_sps ? "sps" : "",
+			nal.is_pps ? "pps" : "", nal.is_rap ? "+rap" : "");
+	ts_LOGf("NAL HEVC:%s rap:%d\n", types, ts_nal_is_rap((uint8_t *)hevc_au, sizeof(hevc_au), NAL_CODEC_HEVC));
+
+	// Start codes at every alignment must be found, compare with simple search
+	int size = 64 * 1024, found = 0, expected = 0;
+	uint8_t *data = malloc(size);
+	for (i=0;i<size;i++)
+		data[i] = (i * 37 + i / 7) | 0x02;
+	for (i=5;i+3<size;i+=i%97+3)
+		memcpy(data + i, "\x00\x00\x01", 3);
+	for (i=0;i+3<=size;i++)
+		expected += data[i] == 0 && data[i+1] == 0 && data[i+2] == 1;
+	uint8_t *p = data, *end = data + size;
+	while ((p = ts_nal_find_start_code(p, end))) {
+		found++;
+		p++;
+	}
+	ts_LOGf("NAL start codes: expected:%d found:%d\n", expected, found);
+	free(data);
+}
+
+void ts_mpeg_video_test(void) {
+	static const uint8_t es[] = {
+		0x00, 0x00, 0x01, 0xb3, 0x2d, 0x02, 0x40, 0x33, 0x24, 0x9f, 0x23, 0x80,	// Sequence header 720x576 25 fps 15 Mbit/s
+		0x00, 0x00, 0x01, 0xb5, 0x14, 0x82, 0x00, 0x01, 0x00, 0x00,				// Sequence extension
+		0x00, 0x00, 0x01, 0xb8, 0x29, 0x4b, 0xc6, 0x40,							// GOP 10:20:30:12 closed
+		0x00, 0x00, 0x01, 0x00, 0x00, 0x8f, 0xff, 0xf8,							// I picture
+		0x00, 0x00, 0x01, 0x01, 0x12, 0x34,										// Slice
+	};
+	uint8_t ts_packets[2 * TS_PACKET_SIZE];
+	uint8_t pes_data[184], next_pes[184];
+	int i;
+
+	ts_gen_test_pes(ts_packets, 0x100, pes_data, 184, 900000);
+	ts_gen_test_pes(ts_packets + TS_PACKET_SIZE, 0x100, next_pes, 184, 903600);
+	ts_packets[4 + 6] = 0x84; // data_alignment
+	memcpy(ts_packets + 4 + 14, es, sizeof(es));
+
+	struct ts_pmt *pmt = ts_pmt_alloc_init(1, 0x30, 0x100);
+	ts_pmt_add_stream(pmt, STREAM_TYPE_MPEG2_VIDEO, 0x100);
+
+	struct ts_pes *pes = ts_pes_alloc();
+	for (i=0;i<2;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (ts_pes_is_finished(pes, ts_packet))
+			break;
+		pes = ts_pes_push_packet(pes, ts_packet, pmt, 0x100);
+	}
+	ts_LOGf("MPEG video: mpeg2:%d rap:%d\n", pes->is_video_mpeg2, pes->is_rap);
+	ts_pes_es_dump(pes);
+
+	ts_pes_free(&pes);
+	ts_pmt_free(&pmt);
+}
+
+static struct ts_pes *ts_es_test_pes(struct ts_pmt *pmt, uint16_t pid, uint8_t stream_id, const uint8_t *es, int es_size) {
+	uint8_t ts_packets[2 * TS_PACKET_SIZE];
+	uint8_t pes_data[184], next_pes[184];
+	int i;
+
+	ts_gen_test_pes(ts_packets, pid, pes_data, 184, 900000);
+	ts_gen_test_pes(ts_packets + TS_PACKET_SIZE, pid, next_pes, 184, 903600);
+	ts_packets[4 + 3] = stream_id;
+	ts_packets[4 + 6] = 0x84; // data_alignment
+	memcpy(ts_packets + 4 + 14, es, es_size);
+
+	struct ts_pes *pes = ts_pes_alloc();
+	for (i=0;i<2;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (ts_pes_is_finished(pes, ts_packet))
+			break;
+		pes = ts_pes_push_packet(pes, ts_packet, pmt, pid);
+	}
+	return pes;
+}
+
+void ts_stream_types_test(void) {
+	static const uint8_t hevc[] = {
+		0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0c,						// VPS
+		0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x02, 0x20, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00, 0x00, 0x03,
+		0x00, 0x00, 0x03, 0x00, 0x99, 0xa0, 0x01, 0xe0, 0x20, 0x02, 0x1c, 0x4d, 0xc0,	// SPS 3840x2160 Main10
+		0x00, 0x00, 0x00, 0x01, 0x26, 0x01, 0xaf,						// IDR slice
+	};
+	static const uint8_t avc[] = {
+		0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x40,	// SPS 1920x1080 High
+		0x00, 0x00, 0x01, 0x41, 0x9a, 0x00,								// Non IDR slice
+	};
+	static const uint8_t adts[] = { 0xff, 0xf1, 0x4c, 0x80, 0x2e, 0x7f, 0xfc };	// LC 48 kHz stereo, 371 bytes
+	static const uint8_t latm[] = { 0x56, 0xe1, 0x00, 0x20, 0x00, 0x11, 0x90 };	// LC 48 kHz stereo, 259 bytes
+	static const uint8_t ac3[]  = { 0x0b, 0x77, 0x00, 0x00, 0x1c, 0x40, 0xe1 };	// 384 kbit/s 48 kHz 3/2+LFE
+	static const uint8_t eac3[] = { 0x0b, 0x77, 0x01, 0x7f, 0x34, 0x80, 0x00 };	// 768 bytes 48 kHz 2/0
+	static const uint8_t dts[]  = { 0x7f, 0xfe, 0x80, 0x01, 0xfc, 0x3c, 0x7f, 0xf2, 0x75, 0xe0, 0x02, 0x80 };
+	static const uint8_t ac4[]  = { 0xac, 0x40, 0x02, 0x00, 0x80, 0x04, 0x80 };	// 25 fps 48 kHz
+	static const uint8_t ac4_120[] = { 0xac, 0x40, 0x02, 0x00, 0x80, 0x07, 0x00 };	// 120 fps 48 kHz
+	static const uint8_t opus[] = { 0x7f, 0xe0, 0x50, 0xfc };						// CELT 20 ms stereo
+	static const struct {
+		uint8_t			stream_type;
+		uint8_t			stream_id;
+		char			*desc;
+		int				desc_size;
+		const uint8_t	*es;
+		int				es_size;
+	} streams[] = {
+		{ STREAM_TYPE_HEVC_VIDEO,		0xe0, NULL, 0,						hevc, sizeof(hevc) },
+		{ STREAM_TYPE_AVC_VIDEO,		0xe0, NULL, 0,						avc,  sizeof(avc)  },
+		{ STREAM_TYPE_ADTS_AUDIO,		0xc0, NULL, 0,						adts, sizeof(adts) },
+		{ STREAM_TYPE_LATM_AUDIO,		0xc0, NULL, 0,						latm, sizeof(latm) },
+		{ STREAM_TYPE_DOLBY_DVB_AUDIO,	0xbd, "\x6a\x01\x00", 3,			ac3,  sizeof(ac3)  },
+		{ STREAM_TYPE_DOLBY_DVB_AUDIO,	0xbd, "\x7a\x01\x00", 3,			eac3, sizeof(eac3) },
+		{ STREAM_TYPE_EAC3_ATSC_AUDIO,	0xbd, NULL, 0,						eac3, sizeof(eac3) },
+		{ STREAM_TYPE_DOLBY_DVB_AUDIO,	0xbd, "\x7b\x01\x00", 3,			dts,  sizeof(dts)  },
+		{ STREAM_TYPE_DOLBY_DVB_AUDIO,	0xbd, "\x7f\x01\x15", 3,			ac4,  sizeof(ac4)  },
+		{ STREAM_TYPE_DOLBY_DVB_AUDIO,	0xbd, "\x7f\x01\x15", 3,			ac4_120, sizeof(ac4_120) },
+		{ STREAM_TYPE_DOLBY_DVB_AUDIO,	0xbd, "\x05\x04Opus\x7f\x02\x80\x02", 10,	opus, sizeof(opus) },
+	};
+	int i, n = sizeof(streams) / sizeof(streams[0]);
+
+	struct ts_pmt *pmt = ts_pmt_alloc_init(1, 0x30, 0x100);
+	for (i=0;i<n;i++) {
+		ts_pmt_add_stream(pmt, streams[i].stream_type, 0x100 + i);
+		if (streams[i].desc)
+			ts_pmt_add_es_descriptor(pmt, 0x100 + i, (uint8_t *)streams[i].desc, streams[i].desc_size);
+	}
+
+	for (i=0;i<n;i++) {
+		const struct ts_stream_type_info *info = ts_get_stream_type_info(streams[i].stream_type);
+		ts_LOGf("Stream type 0x%02x: video:%d audio:%d pes:%d codec:%d %s\n", streams[i].stream_type,
+			info->is_video, info->is_audio, info->is_pes, info->codec, h222_stream_type_desc(streams[i].stream_type));
+		struct ts_pes *pes = ts_es_test_pes(pmt, 0x100 + i, streams[i].stream_id, streams[i].es, streams[i].es_size);
+		ts_LOGf("  PID %03x: video:%d audio:%d hevc:%d h264:%d aac:%d latm:%d ac3:%d eac3:%d ac4:%d dts:%d opus:%d rap:%d\n",
+			0x100 + i, pes->is_video, pes->is_audio, pes->is_video_hevc, pes->is_video_h264,
+			pes->is_audio_aac, pes->is_audio_latm, pes->is_audio_ac3, pes->is_audio_eac3,
+			pes->is_audio_ac4, pes->is_audio_dts, pes->is_audio_opus, pes->is_rap);
+		ts_pes_es_dump(pes);
+		ts_pes_free(&pes);
+	}
+	ts_LOGf("Stream type 0x00: %s, 0x1c: %s, 0x80: %s\n",
+		h222_stream_type_desc(0x00), h222_stream_type_desc(0x1c), h222_stream_type_desc(0x80));
+
+	ts_pmt_free(&pmt);
+}
+
+static int ts_gen_adts_frame(uint8_t *d, int frame_length) {
+	memset(d, 0, frame_length);
+	d[0] = 0xff;
+	d[1] = 0xf1;
+	d[2] = 0x50; // LC 44.1 kHz
+	d[3] = 0x80 | (frame_length >> 11); // stereo
+	d[4] = frame_length >> 3;
+	d[5] = ((frame_length & 7) << 5) | 0x1f;
+	d[6] = 0xfc;
+	return frame_length;
+}
+
+static void ts_audio_frames_dump(char *name, struct ts_audio_frame_iter *it) {
+	struct ts_audio_frame frame;
+	while (ts_audio_frame_next(it, &frame)) {
+		ts_LOGf("  %s frame offset:%u size:%u%s pts:%llu rate:%u channels:%d%s bitrate:%u\n",
+			name, frame.offset, frame.size, frame.truncated ? " truncated" : "",
+			(unsigned long long)frame.pts, frame.hdr.sample_rate, frame.hdr.channels,
+			frame.hdr.lfe ? "+LFE" : "", frame.hdr.bitrate);
+	}
+	ts_LOGf("  %s frames:%u skipped:%u\n", name, it->frames, it->skipped);
+}
+
+void ts_audio_frames_test(void) {
+	struct ts_audio_frame_iter it;
+	uint8_t *es = malloc(8192);
+	int pos;
+
+	ts_LOGf("Audio frames\n");
+	// Garbage, three ADTS frames and a truncated one
+	pos = 0;
+	es[pos++] = 0xff;
+	es[pos++] = 0x12;
+	pos += ts_gen_adts_frame(es + pos, 200);
+	pos += ts_gen_adts_frame(es + pos, 210);
+	pos += ts_gen_adts_frame(es + pos, 190);
+	ts_gen_adts_frame(es + pos, 300);
+	pos += 50;
+	ts_audio_frame_iter_init(&it, CODEC_AAC_ADTS_AUDIO, es, pos, 8589930000ull);
+	ts_audio_frames_dump("ADTS", &it);
+
+	// LATM frame with StreamMuxConfig followed by frames that reuse it
+	static const uint8_t latm_config[] = { 0x56, 0xe0, 0x40, 0x20, 0x00, 0x11, 0x90 };
+	pos = 0;
+	memset(es, 0, 8192);
+	memcpy(es, latm_config, sizeof(latm_config));
+	pos += 3 + 0x40;
+	es[pos + 0] = 0x56;
+	es[pos + 1] = 0xe0;
+	es[pos + 2] = 0x30;
+	es[pos + 3] = 0x80; // useSameStreamMux
+	pos += 3 + 0x30;
+	ts_audio_frame_iter_init(&it, CODEC_AAC_LATM_AUDIO, es, pos, 900000);
+	ts_audio_frames_dump("LATM", &it);
+
+	// AC-3 48 kHz 384 kbit/s 3/2+LFE and E-AC-3 32 kHz frames
+	static const uint8_t ac3[]  = { 0x0b, 0x77, 0x00, 0x00, 0x1c, 0x40, 0xe1 };
+	static const uint8_t eac3[] = { 0x0b, 0x77, 0x00, 0xff, 0xb4, 0x80, 0x00 };	// 512 bytes 32 kHz 2/0
+	memset(es, 0, 8192);
+	memcpy(es, ac3, sizeof(ac3));
+	memcpy(es + 1536, ac3, sizeof(ac3));
+	memcpy(es + 3072, eac3, sizeof(eac3));
+	ts_audio_frame_iter_init(&it, CODEC_AC3_AUDIO, es, 3072 + 512, 900000);
+	ts_audio_frames_dump("AC-3", &it);
+
+	free(es);
+}
+
+void ts_packetizer_test(void) {
+	static const struct {
+		uint8_t		stream_id;
+		uint32_t	es_size;
+		uint64_t	pts;
+		uint64_t	dts;
+		uint64_t	pcr;
+	} aus[] = {
+		{ 0xc0, 100,   900000,  NO_DTS, NO_PCR },		// Single packet with stuffing
+		{ 0xe0, 1000,  903600,  900000, 900000 * 300 },	// PCR in the first packet
+		{ 0xc0, 169,   906000,  NO_DTS, NO_PCR },		// 1 byte adaptation field (169 + 14 == 183)
+		{ 0xe0, 70000, 907200,  903600, NO_PCR },		// Unbounded PES
+		{ 0xc0, 10,    8589934591ull, NO_DTS, NO_PCR },	// Last PES, finishes the previous one
+	};
+	int i, j, n = sizeof(aus) / sizeof(aus[0]);
+	int max_packets = 512, num_packets = 0;
+	uint8_t *es = malloc(70000);
+	uint8_t *ts_packets = malloc(max_packets * TS_PACKET_SIZE);
+	struct ts_packetizer pz[2];
+
+	ts_LOGf("Packetizer\n");
+	for (i=0;i<70000;i++)
+		es[i] = i * 13;
+	ts_packetizer_init(&pz[0], 0x101, 0xc0);
+	ts_packetizer_init(&pz[1], 0x101, 0xe0);
+	pz[1].continuity = pz[0].continuity;
+
+	for (i=0;i<n;i++) {
+		struct ts_packetizer *p = aus[i].stream_id == 0xc0 ? &pz[0] : &pz[1];
+		uint8_t *out = ts_packets + num_packets * TS_PACKET_SIZE;
+		int expected = ts_packetizer_num_packets(p, aus[i].es_size, aus[i].pts, aus[i].dts, aus[i].pcr);
+		int num = ts_packetizer_push(p, es, aus[i].es_size, aus[i].pts, aus[i].dts, aus[i].pcr, out, max_packets - num_packets);
+		(aus[i].stream_id == 0xc0 ? &pz[1] : &pz[0])->continuity = p->continuity; // Same PID
+		char adapt[64] = "";
+		uint8_t *last = out + (num - 1) * TS_PACKET_SIZE;
+		if (last[3] & 0x20)
+			snprintf(adapt, sizeof(adapt), " last_adapt_len:%d", last[4]);
+		ts_LOGf("  AU %d: es_size:%u packets:%d expected:%d pcr:%d cc:%d..%d%s\n", i, aus[i].es_size, num, expected,
+			ts_packet_has_pcr(out), ts_packet_get_cont(out), ts_packet_get_cont(last), adapt);
+		num_packets += num;
+	}
+	ts_LOGf("  Too small buffer: %d\n", ts_packetizer_push(&pz[0], es, 1000, NO_PTS, NO_DTS, NO_PCR, ts_packets, 2));
+
+	// Parse the generated packets back
+	struct ts_pes *pes = ts_pes_alloc();
+	for (i=0,j=0;i<num_packets;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (ts_pes_is_finished(pes, ts_packet)) {
+			ts_LOGf("  PES %d: stream_id:%02x len:%d es_size:%d pts:%llu dts:%llu same_data:%d\n", j,
+				pes->stream_id, pes->pes_packet_len, pes->es_data_size,
+				(unsigned long long)pes->PTS, (unsigned long long)pes->DTS,
+				(uint32_t)pes->es_data_size == aus[j].es_size && memcmp(pes->es_data, es, aus[j].es_size) == 0);
+			ts_pes_clear(pes);
+			j++;
+		}
+		pes = ts_pes_push_packet(pes, ts_packet, NULL, 0x101);
+	}
+	ts_LOGf("  PES %d: finished:%d es_size:%d pts:%llu\n", j, pes->pes_data_initialized, pes->es_data_size, (unsigned long long)pes->PTS);
+	ts_pes_free(&pes);
+
+	free(ts_packets);
+	free(es);
+}
+
+void ts_adapt_field_test(void) {
+	uint8_t ts_packet[TS_PACKET_SIZE];
+	uint8_t private_data[] = { 0xde, 0xad, 0xbe, 0xef };
+	struct ts_header ts_header;
+	struct ts_adapt_field af, af2;
+
+	ts_LOGf("Adaptation field\n");
+	memset(&ts_header, 0, sizeof(struct ts_header));
+	ts_header.pid           = 0x100;
+	ts_header.payload_field = 1;
+	ts_packet_header_generate(ts_packet, &ts_header);
+
+	memset(&af, 0, sizeof(struct ts_adapt_field));
+	ts_LOGf("  empty size:%d\n", ts_adapt_field_size(&af));
+	af.discontinuity		= 1;
+	af.random_access		= 1;
+	af.pcr_flag				= 1;
+	af.pcr					= 2576980377ull * 300 + 299;
+	af.opcr_flag			= 1;
+	af.opcr					= 123456789;
+	af.splicing_point_flag	= 1;
+	af.splice_countdown		= -3;
+	af.private_data_flag	= 1;
+	af.private_data_len		= sizeof(private_data);
+	af.private_data			= private_data;
+	af.extension_flag		= 1;
+	af.ltw_flag				= 1;
+	af.ltw_valid			= 1;
+	af.ltw_offset			= 0x1234;
+	af.piecewise_rate_flag	= 1;
+	af.piecewise_rate		= 0x2abcde;
+	af.seamless_splice_flag	= 1;
+	af.splice_type			= 3;
+	af.dts_next_au			= 8589934591ull;
+	int too_small = ts_adapt_field_generate(ts_packet, &af, 20);
+	int generated = ts_adapt_field_generate(ts_packet, &af, 60);
+	ts_LOGf("  full size:%d generate:%d too small:%d\n", ts_adapt_field_size(&af), generated, too_small);
+
+	int ok = ts_adapt_field_parse(ts_packet, &af2);
+	ts_LOGf("  parse:%d random_access:%d has_pcr:%d pcr_same:%d discontinuity:%d private_data_same:%d\n", ok,
+		ts_packet_is_random_access(ts_packet), ts_packet_has_pcr(ts_packet), ts_packet_get_pcr(ts_packet) == af2.pcr,
+		ts_packet_has_discontinuity(ts_packet), memcmp(af2.private_data, private_data, sizeof(private_data)) == 0);
+	ts_adapt_field_dump(&af2);
+
+	// Bad lengths
+	ts_packet[4] = 183;
+	ts_LOGf("  adapt_len 183 with payload: %d\n", ts_adapt_field_parse(ts_packet, &af2));
+	ts_packet[4] = 5; // PCR does not fit
+	ts_LOGf("  adapt_len 5 with PCR: %d\n", ts_adapt_field_parse(ts_packet, &af2));
+
+	// One byte stuffing
+	ts_packet_header_generate(ts_packet, &ts_header);
+	memset(&af, 0, sizeof(struct ts_adapt_field));
+	generated = ts_adapt_field_generate(ts_packet, &af, 1);
+	ok = ts_adapt_field_parse(ts_packet, &af2);
+	ts_LOGf("  stuffing generate:%d parse:%d len:%d payload_offset:%d\n", generated, ok, af2.len, ts_packet_get_payload_offset(ts_packet));
+
+	// Packetizer random access point
+	struct ts_packetizer pz;
+	uint8_t ts_packets[2 * TS_PACKET_SIZE];
+	ts_packetizer_init(&pz, 0x100, 0xe0);
+	pz.random_access = 1;
+	ts_packetizer_push(&pz, private_data, sizeof(private_data), 900000, NO_DTS, NO_PCR, ts_packets, 2);
+	int rap = ts_packet_is_random_access(ts_packets);
+	ts_packetizer_push(&pz, private_data, sizeof(private_data), 903600, NO_DTS, NO_PCR, ts_packets, 2);
+	ts_LOGf("  packetizer random_access:%d next:%d\n", rap, ts_packet_is_random_access(ts_packets));
+}
+
+void ts_clock_test(void) {
+	uint8_t ts_packet[TS_PACKET_SIZE];
+	struct ts_header ts_header;
+	struct ts_adapt_field af;
+	uint64_t start = TS_CLOCK_PCR_WRAP - 27000000 / 2; // Wrap after half second
+	uint64_t ticks = 10152; // 4 Mbit/s
+	int i;
+
+	ts_LOGf("Clock recovery\n");
+	struct ts_clock *c = ts_clock_alloc(0x100);
+	memset(&ts_header, 0, sizeof(struct ts_header));
+	ts_header.pid           = 0x100;
+	ts_header.payload_field = 1;
+	for (i=0;i<4000;i++) {
+		ts_packet_header_generate(ts_packet, &ts_header);
+		memset(&af, 0, sizeof(struct ts_adapt_field));
+		if (i == 3000) { // PCR jumps back
+			af.discontinuity = 1;
+			start -= 27000000 * 10;
+		}
+		if (i % 40 == 0) {
+			af.pcr_flag = 1;
+			af.pcr      = (start + i * ticks) % TS_CLOCK_PCR_WRAP;
+		}
+		ts_adapt_field_generate(ts_packet, &af, ts_adapt_field_size(&af));
+		// Arrival time from local clock that is 50 ppm slower than the PCR clock
+		ts_clock_push_packet(c, ts_packet, i * ticks * 1000000 / (27 * 1000050ull));
+		if (i == 2999) {
+			uint64_t predicted = ts_clock_predict_pcr(c, 3020);
+			uint64_t expected = (start + 3020 * ticks) % TS_CLOCK_PCR_WRAP;
+			ts_LOGf("  predicted pcr:%llu expected:%llu diff:%lld\n", (unsigned long long)predicted, (unsigned long long)expected, (long long)(predicted - expected));
+			ts_clock_dump(c);
+		}
+	}
+	ts_clock_dump(c);
+	ts_clock_free(&c);
+
+	// Variable bitrate between PCR values, no arrival times
+	c = ts_clock_alloc(0x100);
+	ts_LOGf("  predict without model:%d\n", ts_clock_predict_pcr(c, 0) == NO_PCR);
+	ts_clock_push_pcr(c, 0, 0, TS_CLOCK_NO_TIME);
+	ts_clock_push_pcr(c, 100, 100 * 10152, TS_CLOCK_NO_TIME);
+	ts_clock_push_pcr(c, 150, 200 * 10152, TS_CLOCK_NO_TIME);
+	ts_clock_dump(c);
+	ts_clock_free(&c);
+
+	// One packet per tick is above the uint32_t bitrate range
+	c = ts_clock_alloc(0x100);
+	ts_clock_push_pcr(c, 0, 1000, TS_CLOCK_NO_TIME);
+	ts_clock_push_pcr(c, 1, 1001, TS_CLOCK_NO_TIME);
+	ts_clock_dump(c);
+	ts_clock_free(&c);
+}
+
+void ts_pcr_restamp_test(void) {
+	int i, num = 0, errors = 0;
+	uint32_t bitrate = 3000001;
+	uint64_t ticks = TS_PACKET_SIZE * 8 * 27000000ull;
+	uint64_t first[2] = { 0, 0 };
+	uint64_t first_pos[2] = { 0, 0 };
+	int seen[2] = { 0, 0 };
+	uint8_t *ts_packets = malloc(1500 * TS_PACKET_SIZE);
+	struct ts_header ts_header;
+	struct ts_adapt_field af;
+
+	ts_LOGf("PCR restamp\n");
+	memset(&ts_header, 0, sizeof(struct ts_header));
+	ts_header.payload_field = 1;
+	for (i=0;i<1500;i++) {
+		int pcr_1 = i % 20 == 0, pcr_2 = i % 50 == 5;
+		if (i % 3 == 2 && !pcr_1 && !pcr_2) // Filtered out
+			continue;
+		uint8_t *ts_packet = ts_packets + num++ * TS_PACKET_SIZE;
+		ts_header.pid = pcr_2 ? 0x200 : 0x100;
+		ts_packet_header_generate(ts_packet, &ts_header);
+		memset(&af, 0, sizeof(struct ts_adapt_field));
+		if (pcr_1 || pcr_2) { // Input PCR at 4 Mbit/s, PID 0x200 wraps
+			af.pcr_flag = 1;
+			af.pcr      = pcr_1 ? i * 10152ull : (TS_CLOCK_PCR_WRAP - 27000000 / 10 + i * 10152ull) % TS_CLOCK_PCR_WRAP;
+		}
+		ts_adapt_field_generate(ts_packet, &af, ts_adapt_field_size(&af));
+	}
+
+	struct ts_pcr_restamp *r = ts_pcr_restamp_alloc(bitrate);
+	int restamped = ts_pcr_restamp_packets(r, ts_packets, num / 2);
+	restamped += ts_pcr_restamp_packets(r, ts_packets + (num / 2) * TS_PACKET_SIZE, num - num / 2);
+	for (i=0;i<num;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		if (!ts_packet_has_pcr(ts_packet))
+			continue;
+		int n = ts_packet_get_pid(ts_packet) == 0x200;
+		uint64_t pcr = ts_packet_get_pcr(ts_packet);
+		if (!seen[n]) {
+			seen[n]      = 1;
+			first[n]     = pcr;
+			first_pos[n] = i;
+			continue;
+		}
+		uint64_t expected = (first[n] - (first_pos[n] * ticks / bitrate) + (i * ticks / bitrate)) % TS_CLOCK_PCR_WRAP;
+		if (pcr != expected)
+			errors++;
+	}
+	ts_LOGf("  packets:%d restamped:%d errors:%d\n", num, restamped, errors);
+	ts_pcr_restamp_dump(r);
+	ts_pcr_restamp_free(&r);
+	free(ts_packets);
+}
+
+void ts_pcr_metrics_test(void) {
+	uint8_t ts_packet[TS_PACKET_SIZE];
+	struct ts_header ts_header;
+	struct ts_adapt_field af;
+	int i;
+
+	ts_LOGf("PCR metrics\n");
+	struct ts_pcr_metrics *m = ts_pcr_metrics_alloc();
+	memset(&ts_header, 0, sizeof(struct ts_header));
+	ts_header.payload_field = 1;
+	// 30 seconds of 4 Mbit/s, PCR clock is 20 ppm (540 Hz) faster than the arrival clock
+	for (i=0;i<80000;i++) {
+		ts_header.pid = i % 40 == 20 ? 0x200 : 0x100;
+		ts_packet_header_generate(ts_packet, &ts_header);
+		memset(&af, 0, sizeof(struct ts_adapt_field));
+		if (i % 40 == 0) {
+			af.pcr_flag = 1;
+			af.pcr      = i * 10152ull;
+			if (i % 4000 == 0) // Inaccurate PCR
+				af.pcr += 27;
+		}
+		if (i % 40 == 20) { // PID 0x200 PCR wraps
+			af.pcr_flag = 1;
+			af.pcr      = (TS_CLOCK_PCR_WRAP - 27000000 + i * 10152ull) % TS_CLOCK_PCR_WRAP;
+		}
+		if (i == 60020) { // PID 0x200 PCR jumps
+			af.discontinuity = 1;
+			af.pcr           = 0;
+		}
+		ts_adapt_field_generate(ts_packet, &af, ts_adapt_field_size(&af));
+		// 376 us per packet, +-300 ns network jitter
+		uint64_t arrival = i * 376000ull * 1000000 / 1000020 + ((i / 40) % 3) * 300;
+		ts_pcr_metrics_push_packet(m, ts_packet, arrival);
+	}
+	ts_pcr_metrics_dump(m);
+	ts_pcr_metrics_free(&m);
+}
+
+void ts_shift_timestamps_test(void) {
+	uint8_t ts_packets[3 * TS_PACKET_SIZE], orig[3 * TS_PACKET_SIZE];
+	uint8_t es[100];
+	struct ts_packetizer pz;
+	struct ts_header ts_header;
+	struct ts_adapt_field af;
+	uint64_t pts, dts;
+	int i;
+
+	ts_LOGf("Shift timestamps\n");
+	// PCR, PTS and DTS
+	memset(es, 0x55, sizeof(es));
+	ts_packetizer_init(&pz, 0x100, 0xe0);
+	ts_packetizer_push(&pz, es, sizeof(es), 500, 100, 90 * 300 + 7, ts_packets, 1);
+
+	// PTS and ESCR (base 0, extension 5)
+	memcpy(ts_packets + TS_PACKET_SIZE, ts_packets, 4);
+	ts_packets[TS_PACKET_SIZE + 3] = 0x10;
+	memset(ts_packets + TS_PACKET_SIZE + 4, 0xff, 184);
+	memcpy(ts_packets + TS_PACKET_SIZE + 4, "\x00\x00\x01\xe0\x00\x00\x80\xa0\x0b", 9);
+	ts_encode_pts_dts(ts_packets + TS_PACKET_SIZE + 4 + 9, 2, 8589934000ull);
+	memcpy(ts_packets + TS_PACKET_SIZE + 4 + 14, "\xc4\x00\x04\x00\x04\x0b", 6);
+
+	// Adaptation field only with PCR and OPCR
+	memset(&ts_header, 0, sizeof(struct ts_header));
+	ts_header.pid         = 0x100;
+	ts_header.adapt_field = 1;
+	ts_packet_header_generate(ts_packets + 2 * TS_PACKET_SIZE, &ts_header);
+	memset(&af, 0, sizeof(struct ts_adapt_field));
+	af.pcr_flag  = 1;
+	af.pcr       = 8589934591ull * 300 + 299;
+	af.opcr_flag = 1;
+	af.opcr      = 10 * 300 + 1;
+	ts_adapt_field_generate(ts_packets + 2 * TS_PACKET_SIZE, &af, 183);
+
+	memcpy(orig, ts_packets, sizeof(ts_packets));
+	int changed = ts_packets_shift_timestamps(ts_packets, 3, -1000);
+	ts_LOGf("  shift -1000 changed:%d\n", changed);
+	for (i=0;i<3;i++) {
+		uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+		char pcr[64] = "";
+		if (ts_packet_has_pcr(ts_packet))
+			snprintf(pcr, sizeof(pcr), " pcr:%llu", (unsigned long long)ts_packet_get_pcr(ts_packet));
+		if (ts_adapt_field_parse(ts_packet, &af) && af.opcr_flag)
+			snprintf(pcr + strlen(pcr), sizeof(pcr) - strlen(pcr), " opcr:%llu", (unsigned long long)af.opcr);
+		ts_packet_has_pts_dts(ts_packet, &pts, &dts);
+		ts_LOGf("  packet %d pts:%lld dts:%lld%s\n", i, (long long)pts, (long long)dts, pcr);
+	}
+	ts_LOGf("  escr changed:%d\n", memcmp(ts_packets + TS_PACKET_SIZE + 18, orig + TS_PACKET_SIZE + 18, 6) != 0);
+	changed = ts_packets_shift_timestamps(ts_packets, 3, 1000);
+	ts_LOGf("  shift back changed:%d same:%d\n", changed, memcmp(ts_packets, orig, sizeof(orig)) == 0);
+}
+
+void ts_loop_test(void) {
+	uint8_t ts_packet[TS_PACKET_SIZE], pes_data[184];
+	uint8_t last_cc[0x2000];
+	uint64_t last_pcr = NO_PCR, last_pts = NO_PTS, pts, dts;
+	int i, j, cc = 7, pos = 0, last_pcr_pos = 0, cc_errors = 0, pcr_errors = 0, pts_errors = 0;
+
+	ts_LOGf("Loop\n");
+	// PAT with the same version but different content at the start and at the end
+	struct ts_pat *pat_start = ts_pat_alloc_init(1);
+	ts_pat_add_program(pat_start, 1, 0x30);
+	struct ts_pat *pat_end = ts_pat_copy(pat_start);
+	ts_pat_add_program(pat_end, 2, 0x40);
+	pat_end->section_header->version_number = pat_start->section_header->version_number;
+	ts_pat_regenerate_packets(pat_end);
+
+	FILE *f = tmpfile();
+	for (i=0;i<200;i++) {
+		if (i == 0 || i == 199) {
+			memcpy(ts_packet, i ? pat_end->section_header->packet_data : pat_start->section_header->packet_data, TS_PACKET_SIZE);
+			ts_packet_set_cont(ts_packet, i ? 1 : 0);
+		} else if (i % 40 == 5) {
+			ts_gen_test_pes(ts_packet, 0x101, pes_data, 184, i * 90);
+			ts_packet_set_cont(ts_packet, i / 40);
+		} else {
+			memset(ts_packet, 0xff, TS_PACKET_SIZE);
+			ts_packet[0] = 0x47;
+			ts_packet_set_pid(ts_packet, 0x100);
+			ts_packet[3] = 0x10 | (cc++ & 0x0f);
+			if (i % 10 == 0) {
+				ts_packet[3] |= 0x20;
+				ts_packet[4] = 7;
+				ts_packet[5] = 0x10; // PCR flag
+				ts_packet_set_pcr(ts_packet, (TS_CLOCK_PCR_WRAP - 27000 * 300 + i * 27000ull) % TS_CLOCK_PCR_WRAP);
+			}
+		}
+		fwrite(ts_packet, TS_PACKET_SIZE, 1, f);
+	}
+	fflush(f);
+	ts_pat_free(&pat_start);
+	ts_pat_free(&pat_end);
+
+	struct ts_loop *l = ts_loop_open_fd(fileno(f));
+	fclose(f);
+	ts_loop_dump(l);
+
+	memset(last_cc, 0xff, sizeof(last_cc));
+	for (j=0;j<3 * 200 / 64 + 1;j++) {
+		uint8_t *ts_packets;
+		int num = ts_loop_read(l, &ts_packets, 64);
+		for (i=0;i<num;i++,pos++) {
+			uint8_t *pkt = ts_packets + i * TS_PACKET_SIZE;
+			uint16_t pid = ts_packet_get_pid(pkt);
+			if (last_cc[pid] != 0xff && ts_packet_get_cont(pkt) != ((last_cc[pid] + 1) & 0x0f))
+				cc_errors++;
+			last_cc[pid] = ts_packet_get_cont(pkt);
+			if (ts_packet_has_pcr(pkt)) {
+				uint64_t pcr = ts_packet_get_pcr(pkt);
+				if (last_pcr != NO_PCR && (pcr - last_pcr + TS_CLOCK_PCR_WRAP) % TS_CLOCK_PCR_WRAP != (pos - last_pcr_pos) * 27000ull)
+					pcr_errors++;
+				last_pcr     = pcr;
+				last_pcr_pos = pos;
+			}
+			if (ts_packet_has_pts_dts(pkt, &pts, &dts)) {
+				if (last_pts != NO_PTS && ((pts - last_pts) & (TS_TIMESTAMP_WRAP - 1)) != 3600)
+					pts_errors++;
+				last_pts = pts;
+			}
+			if (pid == 0)
+				ts_LOGf("  loop %llu PAT version:%d crc_ok:%d\n", (unsigned long long)l->loops, (pkt[10] >> 1) & 0x1f,
+					ts_crc32(pkt + 5, 3 + (((pkt[6] & 0x0f) << 8) | pkt[7])) == 0);
+		}
+	}
+	ts_LOGf("  loops:%llu cc_errors:%d pcr_errors:%d pts_errors:%d\n", (unsigned long long)l->loops, cc_errors, pcr_errors, pts_errors);
+	ts_loop_free(&l);
+}
+
+// Without PCR the loop point is signalled with discontinuity_indicator
+void ts_loop_no_pcr_test(void) {
+	uint8_t ts_packet[TS_PACKET_SIZE];
+	uint8_t last_cc[0x2000];
+	int i, j, cc_errors = 0, af_only = 0, flagged = 0, packets = 0;
+
+	ts_LOGf("Loop without PCR\n");
+	FILE *f = tmpfile();
+	for (i=0;i<15;i++) {
+		memset(ts_packet, 0xff, TS_PACKET_SIZE);
+		ts_packet[0] = 0x47;
+		if (i % 3 == 2) {
+			ts_packet_set_pid(ts_packet, 0x101);
+			ts_packet[3] = 0x30 | (i / 3); // Adaptation field and payload
+			ts_packet[4] = 1;
+			ts_packet[5] = 0x00;
+		} else {
+			ts_packet_set_pid(ts_packet, 0x100);
+			ts_packet[3] = 0x10 | ((i - i / 3) & 0x0f); // Payload only
+		}
+		fwrite(ts_packet, TS_PACKET_SIZE, 1, f);
+	}
+	fflush(f);
+	struct ts_loop *l = ts_loop_open_fd(fileno(f));
+	fclose(f);
+
+	memset(last_cc, 0xff, sizeof(last_cc));
+	for (j=0;j<8;j++) {
+		uint8_t *ts_packets;
+		int num = ts_loop_read(l, &ts_packets, 7);
+		for (i=0;i<num;i++,packets++) {
+			uint8_t *pkt = ts_packets + i * TS_PACKET_SIZE;
+			uint16_t pid = ts_packet_get_pid(pkt);
+			if ((pkt[3] & 0x20) && pkt[4] && (pkt[5] & 0x80))
+				flagged++;
+			if (!ts_packet_has_payload(pkt)) {
+				af_only++;
+				if (ts_packet_get_cont(pkt) != last_cc[pid])
+					cc_errors++;
+				continue;
+			}
+			if (last_cc[pid] != 0xff && ts_packet_get_cont(pkt) != ((last_cc[pid] + 1) & 0x0f))
+				cc_errors++;
+			last_cc[pid] = ts_packet_get_cont(pkt);
+		}
+	}
+	ts_loop_dump(l);
+	ts_LOGf("  loops:%llu packets:%d af_only:%d flagged:%d cc_errors:%d\n",
+		(unsigned long long)l->loops, packets, af_only, flagged, cc_errors);
+	ts_loop_free(&l);
+}
+
+static int ts_spts_test_add(uint8_t *ts_packets, int num, uint8_t *packets, int num_packets) {
+	memcpy(ts_packets + num * TS_PACKET_SIZE, packets, num_packets * TS_PACKET_SIZE);
+	return num + num_packets;
+}
+
+void ts_spts_test(void) {
+	uint16_t es_pids[] = { 0x101, 0x102, 0x150, 0x201, 0x301, 0x400 };
+	uint16_t programs[] = { 1, 3 };
+	uint16_t pid_count[0x2000];
+	uint8_t *ts_packets = malloc(200 * TS_PACKET_SIZE);
+	uint8_t *out = malloc(200 * TS_PACKET_SIZE);
+	uint8_t ts_packet[TS_PACKET_SIZE];
+	int i, j, num = 0;
+
+	ts_LOGf("SPTS\n");
+	struct ts_pat *pat = ts_pat_alloc_init(0x77);
+	ts_pat_add_program(pat, 1, 0x100);
+	ts_pat_add_program(pat, 2, 0x200);
+	ts_pat_add_program(pat, 3, 0x300);
+	struct ts_pmt *pmt[3];
+	pmt[0] = ts_pmt_alloc_init(1, 0x100, 0x101);
+	ts_pmt_add_stream(pmt[0], 0x02, 0x101);
+	ts_pmt_add_stream(pmt[0], 0x03, 0x102);
+	ts_pmt_add_es_ca_descriptor(pmt[0], 0x102, 0x0500, 0x150);
+	pmt[1] = ts_pmt_alloc_init(2, 0x200, 0x201);
+	ts_pmt_add_stream(pmt[1], 0x02, 0x201);
+	pmt[2] = ts_pmt_alloc_init(3, 0x300, 0x301);
+	ts_pmt_add_stream(pmt[2], 0x1b, 0x301);
+	struct ts_sdt *sdt = ts_sdt_alloc_init(1, 0x77);
+	ts_sdt_add_service_descriptor(sdt, 1, 1, "Provider", "One");
+	ts_sdt_add_service_descriptor(sdt, 2, 1, "Provider", "Two");
+	ts_sdt_add_service_descriptor(sdt, 3, 1, "Provider", "Three");
+	struct ts_eit *eit[3];
+	for (i=0;i<3;i++) {
+		eit[i] = ts_eit_alloc_init_pf(i + 1, 0x77, 1, 0, 1);
+		ts_eit_add_short_event_descriptor(eit[i], 4, 1, NOW, 3600, "Event", "Text");
+	}
+
+	for (j=0;j<3;j++) {
+		num = ts_spts_test_add(ts_packets, num, pat->section_header->packet_data, pat->section_header->num_packets);
+		for (i=0;i<3;i++) {
+			num = ts_spts_test_add(ts_packets, num, pmt[i]->section_header->packet_data, pmt[i]->section_header->num_packets);
+		}
+		num = ts_spts_test_add(ts_packets, num, sdt->section_header->packet_data, sdt->section_header->num_packets);
+		for (i=0;i<3;i++) {
+			num = ts_spts_test_add(ts_packets, num, eit[i]->section_header->packet_data, eit[i]->section_header->num_packets);
+		}
+		for (i=0;i<(int)(sizeof(es_pids) / sizeof(es_pids[0]));i++) {
+			memset(ts_packet, 0xff, TS_PACKET_SIZE);
+			ts_packet[0] = 0x47;
+			ts_packet_set_pid(ts_packet, es_pids[i]);
+			ts_packet[3] = 0x10 | j;
+			num = ts_spts_test_add(ts_packets, num, ts_packet, 1);
+		}
+	}
+
+	struct ts_spts *spts = ts_spts_alloc(programs, 2, 1);
+	int out_num = ts_spts_push_packets(spts, ts_packets, num / 2, out, 200);
+	out_num += ts_spts_push_packets(spts, ts_packets + (num / 2) * TS_PACKET_SIZE, num - num / 2, out + out_num * TS_PACKET_SIZE, 200 - out_num);
+	ts_spts_dump(spts);
+
+	struct ts_pat *out_pat = ts_pat_alloc();
+	struct ts_sdt *out_sdt = ts_sdt_alloc();
+	char eit_services[64] = "";
+	int eit_cc = -1, eit_cc_errors = 0;
+	memset(pid_count, 0, sizeof(pid_count));
+	for (i=0;i<out_num;i++) {
+		uint8_t *pkt = out + i * TS_PACKET_SIZE;
+		uint16_t pid = ts_packet_get_pid(pkt);
+		pid_count[pid]++;
+		if (pid == 0x00 && !out_pat->initialized)
+			out_pat = ts_pat_push_packet(out_pat, pkt);
+		if (pid == 0x11 && !out_sdt->initialized)
+			out_sdt = ts_sdt_push_packet(out_sdt, pkt);
+		if (pid == 0x12) {
+			if (eit_cc >= 0 && ts_packet_get_cont(pkt) != ((eit_cc + 1) & 0x0f))
+				eit_cc_errors++;
+			eit_cc = ts_packet_get_cont(pkt);
+		}
+		if (pid == 0x12 && ts_packet_is_pusi(pkt))
+			snprintf(eit_services + strlen(eit_services), sizeof(eit_services) - strlen(eit_services), " %d", (pkt[8] << 8) | pkt[9]);
+	}
+	ts_LOGf("  in:%d out:%d PAT:%d PMT:%d/%d/%d SDT:%d EIT:%d ES:%d/%d/%d/%d/%d/%d\n", num, out_num,
+		pid_count[0], pid_count[0x100], pid_count[0x200], pid_count[0x300], pid_count[0x11], pid_count[0x12],
+		pid_count[0x101], pid_count[0x102], pid_count[0x150], pid_count[0x201], pid_count[0x301], pid_count[0x400]);
+	ts_LOGf("  PAT programs:%d first:%d second:%d SDT services:%d first:%d second:%d EIT services:%s cc_errors:%d\n",
+		out_pat->programs_num, out_pat->programs[0]->program, out_pat->programs[1]->program,
+		out_sdt->streams_num, out_sdt->streams[0]->service_id, out_sdt->streams[1]->service_id, eit_services, eit_cc_errors);
+
+	ts_pat_free(&out_pat);
+	ts_sdt_free(&out_sdt);
+	ts_spts_free(&spts);
+	ts_pat_free(&pat);
+	ts_sdt_free(&sdt);
+	for (i=0;i<3;i++) {
+		ts_pmt_free(&pmt[i]);
+		ts_eit_free(&eit[i]);
+	}
+	free(ts_packets);
+	free(out);
+}
+
+void ts_mux_test(void) {
+	uint8_t *ts_packets = malloc(200 * TS_PACKET_SIZE);
+	uint8_t *out = malloc(500 * TS_PACKET_SIZE);
+	uint8_t ts_packet[TS_PACKET_SIZE];
+	uint16_t pid_count[0x2000];
+	uint8_t cc[0x2000];
+	char *names[] = { "One", "Two" };
+	int i, k, num, out_num = 0, cc_errors = 0;
+
+	ts_LOGf("MPTS mux\n");
+	struct ts_mux *mux = ts_mux_alloc(0x99, 0x55);
+	for (k=0;k<2;k++) {
+		ts_mux_add_input(mux, 0);
+		// Both inputs use the same program_number and PIDs
+		struct ts_pat *pat = ts_pat_alloc_init(0x77 + k);
+		ts_pat_add_program(pat, 1, 0x100);
+		struct ts_pmt *pmt = ts_pmt_alloc_init(1, 0x100, 0x101);
+		ts_pmt_add_stream(pmt, 0x02, 0x101);
+		ts_pmt_add_es_ca_descriptor(pmt, 0x101, 0x0500, 0x150);
+		struct ts_sdt *sdt = ts_sdt_alloc_init(1, 0x77 + k);
+		ts_sdt_add_service_descriptor(sdt, 1, 1, "Provider", names[k]);
+		struct ts_eit *eit = ts_eit_alloc_init_pf(1, 0x77 + k, 1, 0, 1);
+		ts_eit_add_short_event_descriptor(eit, 4, 1, NOW, 3600, "Event", names[k]);
+
+		num = 0;
+		num = ts_spts_test_add(ts_packets, num, pat->section_header->packet_data, pat->section_header->num_packets);
+		num = ts_spts_test_add(ts_packets, num, pmt->section_header->packet_data, pmt->section_header->num_packets);
+		num = ts_spts_test_add(ts_packets, num, sdt->section_header->packet_data, sdt->section_header->num_packets);
+		num = ts_spts_test_add(ts_packets, num, eit->section_header->packet_data, eit->section_header->num_packets);
+		for (i=0;i<100;i++) {
+			memset(ts_packet, 0xff, TS_PACKET_SIZE);
+			ts_packet[0] = 0x47;
+			ts_packet_set_pid(ts_packet, i == 50 ? 0x150 : 0x101);
+			ts_packet[3] = 0x10 | ((i - (i > 50)) & 0x0f);
+			if (i % 10 == 0) {
+				ts_packet[3] |= 0x20;
+				ts_packet[4] = 7;
+				ts_packet[5] = 0x10; // PCR flag
+				ts_packet_set_pcr(ts_packet, i * 2700ull * (k + 1));
+			}
+			num = ts_spts_test_add(ts_packets, num, ts_packet, 1);
+		}
+		// Second PMT is sent after the PIDs are known
+		num = ts_spts_test_add(ts_packets, num, pmt->section_header->packet_data, pmt->section_header->num_packets);
+		ts_mux_push_packets(mux, k, ts_packets, num);
+
+		ts_pat_free(&pat);
+		ts_pmt_free(&pmt);
+		ts_sdt_free(&sdt);
+		ts_eit_free(&eit);
+	}
+	ts_mux_dump(mux);
+
+	struct ts_pat *out_pat = ts_pat_alloc();
+	struct ts_sdt *out_sdt = ts_sdt_alloc();
+	struct ts_pmt *out_pmt = ts_pmt_alloc();
+	char eit_services[64] = "";
+	memset(pid_count, 0, sizeof(pid_count));
+	memset(cc, 0xff, sizeof(cc));
+	for (k=1;k<=30;k++) {
+		int n = ts_mux_get_packets(mux, k * 27000ull, out + out_num * TS_PACKET_SIZE, 500 - out_num);
+		for (i=out_num;i<out_num+n;i++) {
+			uint8_t *pkt = out + i * TS_PACKET_SIZE;
+			uint16_t pid = ts_packet_get_pid(pkt);
+			pid_count[pid]++;
+			if (cc[pid] != 0xff && ts_packet_get_cont(pkt) != ((cc[pid] + 1) & 0x0f))
+				cc_errors++;
+			cc[pid] = ts_packet_get_cont(pkt);
+			if (pid == 0x00 && !out_pat->initialized)
+				out_pat = ts_pat_push_packet(out_pat, pkt);
+			if (pid == 0x11 && !out_sdt->initialized)
+				out_sdt = ts_sdt_push_packet(out_sdt, pkt);
+			if (pid == 0x20 && !out_pmt->initialized)
+				out_pmt = ts_pmt_push_packet(out_pmt, pkt);
+			if (pid == 0x12 && ts_packet_is_pusi(pkt))
+				snprintf(eit_services + strlen(eit_services), sizeof(eit_services) - strlen(eit_services), " %d/%04x/%04x",
+					(pkt[8] << 8) | pkt[9], (pkt[13] << 8) | pkt[14], (pkt[15] << 8) | pkt[16]);
+		}
+		out_num += n;
+		if (k == 5)
+			ts_LOGf("  5 ms: out:%d ES:%d/%d\n", out_num, pid_count[0x101], pid_count[0x21]);
+	}
+	ts_mux_dump(mux);
+
+	ts_LOGf("  out:%d cc_errors:%d PAT:%d PMT:%d/%d SDT:%d EIT:%d ES:%d/%d ECM:%d/%d\n", out_num, cc_errors,
+		pid_count[0], pid_count[0x100], pid_count[0x20], pid_count[0x11], pid_count[0x12],
+		pid_count[0x101], pid_count[0x21], pid_count[0x150], pid_count[0x22]);
+	ts_LOGf("  PAT ts_id:%04x programs:%d/%04x %d/%04x\n", out_pat->section_header->ts_id_number,
+		out_pat->programs[0]->program, out_pat->programs[0]->pid, out_pat->programs[1]->program, out_pat->programs[1]->pid);
+	ts_LOGf("  PMT program:%d PCR:%04x stream:%04x ECM:%04x\n", out_pmt->section_header->ts_id_number, out_pmt->PCR_pid,
+		out_pmt->streams[0]->pid, ((out_pmt->streams[0]->ES_info[4] & 0x1f) << 8) | out_pmt->streams[0]->ES_info[5]);
+	ts_LOGf("  SDT ts_id:%04x onid:%04x services:%d/%d EIT service/ts_id/onid:%s\n", out_sdt->section_header->ts_id_number,
+		out_sdt->original_network_id, out_sdt->streams[0]->service_id, out_sdt->streams[1]->service_id, eit_services);
+
+	ts_pat_free(&out_pat);
+	ts_sdt_free(&out_sdt);
+	ts_pmt_free(&out_pmt);
+	ts_mux_free(&mux);
+	free(ts_packets);
+	free(out);
+}
+
+void ts_shaper_test(void) {
+	uint8_t *ts_packets = malloc(40 * TS_PACKET_SIZE);
+	uint8_t *out = malloc(20 * TS_PACKET_SIZE);
+	int i, t, num, pcr_errors = 0, out_total = 0;
+	uint64_t last_pcr = 0, last_pcr_pos = 0, pcrs = 0;
+
+	ts_LOGf("CBR shaper\n");
+	// 1000 packets per second, 25 packets of buffer
+	struct ts_shaper *s = ts_shaper_alloc(1504000, 25);
+	for (t=0;t<=100;t+=10) {
+		// VBR input: burst at 0 ms, some packets and null packets at 50 ms
+		num = t == 0 ? 30 : t == 50 ? 15 : 0;
+		for (i=0;i<num;i++) {
+			uint8_t *ts_packet = ts_packets + i * TS_PACKET_SIZE;
+			memset(ts_packet, 0xff, TS_PACKET_SIZE);
+			ts_packet[0] = 0x47;
+			ts_packet_set_pid(ts_packet, i >= 10 && t == 50 ? NULL_PID : 0x100);
+			ts_packet[3] = 0x10 | (i & 0x0f);
+			if (i % 5 == 0) {
+				ts_packet[3] |= 0x20;
+				ts_packet[4] = 7;
+				ts_packet[5] = 0x10; // PCR flag
+				ts_packet_set_pcr(ts_packet, 1000000 + t * 27000ull + i * 300);
+			}
+		}
+		ts_shaper_push_packets(s, ts_packets, num);
+		int n = ts_shaper_tick(s, t * 1000ull, out, 20);
+		int nulls = 0;
+		for (i=0;i<n;i++) {
+			uint8_t *pkt = out + i * TS_PACKET_SIZE;
+			if (ts_packet_get_pid(pkt) == NULL_PID)
+				nulls++;
+			if (ts_packet_has_pcr(pkt)) {
+				uint64_t pcr = ts_packet_get_pcr(pkt);
+				// One output packet is 1 ms
+				if (pcrs && pcr - last_pcr != (out_total + i - last_pcr_pos) * 27000)
+					pcr_errors++;
+				last_pcr     = pcr;
+				last_pcr_pos = out_total + i;
+				pcrs++;
+			}
+		}
+		out_total += n;
+		ts_LOGf("  %3d ms: in:%2d out:%2d nulls:%2d fill:%d\n", t, num, n, nulls, s->fill);
+	}
+	ts_LOGf("  out:%d pcrs:%llu pcr_errors:%d\n", out_total, (unsigned long long)pcrs, pcr_errors);
+	ts_shaper_dump(s);
+	ts_shaper_free(&s);
+	free(ts_packets);
+	free(out);
+}
+
 int main(void) {
 	ts_pat_test();
 	ts_tdt_test();
 	ts_tot_test();
 	ts_sdt_test();
 	ts_eit_test();
+	ts_carousel_test();
+	ts_eit_sched_test();
+	ts_eit_pf_test();
+	ts_pmt_test();
+	ts_cat_test();
+	ts_pes_chunks_test();
+	ts_pes_chunks_es_test();
+	ts_pes_ext_test();
+	ts_pes_stream_test();
+	pes_array_test();
+	ts_times_test();
+	ts_probe_test();
+	ts_nal_test();
+	ts_mpeg_video_test();
+	ts_stream_types_test();
+	ts_audio_frames_test();
+	ts_packetizer_test();
+	ts_adapt_field_test();
+	ts_clock_test();
+	ts_pcr_restamp_test();
+	ts_pcr_metrics_test();
+	ts_shift_timestamps_test();
+	ts_loop_test();
+	ts_loop_no_pcr_test();
+	ts_spts_test();
+	ts_mux_test();
+	ts_shaper_test();
 	return 0;
 }